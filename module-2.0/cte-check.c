@@ -0,0 +1,408 @@
+/* Licensed to the Apache Software Foundation (ASF) under one or more
+ * contributor license agreements.  See the NOTICE file distributed with
+ * this work for additional information regarding copyright ownership.
+ * The ASF licenses this file to You under the Apache License, Version 2.0
+ * (the "License"); you may not use this file except in compliance with
+ * the License.  You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+/* Differential check of the base64 and quoted-printable decoders.
+ *
+ * mbox_cte.c is built here once per instruction set (see 'scons check'):
+ * plain, SSSE3 and AVX2.  Each build decodes the same inputs as the
+ * scalar decoders below, which are those mbox_cte.c had before it was
+ * vectorized, and must give the same bytes.  The inputs are random
+ * (from a fixed seed, so that a failure can be replayed) and, around
+ * clean vector blocks, exhaustive for single byte changes.
+ *
+ * Usage: cte-check [random inputs]
+ */
+
+#include "mbox_cte.h"
+
+#include <ctype.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#if defined(__AVX2__)
+#define VARIANT "avx2"
+#elif defined(__SSSE3__)
+#define VARIANT "ssse3"
+#else
+#define VARIANT "scalar"
+#endif
+
+#define MAX_INPUT 1024
+
+static const char b64_alphabet[] =
+    "ABCDEFGHIJKLMNOPQRSTUVWXYZabcdefghijklmnopqrstuvwxyz0123456789+/";
+
+static unsigned long inputs;
+
+/* Reference decoders */
+
+static char index_64[128] = {
+    -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1,
+    -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1,
+    -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, 62, -1, -1, -1, 63,
+    52, 53, 54, 55, 56, 57, 58, 59, 60, 61, -1, -1, -1, -1, -1, -1,
+    -1, 0, 1, 2, 3, 4, 5, 6, 7, 8, 9, 10, 11, 12, 13, 14,
+    15, 16, 17, 18, 19, 20, 21, 22, 23, 24, 25, -1, -1, -1, -1, -1,
+    -1, 26, 27, 28, 29, 30, 31, 32, 33, 34, 35, 36, 37, 38, 39, 40,
+    41, 42, 43, 44, 45, 46, 47, 48, 49, 50, 51, -1, -1, -1, -1, -1
+};
+
+#define char64(c)  (((c) < 0 || (c) > 127) ? -1 : index_64[(c)])
+
+static apr_size_t ref_decode_b64(char *src)
+{
+    apr_size_t len = 0;
+
+    int data_done = 0;
+    int c1, c2, c3, c4;
+    char *dst;
+
+    dst = src;
+
+    while ((c1 = *src++) != '\0') {
+        if (isspace(c1))
+            continue;
+
+        if (data_done)
+            break;
+
+        do {
+            c2 = *src++;
+        } while (c2 != '\0' && isspace(c2));
+
+        do {
+            c3 = *src++;
+        } while (c3 != '\0' && isspace(c3));
+
+        do {
+            c4 = *src++;
+        } while (c4 != '\0' && isspace(c4));
+
+        if ((c2 == '\0') || (c3 == '\0') || (c4 == '\0')) {
+            return len;
+        }
+
+        if (c1 == '=' || c2 == '=') {
+            data_done = 1;
+            continue;
+        }
+
+        c1 = char64(c1);
+        c2 = char64(c2);
+        *dst++ = (c1 << 2) | ((c2 & 0x30) >> 4);
+        len++;
+
+        if (c3 == '=') {
+            data_done = 1;
+        }
+        else {
+            c3 = char64(c3);
+            *dst++ = ((c2 & 0XF) << 4) | ((c3 & 0x3C) >> 2);
+            len++;
+
+            if (c4 == '=') {
+                data_done = 1;
+            }
+            else {
+                c4 = char64(c4);
+                *dst++ = ((c3 & 0x03) << 6) | c4;
+                len++;
+            }
+        }
+    }
+
+    *dst = '\0';
+    return len;
+}
+
+static int hex2dec_char(char ch)
+{
+    if (isdigit(ch)) {
+        return ch - '0';
+    }
+    else if (isupper(ch)) {
+        return ch - 'A' + 10;
+    }
+    else {
+        return ch - 'a' + 10;
+    }
+}
+
+/* The character loop, stopping at a '=' too close to the end instead of
+ * reading past it, as mbox_cte_decode_qp() now does.
+ */
+static apr_size_t ref_decode_qp(char *p)
+{
+    apr_size_t len = 0;
+    char *src, *dst;
+
+    dst = src = p;
+    while (*src != '\0') {
+        if (*src == '=') {
+            if (src[1] == '\n') {
+                src += 2;
+                continue;
+            }
+            if (src[1] == '\0' || src[2] == '\0') {
+                break;
+            }
+            *dst = (hex2dec_char(src[1]) * 16) + hex2dec_char(src[2]);
+            src += 3;
+        }
+        else {
+            *dst = *src++;
+        }
+
+        ++dst;
+        len++;
+    }
+
+    *dst = '\0';
+    return len;
+}
+
+/* Inputs */
+
+static apr_uint64_t rng_state = 0x2545f4914f6cdd1dULL;
+
+static apr_uint32_t rng(void)
+{
+    rng_state ^= rng_state >> 12;
+    rng_state ^= rng_state << 25;
+    rng_state ^= rng_state >> 27;
+    return (apr_uint32_t) ((rng_state * 0x2545f4914f6cdd1dULL) >> 32);
+}
+
+static char random_byte(void)
+{
+    return (char) (1 + rng() % 255);
+}
+
+/* Fills s with a base64 encoding of random bytes, broken in lines. */
+static apr_size_t random_b64(char *s, apr_size_t max)
+{
+    apr_size_t len = 0, n = rng() % (max * 3 / 5), line = 4 * (1 + rng() % 19);
+    apr_size_t i, col = 0;
+    int crlf = rng() % 2;
+
+    for (i = 0; i < n && len + 6 < max; i += 3) {
+        apr_uint32_t v = rng() & 0xffffff;
+        int left = (int) (n - i);
+
+        s[len++] = b64_alphabet[v >> 18];
+        s[len++] = b64_alphabet[(v >> 12) & 0x3f];
+        s[len++] = left > 1 ? b64_alphabet[(v >> 6) & 0x3f] : '=';
+        s[len++] = left > 2 ? b64_alphabet[v & 0x3f] : '=';
+        col += 4;
+        if (col >= line && len + 8 < max) {
+            if (crlf) {
+                s[len++] = '\r';
+            }
+            s[len++] = '\n';
+            col = 0;
+        }
+    }
+    s[len] = '\0';
+    return len;
+}
+
+/* Fills s with characters mostly of the base64 alphabet. */
+static apr_size_t random_b64_noise(char *s, apr_size_t max)
+{
+    static const char other[] = " \t\r\n=-_.:*";
+    apr_size_t len = rng() % max, i;
+
+    for (i = 0; i < len; i++) {
+        apr_uint32_t r = rng() % 100;
+        if (r < 90) {
+            s[i] = b64_alphabet[rng() % 64];
+        }
+        else if (r < 97) {
+            s[i] = other[rng() % (sizeof(other) - 1)];
+        }
+        else {
+            s[i] = random_byte();
+        }
+    }
+    s[len] = '\0';
+    return len;
+}
+
+/* Fills s with text, escapes and soft line breaks. */
+static apr_size_t random_qp(char *s, apr_size_t max)
+{
+    static const char chars[] = "0123456789ABCDEFabcdefxyz \t\n==";
+    apr_size_t len = rng() % max, i;
+
+    for (i = 0; i < len; i++) {
+        s[i] = rng() % 16 ? chars[rng() % (sizeof(chars) - 1)]
+                          : random_byte();
+    }
+    s[len] = '\0';
+    return len;
+}
+
+/* Checks */
+
+static void dump(const char *what, const char *s)
+{
+    fprintf(stderr, "cte-check (" VARIANT "): %s differs on:", what);
+    for (; *s; s++) {
+        fprintf(stderr, " %02x", (unsigned char) *s);
+    }
+    fprintf(stderr, "\n");
+    exit(1);
+}
+
+static void check_b64(const char *s)
+{
+    char a[MAX_INPUT + 1], b[MAX_INPUT + 1];
+    apr_size_t la, lb;
+
+    strcpy(a, s);
+    strcpy(b, s);
+    la = mbox_cte_decode_b64(a);
+    lb = ref_decode_b64(b);
+    if (la != lb || memcmp(a, b, la) != 0) {
+        dump("base64", s);
+    }
+    inputs++;
+}
+
+static void check_qp(const char *s)
+{
+    char a[MAX_INPUT + 1], b[MAX_INPUT + 1];
+    apr_size_t la, lb;
+
+    strcpy(a, s);
+    strcpy(b, s);
+    la = mbox_cte_decode_qp(a);
+    lb = ref_decode_qp(b);
+    if (la != lb || memcmp(a, b, la + 1) != 0) {
+        dump("quoted-printable", s);
+    }
+    inputs++;
+}
+
+/* Every byte at every position of a clean run long enough for two
+ * vector blocks of each size, and at each end of a shorter one.
+ */
+static void exhaustive_b64(void)
+{
+    char s[MAX_INPUT + 1];
+    apr_size_t len, i;
+    int c, round;
+
+    for (round = 0; round < 4; round++) {
+        len = round < 2 ? 96 + round : 3 + round * 5;
+        for (i = 0; i < len; i++) {
+            s[i] = b64_alphabet[rng() % 64];
+        }
+        s[len] = '\0';
+        check_b64(s);
+
+        for (i = 0; i < len; i++) {
+            char saved = s[i];
+            for (c = 1; c < 256; c++) {
+                s[i] = (char) c;
+                check_b64(s);
+            }
+            s[i] = saved;
+        }
+    }
+}
+
+/* All inputs of one or two bytes, and of three that start with '='. */
+static void exhaustive_qp(void)
+{
+    char s[4];
+    int c1, c2;
+
+    for (c1 = 1; c1 < 256; c1++) {
+        s[0] = (char) c1;
+        s[1] = '\0';
+        check_qp(s);
+        for (c2 = 1; c2 < 256; c2++) {
+            s[1] = (char) c2;
+            s[2] = '\0';
+            check_qp(s);
+            s[0] = '=';
+            s[1] = (char) c1;
+            s[2] = (char) c2;
+            s[3] = '\0';
+            check_qp(s);
+            s[0] = (char) c1;
+        }
+    }
+}
+
+int main(int argc, const char *const argv[])
+{
+    char s[MAX_INPUT + 1];
+    unsigned long n = 200000, i;
+
+    if (argc > 1) {
+        n = strtoul(argv[1], NULL, 10);
+    }
+
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+    __builtin_cpu_init();
+#if defined(__AVX2__)
+    if (!__builtin_cpu_supports("avx2")) {
+        printf("cte-check (" VARIANT "): skipped, not supported here\n");
+        return 0;
+    }
+#elif defined(__SSSE3__)
+    if (!__builtin_cpu_supports("ssse3")) {
+        printf("cte-check (" VARIANT "): skipped, not supported here\n");
+        return 0;
+    }
+#endif
+#endif
+
+    exhaustive_b64();
+    exhaustive_qp();
+
+    for (i = 0; i < n; i++) {
+        switch (i % 4) {
+        case 0:
+            random_b64(s, MAX_INPUT);
+            break;
+        case 1:
+            /* A clean encoding with a few bytes changed */
+            if (random_b64(s, MAX_INPUT)) {
+                apr_size_t len = strlen(s);
+                int k = 1 + rng() % 3;
+                while (k--) {
+                    s[rng() % len] = random_byte();
+                }
+            }
+            break;
+        case 2:
+            random_b64_noise(s, MAX_INPUT);
+            break;
+        default:
+            random_qp(s, MAX_INPUT);
+            check_qp(s);
+            continue;
+        }
+        check_b64(s);
+    }
+
+    printf("cte-check (" VARIANT "): %lu inputs, no difference\n", inputs);
+    return 0;
+}
@@ -0,0 +1,1598 @@
+/* Licensed to the Apache Software Foundation (ASF) under one or more
+ * contributor license agreements.  See the NOTICE file distributed with
+ * this work for additional information regarding copyright ownership.
+ * The ASF licenses this file to You under the Apache License, Version 2.0
+ * (the "License"); you may not use this file except in compliance with
+ * the License.  You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+/* Round trip check of the index files mod-mbox-util writes.
+ *
+ * Each index is written, in a temporary directory, from a few made up
+ * messages, opened again and queried: what it answers must be what was
+ * written.  Its header is then damaged the ways a crash or another build
+ * leave it (cut short, with another magic or another version), and
+ * opening it must fail instead of reading past the file.
+ *
+ * The column filters, which select 16 messages at a time with SSE2 when
+ * the compiler targets it, are compared with a plain scan of what was
+ * written; 'scons check' builds this check, and the columns, once with
+ * SSE2 and once without, where the host has it.
+ *
+ * Usage: index-check
+ */
+
+#include "apr_file_io.h"
+#include "apr_general.h"
+#include "apr_strings.h"
+#include "apr_time.h"
+
+#include "mbox_author.h"
+#include "mbox_column.h"
+#include "mbox_cte.h"
+#include "mbox_frag.h"
+#include "mbox_fts.h"
+#include "mbox_msgid.h"
+#include "mbox_ordinal.h"
+#include "mbox_parse.h"
+#include "mbox_subject.h"
+#include "mbox_variant.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <zlib.h>
+#ifdef HAVE_ZSTD
+#include <zstd.h>
+#endif
+
+#if defined(__SSE2__)
+#define VARIANT "sse2"
+#else
+#define VARIANT "scalar"
+#endif
+
+static apr_pool_t *pool;
+static const char *dir;
+static unsigned long checks;
+
+/* Where headers have their magic and their version (in the header line
+ * of a variant, the space after the magic).
+ */
+#define MAGIC_OFFSET   0
+#define VERSION_OFFSET 8
+
+static void check(int ok, const char *what)
+{
+    checks++;
+    if (!ok) {
+        fprintf(stderr, "index-check (" VARIANT "): %s\n", what);
+        exit(1);
+    }
+}
+
+static const char *path_of(const char *name)
+{
+    return apr_pstrcat(pool, dir, "/", name, NULL);
+}
+
+static char *slurp(const char *path, apr_size_t *len)
+{
+    apr_file_t *f;
+    apr_finfo_t finfo;
+    char *buf;
+
+    check(apr_file_open(&f, path, APR_READ, APR_OS_DEFAULT, pool)
+          == APR_SUCCESS, apr_pstrcat(pool, "cannot read ", path, NULL));
+    apr_file_info_get(&finfo, APR_FINFO_SIZE, f);
+    buf = apr_palloc(pool, finfo.size + 1);
+    apr_file_read_full(f, buf, finfo.size, len);
+    apr_file_close(f);
+    return buf;
+}
+
+static void spit(const char *path, const char *buf, apr_size_t len)
+{
+    apr_file_t *f;
+
+    check(apr_file_open(&f, path, APR_WRITE | APR_CREATE | APR_TRUNCATE,
+                        APR_OS_DEFAULT, pool) == APR_SUCCESS,
+          apr_pstrcat(pool, "cannot write ", path, NULL));
+    apr_file_write_full(f, buf, len, NULL);
+    apr_file_close(f);
+}
+
+/* Opens an index file, as its reader does, in p. */
+typedef apr_status_t open_fn(apr_pool_t *p, const char *path);
+
+/* Damages the header, header_len bytes long, of the index in file: it
+ * must not open any more.  The file is put back as it was.
+ */
+static void check_damage(const char *what, const char *file,
+                         apr_size_t header_len, open_fn *open,
+                         const char *path)
+{
+    apr_size_t len, cuts[3];
+    char *buf, *copy;
+    apr_pool_t *p;
+    int i;
+
+    buf = slurp(file, &len);
+    check(len > header_len, apr_pstrcat(pool, what, ": no more than a header",
+                                        NULL));
+    copy = apr_pmemdup(pool, buf, len);
+    apr_pool_create(&p, pool);
+
+    cuts[0] = 0;
+    cuts[1] = header_len / 2;
+    cuts[2] = header_len - 1;
+    for (i = 0; i < 3; i++) {
+        spit(file, buf, cuts[i]);
+        check(open(p, path) != APR_SUCCESS,
+              apr_psprintf(pool, "%s: opens when cut to %" APR_SIZE_T_FMT
+                           " bytes", what, cuts[i]));
+        apr_pool_clear(p);
+    }
+
+    copy[MAGIC_OFFSET] ^= 0x20;
+    spit(file, copy, len);
+    check(open(p, path) != APR_SUCCESS,
+          apr_pstrcat(pool, what, ": opens with another magic", NULL));
+    apr_pool_clear(p);
+    copy[MAGIC_OFFSET] ^= 0x20;
+
+    copy[VERSION_OFFSET]++;
+    spit(file, copy, len);
+    check(open(p, path) != APR_SUCCESS,
+          apr_pstrcat(pool, what, ": opens with another version", NULL));
+    apr_pool_clear(p);
+
+    spit(file, buf, len);
+    check(open(p, path) == APR_SUCCESS,
+          apr_pstrcat(pool, what, ": does not open once put back", NULL));
+    apr_pool_destroy(p);
+}
+
+/* Messages */
+
+#define MESSAGES 5
+
+static const struct
+{
+    const char *from;
+    const char *subject;
+    const char *body;           /* As rendered: escaped */
+} messages[MESSAGES] = {
+    {"Alice Example <alice@example.org>", "Patch for the parser",
+     "The quick brown fox jumps over the lazy dog."},
+    {"Bob Example <bob@example.org>", "Re: Patch for the parser",
+     "Looks good to me, committed the brown fox fix."},
+    {"Carol Example <carol@example.org>", "Release vote",
+     "Please vote on the release; the quick vote ends soon."},
+    {"Dave Example <dave@example.org>", "Stra\xc3\x9f" "e &amp; CAF\xc3\x89",
+     "See &lt;configuration&gt; in "
+     "supercalifragilisticexpialidociousandthensome."},
+    {"Alice Example <alice@example.org>", "Re: Release vote",
+     "+1 from me"},
+};
+
+/* The date of message n: a day apart, the last the latest */
+static apr_time_t message_date(int n)
+{
+    return apr_time_from_sec(1072915200 + n * 86400);
+}
+
+static Message *message(apr_pool_t *p, int n)
+{
+    Message *m = apr_pcalloc(p, sizeof(Message));
+    const char *from = messages[n].from;
+
+    m->msgID = apr_psprintf(p, "<%d@example.org>", n);
+    m->uri_msgID = apr_psprintf(p, "%%3c%d@example.org%%3e", n);
+    m->from = apr_pstrdup(p, from);
+    m->name = apr_pstrndup(p, from, strchr(from, '<') - from - 1);
+    m->html_name = m->name;
+    m->html_name_antispam = m->name;
+    m->subject = apr_pstrdup(p, messages[n].subject);
+    m->utf8_subject = m->subject;
+    m->html_subject = m->subject;
+    m->date = message_date(n);
+    m->str_date = apr_psprintf(p, "day %d", n);
+    return m;
+}
+
+/* Full text index */
+
+#define FTS_HEADER_LEN 120      /* sizeof(fts_header) */
+
+static apr_status_t fts_open(apr_pool_t *p, const char *path)
+{
+    mbox_fts_t *fts;
+
+    return mbox_fts_open(&fts, p, path);
+}
+
+/* Returns the messages that match query, as a string of their numbers:
+ * best first, or latest first by date.
+ */
+static const char *fts_hits(mbox_fts_t **fts, int count, const char *query,
+                            int order, int k)
+{
+    mbox_fts_query_t *q;
+    apr_array_header_t *hits;
+    char *s = "";
+    int i;
+
+    if (mbox_fts_query_parse(&q, pool, query) != APR_SUCCESS) {
+        return NULL;
+    }
+    check(mbox_fts_search(&hits, pool, fts, count, q, order, k, NULL)
+          == APR_SUCCESS, "fts: search failed");
+    for (i = 0; i < hits->nelts; i++) {
+        const mbox_fts_hit_t *hit = &APR_ARRAY_IDX(hits, i, mbox_fts_hit_t);
+
+        s = apr_pstrcat(pool, s, i ? " " : "", hit->uri_msgID + 3, NULL);
+        s[strlen(s) - strlen("@example.org%3e")] = '\0';
+    }
+    return s;
+}
+
+/* Compares hits, whose order only matters if ordered is set. */
+static void check_hits(const char *query, const char *got,
+                       const char *expected, int ordered)
+{
+    int ok;
+
+    if (!got || !expected) {
+        ok = got == expected;
+    }
+    else if (ordered) {
+        ok = strcmp(got, expected) == 0;
+    }
+    else {
+        char *a = apr_pstrdup(pool, got), *b = apr_pstrdup(pool, expected);
+
+        qsort(a, strlen(a), 1, (int (*)(const void *, const void *)) strcmp);
+        qsort(b, strlen(b), 1, (int (*)(const void *, const void *)) strcmp);
+        ok = strcmp(a, b) == 0;
+    }
+    check(ok, apr_psprintf(pool, "fts: '%s' finds '%s', not '%s'", query,
+                           got ? got : "(invalid query)",
+                           expected ? expected : "(invalid query)"));
+}
+
+static void check_fts(void)
+{
+    static const struct
+    {
+        const char *query;
+        const char *hits;       /* NULL if the query is invalid */
+    } queries[] = {
+        {"fox", "0 1"},
+        {"BROWN Fox", "0 1"},
+        {"\"quick brown\"", "0"},
+        {"\"brown quick\"", ""},
+        {"quick -vote", "0"},
+        {"vote OR committed", "1 2 4"},
+        {"parser OR release -alice", "1 2"},
+        {"alice", "0 4"},
+        {"example.org", "0 1 2 3 4"},
+        {"stra\xc3\x9f" "e", "3"},
+        {"caf\xc3\x89", "3"},
+        {"lt", ""},
+        {"amp", ""},
+        {"configuration", "3"},
+        {"supercalifragilisticexpialidocio", "3"},
+        {"supercalifragilisticexpialidociousandthensome", "3"},
+        {"supercalifragilistic", ""},
+        {"1", "4"},
+        {"", NULL},
+        {"   ", NULL},
+        {"-fox", NULL},
+        {"OR", NULL},
+        {"\"\"", NULL},
+    };
+    const char *box = path_of("200401.mbox"), *box2 = path_of("200402.mbox");
+    mbox_fts_writer_t *w;
+    mbox_fts_t *fts[2];
+    int i;
+
+    check(mbox_fts_create(&w, pool, box, 1234, 5678) == APR_SUCCESS,
+          "fts: cannot create");
+    for (i = 0; i < MESSAGES; i++) {
+        mbox_out_puts(mbox_fts_begin(w, message(pool, i)), messages[i].body);
+        mbox_fts_end(w);
+    }
+    check(mbox_fts_commit(w) == APR_SUCCESS, "fts: cannot commit");
+
+    check(mbox_fts_open(&fts[0], pool, box) == APR_SUCCESS,
+          "fts: cannot open");
+    check(mbox_fts_matches(fts[0], 1234, 5678), "fts: version lost");
+    check(!mbox_fts_matches(fts[0], 1234, 5679), "fts: version ignored");
+
+    for (i = 0; i < sizeof(queries) / sizeof(queries[0]); i++) {
+        check_hits(queries[i].query, fts_hits(fts, 1, queries[i].query,
+                                              MBOX_FTS_BY_RELEVANCE, 10),
+                   queries[i].hits, 0);
+    }
+
+    /* By date, and the best k only */
+    check_hits("the (by date)", fts_hits(fts, 1, "the", MBOX_FTS_BY_DATE, 10),
+               "2 1 0", 1);
+    check_hits("the (2 by date)", fts_hits(fts, 1, "the", MBOX_FTS_BY_DATE, 2),
+               "2 1", 1);
+    check_hits("vote (1)", fts_hits(fts, 1, "vote", MBOX_FTS_BY_RELEVANCE, 1),
+               "2", 1);
+
+    /* Across mailboxes: a month without any message */
+    check(mbox_fts_create(&w, pool, box2, 1, 1) == APR_SUCCESS
+          && mbox_fts_commit(w) == APR_SUCCESS, "fts: cannot write empty");
+    check(mbox_fts_open(&fts[1], pool, box2) == APR_SUCCESS,
+          "fts: cannot open empty");
+    check_hits("fox (2 boxes)", fts_hits(fts, 2, "fox", MBOX_FTS_BY_DATE, 10),
+               "1 0", 1);
+
+    check_damage("fts", apr_pstrcat(pool, box, MBOX_FTS_SUFFIX, NULL),
+                 FTS_HEADER_LEN, fts_open, box);
+}
+
+/* Message-ID index */
+
+#define MSGID_HEADER_LEN 64     /* sizeof(msgid_header) */
+
+static apr_status_t msgid_open(apr_pool_t *p, const char *path)
+{
+    mbox_msgid_index_t *idx;
+
+    return mbox_msgid_index_open(&idx, p, path);
+}
+
+/* Returns where the index has msgID, as "list box", or "" if nowhere. */
+static const char *msgid_where(const char *path, const char *msgID)
+{
+    mbox_msgid_index_t *idx;
+    mbox_msgid_loc_t loc;
+    apr_status_t rv;
+
+    check(mbox_msgid_index_open(&idx, pool, path) == APR_SUCCESS,
+          "msgid: cannot open");
+    rv = mbox_msgid_index_lookup(idx, msgID, &loc);
+    check(rv == APR_SUCCESS || rv == APR_NOTFOUND, "msgid: lookup failed");
+    return rv == APR_SUCCESS ? apr_pstrcat(pool, loc.list, " ", loc.box, NULL)
+        : "";
+}
+
+static void check_msgid_where(const char *path, const char *msgID,
+                              const char *expected)
+{
+    const char *got = msgid_where(path, msgID);
+
+    check(strcmp(got, expected) == 0,
+          apr_psprintf(pool, "msgid: %s is at '%s', not '%s'", msgID, got,
+                       expected));
+}
+
+static void check_msgid(void)
+{
+    const char *path = path_of("msgid.idx");
+    mbox_msgid_index_t *idx;
+    mbox_msgid_writer_t *w;
+    char msgID[32];
+    int i;
+
+    check(mbox_msgid_index_open(&idx, pool, path) == APR_NOTFOUND,
+          "msgid: opens before it is written");
+
+    /* A list of two mailboxes, with enough messages to grow the table */
+    check(mbox_msgid_writer_create(&w, pool, path, "/dev") == APR_SUCCESS,
+          "msgid: cannot create");
+    check(!mbox_msgid_writer_box(w, "200401.mbox", 1, 10),
+          "msgid: new mailbox taken as known");
+    for (i = 0; i < 3000; i++) {
+        apr_snprintf(msgID, sizeof(msgID), "<%d@example.org>", i);
+        mbox_msgid_writer_add(w, msgID);
+    }
+    check(!mbox_msgid_writer_box(w, "200402.mbox", 2, 20),
+          "msgid: new mailbox taken as known");
+    mbox_msgid_writer_add(w, "<feb@example.org>");
+    check(mbox_msgid_writer_commit(w) == APR_SUCCESS, "msgid: cannot commit");
+
+    for (i = 0; i < 3000; i += 7) {
+        apr_snprintf(msgID, sizeof(msgID), "<%d@example.org>", i);
+        check_msgid_where(path, msgID, "/dev 200401.mbox");
+    }
+    check_msgid_where(path, "<feb@example.org>", "/dev 200402.mbox");
+    check_msgid_where(path, "<3000@example.org>", "");
+    check_msgid_where(path, "feb@example.org", "");
+
+    /* Another list: the first keeps its entries */
+    check(mbox_msgid_writer_create(&w, pool, path, "/users") == APR_SUCCESS,
+          "msgid: cannot create");
+    mbox_msgid_writer_box(w, "200401.mbox", 3, 30);
+    mbox_msgid_writer_add(w, "<user@example.org>");
+    check(mbox_msgid_writer_commit(w) == APR_SUCCESS, "msgid: cannot commit");
+    check_msgid_where(path, "<user@example.org>", "/users 200401.mbox");
+    check_msgid_where(path, "<1@example.org>", "/dev 200401.mbox");
+
+    /* The first again: a mailbox unchanged, one changed, one gone */
+    check(mbox_msgid_writer_create(&w, pool, path, "/dev") == APR_SUCCESS,
+          "msgid: cannot create");
+    check(mbox_msgid_writer_box(w, "200401.mbox", 1, 10),
+          "msgid: unchanged mailbox taken as new");
+    check(!mbox_msgid_writer_box(w, "200403.mbox", 4, 40),
+          "msgid: new mailbox taken as known");
+    mbox_msgid_writer_add(w, "<mar@example.org>");
+    check(mbox_msgid_writer_commit(w) == APR_SUCCESS, "msgid: cannot commit");
+    check_msgid_where(path, "<1@example.org>", "/dev 200401.mbox");
+    check_msgid_where(path, "<mar@example.org>", "/dev 200403.mbox");
+    check_msgid_where(path, "<feb@example.org>", "");
+    check_msgid_where(path, "<user@example.org>", "/users 200401.mbox");
+
+    /* Nothing written when aborted */
+    check(mbox_msgid_writer_create(&w, pool, path, "/users") == APR_SUCCESS,
+          "msgid: cannot create");
+    mbox_msgid_writer_abort(w);
+    check_msgid_where(path, "<user@example.org>", "/users 200401.mbox");
+
+    check_damage("msgid", path, MSGID_HEADER_LEN, msgid_open, path);
+}
+
+/* Subject index */
+
+#define SUBJECT_HEADER_LEN 80   /* sizeof(subject_header) */
+
+static apr_status_t subject_open(apr_pool_t *p, const char *path)
+{
+    mbox_subject_index_t *idx;
+
+    return mbox_subject_open(&idx, p, path);
+}
+
+/* Returns a thread of root (none if NULL) and a reply to it. */
+static Container *thread(apr_pool_t *p, Message *root, Message *reply)
+{
+    Container *c = apr_pcalloc(p, sizeof(Container));
+
+    c->message = root;
+    if (reply) {
+        c->child = apr_pcalloc(p, sizeof(Container));
+        c->child->message = reply;
+        c->child->parent = c;
+    }
+    return c;
+}
+
+/* Returns a message of its own thread, subject and date. */
+static Message *thread_message(apr_pool_t *p, const char *subject,
+                               apr_time_t date)
+{
+    Message *m = message(p, 0);
+
+    m->subject = apr_pstrdup(p, subject);
+    m->utf8_subject = m->subject;
+    m->html_subject = m->subject;
+    m->uri_msgID = apr_psprintf(p, "%" APR_TIME_T_FMT, date);
+    m->date = date;
+    return m;
+}
+
+/* Returns the threads whose subject has query, as "box subject (count)"
+ * separated with "|".
+ */
+static const char *subject_hits(const char *dir, const char *query, int k)
+{
+    mbox_subject_index_t *idx;
+    apr_array_header_t *hits;
+    char *s = "";
+    int i;
+
+    check(mbox_subject_open(&idx, pool, dir) == APR_SUCCESS,
+          "subject: cannot open");
+    mbox_subject_search(&hits, pool, idx, query, k);
+    for (i = 0; i < hits->nelts; i++) {
+        const mbox_subject_hit_t *hit =
+            &APR_ARRAY_IDX(hits, i, mbox_subject_hit_t);
+
+        s = apr_psprintf(pool, "%s%s%s %s (%u)", s, i ? "|" : "", hit->box,
+                         hit->html_subject, hit->count);
+    }
+    return s;
+}
+
+static void check_subject_hits(const char *dir, const char *query, int k,
+                               const char *expected)
+{
+    const char *got = subject_hits(dir, query, k);
+
+    check(strcmp(got, expected) == 0,
+          apr_psprintf(pool, "subject: '%s' finds '%s', not '%s'", query,
+                       got, expected));
+}
+
+static void check_subject(void)
+{
+    const char *dir = path_of("");
+    mbox_subject_index_t *idx;
+    mbox_subject_writer_t *w;
+    int i;
+
+    check(mbox_subject_open(&idx, pool, dir) == APR_NOTFOUND,
+          "subject: opens before it is written");
+    check(strcmp(mbox_subject_normalize(pool, "Re: RE:  Patch \tfor  it "),
+                 "patch for it") == 0, "subject: not normalized");
+
+    /* Enough threads for the postings of trigrams to be intersected */
+    check(mbox_subject_writer_create(&w, pool, dir) == APR_SUCCESS,
+          "subject: cannot create");
+    check(!mbox_subject_writer_box(w, "200401.mbox", 1, 10),
+          "subject: new mailbox taken as known");
+    mbox_subject_writer_add(w, thread(pool, message(pool, 0),
+                                      message(pool, 1)));
+    mbox_subject_writer_add(w, thread(pool, message(pool, 2),
+                                      message(pool, 4)));
+    mbox_subject_writer_add(w, thread(pool, NULL, message(pool, 3)));
+    for (i = 0; i < 100; i++) {
+        mbox_subject_writer_add(w, thread(pool, thread_message(pool,
+            apr_psprintf(pool, "Build %d report", i), message_date(5 + i)),
+            NULL));
+    }
+    check(!mbox_subject_writer_box(w, "200402.mbox", 2, 20),
+          "subject: new mailbox taken as known");
+    mbox_subject_writer_add(w, thread(pool, thread_message(pool,
+        "Released: parser 1.0", message_date(200)), NULL));
+    check(mbox_subject_writer_commit(w) == APR_SUCCESS,
+          "subject: cannot commit");
+
+    check_subject_hits(dir, "parser", 10,
+                       "200402.mbox Released: parser 1.0 (1)|"
+                       "200401.mbox Patch for the parser (2)");
+    check_subject_hits(dir, "RE:  Patch  FOR", 10,
+                       "200401.mbox Patch for the parser (2)");
+    check_subject_hits(dir, "release", 10,
+                       "200402.mbox Released: parser 1.0 (1)|"
+                       "200401.mbox Release vote (2)");
+    check_subject_hits(dir, "re", 3,
+                       "200402.mbox Released: parser 1.0 (1)|"
+                       "200401.mbox Release vote (2)|"
+                       "200401.mbox Build 99 report (1)");
+    check_subject_hits(dir, "ease vo", 10, "200401.mbox Release vote (2)");
+    check_subject_hits(dir, "caf\xc3\x89", 10,
+                       "200401.mbox Stra\xc3\x9f" "e &amp; CAF\xc3\x89 (1)");
+    check_subject_hits(dir, "build 42 report", 10,
+                       "200401.mbox Build 42 report (1)");
+    check_subject_hits(dir, "report", 2,
+                       "200401.mbox Build 99 report (1)|"
+                       "200401.mbox Build 98 report (1)");
+    check_subject_hits(dir, "b", 1, "200401.mbox Build 99 report (1)");
+    check_subject_hits(dir, "nothing like it", 10, "");
+    check_subject_hits(dir, "", 10, "");
+
+    /* A mailbox unchanged, one gone */
+    check(mbox_subject_writer_create(&w, pool, dir) == APR_SUCCESS,
+          "subject: cannot create");
+    check(mbox_subject_writer_box(w, "200402.mbox", 2, 20),
+          "subject: unchanged mailbox taken as new");
+    check(mbox_subject_writer_commit(w) == APR_SUCCESS,
+          "subject: cannot commit");
+    check_subject_hits(dir, "parser", 10,
+                       "200402.mbox Released: parser 1.0 (1)");
+
+    check_damage("subject", path_of(MBOX_SUBJECT_FILE), SUBJECT_HEADER_LEN,
+                 subject_open, dir);
+}
+
+/* Author index */
+
+#define AUTHOR_HEADER_LEN 64    /* sizeof(author_header) */
+
+static apr_status_t author_open(apr_pool_t *p, const char *path)
+{
+    mbox_author_index_t *idx;
+
+    return mbox_author_open(&idx, p, path);
+}
+
+/* Returns the messages of the author of from, from the first-th newest,
+ * as "box msgID" separated with "|".
+ */
+static const char *author_postings(const char *dir, const char *from,
+                                   apr_uint32_t first, apr_uint32_t n)
+{
+    mbox_author_index_t *idx;
+    apr_array_header_t *postings;
+    char *s = "";
+    int i;
+
+    check(mbox_author_open(&idx, pool, dir) == APR_SUCCESS,
+          "author: cannot open");
+    mbox_author_postings(&postings, pool, idx, mbox_author_key(pool, from),
+                         first, n);
+    for (i = 0; i < postings->nelts; i++) {
+        const mbox_author_posting_t *posting =
+            &APR_ARRAY_IDX(postings, i, mbox_author_posting_t);
+
+        s = apr_pstrcat(pool, s, i ? "|" : "", posting->box, " ",
+                        posting->msgID, NULL);
+    }
+    return s;
+}
+
+static void check_author_postings(const char *dir, const char *from,
+                                  apr_uint32_t first, apr_uint32_t n,
+                                  const char *expected)
+{
+    const char *got = author_postings(dir, from, first, n);
+
+    check(strcmp(got, expected) == 0,
+          apr_psprintf(pool, "author: %s from %u has '%s', not '%s'", from,
+                       first, got, expected));
+}
+
+/* Checks the number of messages of the author of from, and the name of
+ * the newest.
+ */
+static void check_author_count(const char *dir, const char *from,
+                               apr_uint32_t count, const char *name)
+{
+    mbox_author_index_t *idx;
+    const char *got = NULL;
+    apr_uint32_t n;
+
+    check(mbox_author_open(&idx, pool, dir) == APR_SUCCESS,
+          "author: cannot open");
+    n = mbox_author_count(idx, mbox_author_key(pool, from), &got);
+    check(n == count && (!count || strcmp(got, name) == 0),
+          apr_psprintf(pool, "author: %s has %u messages, not %u, of '%s'",
+                       from, n, count, count ? got : ""));
+}
+
+static void check_author(void)
+{
+    const char *dir = path_of("");
+    mbox_author_index_t *idx;
+    mbox_author_writer_t *w;
+    Message *m;
+    int i;
+
+    check(mbox_author_open(&idx, pool, dir) == APR_NOTFOUND,
+          "author: opens before it is written");
+
+    /* Keys from the From header, and a month of many messages */
+    check(mbox_author_writer_create(&w, pool, dir) == APR_SUCCESS,
+          "author: cannot create");
+    check(!mbox_author_writer_box(w, "200401.mbox", 1, 10),
+          "author: new mailbox taken as known");
+    for (i = 0; i < MESSAGES; i++) {
+        mbox_author_writer_add(w, message(pool, i));
+    }
+    check(!mbox_author_writer_box(w, "200402.mbox", 2, 20),
+          "author: new mailbox taken as known");
+    for (i = 0; i < 50; i++) {
+        m = message(pool, 0);
+        m->msgID = apr_psprintf(pool, "<feb.%d@example.org>", i);
+        m->name = "Alice";
+        m->date = message_date(MESSAGES + i);
+        mbox_author_writer_add(w, m);
+    }
+    check(mbox_author_writer_commit(w) == APR_SUCCESS,
+          "author: cannot commit");
+
+    check_author_count(dir, messages[1].from, 1, "Bob Example");
+    check_author_count(dir, messages[0].from, 52, "Alice");
+    check_author_count(dir, "\"ALICE  example\" <alice@example.net>", 52,
+                       "Alice");
+    check_author_count(dir, "Nobody <nobody@example.org>", 0, NULL);
+    check_author_postings(dir, messages[2].from, 0, 10,
+                          "200401.mbox <2@example.org>");
+    check_author_postings(dir, messages[0].from, 0, 2,
+                          "200402.mbox <feb.49@example.org>|"
+                          "200402.mbox <feb.48@example.org>");
+    check_author_postings(dir, messages[0].from, 49, 10,
+                          "200402.mbox <feb.0@example.org>|"
+                          "200401.mbox <4@example.org>|"
+                          "200401.mbox <0@example.org>");
+    check_author_postings(dir, messages[0].from, 52, 10, "");
+    check_author_postings(dir, "Nobody <nobody@example.org>", 0, 10, "");
+
+    /* A mailbox unchanged, one gone */
+    check(mbox_author_writer_create(&w, pool, dir) == APR_SUCCESS,
+          "author: cannot create");
+    check(mbox_author_writer_box(w, "200402.mbox", 2, 20),
+          "author: unchanged mailbox taken as new");
+    check(mbox_author_writer_commit(w) == APR_SUCCESS,
+          "author: cannot commit");
+    check_author_count(dir, messages[0].from, 50, "Alice");
+    check_author_count(dir, messages[1].from, 0, NULL);
+
+    check_damage("author", path_of(MBOX_AUTHOR_FILE), AUTHOR_HEADER_LEN,
+                 author_open, dir);
+}
+
+/* Columns */
+
+#define COLUMN_HEADER_LEN 144   /* sizeof(column_header) */
+
+/* Enough rows for runs of 16 and the rows left over, and for flags to
+ * be counted in more than one pass of 255 runs.
+ */
+#define ROWS 1000
+#define STATS_ROWS 5000
+
+static const char *const authors[] = {
+    "alice@example.org", "alice@example.net", "alicia@example.org",
+    "bob@example.org", "carol@example.org", "", "dave@example.com",
+};
+#define AUTHORS (sizeof(authors) / sizeof(authors[0]))
+
+static const char *const subjects[] = {
+    "Patch for the parser", "Re: Patch for the parser", "Release vote",
+    "Build report", "RE: Build  report", "Stra\xc3\x9f" "e",
+};
+#define SUBJECTS (sizeof(subjects) / sizeof(subjects[0]))
+
+/* What was written, to scan */
+static struct
+{
+    apr_int64_t sec;
+    const char *author;
+    const char *subject;        /* Normalized */
+    int flags;
+} rows[STATS_ROWS];
+
+static apr_uint32_t seed = 1;
+
+static apr_uint32_t rnd(apr_uint32_t n)
+{
+    seed = seed * 1103515245 + 12345;
+    return (seed >> 16) % n;
+}
+
+static apr_status_t column_open(apr_pool_t *p, const char *path)
+{
+    mbox_column_t *cols;
+
+    return mbox_column_open(&cols, p, path);
+}
+
+/* Writes the columns of box from rows, made up, from date sec on. */
+static void column_write(const char *box, apr_int64_t sec, int n)
+{
+    mbox_column_writer_t *w;
+    Container *threads = NULL, *c;
+    Message **m = apr_palloc(pool, (n ? n : 1) * sizeof(Message *));
+    int i;
+
+    for (i = 0; i < n; i++) {
+        /* Several messages of the same second, some days apart */
+        sec += rnd(4) == 0 ? 0 : rnd(8) == 0 ? 3 * MBOX_COLUMN_DAY
+            : rnd(600);
+        rows[i].sec = sec;
+        rows[i].author = authors[rnd(AUTHORS)];
+        rows[i].subject = mbox_subject_normalize(pool,
+                                                 subjects[rnd(SUBJECTS)]);
+        rows[i].flags = (rnd(3) == 0 ? MBOX_COLUMN_THREAD : 0)
+            | (rnd(5) == 0 ? MBOX_COLUMN_ATTACHMENT : 0);
+
+        m[i] = message(pool, 0);
+        m[i]->msgID = apr_psprintf(pool, "<%s.%d@example.org>", box, i);
+        m[i]->author_key = apr_pstrdup(pool, rows[i].author);
+        m[i]->subject = apr_pstrdup(pool, rows[i].subject);
+        m[i]->utf8_subject = m[i]->subject;
+        m[i]->date = apr_time_from_sec(sec);
+        if (rows[i].flags & MBOX_COLUMN_ATTACHMENT) {
+            m[i]->mime_msg = apr_pcalloc(pool, sizeof(mbox_mime_message_t));
+            m[i]->mime_msg->content_type = "application/pdf";
+            m[i]->mime_msg->content_name = "report.pdf";
+        }
+        if (rows[i].flags & MBOX_COLUMN_THREAD) {
+            c = thread(pool, m[i], NULL);
+            c->next = threads;
+            threads = c;
+        }
+    }
+
+    check(mbox_column_create(&w, pool, path_of(box), 1234, 5678)
+          == APR_SUCCESS, "column: cannot create");
+    mbox_column_threads(w, threads);
+    for (i = 0; i < n; i++) {
+        mbox_column_add(w, m[i]);
+    }
+    check(mbox_column_commit(w) == APR_SUCCESS, "column: cannot commit");
+}
+
+/* Returns 1 if row i matches f. */
+static int row_matches(int i, const mbox_filter_t *f)
+{
+    apr_time_t date = apr_time_from_sec(rows[i].sec);
+
+    return (!f->after || date >= f->after)
+        && (!f->before || date < f->before)
+        && (!f->author
+            || (f->author_prefix
+                ? strncmp(rows[i].author, f->author, strlen(f->author)) == 0
+                : strcmp(rows[i].author, f->author) == 0))
+        && (!f->subject || strstr(rows[i].subject, f->subject))
+        && (rows[i].flags & f->flags) == f->flags;
+}
+
+/* Filters the columns of n rows with f, and scans the rows. */
+static void check_filter(const mbox_column_t *cols, int n,
+                         const mbox_filter_t *f)
+{
+    apr_array_header_t *ordinals;
+    int i, j = 0;
+
+    mbox_column_filter(&ordinals, pool, cols, f);
+    for (i = 0; i < n; i++) {
+        if (row_matches(i, f)) {
+            if (j >= ordinals->nelts
+                || APR_ARRAY_IDX(ordinals, j, apr_uint32_t) != i) {
+                break;
+            }
+            j++;
+        }
+    }
+    check(i == n && j == ordinals->nelts,
+          apr_psprintf(pool, "column: filter (%" APR_TIME_T_FMT
+                       ", %" APR_TIME_T_FMT ", '%s'%s, '%s', %d) "
+                       "differs from row %d", apr_time_sec(f->after),
+                       apr_time_sec(f->before),
+                       f->author ? f->author : "",
+                       f->author_prefix ? "*" : "",
+                       f->subject ? f->subject : "", f->flags, i));
+}
+
+static int author_cmp(const void *a, const void *b)
+{
+    return strcmp(*(const char *const *) a, *(const char *const *) b);
+}
+
+/* Compares the statistics of the columns of n rows with a scan. */
+static void check_stats(const char *box, int n)
+{
+    mbox_column_t *cols;
+    mbox_column_stats_t *stats;
+    const char *sorted[AUTHORS];
+    apr_uint32_t threads = 0, count;
+    apr_int64_t day;
+    int i, j, d = 0, a = 0;
+
+    check(mbox_column_open(&cols, pool, path_of(box)) == APR_SUCCESS,
+          "stats: cannot open");
+    mbox_column_stats(&stats, pool, cols);
+    check(stats->messages == n, "stats: messages miscounted");
+
+    for (i = 0; i < n; i++) {
+        threads += (rows[i].flags & MBOX_COLUMN_THREAD) != 0;
+    }
+    check(stats->threads == threads,
+          apr_psprintf(pool, "stats: %u threads, not %u", stats->threads,
+                       threads));
+
+    /* Days, rounded down before 1970 too */
+    for (i = 0; i < n; i = j) {
+        day = rows[i].sec / MBOX_COLUMN_DAY
+            - (rows[i].sec < 0 && rows[i].sec % MBOX_COLUMN_DAY);
+        for (j = i; j < n && rows[j].sec < (day + 1) * MBOX_COLUMN_DAY; j++);
+        check(d < stats->days->nelts
+              && APR_ARRAY_IDX(stats->days, d, mbox_column_day_t).day
+                 == apr_time_from_sec(day * MBOX_COLUMN_DAY)
+              && APR_ARRAY_IDX(stats->days, d, mbox_column_day_t).count
+                 == j - i,
+              apr_psprintf(pool, "stats: day %" APR_INT64_T_FMT
+                           " of %s miscounted", day, box));
+        d++;
+    }
+    check(d == stats->days->nelts, "stats: days made up");
+
+    /* Posters, in the order of their keys */
+    memcpy(sorted, authors, sizeof(sorted));
+    qsort(sorted, AUTHORS, sizeof(const char *), author_cmp);
+    for (i = 0; i < AUTHORS; i++) {
+        for (count = 0, j = 0; j < n; j++) {
+            count += strcmp(rows[j].author, sorted[i]) == 0;
+        }
+        if (!count) {
+            continue;
+        }
+        check(a < stats->posters->nelts
+              && strcmp(APR_ARRAY_IDX(stats->posters, a,
+                                      mbox_column_poster_t).author,
+                        sorted[i]) == 0
+              && APR_ARRAY_IDX(stats->posters, a,
+                               mbox_column_poster_t).count == count,
+              apr_psprintf(pool, "stats: '%s' miscounted", sorted[i]));
+        a++;
+    }
+    check(a == stats->posters->nelts, "stats: posters made up");
+}
+
+/* Returns a date around those of the rows, to the microsecond, or 0. */
+static apr_time_t any_date(apr_int64_t first, apr_int64_t last)
+{
+    if (!rnd(8)) {
+        return 0;
+    }
+    return apr_time_from_sec(first - 10 + rnd(last - first + 20))
+        + (rnd(2) ? rnd(APR_USEC_PER_SEC) : 0);
+}
+
+/* Compares the range of the columns of n rows from after until before
+ * with a scan.
+ */
+static void check_range(const mbox_column_t *cols, int n, apr_time_t after,
+                        apr_time_t before)
+{
+    mbox_filter_t f;
+    apr_uint32_t begin, end;
+    int i, j;
+
+    memset(&f, 0, sizeof(f));
+    f.after = after;
+    f.before = before;
+    mbox_column_range(cols, after, before, &begin, &end);
+    for (i = 0; i < n && !row_matches(i, &f); i++);
+    for (j = i; j < n && row_matches(j, &f); j++);
+    check(i == n ? begin == end : begin == i && end == j,
+          apr_psprintf(pool, "range: (%" APR_TIME_T_FMT ", %" APR_TIME_T_FMT
+                       ") is [%u, %u), not [%d, %d)", after, before, begin,
+                       end, i, j));
+}
+
+/* A message of the runs merged, as a scan orders them */
+typedef struct merged
+{
+    apr_int64_t sec;
+    int run;
+    apr_uint32_t ordinal;
+} merged;
+
+/* Newest first; on ties, earlier runs first, and the latest of a run. */
+static int merged_cmp(const void *a, const void *b)
+{
+    const merged *x = a, *y = b;
+
+    if (x->sec != y->sec)
+        return x->sec < y->sec ? 1 : -1;
+    if (x->run != y->run)
+        return x->run < y->run ? -1 : 1;
+    return (x->ordinal < y->ordinal) - (x->ordinal > y->ordinal);
+}
+
+#define MERGE_BOXES 4
+
+/* Compares merges of runs of several mailboxes with a sort of their
+ * messages.
+ */
+static void check_merge(void)
+{
+    mbox_column_t *cols[MERGE_BOXES];
+    apr_int64_t *secs[MERGE_BOXES], first = 1072915200;
+    apr_uint32_t counts[MERGE_BOXES];
+    mbox_column_run_t runs[2 * MERGE_BOXES];
+    apr_array_header_t *picks;
+    merged *all;
+    apr_uint32_t skip, n, total, o;
+    int b, i, j, nruns, ok;
+
+    /* The last mailbox has the dates of the first: every date ties. */
+    for (b = 0; b < MERGE_BOXES; b++) {
+        const char *box = apr_psprintf(pool, "2005%02d.mbox", b);
+
+        if (b == 0 || b == MERGE_BOXES - 1) {
+            seed = 48;
+        }
+        counts[b] = b == 1 ? 0 : 40 + 97 * b;
+        column_write(box, first + (b == 2 ? 3600 : 0), counts[b]);
+        secs[b] = apr_palloc(pool, (counts[b] + 1) * sizeof(apr_int64_t));
+        for (i = 0; i < counts[b]; i++) {
+            secs[b][i] = rows[i].sec;
+        }
+        check(mbox_column_open(&cols[b], pool, path_of(box)) == APR_SUCCESS,
+              "merge: cannot open");
+    }
+
+    for (i = 0; i < 500; i++) {
+        /* Runs of any part of any mailbox, some of the same twice */
+        nruns = i ? rnd(2 * MERGE_BOXES + 1) : 0;
+        total = 0;
+        for (j = 0; j < nruns; j++) {
+            b = rnd(MERGE_BOXES);
+            runs[j].cols = cols[b];
+            runs[j].begin = counts[b] ? rnd(counts[b] + 1) : 0;
+            runs[j].end = runs[j].begin + rnd(counts[b] - runs[j].begin + 1);
+            total += runs[j].end - runs[j].begin;
+        }
+
+        all = apr_palloc(pool, (total + 1) * sizeof(merged));
+        total = 0;
+        for (j = 0; j < nruns; j++) {
+            for (b = 0; runs[j].cols != cols[b]; b++);
+            for (o = runs[j].begin; o < runs[j].end; o++) {
+                all[total].sec = secs[b][o];
+                all[total].run = j;
+                all[total].ordinal = o;
+                total++;
+            }
+        }
+        qsort(all, total, sizeof(merged), merged_cmp);
+
+        skip = rnd(total + 5);
+        n = rnd(60);
+        mbox_column_merge(&picks, pool, runs, nruns, skip, n);
+        ok = picks->nelts == (skip >= total ? 0
+                              : total - skip < n ? total - skip : n);
+        for (j = 0; ok && j < picks->nelts; j++) {
+            const mbox_column_pick_t *pick =
+                &APR_ARRAY_IDX(picks, j, mbox_column_pick_t);
+
+            ok = pick->run == all[skip + j].run
+                && pick->ordinal == all[skip + j].ordinal;
+        }
+        check(ok, apr_psprintf(pool, "merge: %d runs, after %u, differ at "
+                               "pick %d", nruns, skip, j));
+    }
+}
+
+static void check_column(void)
+{
+    static const char *const looked_for[] = {
+        NULL, "alice@example.org", "alice", "alice@", "al", "bob@example.org",
+        "", "zed", "carol@example.org ",
+    };
+    static const char *const found_in[] = {
+        NULL, "", "patch", "build report", "re", "stra\xc3\x9f" "e", "none",
+    };
+    const char *box = "200401.mbox";
+    apr_int64_t first = 1072915200, last;
+    mbox_column_t *cols;
+    mbox_filter_t f;
+    int i, a, s, flags;
+
+    check(mbox_column_open(&cols, pool, path_of(box)) == APR_NOTFOUND,
+          "column: opens before it is written");
+
+    column_write(box, first, ROWS);
+    last = rows[ROWS - 1].sec;
+    check(mbox_column_open(&cols, pool, path_of(box)) == APR_SUCCESS,
+          "column: cannot open");
+    check(mbox_column_matches(cols, 1234, 5678), "column: version lost");
+    check(!mbox_column_matches(cols, 1235, 5678), "column: version ignored");
+    check(mbox_column_count(cols) == ROWS, "column: rows lost");
+    for (i = 0; i < ROWS; i++) {
+        check(strcmp(mbox_column_msgid(cols, i),
+                     apr_psprintf(pool, "<%s.%d@example.org>", box, i)) == 0,
+              "column: Message-ID lost");
+    }
+
+    /* Every predicate, alone and together */
+    for (a = 0; a < sizeof(looked_for) / sizeof(looked_for[0]); a++) {
+        for (s = 0; s < sizeof(found_in) / sizeof(found_in[0]); s++) {
+            for (flags = 0; flags < 4; flags++) {
+                memset(&f, 0, sizeof(f));
+                f.author = looked_for[a];
+                f.subject = found_in[s];
+                f.flags = flags;
+                check_filter(cols, ROWS, &f);
+                f.author_prefix = 1;
+                check_filter(cols, ROWS, &f);
+            }
+        }
+    }
+
+    /* Dates: ranges of every length, at every offset from a run of 16 */
+    for (i = 0; i < 2000; i++) {
+        memset(&f, 0, sizeof(f));
+        f.after = rnd(8) ? apr_time_from_sec(first - 10
+                                             + rnd(last - first + 20)) : 0;
+        f.before = rnd(8) ? apr_time_from_sec(first - 10
+                                              + rnd(last - first + 20)) : 0;
+        f.author = rnd(2) ? looked_for[1 + rnd(4)] : NULL;
+        f.author_prefix = rnd(2);
+        f.flags = rnd(4);
+        check_filter(cols, ROWS, &f);
+    }
+    for (i = 0; i < 40; i++) {
+        memset(&f, 0, sizeof(f));
+        f.after = apr_time_from_sec(rows[i].sec);
+        f.before = apr_time_from_sec(rows[ROWS - 1 - i].sec);
+        f.flags = MBOX_COLUMN_THREAD;
+        check_filter(cols, ROWS, &f);
+        f.author = "alice";
+        f.author_prefix = 1;
+        check_filter(cols, ROWS, &f);
+    }
+
+    /* Ranges, to the microsecond, and past either end */
+    for (i = 0; i < 2000; i++) {
+        check_range(cols, ROWS, any_date(first, last), any_date(first, last));
+    }
+    for (i = 0; i < 20; i++) {
+        check_range(cols, ROWS, apr_time_from_sec(rows[i].sec) + i % 2,
+                    apr_time_from_sec(rows[ROWS - 1 - i].sec) + i % 2);
+    }
+    check_range(cols, ROWS, apr_time_from_sec(last + 1), 0);
+    check_range(cols, ROWS, 0, apr_time_from_sec(first));
+
+    /* Fewer rows than a run of 16, and none */
+    for (i = 0; i < 17; i += 8) {
+        box = apr_psprintf(pool, "2002%02d.mbox", i);
+        column_write(box, first, i);
+        check(mbox_column_open(&cols, pool, path_of(box)) == APR_SUCCESS,
+              "column: cannot open");
+        memset(&f, 0, sizeof(f));
+        f.author = "alice";
+        f.author_prefix = 1;
+        f.flags = MBOX_COLUMN_THREAD;
+        check_filter(cols, i, &f);
+        f.after = apr_time_from_sec(first + 1);
+        check_filter(cols, i, &f);
+    }
+
+    /* Statistics, of many rows, of few, of none, and before 1970 */
+    column_write("200403.mbox", first, STATS_ROWS);
+    check_stats("200403.mbox", STATS_ROWS);
+    column_write("200404.mbox", first, 17);
+    check_stats("200404.mbox", 17);
+    column_write("200405.mbox", first, 0);
+    check_stats("200405.mbox", 0);
+    column_write("196912.mbox", -3 * MBOX_COLUMN_DAY - 1, 500);
+    check_stats("196912.mbox", 500);
+
+    check_merge();
+
+    check_damage("column", path_of("200401.mbox" MBOX_COLUMN_SUFFIX),
+                 COLUMN_HEADER_LEN, column_open, path_of("200401.mbox"));
+}
+
+/* Ordinal index */
+
+#define ORDINAL_HEADER_LEN 32   /* sizeof(ordinal_header) */
+
+#define RECORDS 300
+
+static apr_status_t ordinal_open(apr_pool_t *p, const char *path)
+{
+    mbox_ordinal_t *ord;
+
+    return mbox_ordinal_open(&ord, p, path);
+}
+
+static void check_ordinal(void)
+{
+    const char *box = path_of("200601.mbox");
+    apr_time_t dates[RECORDS], date, first = apr_time_from_sec(1136073600);
+    mbox_ordinal_writer_t *w;
+    mbox_ordinal_t *ord;
+    apr_uint32_t i, j, end;
+
+    check(mbox_ordinal_open(&ord, pool, box) == APR_NOTFOUND,
+          "ordinal: opens before it is written");
+
+    /* Several messages of the same second, and of the same microsecond */
+    check(mbox_ordinal_create(&w, pool, box, 1234, 5678) == APR_SUCCESS,
+          "ordinal: cannot create");
+    for (date = first, i = 0; i < RECORDS; i++) {
+        date += rnd(3) == 0 ? 0 : rnd(2) ? rnd(APR_USEC_PER_SEC)
+            : apr_time_from_sec(rnd(100));
+        dates[i] = date;
+        mbox_ordinal_add(w, date, apr_psprintf(pool, "<%u@example.org>", i));
+    }
+    check(mbox_ordinal_commit(w) == APR_SUCCESS, "ordinal: cannot commit");
+
+    check(mbox_ordinal_open(&ord, pool, box) == APR_SUCCESS,
+          "ordinal: cannot open");
+    check(mbox_ordinal_matches(ord, 1234, 5678), "ordinal: version lost");
+    check(!mbox_ordinal_matches(ord, 1234, 5677), "ordinal: version ignored");
+    check(mbox_ordinal_count(ord) == RECORDS, "ordinal: records lost");
+    for (i = 0; i < RECORDS; i++) {
+        check(mbox_ordinal_date(ord, i) == dates[i]
+              && strcmp(mbox_ordinal_msgid(ord, i),
+                        apr_psprintf(pool, "<%u@example.org>", i)) == 0,
+              apr_psprintf(pool, "ordinal: record %u lost", i));
+    }
+    check(mbox_ordinal_date(ord, RECORDS) == 0
+          && strcmp(mbox_ordinal_msgid(ord, RECORDS), "") == 0,
+          "ordinal: record past the last");
+
+    /* The first of a date, and the next of a message */
+    for (i = 0; i < 1000; i++) {
+        date = first - APR_USEC_PER_SEC
+            + rnd((apr_uint32_t) apr_time_sec(dates[RECORDS - 1] - first) + 2)
+              * APR_USEC_PER_SEC + rnd(APR_USEC_PER_SEC);
+        for (j = 0; j < RECORDS && dates[j] < date; j++);
+        check(mbox_ordinal_find(ord, date) == j,
+              apr_psprintf(pool, "ordinal: %" APR_TIME_T_FMT " found at %u, "
+                           "not %u", date, mbox_ordinal_find(ord, date), j));
+    }
+    for (i = 0; i < RECORDS; i++) {
+        /* Anywhere in the second of the message */
+        date = apr_time_from_sec(apr_time_sec(dates[i]))
+            + rnd(APR_USEC_PER_SEC);
+        check(mbox_ordinal_after(ord, date,
+                                 apr_psprintf(pool, "<%u@example.org>", i))
+              == i + 1, apr_psprintf(pool, "ordinal: %u not before %u", i,
+                                     i + 1));
+        for (end = i; end < RECORDS && apr_time_sec(dates[end])
+                                       == apr_time_sec(dates[i]); end++);
+        check(mbox_ordinal_after(ord, dates[i], "<none@example.org>") == end,
+              apr_psprintf(pool, "ordinal: unknown message of %u not before "
+                           "%u", i, end));
+    }
+
+    check_damage("ordinal", apr_pstrcat(pool, box, MBOX_ORDINAL_SUFFIX, NULL),
+                 ORDINAL_HEADER_LEN, ordinal_open, box);
+
+    /* Nothing */
+    check(mbox_ordinal_create(&w, pool, box, 1, 1) == APR_SUCCESS
+          && mbox_ordinal_commit(w) == APR_SUCCESS,
+          "ordinal: cannot write empty");
+    check(mbox_ordinal_open(&ord, pool, box) == APR_SUCCESS,
+          "ordinal: cannot open empty");
+    check(mbox_ordinal_count(ord) == 0 && mbox_ordinal_find(ord, first) == 0
+          && mbox_ordinal_after(ord, first, "<0@example.org>") == 0,
+          "ordinal: empty index has records");
+
+    /* Nothing replaced when aborted */
+    check(mbox_ordinal_create(&w, pool, box, 2, 2) == APR_SUCCESS,
+          "ordinal: cannot create");
+    mbox_ordinal_add(w, first, "<0@example.org>");
+    mbox_ordinal_abort(w);
+    check(mbox_ordinal_open(&ord, pool, box) == APR_SUCCESS
+          && mbox_ordinal_matches(ord, 1, 1),
+          "ordinal: replaced when aborted");
+}
+
+/* Prerendered views */
+
+#define FRAG_HEADER_LEN 48      /* sizeof(frag_header) */
+
+static apr_status_t frag_open(apr_pool_t *p, const char *path)
+{
+    mbox_frag_t *frag;
+
+    return mbox_frag_open(&frag, p, path);
+}
+
+static apr_status_t varbuf_write(void *baton, const char *data,
+                                 apr_size_t len)
+{
+    mbox_varbuf_strmemcat(baton, data, len);
+    return APR_SUCCESS;
+}
+
+/* Returns the view of message n: the last one spans many buffers. */
+static const char *frag_view(int n)
+{
+    static mbox_varbuf_t vb;
+    const char *line;
+    int i;
+
+    if (n < MESSAGES - 1) {
+        return apr_psprintf(pool, "<pre>%s</pre>\n", messages[n].body);
+    }
+    if (!vb.pool) {
+        mbox_varbuf_init(pool, &vb, 64 * 1024);
+        for (i = 0; i < 5000; i++) {
+            line = apr_psprintf(pool, "<p>%d %s</p>\n", i,
+                                messages[i % MESSAGES].body);
+            mbox_varbuf_strmemcat(&vb, line, strlen(line));
+        }
+    }
+    return vb.buf;
+}
+
+/* Checks that the views of frag are those written. */
+static void check_frag_views(mbox_frag_t *frag, const char *what)
+{
+    mbox_frag_rec_t rec;
+    mbox_varbuf_t vb;
+    const char *view;
+    int i;
+
+    for (i = 0; i < MESSAGES; i++) {
+        view = frag_view(i);
+        check(mbox_frag_fetch(frag, pool, message(pool, i)->msgID, &rec)
+              == APR_SUCCESS, apr_psprintf(pool, "frag (%s): view %d lost",
+                                           what, i));
+        check(rec.date == message_date(i) && rec.len == strlen(view)
+              && strcmp(rec.html_subject, messages[i].subject) == 0,
+              apr_psprintf(pool, "frag (%s): record %d lost", what, i));
+        mbox_varbuf_init(pool, &vb, 64);
+        check(mbox_frag_read(frag, &rec, varbuf_write, &vb) == APR_SUCCESS
+              && vb.len == strlen(view) && memcmp(vb.buf, view, vb.len) == 0,
+              apr_psprintf(pool, "frag (%s): view %d differs", what, i));
+    }
+    check(mbox_frag_fetch(frag, pool, "<none@example.org>", &rec)
+          == APR_NOTFOUND, apr_psprintf(pool, "frag (%s): view made up",
+                                        what));
+}
+
+static void check_frag(void)
+{
+    const char *box = path_of("200701.mbox");
+    mbox_frag_info_t info, other;
+    mbox_frag_writer_t *w;
+    mbox_frag_t *frag, *old = NULL;
+    mbox_frag_rec_t rec;
+    int flags, i;
+
+    check(mbox_frag_open(&frag, pool, box) != APR_SUCCESS,
+          "frag: opens before it is written");
+
+    memset(&info, 0, sizeof(info));
+    info.antispam = 1;
+    info.index_mtime = 1234;
+    info.index_size = 5678;
+    info.base_uri = "/mod_mbox/dev/200701.mbox";
+
+    /* As they are, and compressed: each replaces the other. */
+    for (flags = 0; flags <= MBOX_FRAG_GZIP; flags += MBOX_FRAG_GZIP) {
+        info.flags = flags;
+        check(mbox_frag_create(&w, pool, box, &info) == APR_SUCCESS,
+              "frag: cannot create");
+        for (i = 0; i < MESSAGES; i++) {
+            mbox_out_puts(mbox_frag_begin(w, pool), frag_view(i));
+            check(mbox_frag_end(w, message(pool, i)->msgID, message_date(i),
+                                messages[i].subject) == APR_SUCCESS,
+                  "frag: cannot end a view");
+        }
+        check(mbox_frag_commit(w) == APR_SUCCESS, "frag: cannot commit");
+
+        check(mbox_frag_open(&frag, pool, box) == APR_SUCCESS,
+              "frag: cannot open");
+        check_frag_views(frag, flags ? "gzip" : "plain");
+
+        /* Views of the file replaced are not taken for those of this one */
+        if (old) {
+            check(mbox_frag_fetch(old, pool, message(pool, 0)->msgID, &rec)
+                  == APR_NOTFOUND, "frag: view of a replaced file");
+        }
+        old = frag;
+    }
+
+    /* Settings that the views depend on, and one they do not */
+    other = info;
+    check(mbox_frag_matches(frag, &other), "frag: settings lost");
+    other.flags = 0;
+    check(mbox_frag_matches(frag, &other), "frag: flags matter");
+    other.antispam = 0;
+    check(!mbox_frag_matches(frag, &other), "frag: antispam ignored");
+    other = info;
+    other.base_uri = "/mod_mbox/users/200701.mbox";
+    check(!mbox_frag_matches(frag, &other), "frag: base URI ignored");
+    other = info;
+    other.index_size++;
+    check(!mbox_frag_matches(frag, &other), "frag: version ignored");
+
+    /* Nothing replaced when aborted */
+    check(mbox_frag_create(&w, pool, box, &info) == APR_SUCCESS,
+          "frag: cannot create");
+    mbox_out_puts(mbox_frag_begin(w, pool), "<p>gone</p>");
+    mbox_frag_end(w, message(pool, 0)->msgID, message_date(0), "gone");
+    mbox_frag_abort(w);
+    check(mbox_frag_open(&frag, pool, box) == APR_SUCCESS,
+          "frag: cannot open");
+    check_frag_views(frag, "aborted");
+
+    check_damage("frag", apr_pstrcat(pool, box, MBOX_FRAG_SUFFIX, NULL),
+                 FRAG_HEADER_LEN, frag_open, box);
+}
+
+/* Precompressed variants */
+
+#define VARIANT_HEADER_LEN 50   /* "MBOXVAR1 ", the hash and a newline */
+
+static const char *variant_location = "/dev/200701.mbox/date";
+static const mbox_encoding_t *variant_enc;
+
+static apr_status_t variant_open(apr_pool_t *p, const char *dir)
+{
+    mbox_variant_t v;
+    apr_status_t rv;
+
+    rv = mbox_variant_open(&v, p, dir, variant_location, "v2", variant_enc);
+    if (rv == APR_SUCCESS) {
+        apr_file_close(v.file);
+    }
+    return rv;
+}
+
+/* Returns the page a variant holds, uncompressed, or NULL if it does
+ * not open.
+ */
+static const char *variant_page(const char *dir, const char *location,
+                                const char *version,
+                                const mbox_encoding_t *enc)
+{
+    mbox_variant_t v;
+    char *in, *out = NULL;
+    apr_size_t n;
+    apr_off_t offset;
+
+    if (mbox_variant_open(&v, pool, dir, location, version, enc)
+        != APR_SUCCESS) {
+        return NULL;
+    }
+    in = apr_palloc(pool, v.len + 1);
+    offset = v.offset;
+    check(apr_file_seek(v.file, APR_SET, &offset) == APR_SUCCESS
+          && apr_file_read_full(v.file, in, v.len, &n) == APR_SUCCESS,
+          "variant: cannot read");
+    apr_file_close(v.file);
+
+#ifdef HAVE_ZSTD
+    if (strcmp(enc->name, "zstd") == 0) {
+        /* Pages are compressed as a stream: their size is not known. */
+        ZSTD_DCtx *dc = ZSTD_createDCtx();
+        ZSTD_inBuffer zin = {in, n, 0};
+        ZSTD_outBuffer zout;
+        mbox_varbuf_t vb;
+        char buf[16 * 1024];
+        size_t left;
+
+        mbox_varbuf_init(pool, &vb, sizeof(buf));
+        do {
+            zout.dst = buf;
+            zout.size = sizeof(buf);
+            zout.pos = 0;
+            left = ZSTD_decompressStream(dc, &zout, &zin);
+            check(!ZSTD_isError(left), "variant: bad zstd data");
+            mbox_varbuf_strmemcat(&vb, buf, zout.pos);
+        } while (left && (zin.pos < zin.size || zout.pos == zout.size));
+        check(!left && zin.pos == zin.size, "variant: bad zstd data");
+        ZSTD_freeDCtx(dc);
+        out = vb.buf;
+    }
+#endif
+    if (strcmp(enc->name, "gzip") == 0) {
+        z_stream z;
+        apr_size_t size = 64 * 1024;
+
+        memset(&z, 0, sizeof(z));
+        check(inflateInit2(&z, 15 + 16) == Z_OK, "variant: no zlib");
+        z.next_in = (unsigned char *) in;
+        z.avail_in = (uInt) n;
+        out = apr_palloc(pool, size);
+        z.next_out = (unsigned char *) out;
+        z.avail_out = (uInt) size - 1;
+        while (inflate(&z, Z_NO_FLUSH) == Z_OK && !z.avail_out) {
+            char *more = apr_palloc(pool, 2 * size);
+
+            memcpy(more, out, z.total_out);
+            out = more;
+            z.next_out = (unsigned char *) out + z.total_out;
+            z.avail_out = (uInt) (2 * size - z.total_out - 1);
+            size *= 2;
+        }
+        check(z.avail_in == 0, "variant: bad gzip data");
+        out[z.total_out] = '\0';
+        inflateEnd(&z);
+    }
+    check(out != NULL, "variant: unknown encoding");
+    return out;
+}
+
+static void check_variant(void)
+{
+    const char *dir = path_of("pages"), *page = frag_view(MESSAGES - 1);
+    const mbox_encoding_t *enc;
+    mbox_variant_writer_t *w;
+    const char *got;
+
+    check(strlen(mbox_variant_hash(pool, "v1")) == 40
+          && strcmp(mbox_variant_hash(pool, "v1"),
+                    mbox_variant_hash(pool, "v1")) == 0
+          && strcmp(mbox_variant_hash(pool, "v1"),
+                    mbox_variant_hash(pool, "v2")) != 0,
+          "variant: hash");
+
+    /* A page of many buffers, then its next version */
+    check(mbox_variant_create(&w, pool, dir, variant_location, "v1")
+          == APR_SUCCESS, "variant: cannot create");
+    mbox_out_puts(mbox_variant_out(w), page);
+    check(mbox_variant_commit(w) == APR_SUCCESS, "variant: cannot commit");
+    for (enc = mbox_variant_encodings; enc->name; enc++) {
+        got = variant_page(dir, variant_location, "v1", enc);
+        check(got && strcmp(got, page) == 0,
+              apr_pstrcat(pool, "variant: ", enc->name, " page differs",
+                          NULL));
+        check(!variant_page(dir, variant_location, "v2", enc)
+              && !variant_page(dir, "/dev/200701.mbox/thread", "v1", enc),
+              apr_pstrcat(pool, "variant: ", enc->name, " page of another "
+                          "version or location", NULL));
+    }
+
+    check(mbox_variant_create(&w, pool, dir, variant_location, "v2")
+          == APR_SUCCESS, "variant: cannot create");
+    mbox_out_puts(mbox_variant_out(w), "<p>v2</p>");
+    check(mbox_variant_commit(w) == APR_SUCCESS, "variant: cannot commit");
+
+    /* Nothing replaced when aborted */
+    check(mbox_variant_create(&w, pool, dir, variant_location, "v3")
+          == APR_SUCCESS, "variant: cannot create");
+    mbox_out_puts(mbox_variant_out(w), "<p>v3</p>");
+    mbox_variant_abort(w);
+
+    for (enc = mbox_variant_encodings; enc->name; enc++) {
+        got = variant_page(dir, variant_location, "v2", enc);
+        check(got && strcmp(got, "<p>v2</p>") == 0
+              && !variant_page(dir, variant_location, "v1", enc)
+              && !variant_page(dir, variant_location, "v3", enc),
+              apr_pstrcat(pool, "variant: ", enc->name, " not replaced",
+                          NULL));
+
+        variant_enc = enc;
+        got = mbox_variant_hash(pool, variant_location);
+        check_damage(apr_pstrcat(pool, "variant ", enc->name, NULL),
+                     apr_psprintf(pool, "%s/%.2s/%s%s", dir, got, got + 2,
+                                  enc->suffix),
+                     VARIANT_HEADER_LEN, variant_open, dir);
+    }
+}
+
+/* Removes path, and what is in it if it is a directory. */
+static void remove_tree(const char *path)
+{
+    apr_dir_t *d;
+    apr_finfo_t finfo;
+    apr_status_t rv;
+
+    if (apr_dir_open(&d, path, pool) != APR_SUCCESS) {
+        apr_file_remove(path, pool);
+        return;
+    }
+    while ((rv = apr_dir_read(&finfo, APR_FINFO_NAME, d))
+           == APR_SUCCESS || APR_STATUS_IS_INCOMPLETE(rv)) {
+        if (strcmp(finfo.name, ".") && strcmp(finfo.name, "..")) {
+            remove_tree(apr_pstrcat(pool, path, "/", finfo.name, NULL));
+        }
+    }
+    apr_dir_close(d);
+    apr_dir_remove(path, pool);
+}
+
+/* Leaves the temporary directory as it was found. */
+static void remove_dir(void)
+{
+    remove_tree(dir);
+}
+
+int main(int argc, const char *const argv[])
+{
+    const char *tmp;
+
+    apr_app_initialize(&argc, &argv, NULL);
+    atexit(apr_terminate);
+    apr_pool_create(&pool, NULL);
+    mbox_cte_xlate_cache_init(pool);
+
+    if (apr_temp_dir_get(&tmp, pool) != APR_SUCCESS) {
+        tmp = ".";
+    }
+    dir = apr_psprintf(pool, "%s/index-check-" VARIANT ".%" APR_TIME_T_FMT,
+                       tmp, apr_time_now());
+    check(apr_dir_make(dir, APR_OS_DEFAULT, pool) == APR_SUCCESS,
+          apr_pstrcat(pool, "cannot create ", dir, NULL));
+    atexit(remove_dir);
+
+    check_fts();
+    check_msgid();
+    check_subject();
+    check_author();
+    check_column();
+    check_ordinal();
+    check_frag();
+    check_variant();
+
+    printf("index-check (" VARIANT "): %lu checks, no failure\n", checks);
+    return 0;
+}
@@ -0,0 +1,166 @@
+/* Licensed to the Apache Software Foundation (ASF) under one or more
+ * contributor license agreements.  See the NOTICE file distributed with
+ * this work for additional information regarding copyright ownership.
+ * The ASF licenses this file to You under the Apache License, Version 2.0
+ * (the "License"); you may not use this file except in compliance with
+ * the License.  You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+/* Content-addressed attachment store.
+ *
+ * A content is kept in DIR/xx/yyyy..., where xxyyyy... is the SHA-1 of
+ * the content in hex.  SHA-1 is what APR has to offer; since collisions
+ * can be made on purpose, a content is never assumed to be the one
+ * already stored under its key: the two are compared first.
+ */
+
+#include "mbox_attach.h"
+
+#include "apr_file_io.h"
+#include "apr_file_info.h"
+#include "apr_lib.h"
+#include "apr_sha1.h"
+#include "apr_strings.h"
+
+#include <string.h>
+
+#define KEY_LEN (APR_SHA1_DIGESTSIZE * 2)
+
+#define STORE_PERMS (APR_FPROT_UREAD | APR_FPROT_UWRITE | \
+                     APR_FPROT_GREAD | APR_FPROT_WREAD)
+#define STORE_DIR_PERMS (STORE_PERMS | APR_FPROT_UEXECUTE | \
+                         APR_FPROT_GEXECUTE | APR_FPROT_WEXECUTE)
+
+static char *content_key(apr_pool_t *p, const char *data, apr_size_t len)
+{
+    static const char hex[] = "0123456789abcdef";
+    unsigned char digest[APR_SHA1_DIGESTSIZE];
+    apr_sha1_ctx_t ctx;
+    char *key;
+    int i;
+
+    apr_sha1_init(&ctx);
+    /* apr_sha1_update_binary() takes an unsigned int length. */
+    while (len) {
+        unsigned int n = len > 0x40000000 ? 0x40000000 : (unsigned int) len;
+        apr_sha1_update_binary(&ctx, (const unsigned char *) data, n);
+        data += n;
+        len -= n;
+    }
+    apr_sha1_final(digest, &ctx);
+
+    key = apr_palloc(p, KEY_LEN + 1);
+    for (i = 0; i < APR_SHA1_DIGESTSIZE; i++) {
+        key[2 * i] = hex[digest[i] >> 4];
+        key[2 * i + 1] = hex[digest[i] & 0xf];
+    }
+    key[KEY_LEN] = '\0';
+    return key;
+}
+
+/* Returns APR_SUCCESS if the file at path holds exactly data. */
+static apr_status_t same_content(apr_pool_t *p, const char *path,
+                                 const char *data, apr_size_t len)
+{
+    apr_file_t *f;
+    apr_finfo_t finfo;
+    apr_status_t rv;
+    char buf[8192];
+
+    rv = apr_file_open(&f, path, APR_READ, APR_OS_DEFAULT, p);
+    if (rv != APR_SUCCESS)
+        return rv;
+
+    rv = apr_file_info_get(&finfo, APR_FINFO_SIZE, f);
+    if (rv == APR_SUCCESS && finfo.size != (apr_off_t) len)
+        rv = APR_EEXIST;
+
+    while (rv == APR_SUCCESS && len) {
+        apr_size_t n = len > sizeof(buf) ? sizeof(buf) : len;
+
+        rv = apr_file_read_full(f, buf, n, &n);
+        if (rv == APR_SUCCESS && memcmp(buf, data, n) != 0)
+            rv = APR_EEXIST;
+        data += n;
+        len -= n;
+    }
+
+    apr_file_close(f);
+    return rv;
+}
+
+char *mbox_attach_path(apr_pool_t *p, const char *dir, const char *key)
+{
+    int i;
+
+    if (!key)
+        return NULL;
+    for (i = 0; i < KEY_LEN; i++) {
+        if (!apr_isxdigit(key[i]) || apr_isupper(key[i]))
+            return NULL;
+    }
+    if (key[KEY_LEN] != '\0')
+        return NULL;
+
+    return apr_psprintf(p, "%s/%.2s/%s", dir, key, key + 2);
+}
+
+apr_status_t mbox_attach_put(apr_pool_t *p, const char *dir,
+                             const char *data, apr_size_t len, char **key)
+{
+    apr_file_t *f;
+    apr_finfo_t finfo;
+    apr_status_t rv;
+    char *k, *path, *tmp;
+    apr_size_t written;
+
+    k = content_key(p, data, len);
+    path = mbox_attach_path(p, dir, k);
+
+    /* Already stored, from this list or another one. */
+    if (apr_stat(&finfo, path, APR_FINFO_TYPE, p) == APR_SUCCESS) {
+        rv = same_content(p, path, data, len);
+        if (rv == APR_SUCCESS)
+            *key = k;
+        return rv;
+    }
+
+    rv = apr_dir_make_recursive(apr_psprintf(p, "%s/%.2s", dir, k),
+                                STORE_DIR_PERMS, p);
+    if (rv != APR_SUCCESS)
+        return rv;
+
+    /* Write to a temporary file first, so that a content is either
+       complete or missing, even if another process stores it too. */
+    tmp = apr_pstrcat(p, path, ".XXXXXX", NULL);
+    rv = apr_file_mktemp(&f, tmp, APR_CREATE | APR_WRITE | APR_EXCL, p);
+    if (rv != APR_SUCCESS)
+        return rv;
+
+    rv = apr_file_write_full(f, data, len, &written);
+    if (rv == APR_SUCCESS)
+        rv = apr_file_close(f);
+    else
+        apr_file_close(f);
+    if (rv == APR_SUCCESS) {
+        /* Temporary files are only readable by their owner, and the
+           server is unlikely to run as the same user as we do. */
+        apr_file_perms_set(tmp, STORE_PERMS);
+        rv = apr_file_rename(tmp, path, p);
+    }
+    if (rv != APR_SUCCESS) {
+        apr_file_remove(tmp, p);
+        return rv;
+    }
+
+    *key = k;
+    return APR_SUCCESS;
+}
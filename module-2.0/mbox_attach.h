@@ -0,0 +1,50 @@
+/* Licensed to the Apache Software Foundation (ASF) under one or more
+ * contributor license agreements.  See the NOTICE file distributed with
+ * this work for additional information regarding copyright ownership.
+ * The ASF licenses this file to You under the Apache License, Version 2.0
+ * (the "License"); you may not use this file except in compliance with
+ * the License.  You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef MBOX_ATTACH_H
+#define MBOX_ATTACH_H
+
+/*
+ * Content-addressed store of decoded attachments.  mod-mbox-util writes
+ * large MIME parts there, once each whatever the number of messages and
+ * lists they appear in, and the module serves them straight from disk.
+ */
+
+#include "apr.h"
+#include "apr_pools.h"
+
+/* Parts smaller than this (once decoded) are not worth a file. */
+#define MBOX_ATTACH_MIN_SIZE (64 * 1024)
+
+typedef struct mbox_attach_store
+{
+    const char *dir;
+    apr_size_t min_size;
+} mbox_attach_store_t;
+
+/* Stores data under dir, unless it is already there, and returns its
+ * key in *key.  Fails with APR_EEXIST if another content has the same
+ * key.
+ */
+apr_status_t mbox_attach_put(apr_pool_t *p, const char *dir,
+                             const char *data, apr_size_t len, char **key);
+
+/* Returns the path of the content with the given key under dir, or NULL
+ * if key is not a valid key.
+ */
+char *mbox_attach_path(apr_pool_t *p, const char *dir, const char *key);
+
+#endif
@@ -0,0 +1,508 @@
+/* Licensed to the Apache Software Foundation (ASF) under one or more
+ * contributor license agreements.  See the NOTICE file distributed with
+ * this work for additional information regarding copyright ownership.
+ * The ASF licenses this file to You under the Apache License, Version 2.0
+ * (the "License"); you may not use this file except in compliance with
+ * the License.  You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+/* Author index.
+ *
+ * The index of a list is a single file: an author_header, then the
+ * segments (an author_seg per mailbox, with the version of its message
+ * index), the authors (an author_entry each, sorted on their key), the
+ * postings (an author_posting per message) and the strings they point
+ * to, NUL terminated.  The postings of an author follow each other,
+ * newest first, so that a page of them is found without reading the
+ * others.
+ *
+ * Sections are aligned on 8 bytes and in the byte order of the host.
+ * The index is written again as a whole when a mailbox changes; the
+ * postings of the other mailboxes are copied from the current one.
+ */
+
+#include "mbox_author.h"
+#include "mbox_cte.h"
+
+#include "apr_file_io.h"
+#include "apr_mmap.h"
+#include "apr_strings.h"
+
+#include <stdlib.h>
+#include <string.h>
+
+#define AUTHOR_MAGIC "MBOXAUT1"
+#define AUTHOR_VERSION 1
+
+#define AUTHOR_PERMS (APR_FPROT_UREAD | APR_FPROT_UWRITE | \
+                      APR_FPROT_GREAD | APR_FPROT_WREAD)
+
+typedef struct author_header
+{
+    char magic[8];
+    apr_uint32_t version;
+    apr_uint32_t nsegs;
+    apr_uint32_t nauthors;
+    apr_uint32_t npostings;
+    apr_uint64_t segs_off;
+    apr_uint64_t authors_off;
+    apr_uint64_t postings_off;
+    apr_uint64_t strings_off;
+    apr_uint64_t strings_len;
+} author_header;
+
+typedef struct author_seg
+{
+    apr_int64_t index_mtime;
+    apr_int64_t index_size;
+    apr_uint32_t box;           /* Offset in the strings */
+    apr_uint32_t reserved;
+} author_seg;
+
+typedef struct author_entry
+{
+    apr_uint32_t key;           /* Offsets in the strings */
+    apr_uint32_t name;
+    apr_uint32_t first;         /* Its first posting */
+    apr_uint32_t count;
+} author_entry;
+
+typedef struct author_posting
+{
+    apr_int64_t date;
+    apr_uint32_t seg;
+    apr_uint32_t msgID;         /* Offset in the strings */
+} author_posting;
+
+struct mbox_author_index
+{
+    const author_header *h;
+    const author_seg *segs;
+    const author_entry *authors;
+    const author_posting *postings;
+    const char *strings;
+};
+
+/* Index being written */
+typedef struct author_wseg
+{
+    const char *box;
+    apr_time_t index_mtime;
+    apr_off_t index_size;
+    int old;                    /* Segment of the current index, or -1 */
+} author_wseg;
+
+typedef struct author_wposting
+{
+    apr_time_t date;
+    apr_uint32_t seg;
+    const char *key;
+    const char *name;
+    const char *msgID;
+} author_wposting;
+
+struct mbox_author_writer
+{
+    apr_pool_t *pool;
+    const char *path;
+    mbox_author_index_t *old;
+    char *declared;             /* Old segments declared */
+
+    apr_array_header_t *segs;   /* Of author_wseg */
+    apr_array_header_t *postings;       /* Of author_wposting */
+    int current;                /* Segment messages are added to */
+    int changed;
+};
+
+/* Reader */
+
+apr_status_t mbox_author_open(mbox_author_index_t **idxp, apr_pool_t *p,
+                              const char *dir)
+{
+    mbox_author_index_t *idx;
+    apr_file_t *f;
+    apr_finfo_t finfo;
+    apr_mmap_t *mm;
+    const author_header *h;
+    const char *base;
+    apr_uint64_t size;
+    apr_status_t rv;
+
+    rv = apr_file_open(&f, apr_pstrcat(p, dir, MBOX_AUTHOR_FILE, NULL),
+                       APR_READ, APR_OS_DEFAULT, p);
+    if (rv != APR_SUCCESS)
+        return APR_STATUS_IS_ENOENT(rv) ? APR_NOTFOUND : rv;
+
+    rv = apr_file_info_get(&finfo, APR_FINFO_SIZE, f);
+    if (rv == APR_SUCCESS && finfo.size < (apr_off_t) sizeof(author_header))
+        rv = APR_EGENERAL;
+    if (rv == APR_SUCCESS)
+        rv = apr_mmap_create(&mm, f, 0, finfo.size, APR_MMAP_READ, p);
+    apr_file_close(f);
+    if (rv != APR_SUCCESS)
+        return rv;
+
+    base = mm->mm;
+    size = finfo.size;
+    h = (const author_header *) base;
+
+    /* Everything the index points to must be within it. */
+    if (memcmp(h->magic, AUTHOR_MAGIC, sizeof(h->magic)) != 0
+        || h->version != AUTHOR_VERSION
+        || h->segs_off != sizeof(author_header)
+        || h->authors_off != h->segs_off + (apr_uint64_t) h->nsegs
+                                           * sizeof(author_seg)
+        || h->postings_off != h->authors_off + (apr_uint64_t) h->nauthors
+                                               * sizeof(author_entry)
+        || h->strings_off != h->postings_off + (apr_uint64_t) h->npostings
+                                               * sizeof(author_posting)
+        || h->strings_off > size
+        || h->strings_len > size - h->strings_off
+        || (h->strings_len && base[h->strings_off + h->strings_len - 1])
+        || (!h->strings_len && (h->nsegs || h->nauthors))) {
+        apr_mmap_delete(mm);
+        return APR_EGENERAL;
+    }
+
+    idx = apr_palloc(p, sizeof(mbox_author_index_t));
+    idx->h = h;
+    idx->segs = (const author_seg *) (base + h->segs_off);
+    idx->authors = (const author_entry *) (base + h->authors_off);
+    idx->postings = (const author_posting *) (base + h->postings_off);
+    idx->strings = base + h->strings_off;
+
+    *idxp = idx;
+    return APR_SUCCESS;
+}
+
+static const char *author_string(const mbox_author_index_t *idx,
+                                 apr_uint32_t off)
+{
+    return off < idx->h->strings_len ? idx->strings + off : "";
+}
+
+static const author_entry *author_lookup(const mbox_author_index_t *idx,
+                                         const char *key)
+{
+    apr_uint32_t lo = 0, hi = idx->h->nauthors;
+
+    while (lo < hi) {
+        apr_uint32_t mid = lo + (hi - lo) / 2;
+        const author_entry *a = &idx->authors[mid];
+        int cmp = strcmp(author_string(idx, a->key), key);
+
+        if (cmp < 0) {
+            lo = mid + 1;
+        }
+        else if (cmp > 0) {
+            hi = mid;
+        }
+        else {
+            /* Its postings must be within the index. */
+            if (a->first > idx->h->npostings
+                || a->count > idx->h->npostings - a->first) {
+                return NULL;
+            }
+            return a;
+        }
+    }
+    return NULL;
+}
+
+apr_uint32_t mbox_author_count(const mbox_author_index_t *idx,
+                               const char *key, const char **name)
+{
+    const author_entry *a = author_lookup(idx, key);
+
+    if (name) {
+        *name = a ? author_string(idx, a->name) : NULL;
+    }
+    return a ? a->count : 0;
+}
+
+void mbox_author_postings(apr_array_header_t **postingsp, apr_pool_t *p,
+                          const mbox_author_index_t *idx, const char *key,
+                          apr_uint32_t first, apr_uint32_t n)
+{
+    const author_entry *a = author_lookup(idx, key);
+    apr_array_header_t *postings;
+    apr_uint32_t i;
+
+    postings = apr_array_make(p, n ? n : 1, sizeof(mbox_author_posting_t));
+    *postingsp = postings;
+    if (!a || first >= a->count) {
+        return;
+    }
+
+    for (i = first; i < a->count && i - first < n; i++) {
+        const author_posting *ap = &idx->postings[a->first + i];
+        mbox_author_posting_t *posting;
+
+        if (ap->seg >= idx->h->nsegs) {
+            continue;
+        }
+        posting = apr_array_push(postings);
+        posting->box = author_string(idx, idx->segs[ap->seg].box);
+        posting->date = ap->date;
+        posting->msgID = author_string(idx, ap->msgID);
+    }
+}
+
+/* Writer */
+
+static author_wseg *writer_seg(mbox_author_writer_t *w, const char *box,
+                               apr_time_t index_mtime, apr_off_t index_size,
+                               int old)
+{
+    author_wseg *seg = apr_array_push(w->segs);
+
+    seg->box = box;
+    seg->index_mtime = index_mtime;
+    seg->index_size = index_size;
+    seg->old = old;
+    return seg;
+}
+
+apr_status_t mbox_author_writer_create(mbox_author_writer_t **wp,
+                                       apr_pool_t *p, const char *dir)
+{
+    mbox_author_writer_t *w;
+
+    w = apr_pcalloc(p, sizeof(mbox_author_writer_t));
+    w->pool = p;
+    w->path = apr_pstrcat(p, dir, MBOX_AUTHOR_FILE, NULL);
+    w->segs = apr_array_make(p, 64, sizeof(author_wseg));
+    w->postings = apr_array_make(p, 1024, sizeof(author_wposting));
+    w->current = -1;
+
+    /* An index that cannot be read is written anew. */
+    if (mbox_author_open(&w->old, p, dir) != APR_SUCCESS) {
+        w->old = NULL;
+        w->changed = 1;
+    }
+    else {
+        w->declared = apr_pcalloc(p, w->old->h->nsegs + 1);
+    }
+
+    *wp = w;
+    return APR_SUCCESS;
+}
+
+int mbox_author_writer_box(mbox_author_writer_t *w, const char *box,
+                           apr_time_t index_mtime, apr_off_t index_size)
+{
+    apr_uint32_t i;
+
+    for (i = 0; w->old && i < w->old->h->nsegs; i++) {
+        const author_seg *s = &w->old->segs[i];
+
+        if (!w->declared[i]
+            && strcmp(author_string(w->old, s->box), box) == 0
+            && s->index_mtime == index_mtime
+            && s->index_size == index_size) {
+            w->declared[i] = 1;
+            writer_seg(w, author_string(w->old, s->box), index_mtime,
+                       index_size, i);
+            w->current = -1;
+            return 1;
+        }
+    }
+
+    writer_seg(w, apr_pstrdup(w->pool, box), index_mtime, index_size, -1);
+    w->current = w->segs->nelts - 1;
+    w->changed = 1;
+    return 0;
+}
+
+void mbox_author_writer_add(mbox_author_writer_t *w, Message *m)
+{
+    author_wposting *wp;
+
+    if (w->current < 0 || !m->msgID) {
+        return;
+    }
+
+    wp = apr_array_push(w->postings);
+    wp->date = m->date;
+    wp->seg = w->current;
+    wp->key = apr_pstrdup(w->pool, m->author_key ? m->author_key
+                          : mbox_author_key(w->pool, m->from));
+    wp->name = apr_pstrdup(w->pool, m->name);
+    wp->msgID = apr_pstrdup(w->pool, m->msgID);
+}
+
+/* By author, then newest first */
+static int wposting_cmp(const void *a, const void *b)
+{
+    const author_wposting *x = a, *y = b;
+    int cmp = strcmp(x->key, y->key);
+
+    if (cmp)
+        return cmp;
+    if (x->date != y->date)
+        return x->date < y->date ? 1 : -1;
+    if (x->seg != y->seg)
+        return x->seg < y->seg ? -1 : 1;
+    return strcmp(x->msgID, y->msgID);
+}
+
+static apr_uint32_t add_string(mbox_varbuf_t *vb, const char *s)
+{
+    apr_size_t off = vb->len;
+
+    if (!s)
+        s = "";
+    mbox_varbuf_strmemcat(vb, s, strlen(s) + 1);
+    return (apr_uint32_t) off;
+}
+
+apr_status_t mbox_author_writer_commit(mbox_author_writer_t *w)
+{
+    author_header h;
+    author_seg *segs;
+    author_entry *authors;
+    author_posting *postings;
+    author_wposting *wp;
+    apr_uint32_t *renum = NULL;
+    mbox_varbuf_t strings;
+    apr_uint32_t i, k, nauthors = 0;
+    apr_file_t *f;
+    apr_size_t n;
+    char *tmp;
+    apr_status_t rv;
+    int j;
+
+    /* Mailboxes that are gone */
+    for (i = 0; w->old && i < w->old->h->nsegs; i++) {
+        if (!w->declared[i]) {
+            w->changed = 1;
+        }
+    }
+    if (!w->changed) {
+        return APR_SUCCESS;
+    }
+
+    mbox_varbuf_init(w->pool, &strings, 4096);
+
+    segs = apr_pcalloc(w->pool, (w->segs->nelts + 1) * sizeof(author_seg));
+    if (w->old) {
+        renum = apr_palloc(w->pool,
+                           (w->old->h->nsegs + 1) * sizeof(apr_uint32_t));
+        for (i = 0; i < w->old->h->nsegs; i++) {
+            renum[i] = (apr_uint32_t) -1;
+        }
+    }
+    for (j = 0; j < w->segs->nelts; j++) {
+        author_wseg *ws = &APR_ARRAY_IDX(w->segs, j, author_wseg);
+
+        segs[j].index_mtime = ws->index_mtime;
+        segs[j].index_size = ws->index_size;
+        segs[j].box = add_string(&strings, ws->box);
+        if (ws->old >= 0) {
+            renum[ws->old] = j;
+        }
+    }
+
+    /* The postings of the mailboxes kept */
+    for (i = 0; w->old && i < w->old->h->nauthors; i++) {
+        const author_entry *a = &w->old->authors[i];
+
+        if (a->first > w->old->h->npostings
+            || a->count > w->old->h->npostings - a->first) {
+            continue;
+        }
+        for (k = a->first; k < a->first + a->count; k++) {
+            const author_posting *ap = &w->old->postings[k];
+
+            if (ap->seg < w->old->h->nsegs
+                && renum[ap->seg] != (apr_uint32_t) -1) {
+                wp = apr_array_push(w->postings);
+                wp->date = ap->date;
+                wp->seg = renum[ap->seg];
+                wp->key = author_string(w->old, a->key);
+                wp->name = author_string(w->old, a->name);
+                wp->msgID = author_string(w->old, ap->msgID);
+            }
+        }
+    }
+    qsort(w->postings->elts, w->postings->nelts, sizeof(author_wposting),
+          wposting_cmp);
+
+    /* An author per run of postings of the same key; its name is that
+       of its newest message. */
+    authors = apr_pcalloc(w->pool,
+                          (w->postings->nelts + 1) * sizeof(author_entry));
+    postings = apr_pcalloc(w->pool,
+                           (w->postings->nelts + 1) * sizeof(author_posting));
+    for (j = 0; j < w->postings->nelts; j++) {
+        wp = &APR_ARRAY_IDX(w->postings, j, author_wposting);
+
+        if (!j || strcmp(wp->key, APR_ARRAY_IDX(w->postings, j - 1,
+                                                author_wposting).key) != 0) {
+            authors[nauthors].key = add_string(&strings, wp->key);
+            authors[nauthors].name = add_string(&strings, wp->name);
+            authors[nauthors].first = j;
+            nauthors++;
+        }
+        authors[nauthors - 1].count++;
+
+        postings[j].date = wp->date;
+        postings[j].seg = wp->seg;
+        postings[j].msgID = add_string(&strings, wp->msgID);
+    }
+
+    memset(&h, 0, sizeof(h));
+    memcpy(h.magic, AUTHOR_MAGIC, sizeof(h.magic));
+    h.version = AUTHOR_VERSION;
+    h.nsegs = w->segs->nelts;
+    h.nauthors = nauthors;
+    h.npostings = w->postings->nelts;
+    h.segs_off = sizeof(author_header);
+    h.authors_off = h.segs_off + (apr_uint64_t) h.nsegs * sizeof(author_seg);
+    h.postings_off = h.authors_off
+        + (apr_uint64_t) nauthors * sizeof(author_entry);
+    h.strings_off = h.postings_off
+        + (apr_uint64_t) h.npostings * sizeof(author_posting);
+    h.strings_len = strings.len;
+
+    tmp = apr_pstrcat(w->pool, w->path, ".XXXXXX", NULL);
+    rv = apr_file_mktemp(&f, tmp, APR_CREATE | APR_WRITE | APR_EXCL
+                         | APR_BUFFERED, w->pool);
+    if (rv != APR_SUCCESS) {
+        return rv;
+    }
+
+    rv = apr_file_write_full(f, &h, sizeof(h), &n);
+    if (rv == APR_SUCCESS && h.nsegs)
+        rv = apr_file_write_full(f, segs, h.nsegs * sizeof(author_seg), &n);
+    if (rv == APR_SUCCESS && nauthors)
+        rv = apr_file_write_full(f, authors,
+                                 nauthors * sizeof(author_entry), &n);
+    if (rv == APR_SUCCESS && h.npostings)
+        rv = apr_file_write_full(f, postings,
+                                 h.npostings * sizeof(author_posting), &n);
+    if (rv == APR_SUCCESS && strings.len)
+        rv = apr_file_write_full(f, strings.buf, strings.len, &n);
+    if (rv == APR_SUCCESS)
+        rv = apr_file_close(f);
+    else
+        apr_file_close(f);
+
+    if (rv == APR_SUCCESS) {
+        /* Temporary files are only readable by their owner. */
+        apr_file_perms_set(tmp, AUTHOR_PERMS);
+        rv = apr_file_rename(tmp, w->path, w->pool);
+    }
+    if (rv != APR_SUCCESS) {
+        apr_file_remove(tmp, w->pool);
+    }
+    return rv;
+}
@@ -0,0 +1,89 @@
+/* Licensed to the Apache Software Foundation (ASF) under one or more
+ * contributor license agreements.  See the NOTICE file distributed with
+ * this work for additional information regarding copyright ownership.
+ * The ASF licenses this file to You under the Apache License, Version 2.0
+ * (the "License"); you may not use this file except in compliance with
+ * the License.  You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef MBOX_AUTHOR_H
+#define MBOX_AUTHOR_H
+
+/*
+ * Author index.  mod-mbox-util lists, in one file in the list directory,
+ * the messages of each author (by author key, see mbox_author_key()) in
+ * all the months of the list, newest first.  The module maps it in
+ * memory to page through the messages of an author without sorting a
+ * single month: only the messages of the page are loaded.
+ */
+
+#include "apr.h"
+#include "apr_pools.h"
+#include "apr_tables.h"
+
+#include "mbox_parse.h"
+
+#define MBOX_AUTHOR_FILE "authors.idx"
+
+typedef struct mbox_author_index mbox_author_index_t;
+
+typedef struct mbox_author_writer mbox_author_writer_t;
+
+/* A message of an author */
+typedef struct mbox_author_posting
+{
+    const char *box;            /* Name of the mailbox */
+    apr_time_t date;
+    const char *msgID;
+} mbox_author_posting_t;
+
+/* Opens the index of the list in dir (with a trailing slash).  Returns
+ * APR_NOTFOUND if there is none.
+ */
+apr_status_t mbox_author_open(mbox_author_index_t **idx, apr_pool_t *p,
+                              const char *dir);
+
+/* Returns the number of messages of the author with the given key, and
+ * in *name (if not NULL) the display name of the newest one.  Returns 0
+ * for an author the index does not know.
+ */
+apr_uint32_t mbox_author_count(const mbox_author_index_t *idx,
+                               const char *key, const char **name);
+
+/* Returns in *postings (of mbox_author_posting_t) at most n messages of
+ * the author with the given key, from the first-th newest.
+ */
+void mbox_author_postings(apr_array_header_t **postings, apr_pool_t *p,
+                          const mbox_author_index_t *idx, const char *key,
+                          apr_uint32_t first, apr_uint32_t n);
+
+/* Starts updating the index of the list in dir.  Nothing replaces the
+ * current index until mbox_author_writer_commit().
+ */
+apr_status_t mbox_author_writer_create(mbox_author_writer_t **w,
+                                       apr_pool_t *p, const char *dir);
+
+/* Declares a mailbox of the list, at the given version of its message
+ * index (see mbox_index_stat()).  Returns 1 if the index already has its
+ * messages for that version; otherwise, they are to be added with
+ * mbox_author_writer_add().  The messages of the mailboxes that are not
+ * declared are removed.
+ */
+int mbox_author_writer_box(mbox_author_writer_t *w, const char *box,
+                           apr_time_t index_mtime, apr_off_t index_size);
+
+/* Adds a message of the mailbox. */
+void mbox_author_writer_add(mbox_author_writer_t *w, Message *m);
+
+/* Replaces the index with the one updated, if anything changed. */
+apr_status_t mbox_author_writer_commit(mbox_author_writer_t *w);
+
+#endif
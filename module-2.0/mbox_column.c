@@ -0,0 +1,965 @@
+/* Licensed to the Apache Software Foundation (ASF) under one or more
+ * contributor license agreements.  See the NOTICE file distributed with
+ * this work for additional information regarding copyright ownership.
+ * The ASF licenses this file to You under the Apache License, Version 2.0
+ * (the "License"); you may not use this file except in compliance with
+ * the License.  You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+/* Column files.
+ *
+ * The columns of a mailbox are a single file: a column_header, then one
+ * section per column, each an array with an entry per message:
+ *
+ *   dates     seconds from date_base, as 32-bit integers, in order
+ *   flags     MBOX_COLUMN_* bytes
+ *   authors   32-bit numbers of the author keys, in the order of the keys
+ *   subjects  offsets of the subjects in the subject heap, and one more
+ *             for its end
+ *   msgids    offsets of the Message-IDs in the strings
+ *
+ * followed by the author keys (offsets in the strings, sorted by the
+ * bytes of the keys), the subject heap (the subjects, as normalized by
+ * mbox_subject_normalize(), NUL terminated, in the order of the
+ * messages) and the strings.
+ *
+ * Filters narrow the messages down to those of the dates looked for
+ * with a binary search, and then scan the columns, ANDing the messages
+ * each predicate selects into a byte per message, 16 at a time with
+ * SSE2 when the compiler targets it.  Authors are selected as a range
+ * of numbers, which a prefix of their keys also is.  Subjects, the
+ * costliest, are only looked at for the messages left.
+ *
+ * Merges read several runs of messages, of different mailboxes, from
+ * the newest, through a heap of the newest message left in each: a page
+ * of n messages, after skip, costs (skip + n) log(runs).
+ *
+ * Statistics count the messages of each day, found with a binary search
+ * at each day's end, those that start a thread, 16 flags at a time with
+ * SSE2, and those of each author, by their number.
+ *
+ * Sections are aligned on 8 bytes and in the byte order of the host.
+ */
+
+#include "mbox_column.h"
+#include "mbox_mime.h"
+#include "mbox_subject.h"
+#include "mbox_view.h"
+
+#include "apr_file_io.h"
+#include "apr_hash.h"
+#include "apr_mmap.h"
+#include "apr_strings.h"
+
+#include <stdlib.h>
+#include <string.h>
+
+#if defined(__SSE2__)
+#include <emmintrin.h>
+#endif
+
+#define COLUMN_MAGIC "MBOXCOL1"
+#define COLUMN_VERSION 2
+
+#define COLUMN_PERMS (APR_FPROT_UREAD | APR_FPROT_UWRITE | \
+                      APR_FPROT_GREAD | APR_FPROT_WREAD)
+
+#define ALIGN8(n) (((n) + 7) & ~(apr_uint64_t) 7)
+
+typedef struct column_header
+{
+    char magic[8];
+    apr_uint32_t version;
+    apr_uint32_t nrows;
+    apr_uint32_t nauthors;
+    apr_uint32_t reserved;
+    apr_int64_t index_mtime;
+    apr_int64_t index_size;
+    apr_int64_t min_date;
+    apr_int64_t max_date;
+    apr_int64_t date_base;      /* min_date, to the second below */
+    apr_uint64_t dates_off;
+    apr_uint64_t flags_off;
+    apr_uint64_t authors_off;
+    apr_uint64_t subjects_off;
+    apr_uint64_t msgids_off;
+    apr_uint64_t keys_off;
+    apr_uint64_t heap_off;
+    apr_uint64_t heap_len;
+    apr_uint64_t strings_off;
+    apr_uint64_t strings_len;
+} column_header;
+
+struct mbox_column
+{
+    const column_header *h;
+    const apr_uint32_t *dates;
+    const unsigned char *flags;
+    const apr_uint32_t *authors;
+    const apr_uint32_t *subjects;
+    const apr_uint32_t *msgids;
+    const apr_uint32_t *keys;
+    const char *heap;
+    const char *strings;
+};
+
+struct mbox_column_writer
+{
+    apr_pool_t *pool;
+    apr_pool_t *tpool;
+    const char *path;
+    char *tmp;
+    apr_file_t *f;
+    column_header h;
+
+    apr_array_header_t *dates;  /* Of apr_time_t */
+    apr_array_header_t *flags;  /* Of unsigned char */
+    apr_array_header_t *authors;        /* Of const char *, from keys */
+    apr_array_header_t *subjects;       /* Of apr_uint32_t */
+    apr_array_header_t *msgids; /* Of apr_uint32_t */
+    apr_hash_t *keys;           /* Of their number, once sorted */
+    apr_hash_t *starts;         /* Message-IDs of the thread starts */
+    mbox_varbuf_t heap;
+    mbox_varbuf_t strings;
+};
+
+/* Sets where the sections of the columns described by h are. */
+static void column_layout(column_header *h)
+{
+    apr_uint64_t n = h->nrows;
+
+    h->dates_off = sizeof(column_header);
+    h->flags_off = h->dates_off + ALIGN8(n * sizeof(apr_uint32_t));
+    h->authors_off = h->flags_off + ALIGN8(n);
+    h->subjects_off = h->authors_off + ALIGN8(n * sizeof(apr_uint32_t));
+    h->msgids_off = h->subjects_off + ALIGN8((n + 1) * sizeof(apr_uint32_t));
+    h->keys_off = h->msgids_off + ALIGN8(n * sizeof(apr_uint32_t));
+    h->heap_off = h->keys_off
+        + ALIGN8((apr_uint64_t) h->nauthors * sizeof(apr_uint32_t));
+    h->strings_off = h->heap_off + h->heap_len;
+}
+
+/* Writer */
+
+static apr_uint32_t add_string(mbox_varbuf_t *vb, const char *s)
+{
+    apr_size_t off = vb->len;
+
+    if (!s)
+        s = "";
+    mbox_varbuf_strmemcat(vb, s, strlen(s) + 1);
+    return (apr_uint32_t) off;
+}
+
+/* Returns 1 if a part under m, other than body, is an attachment. */
+static int has_attachment(apr_pool_t *p, mbox_mime_message_t *m,
+                          mbox_mime_message_t *body)
+{
+    mbox_mime_message_t *part;
+    unsigned int i;
+
+    if (m->sub_count) {
+        for (i = 0; i < m->sub_count; i++) {
+            part = mbox_mime_get_part(p, m, i);
+            if (part && has_attachment(p, part, body))
+                return 1;
+        }
+        return 0;
+    }
+
+    return m != body
+        && ((m->content_disposition
+             && strncasecmp(m->content_disposition, "attachment",
+                            strlen("attachment")) == 0)
+            || m->content_name);
+}
+
+apr_status_t mbox_column_create(mbox_column_writer_t **wp, apr_pool_t *p,
+                                const char *path, apr_time_t index_mtime,
+                                apr_off_t index_size)
+{
+    mbox_column_writer_t *w;
+    apr_status_t rv;
+
+    w = apr_pcalloc(p, sizeof(mbox_column_writer_t));
+    w->pool = p;
+    w->path = apr_pstrcat(p, path, MBOX_COLUMN_SUFFIX, NULL);
+    w->tmp = apr_pstrcat(p, w->path, ".XXXXXX", NULL);
+
+    rv = apr_file_mktemp(&w->f, w->tmp, APR_CREATE | APR_WRITE | APR_EXCL
+                         | APR_BUFFERED, p);
+    if (rv != APR_SUCCESS)
+        return rv;
+
+    memcpy(w->h.magic, COLUMN_MAGIC, sizeof(w->h.magic));
+    w->h.version = COLUMN_VERSION;
+    w->h.index_mtime = index_mtime;
+    w->h.index_size = index_size;
+
+    w->dates = apr_array_make(p, 1024, sizeof(apr_time_t));
+    w->flags = apr_array_make(p, 1024, sizeof(unsigned char));
+    w->authors = apr_array_make(p, 1024, sizeof(const char *));
+    w->subjects = apr_array_make(p, 1024, sizeof(apr_uint32_t));
+    w->msgids = apr_array_make(p, 1024, sizeof(apr_uint32_t));
+    w->keys = apr_hash_make(p);
+    w->starts = apr_hash_make(p);
+    mbox_varbuf_init(p, &w->heap, 64 * 1024);
+    mbox_varbuf_init(p, &w->strings, 64 * 1024);
+    apr_pool_create(&w->tpool, p);
+
+    *wp = w;
+    return APR_SUCCESS;
+}
+
+void mbox_column_threads(mbox_column_writer_t *w, Container *threads)
+{
+    Container *c;
+    Message *m;
+
+    /* Threads without a first message start with a reply. */
+    for (c = threads; c; c = c->next) {
+        m = c->message ? c->message : c->child ? c->child->message : NULL;
+        if (m && m->msgID) {
+            apr_hash_set(w->starts, apr_pstrdup(w->pool, m->msgID),
+                         APR_HASH_KEY_STRING, "");
+        }
+    }
+}
+
+void mbox_column_add(mbox_column_writer_t *w, Message *m)
+{
+    const char *key = m->author_key ? m->author_key : "";
+    const char *interned;
+    unsigned char flags = 0;
+
+    apr_pool_clear(w->tpool);
+
+    if (m->mime_msg
+        && has_attachment(w->tpool, m->mime_msg,
+                          mbox_view_body_part(w->tpool, m->mime_msg))) {
+        flags |= MBOX_COLUMN_ATTACHMENT;
+    }
+    if (m->msgID && apr_hash_get(w->starts, m->msgID, APR_HASH_KEY_STRING)) {
+        flags |= MBOX_COLUMN_THREAD;
+    }
+
+    /* Keys are numbered once they are all known. */
+    interned = apr_hash_get(w->keys, key, APR_HASH_KEY_STRING);
+    if (!interned) {
+        interned = apr_pstrdup(w->pool, key);
+        apr_hash_set(w->keys, interned, APR_HASH_KEY_STRING, interned);
+    }
+
+    APR_ARRAY_PUSH(w->dates, apr_time_t) = m->date;
+    APR_ARRAY_PUSH(w->flags, unsigned char) = flags;
+    APR_ARRAY_PUSH(w->authors, const char *) = interned;
+    APR_ARRAY_PUSH(w->subjects, apr_uint32_t) =
+        add_string(&w->heap,
+                   mbox_subject_normalize(w->tpool, m->utf8_subject
+                                          ? m->utf8_subject : m->subject));
+    APR_ARRAY_PUSH(w->msgids, apr_uint32_t) = add_string(&w->strings,
+                                                         m->msgID);
+}
+
+static int key_cmp(const void *a, const void *b)
+{
+    return strcmp(*(const char * const *) a, *(const char * const *) b);
+}
+
+/* Writes a section, padded to 8 bytes. */
+static apr_status_t write_section(apr_file_t *f, const void *data,
+                                  apr_size_t len)
+{
+    static const char pad[8] = { 0 };
+    apr_size_t n;
+    apr_status_t rv = APR_SUCCESS;
+
+    if (len)
+        rv = apr_file_write_full(f, data, len, &n);
+    if (rv == APR_SUCCESS && len % 8)
+        rv = apr_file_write_full(f, pad, 8 - len % 8, &n);
+    return rv;
+}
+
+apr_status_t mbox_column_commit(mbox_column_writer_t *w)
+{
+    apr_uint32_t n = w->dates->nelts, i;
+    apr_uint32_t *dates, *authors, *keys, *subjects;
+    apr_uint32_t *numbers;
+    const char **sorted;
+    apr_hash_index_t *hi;
+    apr_time_t *d = (apr_time_t *) w->dates->elts;
+    apr_size_t nkeys;
+    apr_status_t rv;
+
+    /* Keys are numbered in their order, so that a prefix is a range. */
+    nkeys = apr_hash_count(w->keys);
+    sorted = apr_palloc(w->pool, (nkeys + 1) * sizeof(const char *));
+    i = 0;
+    for (hi = apr_hash_first(w->pool, w->keys); hi; hi = apr_hash_next(hi)) {
+        const void *key;
+
+        apr_hash_this(hi, &key, NULL, NULL);
+        sorted[i++] = key;
+    }
+    qsort(sorted, nkeys, sizeof(const char *), key_cmp);
+
+    numbers = apr_palloc(w->pool, (nkeys + 1) * sizeof(apr_uint32_t));
+    keys = apr_palloc(w->pool, (nkeys + 1) * sizeof(apr_uint32_t));
+    for (i = 0; i < nkeys; i++) {
+        numbers[i] = i;
+        apr_hash_set(w->keys, sorted[i], APR_HASH_KEY_STRING, &numbers[i]);
+        keys[i] = add_string(&w->strings, sorted[i]);
+    }
+
+    for (i = 0; i < n; i++) {
+        if (!i || d[i] < w->h.min_date)
+            w->h.min_date = d[i];
+        if (!i || d[i] > w->h.max_date)
+            w->h.max_date = d[i];
+    }
+    w->h.date_base = w->h.min_date - w->h.min_date % APR_USEC_PER_SEC;
+    if (w->h.date_base > w->h.min_date)
+        w->h.date_base -= APR_USEC_PER_SEC;
+
+    dates = apr_palloc(w->pool, (n + 1) * sizeof(apr_uint32_t));
+    authors = apr_palloc(w->pool, (n + 1) * sizeof(apr_uint32_t));
+    for (i = 0; i < n; i++) {
+        apr_uint64_t s = (d[i] - w->h.date_base) / APR_USEC_PER_SEC;
+
+        dates[i] = s > APR_UINT32_MAX ? APR_UINT32_MAX : (apr_uint32_t) s;
+        authors[i] = *(apr_uint32_t *)
+            apr_hash_get(w->keys, APR_ARRAY_IDX(w->authors, i, const char *),
+                         APR_HASH_KEY_STRING);
+    }
+
+    /* The end of the last subject */
+    APR_ARRAY_PUSH(w->subjects, apr_uint32_t) = w->heap.len;
+    subjects = (apr_uint32_t *) w->subjects->elts;
+
+    while (w->heap.len % 8)
+        mbox_varbuf_strmemcat(&w->heap, "", 1);
+    while (w->strings.len % 8)
+        mbox_varbuf_strmemcat(&w->strings, "", 1);
+
+    if (w->heap.len > APR_UINT32_MAX || w->strings.len > APR_UINT32_MAX) {
+        mbox_column_abort(w);
+        return APR_ENOSPC;
+    }
+
+    w->h.nrows = n;
+    w->h.nauthors = nkeys;
+    w->h.heap_len = w->heap.len;
+    w->h.strings_len = w->strings.len;
+    column_layout(&w->h);
+
+    rv = write_section(w->f, &w->h, sizeof(column_header));
+    if (rv == APR_SUCCESS)
+        rv = write_section(w->f, dates, n * sizeof(apr_uint32_t));
+    if (rv == APR_SUCCESS)
+        rv = write_section(w->f, w->flags->elts, n);
+    if (rv == APR_SUCCESS)
+        rv = write_section(w->f, authors, n * sizeof(apr_uint32_t));
+    if (rv == APR_SUCCESS)
+        rv = write_section(w->f, subjects, (n + 1) * sizeof(apr_uint32_t));
+    if (rv == APR_SUCCESS)
+        rv = write_section(w->f, w->msgids->elts, n * sizeof(apr_uint32_t));
+    if (rv == APR_SUCCESS)
+        rv = write_section(w->f, keys, nkeys * sizeof(apr_uint32_t));
+    if (rv == APR_SUCCESS)
+        rv = write_section(w->f, w->heap.buf, w->heap.len);
+    if (rv == APR_SUCCESS)
+        rv = write_section(w->f, w->strings.buf, w->strings.len);
+
+    if (rv == APR_SUCCESS)
+        rv = apr_file_close(w->f);
+    else
+        apr_file_close(w->f);
+    w->f = NULL;
+    if (rv == APR_SUCCESS) {
+        /* Temporary files are only readable by their owner. */
+        apr_file_perms_set(w->tmp, COLUMN_PERMS);
+        rv = apr_file_rename(w->tmp, w->path, w->pool);
+    }
+    if (rv != APR_SUCCESS) {
+        mbox_column_abort(w);
+        return rv;
+    }
+
+    w->tmp = NULL;
+    return APR_SUCCESS;
+}
+
+void mbox_column_abort(mbox_column_writer_t *w)
+{
+    if (w->f) {
+        apr_file_close(w->f);
+        w->f = NULL;
+    }
+    if (w->tmp) {
+        apr_file_remove(w->tmp, w->pool);
+        w->tmp = NULL;
+    }
+}
+
+/* Reader */
+
+apr_status_t mbox_column_open(mbox_column_t **colsp, apr_pool_t *p,
+                              const char *path)
+{
+    mbox_column_t *cols;
+    apr_file_t *f;
+    apr_finfo_t finfo;
+    apr_mmap_t *mm;
+    const column_header *h;
+    column_header layout;
+    const apr_uint32_t *subjects;
+    const char *base;
+    apr_uint64_t size;
+    apr_uint32_t i;
+    apr_status_t rv;
+
+    rv = apr_file_open(&f, apr_pstrcat(p, path, MBOX_COLUMN_SUFFIX, NULL),
+                       APR_READ, APR_OS_DEFAULT, p);
+    if (rv != APR_SUCCESS)
+        return APR_STATUS_IS_ENOENT(rv) ? APR_NOTFOUND : rv;
+
+    rv = apr_file_info_get(&finfo, APR_FINFO_SIZE, f);
+    if (rv == APR_SUCCESS && finfo.size < (apr_off_t) sizeof(column_header))
+        rv = APR_EGENERAL;
+    if (rv == APR_SUCCESS)
+        rv = apr_mmap_create(&mm, f, 0, finfo.size, APR_MMAP_READ, p);
+    apr_file_close(f);
+    if (rv != APR_SUCCESS)
+        return rv;
+
+    base = mm->mm;
+    size = finfo.size;
+    h = (const column_header *) base;
+
+    /* Columns of an older format are written again by mod-mbox-util. */
+    if (memcmp(h->magic, COLUMN_MAGIC, sizeof(h->magic)) == 0
+        && h->version != COLUMN_VERSION) {
+        apr_mmap_delete(mm);
+        return APR_NOTFOUND;
+    }
+
+    /* Everything the columns point to must be within them. */
+    layout = *h;
+    column_layout(&layout);
+    if (memcmp(h->magic, COLUMN_MAGIC, sizeof(h->magic)) != 0
+        || memcmp(&layout, h, sizeof(column_header)) != 0
+        || h->heap_len % 8 || h->strings_len % 8
+        || h->heap_off > size || h->heap_len > size - h->heap_off
+        || h->strings_len > size - h->strings_off
+        || (h->heap_len && base[h->heap_off + h->heap_len - 1])
+        || (h->strings_len && base[h->strings_off + h->strings_len - 1])
+        || (!h->strings_len && h->nrows)) {
+        apr_mmap_delete(mm);
+        return APR_EGENERAL;
+    }
+
+    /* Subjects are searched in the heap, from one offset to the next. */
+    subjects = (const apr_uint32_t *) (base + h->subjects_off);
+    for (i = 0; i < h->nrows; i++) {
+        if (subjects[i] >= subjects[i + 1])
+            break;
+    }
+    if (i < h->nrows || subjects[h->nrows] > h->heap_len) {
+        apr_mmap_delete(mm);
+        return APR_EGENERAL;
+    }
+
+    cols = apr_pcalloc(p, sizeof(mbox_column_t));
+    cols->h = h;
+    cols->dates = (const apr_uint32_t *) (base + h->dates_off);
+    cols->flags = (const unsigned char *) base + h->flags_off;
+    cols->authors = (const apr_uint32_t *) (base + h->authors_off);
+    cols->subjects = subjects;
+    cols->msgids = (const apr_uint32_t *) (base + h->msgids_off);
+    cols->keys = (const apr_uint32_t *) (base + h->keys_off);
+    cols->heap = base + h->heap_off;
+    cols->strings = base + h->strings_off;
+
+    *colsp = cols;
+    return APR_SUCCESS;
+}
+
+int mbox_column_matches(const mbox_column_t *cols, apr_time_t index_mtime,
+                        apr_off_t index_size)
+{
+    return cols->h->index_mtime == index_mtime
+        && cols->h->index_size == index_size;
+}
+
+apr_status_t mbox_column_open_current(mbox_column_t **cols, apr_pool_t *p,
+                                      const char *path)
+{
+    apr_finfo_t finfo;
+    apr_status_t rv;
+
+    rv = mbox_index_stat_path(p, path, &finfo);
+    if (rv != APR_SUCCESS)
+        return APR_STATUS_IS_ENOENT(rv) ? APR_NOTFOUND : rv;
+
+    rv = mbox_column_open(cols, p, path);
+    if (rv != APR_SUCCESS)
+        return rv;
+
+    if (!mbox_column_matches(*cols, finfo.mtime, finfo.size))
+        return APR_NOTFOUND;
+
+    return APR_SUCCESS;
+}
+
+apr_uint32_t mbox_column_count(const mbox_column_t *cols)
+{
+    return cols->h->nrows;
+}
+
+static const char *column_string(const mbox_column_t *cols,
+                                 apr_uint32_t off)
+{
+    return off < cols->h->strings_len ? cols->strings + off : "";
+}
+
+const char *mbox_column_msgid(const mbox_column_t *cols,
+                              apr_uint32_t ordinal)
+{
+    if (ordinal >= cols->h->nrows)
+        return "";
+    return column_string(cols, cols->msgids[ordinal]);
+}
+
+/* Filters */
+
+/* Returns the first message sent at sec or later. */
+static apr_uint32_t date_lower(const mbox_column_t *cols, apr_uint64_t sec)
+{
+    apr_uint32_t lo = 0, hi = cols->h->nrows, mid;
+
+    while (lo < hi) {
+        mid = lo + (hi - lo) / 2;
+        if (cols->dates[mid] < sec)
+            lo = mid + 1;
+        else
+            hi = mid;
+    }
+    return lo;
+}
+
+/* Seconds from the base of the dates to t, rounded up. */
+static apr_uint64_t date_seconds(const mbox_column_t *cols, apr_time_t t)
+{
+    if (t <= cols->h->date_base)
+        return 0;
+    return (t - cols->h->date_base + APR_USEC_PER_SEC - 1) / APR_USEC_PER_SEC;
+}
+
+/* Compares the key of an author to what is looked for. */
+static int author_cmp(const mbox_column_t *cols, apr_uint32_t i,
+                      const char *author, apr_size_t len, int prefix)
+{
+    const char *key = column_string(cols, cols->keys[i]);
+
+    return prefix ? strncmp(key, author, len) : strcmp(key, author);
+}
+
+/* Returns the first author comparing above (or, if 'above' is 0, not
+ * below) what is looked for.
+ */
+static apr_uint32_t author_bound(const mbox_column_t *cols,
+                                 const char *author, apr_size_t len,
+                                 int prefix, int above)
+{
+    apr_uint32_t lo = 0, hi = cols->h->nauthors, mid;
+    int cmp;
+
+    while (lo < hi) {
+        mid = lo + (hi - lo) / 2;
+        cmp = author_cmp(cols, mid, author, len, prefix);
+        if (cmp < 0 || (above && cmp == 0))
+            lo = mid + 1;
+        else
+            hi = mid;
+    }
+    return lo;
+}
+
+/* Keeps the messages whose value is in [lo, hi). */
+static void select_range(unsigned char *sel, const apr_uint32_t *col,
+                         apr_size_t n, apr_uint32_t lo, apr_uint32_t hi)
+{
+    /* lo <= v < hi is (v - lo) < (hi - lo), unsigned. */
+    apr_uint32_t width = hi - lo;
+    apr_size_t i = 0;
+
+#if defined(__SSE2__)
+    {
+        /* SSE2 only compares signed integers: the sign bit is flipped. */
+        const __m128i bias = _mm_set1_epi32((int) 0x80000000);
+        const __m128i vlo = _mm_set1_epi32((int) lo);
+        const __m128i vwidth = _mm_set1_epi32((int) (width ^ 0x80000000));
+        __m128i m[4], v;
+        int j;
+
+        while (i + 16 <= n) {
+            for (j = 0; j < 4; j++) {
+                v = _mm_loadu_si128((const __m128i *) (col + i + 4 * j));
+                v = _mm_xor_si128(_mm_sub_epi32(v, vlo), bias);
+                m[j] = _mm_cmplt_epi32(v, vwidth);
+            }
+            v = _mm_packs_epi16(_mm_packs_epi32(m[0], m[1]),
+                                _mm_packs_epi32(m[2], m[3]));
+            v = _mm_and_si128(v, _mm_loadu_si128((const __m128i *) (sel + i)));
+            _mm_storeu_si128((__m128i *) (sel + i), v);
+            i += 16;
+        }
+    }
+#endif
+
+    for (; i < n; i++) {
+        sel[i] &= (unsigned char) -(col[i] - lo < width);
+    }
+}
+
+/* Keeps the messages that have all the flags in mask. */
+static void select_flags(unsigned char *sel, const unsigned char *col,
+                         apr_size_t n, unsigned char mask)
+{
+    apr_size_t i = 0;
+
+#if defined(__SSE2__)
+    {
+        const __m128i vmask = _mm_set1_epi8((char) mask);
+        __m128i v;
+
+        while (i + 16 <= n) {
+            v = _mm_loadu_si128((const __m128i *) (col + i));
+            v = _mm_cmpeq_epi8(_mm_and_si128(v, vmask), vmask);
+            v = _mm_and_si128(v, _mm_loadu_si128((const __m128i *) (sel + i)));
+            _mm_storeu_si128((__m128i *) (sel + i), v);
+            i += 16;
+        }
+    }
+#endif
+
+    for (; i < n; i++) {
+        sel[i] &= (unsigned char) -((col[i] & mask) == mask);
+    }
+}
+
+/* Appends the ordinals of the messages selected, from first. */
+static void collect(apr_array_header_t *ordinals, const unsigned char *sel,
+                    apr_size_t n, apr_uint32_t first)
+{
+    apr_size_t i = 0;
+
+#if defined(__SSE2__)
+    {
+        int mask, j;
+
+        /* Runs of messages left out are skipped 16 at a time. */
+        while (i + 16 <= n) {
+            mask = _mm_movemask_epi8(_mm_loadu_si128((const __m128i *)
+                                                     (sel + i)));
+            for (j = 0; mask; j++, mask >>= 1) {
+                if (mask & 1)
+                    APR_ARRAY_PUSH(ordinals, apr_uint32_t) = first + i + j;
+            }
+            i += 16;
+        }
+    }
+#endif
+
+    for (; i < n; i++) {
+        if (sel[i])
+            APR_ARRAY_PUSH(ordinals, apr_uint32_t) = first + i;
+    }
+}
+
+void mbox_column_range(const mbox_column_t *cols, apr_time_t after,
+                       apr_time_t before, apr_uint32_t *begin,
+                       apr_uint32_t *end)
+{
+    const column_header *h = cols->h;
+
+    /* Messages are in the order of their dates. */
+    *begin = 0;
+    *end = h->nrows;
+    if (after) {
+        *begin = after > h->max_date ? h->nrows
+            : date_lower(cols, date_seconds(cols, after));
+    }
+    if (before) {
+        *end = before <= h->min_date ? 0
+            : date_lower(cols, date_seconds(cols, before));
+    }
+    if (*end < *begin)
+        *end = *begin;
+}
+
+void mbox_column_filter(apr_array_header_t **ordinals, apr_pool_t *p,
+                        const mbox_column_t *cols, const mbox_filter_t *f)
+{
+    apr_uint32_t begin, end, lo, hi, i;
+    unsigned char *sel;
+    apr_size_t n, len;
+
+    *ordinals = apr_array_make(p, 16, sizeof(apr_uint32_t));
+
+    mbox_column_range(cols, f->after, f->before, &begin, &end);
+    if (begin >= end)
+        return;
+
+    n = end - begin;
+    sel = apr_palloc(p, n);
+    memset(sel, 0xff, n);
+
+    if (f->flags) {
+        select_flags(sel, cols->flags + begin, n, (unsigned char) f->flags);
+    }
+
+    if (f->author) {
+        len = strlen(f->author);
+        lo = author_bound(cols, f->author, len, f->author_prefix, 0);
+        hi = author_bound(cols, f->author, len, f->author_prefix, 1);
+        if (lo >= hi)
+            return;
+        select_range(sel, cols->authors + begin, n, lo, hi);
+    }
+
+    if (f->subject && *f->subject) {
+        for (i = 0; i < n; i++) {
+            if (sel[i] && !strstr(cols->heap + cols->subjects[begin + i],
+                                  f->subject)) {
+                sel[i] = 0;
+            }
+        }
+    }
+
+    collect(*ordinals, sel, n, begin);
+}
+
+/* Merges */
+
+/* The newest message of a run left */
+typedef struct merge_head
+{
+    apr_int64_t sec;            /* Its date, in seconds */
+    int run;
+    apr_uint32_t ordinal;
+} merge_head;
+
+static apr_int64_t column_seconds(const mbox_column_t *cols,
+                                  apr_uint32_t ordinal)
+{
+    return cols->h->date_base / APR_USEC_PER_SEC + cols->dates[ordinal];
+}
+
+/* Newer messages come first, and those of earlier runs on ties. */
+static int merge_before(const merge_head *a, const merge_head *b)
+{
+    return a->sec > b->sec || (a->sec == b->sec && a->run < b->run);
+}
+
+/* Moves the head at i down the heap of n heads, to its place. */
+static void merge_sift(merge_head *heap, int n, int i)
+{
+    merge_head top = heap[i];
+    int child;
+
+    while ((child = 2 * i + 1) < n) {
+        if (child + 1 < n && merge_before(&heap[child + 1], &heap[child]))
+            child++;
+        if (!merge_before(&heap[child], &top))
+            break;
+        heap[i] = heap[child];
+        i = child;
+    }
+    heap[i] = top;
+}
+
+void mbox_column_merge(apr_array_header_t **picks, apr_pool_t *p,
+                       const mbox_column_run_t *runs, int nruns,
+                       apr_uint32_t skip, apr_uint32_t n)
+{
+    merge_head *heap, *top;
+    mbox_column_pick_t *pick;
+    apr_uint32_t picked = 0;
+    int len = 0, i;
+
+    *picks = apr_array_make(p, n ? (int) n : 1, sizeof(mbox_column_pick_t));
+
+    /* Each run is read from its end, its newest message. */
+    heap = apr_palloc(p, (nruns ? nruns : 1) * sizeof(merge_head));
+    for (i = 0; i < nruns; i++) {
+        if (runs[i].begin < runs[i].end
+            && runs[i].end <= runs[i].cols->h->nrows) {
+            heap[len].run = i;
+            heap[len].ordinal = runs[i].end - 1;
+            heap[len].sec = column_seconds(runs[i].cols, heap[len].ordinal);
+            len++;
+        }
+    }
+    for (i = len / 2 - 1; i >= 0; i--) {
+        merge_sift(heap, len, i);
+    }
+
+    top = heap;
+    while (len && picked < n) {
+        if (skip) {
+            skip--;
+        }
+        else {
+            pick = apr_array_push(*picks);
+            pick->run = top->run;
+            pick->ordinal = top->ordinal;
+            picked++;
+        }
+
+        if (top->ordinal > runs[top->run].begin) {
+            top->ordinal--;
+            top->sec = column_seconds(runs[top->run].cols, top->ordinal);
+        }
+        else {
+            *top = heap[--len];
+        }
+        merge_sift(heap, len, 0);
+    }
+}
+
+/* Statistics */
+
+/* Returns the number of messages that have all the flags in mask. */
+static apr_uint32_t count_flags(const unsigned char *col, apr_size_t n,
+                                unsigned char mask)
+{
+    apr_uint32_t count = 0;
+    apr_size_t i = 0;
+
+#if defined(__SSE2__)
+    {
+        const __m128i vmask = _mm_set1_epi8((char) mask);
+        const __m128i zero = _mm_setzero_si128();
+        __m128i acc, v;
+        int k;
+
+        /* Byte counters hold up to 255 matches: they are added up
+           every 255 blocks. */
+        while (i + 16 <= n) {
+            acc = zero;
+            for (k = 0; k < 255 && i + 16 <= n; k++, i += 16) {
+                v = _mm_loadu_si128((const __m128i *) (col + i));
+                v = _mm_cmpeq_epi8(_mm_and_si128(v, vmask), vmask);
+                acc = _mm_sub_epi8(acc, v);
+            }
+            acc = _mm_sad_epu8(acc, zero);
+            count += (apr_uint32_t) (_mm_cvtsi128_si32(acc)
+                                     + _mm_cvtsi128_si32(_mm_srli_si128(acc,
+                                                                        8)));
+        }
+    }
+#endif
+
+    for (; i < n; i++) {
+        count += (col[i] & mask) == mask;
+    }
+    return count;
+}
+
+/* Counts the messages of each author in counts, of nauthors + 1: the
+ * last one counts the numbers out of range.  Four tables are filled in
+ * turn, so that the messages of an author in a row do not wait on each
+ * other.
+ */
+static void count_authors(apr_uint32_t *counts, apr_uint32_t *lanes,
+                          const apr_uint32_t *col, apr_size_t n,
+                          apr_uint32_t nauthors)
+{
+    apr_uint32_t *l0 = lanes, *l1 = l0 + nauthors + 1;
+    apr_uint32_t *l2 = l1 + nauthors + 1, *l3 = l2 + nauthors + 1;
+    apr_uint32_t a;
+    apr_size_t i = 0;
+
+    memset(lanes, 0, 4 * (nauthors + 1) * sizeof(apr_uint32_t));
+
+#define AUTHOR_NUMBER(v) ((v) < nauthors ? (v) : nauthors)
+    for (; i + 4 <= n; i += 4) {
+        l0[AUTHOR_NUMBER(col[i])]++;
+        l1[AUTHOR_NUMBER(col[i + 1])]++;
+        l2[AUTHOR_NUMBER(col[i + 2])]++;
+        l3[AUTHOR_NUMBER(col[i + 3])]++;
+    }
+    for (; i < n; i++) {
+        l0[AUTHOR_NUMBER(col[i])]++;
+    }
+#undef AUTHOR_NUMBER
+
+    for (a = 0; a <= nauthors; a++) {
+        counts[a] = l0[a] + l1[a] + l2[a] + l3[a];
+    }
+}
+
+void mbox_column_stats(mbox_column_stats_t **statsp, apr_pool_t *p,
+                       const mbox_column_t *cols)
+{
+    const column_header *h = cols->h;
+    mbox_column_stats_t *stats;
+    apr_uint32_t *counts, *lanes, i, next, a;
+    apr_int64_t base = h->date_base / APR_USEC_PER_SEC, day;
+    apr_pool_t *tpool;
+
+    stats = apr_pcalloc(p, sizeof(mbox_column_stats_t));
+    stats->messages = h->nrows;
+    stats->threads = count_flags(cols->flags, h->nrows, MBOX_COLUMN_THREAD);
+    stats->days = apr_array_make(p, 32, sizeof(mbox_column_day_t));
+    stats->posters = apr_array_make(p, h->nauthors + 1,
+                                    sizeof(mbox_column_poster_t));
+
+    /* Messages are in the order of their dates: each day ends where the
+       next one starts. */
+    for (i = 0; i < h->nrows; i = next) {
+        mbox_column_day_t *d;
+        apr_int64_t sec = base + cols->dates[i], end;
+
+        /* Rounded down, before 1970 too */
+        day = sec / MBOX_COLUMN_DAY - (sec < 0 && sec % MBOX_COLUMN_DAY);
+        end = (day + 1) * MBOX_COLUMN_DAY - base;
+        next = end > (apr_int64_t) APR_UINT32_MAX ? h->nrows
+            : date_lower(cols, (apr_uint64_t) end);
+        if (next <= i) {
+            next = i + 1;
+        }
+
+        d = apr_array_push(stats->days);
+        d->day = apr_time_from_sec(day * MBOX_COLUMN_DAY);
+        d->count = next - i;
+    }
+
+    apr_pool_create(&tpool, p);
+    counts = apr_palloc(tpool, (h->nauthors + 1) * sizeof(apr_uint32_t));
+    lanes = apr_palloc(tpool, 4 * (h->nauthors + 1) * sizeof(apr_uint32_t));
+    count_authors(counts, lanes, cols->authors, h->nrows, h->nauthors);
+    for (a = 0; a < h->nauthors; a++) {
+        mbox_column_poster_t *poster;
+
+        if (!counts[a]) {
+            continue;
+        }
+        poster = apr_array_push(stats->posters);
+        poster->author = apr_pstrdup(p, column_string(cols, cols->keys[a]));
+        poster->count = counts[a];
+    }
+    apr_pool_destroy(tpool);
+
+    *statsp = stats;
+}
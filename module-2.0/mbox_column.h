@@ -0,0 +1,182 @@
+/* Licensed to the Apache Software Foundation (ASF) under one or more
+ * contributor license agreements.  See the NOTICE file distributed with
+ * this work for additional information regarding copyright ownership.
+ * The ASF licenses this file to You under the Apache License, Version 2.0
+ * (the "License"); you may not use this file except in compliance with
+ * the License.  You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef MBOX_COLUMN_H
+#define MBOX_COLUMN_H
+
+/*
+ * Column files.  mod-mbox-util writes, next to each mailbox, the fields
+ * messages are filtered on as columns: one value per message, in the
+ * order of their dates, so that a message is known by its position (its
+ * ordinal, as in the Message-ID index).  Filters scan the columns the
+ * module maps in memory, and return the ordinals of the messages that
+ * match; only those are then loaded from the message index.  The same
+ * columns give the activity of the month: its messages by day, by
+ * author, and the threads started, and, merged with those of other
+ * months, the messages of several months in the order of their dates.
+ */
+
+#include "apr.h"
+#include "apr_pools.h"
+#include "apr_tables.h"
+
+#include "mbox_parse.h"
+
+#define MBOX_COLUMN_SUFFIX ".cols"
+
+/* Flags of a message */
+#define MBOX_COLUMN_ATTACHMENT 0x01     /* Has a part that is not shown
+                                           inline */
+#define MBOX_COLUMN_THREAD 0x02         /* Starts a thread */
+
+/* Seconds in a day, of the statistics */
+#define MBOX_COLUMN_DAY 86400
+
+typedef struct mbox_column mbox_column_t;
+
+typedef struct mbox_column_writer mbox_column_writer_t;
+
+/* What the messages looked for match.  Dates are compared to the
+ * second.
+ */
+typedef struct mbox_filter
+{
+    apr_time_t after;           /* From then on, if not 0 */
+    apr_time_t before;          /* Until then, excluded, if not 0 */
+    const char *author;         /* Author key (see mbox_author_fold()),
+                                   or NULL */
+    int author_prefix;          /* Keys that start with author match */
+    const char *subject;        /* Found in the subject, as normalized by
+                                   mbox_subject_normalize(), or NULL */
+    int flags;                  /* MBOX_COLUMN_* the messages all have */
+} mbox_filter_t;
+
+/* Messages of a day */
+typedef struct mbox_column_day
+{
+    apr_time_t day;             /* Its start, in GMT */
+    apr_uint32_t count;
+} mbox_column_day_t;
+
+/* Messages of an author */
+typedef struct mbox_column_poster
+{
+    const char *author;         /* Author key */
+    apr_uint32_t count;
+} mbox_column_poster_t;
+
+/* Messages of a mailbox, from begin to end (excluded) */
+typedef struct mbox_column_run
+{
+    const mbox_column_t *cols;
+    apr_uint32_t begin;
+    apr_uint32_t end;
+} mbox_column_run_t;
+
+/* A message of a merge */
+typedef struct mbox_column_pick
+{
+    int run;                    /* Of the runs merged */
+    apr_uint32_t ordinal;
+} mbox_column_pick_t;
+
+/* Activity of a mailbox */
+typedef struct mbox_column_stats
+{
+    apr_uint32_t messages;
+    apr_uint32_t threads;       /* Started */
+    apr_array_header_t *days;   /* Of mbox_column_day_t, the days with
+                                   messages, in order */
+    apr_array_header_t *posters;        /* Of mbox_column_poster_t, in the
+                                           order of the keys */
+} mbox_column_stats_t;
+
+/* Opens the columns of the mailbox at path.  Returns APR_NOTFOUND if
+ * there are none, or only of an older format.
+ */
+apr_status_t mbox_column_open(mbox_column_t **cols, apr_pool_t *p,
+                              const char *path);
+
+/* Returns 1 if the columns were written from the given version of the
+ * message index (see mbox_index_stat()).
+ */
+int mbox_column_matches(const mbox_column_t *cols, apr_time_t index_mtime,
+                        apr_off_t index_size);
+
+/* Opens the columns of the mailbox at path, as mbox_column_open(), if
+ * they were written from its current message index.  Returns
+ * APR_NOTFOUND if they were not: their rows are not those of the index.
+ */
+apr_status_t mbox_column_open_current(mbox_column_t **cols, apr_pool_t *p,
+                                      const char *path);
+
+/* Returns the number of messages, and the Message-ID of one. */
+apr_uint32_t mbox_column_count(const mbox_column_t *cols);
+const char *mbox_column_msgid(const mbox_column_t *cols,
+                              apr_uint32_t ordinal);
+
+/* Returns in *ordinals (of apr_uint32_t, in order) the messages that
+ * match f.
+ */
+void mbox_column_filter(apr_array_header_t **ordinals, apr_pool_t *p,
+                        const mbox_column_t *cols, const mbox_filter_t *f);
+
+/* Returns in *begin and *end the messages from after (if not 0) until
+ * before (excluded, if not 0), as in mbox_column_filter().
+ */
+void mbox_column_range(const mbox_column_t *cols, apr_time_t after,
+                       apr_time_t before, apr_uint32_t *begin,
+                       apr_uint32_t *end);
+
+/* Returns in *picks (of mbox_column_pick_t) at most n messages of the
+ * runs, newest first, after the skip newest.  Messages of the same
+ * second are taken from the earlier runs first.
+ */
+void mbox_column_merge(apr_array_header_t **picks, apr_pool_t *p,
+                       const mbox_column_run_t *runs, int nruns,
+                       apr_uint32_t skip, apr_uint32_t n);
+
+/* Returns in *stats the activity of the mailbox, allocated in p: it
+ * does not refer to the columns.
+ */
+void mbox_column_stats(mbox_column_stats_t **stats, apr_pool_t *p,
+                       const mbox_column_t *cols);
+
+/* Starts writing the columns of the mailbox at path.  Nothing replaces
+ * the current ones (if any) until mbox_column_commit().
+ */
+apr_status_t mbox_column_create(mbox_column_writer_t **w, apr_pool_t *p,
+                                const char *path, apr_time_t index_mtime,
+                                apr_off_t index_size);
+
+/* Tells which messages start a thread: the roots of threads, as
+ * calculate_threads() returns them.  To be called before they are
+ * added.
+ */
+void mbox_column_threads(mbox_column_writer_t *w, Container *threads);
+
+/* Adds m, after those of earlier dates.  Its MIME structure tells
+ * whether it has attachments, if it is set.
+ */
+void mbox_column_add(mbox_column_writer_t *w, Message *m);
+
+/* Replaces the current columns with those written. */
+apr_status_t mbox_column_commit(mbox_column_writer_t *w);
+
+/* Throws the columns written away. */
+void mbox_column_abort(mbox_column_writer_t *w);
+
+#endif
@@ -0,0 +1,856 @@
+/* Licensed to the Apache Software Foundation (ASF) under one or more
+ * contributor license agreements.  See the NOTICE file distributed with
+ * this work for additional information regarding copyright ownership.
+ * The ASF licenses this file to You under the Apache License, Version 2.0
+ * (the "License"); you may not use this file except in compliance with
+ * the License.  You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+/* Decoding common Content-Encodings of E-Mail functions.
+ *
+ * These decoding functions do not copy data.  They are shared between
+ * the module and mod-mbox-util, so they must not depend on the httpd
+ * core.
+ */
+
+#include "mbox_cte.h"
+#include "mbox_utf8.h"
+
+#include "apr_strings.h"
+#include "apr_lib.h"
+#include "apr_xlate.h"
+#include "apr_thread_proc.h"
+
+#include <ctype.h>
+#include <string.h>
+
+void mbox_varbuf_init(apr_pool_t *p, mbox_varbuf_t *vb, apr_size_t size)
+{
+    vb->pool = p;
+    vb->len = 0;
+    vb->avail = size < 64 ? 64 : size;
+    vb->buf = apr_palloc(p, vb->avail + 1);
+    vb->buf[0] = '\0';
+}
+
+void mbox_varbuf_grow(mbox_varbuf_t *vb, apr_size_t size)
+{
+    char *nbuf;
+    apr_size_t navail = vb->avail;
+
+    if (size <= vb->avail)
+        return;
+
+    while (navail < size)
+        navail *= 2;
+
+    nbuf = apr_palloc(vb->pool, navail + 1);
+    memcpy(nbuf, vb->buf, vb->len + 1);
+    vb->buf = nbuf;
+    vb->avail = navail;
+}
+
+void mbox_varbuf_strmemcat(mbox_varbuf_t *vb, const char *s, apr_size_t len)
+{
+    mbox_varbuf_grow(vb, vb->len + len);
+    memcpy(vb->buf + vb->len, s, len);
+    vb->len += len;
+    vb->buf[vb->len] = '\0';
+}
+
+/*
+ * The char64 macro and `mime_decode_b64' routine are taken from
+ * metamail 2.7, which is copyright (c) 1991 Bell Communications
+ * Research, Inc. (Bellcore).  The following license applies to all
+ * code below this point:
+ *
+ * Permission to use, copy, modify, and distribute this material
+ * for any purpose and without fee is hereby granted, provided
+ * that the above copyright notice and this permission notice
+ * appear in all copies, and that the name of Bellcore not be
+ * used in advertising or publicity pertaining to this
+ * material without the specific, prior written permission
+ * of an authorized representative of Bellcore.  BELLCORE
+ * MAKES NO REPRESENTATIONS ABOUT THE ACCURACY OR SUITABILITY
+ * OF THIS MATERIAL FOR ANY PURPOSE.  IT IS PROVIDED "AS IS",
+ * WITHOUT ANY EXPRESS OR IMPLIED WARRANTIES.
+ */
+
+static char index_64[128] = {
+    -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1,
+    -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1,
+    -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, 62, -1, -1, -1, 63,
+    52, 53, 54, 55, 56, 57, 58, 59, 60, 61, -1, -1, -1, -1, -1, -1,
+    -1, 0, 1, 2, 3, 4, 5, 6, 7, 8, 9, 10, 11, 12, 13, 14,
+    15, 16, 17, 18, 19, 20, 21, 22, 23, 24, 25, -1, -1, -1, -1, -1,
+    -1, 26, 27, 28, 29, 30, 31, 32, 33, 34, 35, 36, 37, 38, 39, 40,
+    41, 42, 43, 44, 45, 46, 47, 48, 49, 50, 51, -1, -1, -1, -1, -1
+};
+
+#define char64(c)  (((c) < 0 || (c) > 127) ? -1 : index_64[(c)])
+
+/*
+ * Vectorized base64 decoding, after Muła and Lemire, "Faster Base64
+ * Encoding and Decoding Using AVX2 Instructions" (2018).
+ *
+ * Each step translates 32 (AVX2) or 16 (SSSE3) characters with nibble
+ * lookups, and packs them into 24 or 12 bytes.  A block that contains
+ * anything but base64 alphabet characters (line breaks, padding, the
+ * end of the data) is left to the scalar decoder below, which then
+ * hands back to the vector loop at the next quartet.  Output never
+ * overtakes input, so this works in place.
+ */
+#if defined(__AVX2__)
+#include <immintrin.h>
+#define MBOX_B64_SIMD 1
+#elif defined(__SSSE3__)
+#include <tmmintrin.h>
+#define MBOX_B64_SIMD 1
+#endif
+
+#ifdef MBOX_B64_SIMD
+
+#define B64_LUT_LO 0x15, 0x11, 0x11, 0x11, 0x11, 0x11, 0x11, 0x11, \
+                   0x11, 0x11, 0x13, 0x1A, 0x1B, 0x1B, 0x1B, 0x1A
+#define B64_LUT_HI 0x10, 0x10, 0x01, 0x02, 0x04, 0x08, 0x04, 0x08, \
+                   0x10, 0x10, 0x10, 0x10, 0x10, 0x10, 0x10, 0x10
+#define B64_LUT_ROLL 0, 16, 19, 4, -65, -65, -71, -71, \
+                     0, 0, 0, 0, 0, 0, 0, 0
+#define B64_PACK 2, 1, 0, 6, 5, 4, 10, 9, 8, 14, 13, 12, -1, -1, -1, -1
+
+/* Decodes whole blocks from *srcp to *dstp for as long as they are
+ * clean, advancing both.
+ */
+static void decode_b64_blocks(const char **srcp, char **dstp,
+                                    const char *end)
+{
+    const char *src = *srcp;
+    char *dst = *dstp;
+
+#if defined(__AVX2__)
+    {
+        const __m256i lut_lo = _mm256_setr_epi8(B64_LUT_LO, B64_LUT_LO);
+        const __m256i lut_hi = _mm256_setr_epi8(B64_LUT_HI, B64_LUT_HI);
+        const __m256i lut_roll = _mm256_setr_epi8(B64_LUT_ROLL, B64_LUT_ROLL);
+        const __m256i pack = _mm256_setr_epi8(B64_PACK, B64_PACK);
+        const __m256i nib = _mm256_set1_epi8(0x0f);
+        const __m256i slash = _mm256_set1_epi8('/');
+
+        while (end - src >= 32) {
+            __m256i in = _mm256_loadu_si256((const __m256i *) src);
+            __m256i hi_nib = _mm256_and_si256(_mm256_srli_epi32(in, 4), nib);
+            __m256i lo_nib = _mm256_and_si256(in, nib);
+            __m256i lo = _mm256_shuffle_epi8(lut_lo, lo_nib);
+            __m256i hi = _mm256_shuffle_epi8(lut_hi, hi_nib);
+            __m256i roll, out;
+
+            if (!_mm256_testz_si256(lo, hi))
+                break;
+
+            roll = _mm256_shuffle_epi8(lut_roll,
+                       _mm256_add_epi8(_mm256_cmpeq_epi8(in, slash), hi_nib));
+            out = _mm256_add_epi8(in, roll);
+            out = _mm256_maddubs_epi16(out, _mm256_set1_epi32(0x01400140));
+            out = _mm256_madd_epi16(out, _mm256_set1_epi32(0x00011000));
+            out = _mm256_shuffle_epi8(out, pack);
+            out = _mm256_permutevar8x32_epi32(out,
+                      _mm256_setr_epi32(0, 1, 2, 4, 5, 6, 7, 7));
+            _mm256_storeu_si256((__m256i *) dst, out);
+
+            src += 32;
+            dst += 24;
+        }
+    }
+#endif
+    {
+        const __m128i lut_lo = _mm_setr_epi8(B64_LUT_LO);
+        const __m128i lut_hi = _mm_setr_epi8(B64_LUT_HI);
+        const __m128i lut_roll = _mm_setr_epi8(B64_LUT_ROLL);
+        const __m128i pack = _mm_setr_epi8(B64_PACK);
+        const __m128i nib = _mm_set1_epi8(0x0f);
+        const __m128i slash = _mm_set1_epi8('/');
+
+        while (end - src >= 16) {
+            __m128i in = _mm_loadu_si128((const __m128i *) src);
+            __m128i hi_nib = _mm_and_si128(_mm_srli_epi32(in, 4), nib);
+            __m128i lo_nib = _mm_and_si128(in, nib);
+            __m128i lo = _mm_shuffle_epi8(lut_lo, lo_nib);
+            __m128i hi = _mm_shuffle_epi8(lut_hi, hi_nib);
+            __m128i roll, out;
+
+            if (_mm_movemask_epi8(_mm_cmpeq_epi8(_mm_and_si128(lo, hi),
+                                                 _mm_setzero_si128()))
+                != 0xffff)
+                break;
+
+            roll = _mm_shuffle_epi8(lut_roll,
+                       _mm_add_epi8(_mm_cmpeq_epi8(in, slash), hi_nib));
+            out = _mm_add_epi8(in, roll);
+            out = _mm_maddubs_epi16(out, _mm_set1_epi32(0x01400140));
+            out = _mm_madd_epi16(out, _mm_set1_epi32(0x00011000));
+            out = _mm_shuffle_epi8(out, pack);
+            _mm_storeu_si128((__m128i *) dst, out);
+
+            src += 16;
+            dst += 12;
+        }
+    }
+
+    *srcp = src;
+    *dstp = dst;
+}
+#endif /* MBOX_B64_SIMD */
+
+/* Decode BASE64 encoded data */
+apr_size_t mbox_cte_decode_b64(char *src)
+{
+    apr_size_t len = 0;
+
+    int data_done = 0;
+    int c1, c2, c3, c4;
+    char *dst;
+#ifdef MBOX_B64_SIMD
+    const char *end = src + strlen(src);
+#endif
+
+    dst = src;
+
+    for (;;) {
+#ifdef MBOX_B64_SIMD
+        if (!data_done) {
+            char *start = dst;
+            decode_b64_blocks((const char **) &src, &dst, end);
+            len += dst - start;
+        }
+#endif
+        if ((c1 = *src++) == '\0')
+            break;
+
+        if (isspace(c1))
+            continue;
+
+        if (data_done)
+            break;
+
+        do {
+            c2 = *src++;
+        } while (c2 != '\0' && isspace(c2));
+
+        do {
+            c3 = *src++;
+        } while (c3 != '\0' && isspace(c3));
+
+        do {
+            c4 = *src++;
+        } while (c4 != '\0' && isspace(c4));
+
+        /* Premature EOF. Should return an Error? */
+        if ((c2 == '\0') || (c3 == '\0') || (c4 == '\0')) {
+            return len;
+        }
+
+        if (c1 == '=' || c2 == '=') {
+            data_done = 1;
+            continue;
+        }
+
+        c1 = char64(c1);
+        c2 = char64(c2);
+        *dst++ = (c1 << 2) | ((c2 & 0x30) >> 4);
+        len++;
+
+        if (c3 == '=') {
+            data_done = 1;
+        }
+        else {
+            c3 = char64(c3);
+            *dst++ = ((c2 & 0XF) << 4) | ((c3 & 0x3C) >> 2);
+            len++;
+
+            if (c4 == '=') {
+                data_done = 1;
+            }
+            else {
+                c4 = char64(c4);
+                *dst++ = ((c3 & 0x03) << 6) | c4;
+                len++;
+            }
+        }
+    }
+
+    *dst = '\0';
+    return len;
+}
+
+static int hex2dec_char(char ch)
+{
+    if (isdigit(ch)) {
+        return ch - '0';
+    }
+    else if (isupper(ch)) {
+        return ch - 'A' + 10;
+    }
+    else {
+        return ch - 'a' + 10;
+    }
+}
+
+/* Decode quoted-printable to raw text.
+ *
+ * Runs without '=' are found with memchr() and moved in one go.  A '='
+ * too close to the end of the data to be followed by two hex digits
+ * ends decoding.
+ */
+apr_size_t mbox_cte_decode_qp(char *p)
+{
+    char *src, *dst, *end, *eq;
+
+    dst = src = p;
+    end = p + strlen(p);
+
+    while (src < end) {
+        eq = memchr(src, '=', end - src);
+        if (!eq)
+            eq = end;
+
+        if (dst != src)
+            memmove(dst, src, eq - src);
+        dst += eq - src;
+        src = eq;
+
+        if (src == end)
+            break;
+
+        if (src[1] == '\n') {
+            src += 2;
+            continue;
+        }
+        if (src[1] == '\0' || src[2] == '\0')
+            break;
+
+        *dst++ = (hex2dec_char(src[1]) * 16) + hex2dec_char(src[2]);
+        src += 3;
+    }
+
+    *dst = '\0';
+    return dst - p;
+}
+
+/*
+ * Charset conversion.
+ *
+ * Opening an iconv converter is expensive compared to converting a
+ * typical header word or message body, so each thread keeps a handful
+ * of open converters, keyed by normalized charset name.  A converter
+ * is only ever used by the thread that owns it; its shift state is
+ * reset by the flush at the end of every successful conversion, and a
+ * converter that failed part-way is thrown away.
+ */
+
+#define XLATE_CACHE_SLOTS 8
+#define CHARSET_NAME_MAX 40
+
+typedef struct xlate_slot
+{
+    char name[CHARSET_NAME_MAX];
+    apr_pool_t *pool;
+    apr_xlate_t *xlate;
+    unsigned long used;
+} xlate_slot_t;
+
+typedef struct xlate_cache
+{
+    apr_pool_t *pool;
+    unsigned long tick;
+    xlate_slot_t slot[XLATE_CACHE_SLOTS];
+} xlate_cache_t;
+
+#if APR_HAS_THREADS
+static apr_threadkey_t *xlate_key = NULL;
+
+static void xlate_cache_destroy(void *data)
+{
+    xlate_cache_t *cache = data;
+    apr_pool_destroy(cache->pool);
+}
+#else
+static xlate_cache_t *xlate_cache = NULL;
+#endif
+
+static int xlate_cache_enabled = 0;
+
+apr_status_t mbox_cte_xlate_cache_init(apr_pool_t *p)
+{
+#if APR_HAS_THREADS
+    apr_status_t rv;
+
+    rv = apr_threadkey_private_create(&xlate_key, xlate_cache_destroy, p);
+    if (rv != APR_SUCCESS)
+        return rv;
+#endif
+    xlate_cache_enabled = 1;
+    return APR_SUCCESS;
+}
+
+static xlate_cache_t *xlate_cache_get(void)
+{
+    xlate_cache_t *cache = NULL;
+    apr_pool_t *pool;
+
+    if (!xlate_cache_enabled)
+        return NULL;
+
+#if APR_HAS_THREADS
+    if (apr_threadkey_private_get((void **) &cache, xlate_key) != APR_SUCCESS)
+        return NULL;
+#else
+    cache = xlate_cache;
+#endif
+    if (cache)
+        return cache;
+
+    /* Thread lifetime, so not tied to any request or child pool. */
+    if (apr_pool_create(&pool, NULL) != APR_SUCCESS)
+        return NULL;
+    cache = apr_pcalloc(pool, sizeof(xlate_cache_t));
+    cache->pool = pool;
+
+#if APR_HAS_THREADS
+    if (apr_threadkey_private_set(cache, xlate_key) != APR_SUCCESS) {
+        apr_pool_destroy(pool);
+        return NULL;
+    }
+#else
+    xlate_cache = cache;
+#endif
+    return cache;
+}
+
+/* Finds or opens the converter for a (normalized) charset name.
+ * Each slot has its own pool, so evicting a slot frees the converter.
+ */
+static apr_status_t xlate_cache_open(xlate_cache_t *cache, const char *charset,
+                                     const char *name, xlate_slot_t **result)
+{
+    xlate_slot_t *slot, *victim = &cache->slot[0];
+    apr_status_t rv;
+    int i;
+
+    for (i = 0; i < XLATE_CACHE_SLOTS; i++) {
+        slot = &cache->slot[i];
+        if (slot->xlate && !strcmp(slot->name, name)) {
+            slot->used = ++cache->tick;
+            *result = slot;
+            return APR_SUCCESS;
+        }
+        if (slot->used < victim->used)
+            victim = slot;
+    }
+
+    if (victim->pool)
+        apr_pool_clear(victim->pool);
+    else if ((rv = apr_pool_create(&victim->pool, cache->pool)) != APR_SUCCESS)
+        return rv;
+
+    victim->xlate = NULL;
+    victim->used = 0;
+    rv = apr_xlate_open(&victim->xlate, "UTF-8", charset, victim->pool);
+    if (rv != APR_SUCCESS) {
+        victim->xlate = NULL;
+        return rv;
+    }
+    apr_cpystrn(victim->name, name, sizeof(victim->name));
+    victim->used = ++cache->tick;
+    *result = victim;
+    return APR_SUCCESS;
+}
+
+static void xlate_cache_discard(xlate_slot_t *slot)
+{
+    apr_pool_clear(slot->pool);
+    slot->xlate = NULL;
+    slot->used = 0;
+}
+
+/* Lowercases charset and drops everything but letters and digits, so
+ * that "UTF-8", "utf_8" and "Utf8" all map to "utf8".  Returns 0 if the
+ * name does not fit in buf.
+ */
+static int normalize_charset(const char *charset, char *buf, apr_size_t size)
+{
+    apr_size_t n = 0;
+
+    for (; *charset; charset++) {
+        if (!apr_isalnum(*charset))
+            continue;
+        if (n + 1 >= size)
+            return 0;
+        buf[n++] = apr_tolower(*charset);
+    }
+    buf[n] = '\0';
+    return n > 0;
+}
+
+static int charset_is_utf8(const char *name)
+{
+    return !strcmp(name, "utf8");
+}
+
+static int charset_is_ascii(const char *name)
+{
+    return !strcmp(name, "usascii") || !strcmp(name, "ascii")
+        || !strcmp(name, "ansix341968") || !strcmp(name, "iso646us");
+}
+
+/* Whether pure ASCII input comes out of conversion unchanged.  True
+ * for nearly everything seen in mail, except the wide encodings, the
+ * stateful 7-bit ones, EBCDIC, and the few that map a byte below 0x80
+ * elsewhere (Shift_JIS and Johab put the yen and won signs on '\').
+ */
+static int charset_ascii_compatible(const char *name)
+{
+    static const char *const prefixes[] = {
+        "utf16", "utf32", "ucs2", "ucs4", "unicode", "utf7",
+        "iso2022", "hz", "ebcdic", "shiftjis", "sjis", "xsjis",
+        "mskanji", "johab", "viscii", "tcvn", NULL
+    };
+    /* EBCDIC code pages, by their IBM numbers */
+    static const char *const ebcdic[] = {
+        "037", "273", "277", "278", "280", "284", "285", "290", "297",
+        "420", "423", "424", "500", "870", "871", "875", "880", "905",
+        "918", "1025", "1026", "1047", "1140", "1141", "1142", "1143",
+        "1144", "1145", "1146", "1147", "1148", "1149", NULL
+    };
+    const char *num = NULL;
+    int i;
+
+    for (i = 0; prefixes[i]; i++) {
+        if (!strncmp(name, prefixes[i], strlen(prefixes[i])))
+            return 0;
+    }
+
+    if (!strncmp(name, "cp", 2))
+        num = name + 2;
+    else if (!strncmp(name, "ibm", 3))
+        num = name + 3;
+    else if (!strncmp(name, "csibm", 5))
+        num = name + 5;
+    for (i = 0; num && ebcdic[i]; i++) {
+        if (!strcmp(num, ebcdic[i]))
+            return 0;
+    }
+    return 1;
+}
+
+static apr_status_t convert_buffer(apr_xlate_t *convset, const char *src,
+                                   apr_size_t len, mbox_varbuf_t *vb)
+{
+    apr_status_t rv;
+    apr_size_t outbytes_left, inbytes_left = len;
+    char *dst;
+
+    while (inbytes_left > 0) {
+        /* Leave room for the usual 8-bit to UTF-8 growth up front. */
+        mbox_varbuf_grow(vb, vb->len + inbytes_left + inbytes_left / 2 + 8);
+        dst = vb->buf + vb->len;
+        outbytes_left = vb->avail - vb->len;
+        rv = apr_xlate_conv_buffer(convset, src + len - inbytes_left, &inbytes_left,
+                                   dst, &outbytes_left);
+        if (rv != APR_SUCCESS) {
+            *dst = '\0';
+            return rv;
+        }
+        vb->len = vb->avail - outbytes_left;
+    }
+    mbox_varbuf_grow(vb, vb->len + 8);
+    outbytes_left = vb->avail - vb->len;
+    dst = vb->buf + vb->len;
+    rv = apr_xlate_conv_buffer(convset, NULL, NULL, dst, &outbytes_left);
+    if (rv != APR_SUCCESS) {
+        *dst = '\0';
+        return rv;
+    }
+    vb->len = vb->avail - outbytes_left;
+    vb->buf[vb->len] = '\0';
+    return APR_SUCCESS;
+}
+
+apr_status_t mbox_cte_convert_to_utf8(apr_pool_t *p, const char *charset,
+                                      const char *src, apr_size_t len,
+                                      mbox_varbuf_t *vb)
+{
+    char name[CHARSET_NAME_MAX];
+    int have_name;
+    xlate_cache_t *cache;
+    xlate_slot_t *slot;
+    apr_xlate_t *convset;
+    apr_size_t start = vb->len;
+    apr_status_t rv;
+
+    if (len <= 0)
+        return APR_SUCCESS;
+
+    have_name = normalize_charset(charset, name, sizeof(name));
+
+    if (have_name) {
+        /* Nothing to convert: ASCII reads the same in the source
+           charset and in UTF-8. */
+        if (charset_ascii_compatible(name) && mbox_utf8_is_ascii(src, len)) {
+            mbox_varbuf_strmemcat(vb, src, len);
+            return APR_SUCCESS;
+        }
+
+        /* Already UTF-8.  "utf8" in particular is often unknown to
+           iconv, and mail labelled US-ASCII is frequently UTF-8. */
+        if (charset_is_utf8(name) || charset_is_ascii(name)) {
+            if (mbox_utf8_is_valid(src, len)) {
+                mbox_varbuf_strmemcat(vb, src, len);
+                return APR_SUCCESS;
+            }
+            charset = "UTF-8";
+        }
+    }
+
+    cache = have_name ? xlate_cache_get() : NULL;
+    if (cache) {
+        rv = xlate_cache_open(cache, charset, name, &slot);
+        if (rv != APR_SUCCESS)
+            return rv;
+
+        rv = convert_buffer(slot->xlate, src, len, vb);
+        if (rv != APR_SUCCESS) {
+            xlate_cache_discard(slot);
+            vb->len = start;
+            vb->buf[start] = '\0';
+        }
+        return rv;
+    }
+
+    rv = apr_xlate_open(&convset, "UTF-8", charset, p);
+    if (rv != APR_SUCCESS) {
+        return rv;
+    }
+    rv = convert_buffer(convset, src, len, vb);
+    if (rv != APR_SUCCESS) {
+        vb->len = start;
+        vb->buf[start] = '\0';
+    }
+    apr_xlate_close(convset);
+    return rv;
+}
+
+struct mbox_cte_xlate_stream
+{
+    apr_xlate_t *xlate;         /* NULL to pass the input through */
+    int ascii_compatible;
+};
+
+apr_status_t mbox_cte_xlate_stream_open(apr_pool_t *p, const char *charset,
+                                        mbox_cte_xlate_stream_t **xs)
+{
+    char name[CHARSET_NAME_MAX];
+    int have_name;
+    apr_status_t rv;
+
+    *xs = apr_pcalloc(p, sizeof(mbox_cte_xlate_stream_t));
+    if (!charset)
+        return APR_SUCCESS;
+
+    have_name = normalize_charset(charset, name, sizeof(name));
+    if (have_name && (charset_is_utf8(name) || charset_is_ascii(name)))
+        return APR_SUCCESS;
+
+    /* Not one of the cached converters: its shift state must last as
+       long as the body does. */
+    (*xs)->ascii_compatible = have_name && charset_ascii_compatible(name);
+    rv = apr_xlate_open(&(*xs)->xlate, "UTF-8", charset, p);
+    if (rv != APR_SUCCESS)
+        (*xs)->xlate = NULL;
+    return rv;
+}
+
+apr_status_t mbox_cte_xlate_stream_write(mbox_cte_xlate_stream_t *xs,
+                                         const char *src, apr_size_t len,
+                                         int final, apr_size_t *used,
+                                         mbox_varbuf_t *vb)
+{
+    apr_status_t rv, status = APR_SUCCESS;
+    apr_size_t outbytes_left, inbytes_left = len;
+    char *dst;
+
+    *used = len;
+
+    if (!xs->xlate
+        || (xs->ascii_compatible && mbox_utf8_is_ascii(src, len))) {
+        mbox_varbuf_strmemcat(vb, src, len);
+        return APR_SUCCESS;
+    }
+
+    while (inbytes_left > 0) {
+        mbox_varbuf_grow(vb, vb->len + inbytes_left + inbytes_left / 2 + 8);
+        dst = vb->buf + vb->len;
+        outbytes_left = vb->avail - vb->len;
+        rv = apr_xlate_conv_buffer(xs->xlate, src + len - inbytes_left,
+                                   &inbytes_left, dst, &outbytes_left);
+        vb->len = vb->avail - outbytes_left;
+        vb->buf[vb->len] = '\0';
+
+        if (rv == APR_INCOMPLETE && !final) {
+            *used = len - inbytes_left;
+            return APR_SUCCESS;
+        }
+        if (rv != APR_SUCCESS) {
+            /* Let the byte through, and go on with the next one. */
+            mbox_varbuf_strmemcat(vb, src + len - inbytes_left, 1);
+            inbytes_left--;
+            status = rv;
+        }
+    }
+
+    if (final) {
+        mbox_varbuf_grow(vb, vb->len + 8);
+        outbytes_left = vb->avail - vb->len;
+        rv = apr_xlate_conv_buffer(xs->xlate, NULL, NULL,
+                                   vb->buf + vb->len, &outbytes_left);
+        if (rv == APR_SUCCESS)
+            vb->len = vb->avail - outbytes_left;
+        vb->buf[vb->len] = '\0';
+    }
+
+    return status;
+}
+
+/* This function performs the decoding of strings like :
+ * =?UTF-8?B?QnJhbmtvIMSMaWJlag==?=
+ *
+ * These strings complies to the following syntax :
+ * =?charset?mode?data?= rest
+ *
+ * Appends decoded string to vb, resturns
+ * position where to continue parsing.
+ */
+static char *mbox_cte_decode_rfc2047(apr_pool_t *p, char *src, mbox_varbuf_t *vb)
+{
+    char *charset, *mode, *data, *rest;
+    int i;
+    apr_status_t rv;
+    apr_size_t data_len;
+
+    if (strncmp(src, "=?", 2) != 0)
+        return src;
+    charset = src + strlen("=?");
+
+    /* Encoding mode (first '?' after charset) */
+    mode = strstr(charset, "?");
+    if (!mode) {
+        return src;
+    }
+    mode++;
+
+    /* Fetch data */
+    data = strstr(mode, "?");
+    if (!data || data != mode + 1)
+        return src;
+    data++;
+
+    /* Look for the end bound */
+    rest = strstr(data, "?=");
+    if (!rest)
+        return src;
+    data = apr_pstrmemdup(p, data, rest - data);
+
+    /* Quoted-Printable decoding : mode 'q' */
+    if ((*mode == 'q') || (*mode == 'Q')) {
+        int i;
+
+        /* In QP header encoding, spaces are encoded either in =20 (as
+           in all QP encoding) or in underscores '_' (for header
+           encoding). The first case will be handle by the QP
+           decoding, so we must handle the other one */
+        for (i = 0; i < strlen(data); i++) {
+            if (data[i] == '_') {
+                data[i] = ' ';
+            }
+        }
+
+        data_len = mbox_cte_decode_qp(data);
+    }
+    else if ((*mode == 'b') || (*mode == 'B')) {
+        data_len = mbox_cte_decode_b64(data);
+    }
+    else {
+        return src;
+    }
+
+    /* Convert charset to uppercase */
+    charset = apr_pstrmemdup(p, charset, mode - charset - 1);
+    for (i = 0; i < strlen(charset); i++) {
+        charset[i] = toupper(charset[i]);
+    }
+
+    /* Charset conversion */
+    rv = mbox_cte_convert_to_utf8(p, charset, data, data_len, vb);
+    if (rv != APR_SUCCESS) {
+        *rest = '?';
+        return src;
+    }
+    return rest + strlen("?=");;
+}
+
+/* MIME header decoding (see RFC 2047). */
+char *mbox_cte_decode_header(apr_pool_t *p, char *src)
+{
+    char *start, *cont;
+    mbox_varbuf_t vb;
+    int seen_encoded_word = 0;
+    if (src == NULL || *src == '\0')
+        return "";
+    mbox_varbuf_init(p, &vb, 0);
+
+    do {
+        start = strstr(src, "=?");
+        if (!start) {
+            if (vb.len == 0)
+                return src;
+            return apr_pstrcat(p, vb.buf, src, NULL);
+        }
+
+        if (start != src) {
+            if (seen_encoded_word) {
+                /* space between consecutive encoded words must be discarded */
+                char *p = src;
+                while (p < start && apr_isspace(*p))
+                    p++;
+                if (p == start)
+                    src = start;
+                /* XXX: this is wrong if the next encoded word fails to decode */
+            }
+            if (start != src) {
+                mbox_varbuf_strmemcat(&vb, src, start - src);
+                seen_encoded_word = 0;
+            }
+        }
+
+        cont = mbox_cte_decode_rfc2047(p, start, &vb);
+        if (cont == start) {
+            /* decoding failed, copy start delimiter and continue */
+            mbox_varbuf_strmemcat(&vb, start, 2);
+            src = start + 2;
+        }
+        else {
+            src = cont;
+            seen_encoded_word = 1;
+        }
+    } while (src && *src);
+
+    /* vb.buf is pool memory */
+    return vb.buf;
+}
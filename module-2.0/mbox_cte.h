@@ -0,0 +1,92 @@
+/* Licensed to the Apache Software Foundation (ASF) under one or more
+ * contributor license agreements.  See the NOTICE file distributed with
+ * this work for additional information regarding copyright ownership.
+ * The ASF licenses this file to You under the Apache License, Version 2.0
+ * (the "License"); you may not use this file except in compliance with
+ * the License.  You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef MBOX_CTE_H
+#define MBOX_CTE_H
+
+/*
+ * Content-Transfer-Encoding and RFC 2047 header decoding.
+ *
+ * These live in the library (rather than the module) so that
+ * mod-mbox-util, which is not linked against httpd, can decode headers
+ * while building the index.
+ */
+
+#include "apr.h"
+#include "apr_pools.h"
+
+/*
+ * A growable, pool backed string buffer.  It plays the role of httpd's
+ * ap_varbuf, which is not available to mod-mbox-util.
+ *
+ * buf is always NUL-terminated; len does not include the NUL; avail is
+ * the allocated size of buf minus one (for the NUL).
+ */
+typedef struct mbox_varbuf
+{
+    apr_pool_t *pool;
+    char *buf;
+    apr_size_t len;
+    apr_size_t avail;
+} mbox_varbuf_t;
+
+void mbox_varbuf_init(apr_pool_t *p, mbox_varbuf_t *vb, apr_size_t size);
+void mbox_varbuf_grow(mbox_varbuf_t *vb, apr_size_t size);
+void mbox_varbuf_strmemcat(mbox_varbuf_t *vb, const char *s, apr_size_t len);
+
+/* Decoding functions.  These decode in place and do not copy data. */
+apr_size_t mbox_cte_decode_qp(char *p);
+apr_size_t mbox_cte_decode_b64(char *src);
+
+/* Sets up the per-thread cache of open charset converters.  Without
+ * it, every conversion opens and closes its own converter.
+ */
+apr_status_t mbox_cte_xlate_cache_init(apr_pool_t *p);
+
+/* Appends src, converted from charset to UTF-8, to vb.  On failure, vb
+ * is left as it was.
+ */
+apr_status_t mbox_cte_convert_to_utf8(apr_pool_t *p, const char *charset,
+                                      const char *src, apr_size_t len,
+                                      mbox_varbuf_t *vb);
+
+/* Incremental conversion to UTF-8, for bodies converted a piece at a
+ * time.  Bodies in UTF-8 (or labelled US-ASCII) are passed through, as
+ * are the bytes that cannot be converted: invalid sequences are left
+ * for mbox_utf8_repair().
+ */
+typedef struct mbox_cte_xlate_stream mbox_cte_xlate_stream_t;
+
+/* Opens a converter from charset, which may be NULL.  *xs is usable
+ * (as a pass-through) even if this fails.
+ */
+apr_status_t mbox_cte_xlate_stream_open(apr_pool_t *p, const char *charset,
+                                        mbox_cte_xlate_stream_t **xs);
+
+/* Appends the conversion of src to vb.  Unless final is set, the input
+ * may end in the middle of a character: *used is then the number of
+ * bytes converted, and the others must be passed again, followed by
+ * the rest of the input.  Returns the last conversion error, if any.
+ */
+apr_status_t mbox_cte_xlate_stream_write(mbox_cte_xlate_stream_t *xs,
+                                         const char *src, apr_size_t len,
+                                         int final, apr_size_t *used,
+                                         mbox_varbuf_t *vb);
+
+/* MIME header decoding (see RFC 2047). */
+char *mbox_cte_decode_header(apr_pool_t *p, char *src);
+
+#endif
@@ -0,0 +1,311 @@
+/* Licensed to the Apache Software Foundation (ASF) under one or more
+ * contributor license agreements.  See the NOTICE file distributed with
+ * this work for additional information regarding copyright ownership.
+ * The ASF licenses this file to You under the Apache License, Version 2.0
+ * (the "License"); you may not use this file except in compliance with
+ * the License.  You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+/* Escaping functions.
+ *
+ * mod-mbox-util is not linked against httpd, so these replace
+ * ap_escape_html() and ap_escape_uri() for anything that may end up
+ * in the index.
+ *
+ * All HTML and control character escaping goes through
+ * mbox_escape_mem(), which copies clean runs in bulk and escapes the
+ * rest in the same pass.  Finding the end of a clean run is done 32 or
+ * 16 bytes at a time with AVX2 or SSE2 when the compiler targets them.
+ */
+
+#include "mbox_escape.h"
+
+#include "apr_lib.h"
+#include "apr_strings.h"
+
+#include <string.h>
+
+/*
+ * Which characters each escaping class covers, for the scalar paths.
+ * Bytes 0x80 and up are never escaped.
+ */
+#define C MBOX_ESCAPE_CNTRL
+#define M MBOX_ESCAPE_MARKUP
+#define Q MBOX_ESCAPE_QUOTES
+static const unsigned char escape_class[256] = {
+    C, C, C, C, C, C, C, C, C, C, C, C, C, C, C, C,
+    C, C, C, C, C, C, C, C, C, C, C, C, C, C, C, C,
+    0, 0, Q, 0, 0, 0, M, Q, 0, 0, 0, 0, 0, 0, 0, 0,
+    0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, M, 0, M, 0,
+    0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0,
+    0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0,
+    0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0,
+    0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, C,
+};
+#undef C
+#undef M
+#undef Q
+
+#if defined(__AVX2__)
+#include <immintrin.h>
+#elif defined(__SSE2__)
+#include <emmintrin.h>
+#endif
+
+apr_size_t mbox_escape_clean_span(const char *s, apr_size_t len, int flags)
+{
+    const unsigned char *u = (const unsigned char *) s;
+    apr_size_t i = 0;
+
+#if defined(__AVX2__)
+    {
+        const __m256i lt = _mm256_set1_epi8('<'), gt = _mm256_set1_epi8('>');
+        const __m256i amp = _mm256_set1_epi8('&');
+        const __m256i quot = _mm256_set1_epi8('"'), apos = _mm256_set1_epi8('\'');
+        const __m256i c1f = _mm256_set1_epi8(0x1f), del = _mm256_set1_epi8(0x7f);
+
+        while (i + 32 <= len) {
+            __m256i v = _mm256_loadu_si256((const __m256i *) (s + i));
+            __m256i m = _mm256_setzero_si256();
+            if (flags & MBOX_ESCAPE_MARKUP) {
+                m = _mm256_or_si256(m, _mm256_cmpeq_epi8(v, lt));
+                m = _mm256_or_si256(m, _mm256_cmpeq_epi8(v, gt));
+                m = _mm256_or_si256(m, _mm256_cmpeq_epi8(v, amp));
+            }
+            if (flags & MBOX_ESCAPE_QUOTES) {
+                m = _mm256_or_si256(m, _mm256_cmpeq_epi8(v, quot));
+                m = _mm256_or_si256(m, _mm256_cmpeq_epi8(v, apos));
+            }
+            if (flags & MBOX_ESCAPE_CNTRL) {
+                /* unsigned v <= 0x1f */
+                m = _mm256_or_si256(m, _mm256_cmpeq_epi8(_mm256_min_epu8(v, c1f), v));
+                m = _mm256_or_si256(m, _mm256_cmpeq_epi8(v, del));
+            }
+            if (_mm256_movemask_epi8(m))
+                break;
+            i += 32;
+        }
+    }
+#endif
+#if defined(__SSE2__)
+    {
+        const __m128i lt = _mm_set1_epi8('<'), gt = _mm_set1_epi8('>');
+        const __m128i amp = _mm_set1_epi8('&');
+        const __m128i quot = _mm_set1_epi8('"'), apos = _mm_set1_epi8('\'');
+        const __m128i c1f = _mm_set1_epi8(0x1f), del = _mm_set1_epi8(0x7f);
+
+        while (i + 16 <= len) {
+            __m128i v = _mm_loadu_si128((const __m128i *) (s + i));
+            __m128i m = _mm_setzero_si128();
+            if (flags & MBOX_ESCAPE_MARKUP) {
+                m = _mm_or_si128(m, _mm_cmpeq_epi8(v, lt));
+                m = _mm_or_si128(m, _mm_cmpeq_epi8(v, gt));
+                m = _mm_or_si128(m, _mm_cmpeq_epi8(v, amp));
+            }
+            if (flags & MBOX_ESCAPE_QUOTES) {
+                m = _mm_or_si128(m, _mm_cmpeq_epi8(v, quot));
+                m = _mm_or_si128(m, _mm_cmpeq_epi8(v, apos));
+            }
+            if (flags & MBOX_ESCAPE_CNTRL) {
+                m = _mm_or_si128(m, _mm_cmpeq_epi8(_mm_min_epu8(v, c1f), v));
+                m = _mm_or_si128(m, _mm_cmpeq_epi8(v, del));
+            }
+            if (_mm_movemask_epi8(m))
+                break;
+            i += 16;
+        }
+    }
+#endif
+
+    while (i < len && !(escape_class[u[i]] & flags))
+        i++;
+
+    return i;
+}
+
+/* Writes the escaped form of c to dst (which must have room for six
+ * bytes) and returns its length.
+ */
+static apr_size_t escape_char(char *dst, unsigned char c)
+{
+    switch (c) {
+    case '<':
+        memcpy(dst, "&lt;", 4);
+        return 4;
+    case '>':
+        memcpy(dst, "&gt;", 4);
+        return 4;
+    case '&':
+        memcpy(dst, "&amp;", 5);
+        return 5;
+    case '"':
+        memcpy(dst, "&quot;", 6);
+        return 6;
+    case '\'':
+        memcpy(dst, "&#39;", 5);
+        return 5;
+    default:
+        /* "&#%3.3d;" */
+        dst[0] = '&';
+        dst[1] = '#';
+        dst[2] = '0' + c / 100;
+        dst[3] = '0' + (c / 10) % 10;
+        dst[4] = '0' + c % 10;
+        dst[5] = ';';
+        return 6;
+    }
+}
+
+/* Makes sure x has room for need more bytes after the first n. */
+static char *reserve(apr_pool_t *p, char *x, apr_size_t n, apr_size_t need,
+                     apr_size_t *avail)
+{
+    char *nx;
+
+    if (n + need <= *avail)
+        return x;
+    while (n + need > *avail)
+        *avail *= 2;
+    nx = apr_palloc(p, *avail + 1);
+    memcpy(nx, x, n);
+    return nx;
+}
+
+char *mbox_escape_mem(apr_pool_t *p, const char *s, apr_size_t len,
+                      int flags, apr_size_t *outlen)
+{
+    apr_size_t i, run, n, avail;
+    char *x;
+
+    run = mbox_escape_clean_span(s, len, flags);
+    if (run == len) {
+        if (outlen)
+            *outlen = len;
+        return apr_pstrmemdup(p, s, len);
+    }
+
+    /* A little headroom is usually enough; grow by doubling if not. */
+    avail = len + len / 8 + 16;
+    x = apr_palloc(p, avail + 1);
+    memcpy(x, s, run);
+    n = i = run;
+
+    while (i < len) {
+        x = reserve(p, x, n, 6, &avail);
+        n += escape_char(x + n, (unsigned char) s[i++]);
+
+        run = mbox_escape_clean_span(s + i, len - i, flags);
+        if (run) {
+            x = reserve(p, x, n, run, &avail);
+            memcpy(x + n, s + i, run);
+            n += run;
+            i += run;
+        }
+    }
+
+    x[n] = '\0';
+    if (outlen)
+        *outlen = n;
+    return x;
+}
+
+char *mbox_escape_html(apr_pool_t *p, const char *s)
+{
+    return mbox_escape_mem(p, s, strlen(s), MBOX_ESCAPE_ALL, NULL);
+}
+
+/* Antispam protection,
+ * proper order is:
+ * apply mbox_cte_decode_header(), then mbox_email_antispam(), then
+ * mbox_escape_html()
+ */
+char *mbox_email_antispam(char *email)
+{
+    char *tmp;
+    int i, atsign = 0, ltsign = 0;
+
+    tmp = strrchr(email, '@');
+
+    if (!tmp) {
+        return email;
+    }
+
+    /* Before the '@' sign */
+    atsign = tmp - email - 1;
+
+    tmp = strstr(email, "&lt;");
+    if (tmp) {
+        /* After the '&lt;' */
+        ltsign = tmp - email + strlen("&lt;") - 1;
+    }
+
+    /* Wipe out at most three chars preceding the '@' sign */
+    for (i = 0; i < 3; i++) {
+        if ((atsign - i) > ltsign) {
+            email[atsign - i] = '.';
+        }
+    }
+
+    return email;
+}
+
+/* Characters ap_escape_uri() leaves alone (T_OS_ESCAPE_PATH in httpd's
+ * gen_test_char.c), minus '&', which has a meaning of its own in URIs.
+ */
+#define URI_SAFE(c) \
+    (apr_isalnum(c) || ((c) && strchr("$-_.+!*'(),:@=/~", (c))))
+
+/* Unreserved characters of RFC 3986, the only ones a query component
+ * can hold as they are: '+' is a space and '=' a separator to
+ * ap_args_to_table().
+ */
+#define QUERY_SAFE(c) \
+    (apr_isalnum(c) || ((c) && strchr("-_.~", (c))))
+
+static char *escape_uri(apr_pool_t *p, const char *s, int query)
+{
+    static const char c2x[] = "0123456789abcdef";
+    const unsigned char *u = (const unsigned char *) s;
+    apr_size_t i, j;
+    char *x;
+
+#define SAFE(c) (query ? QUERY_SAFE(c) : URI_SAFE(c))
+    for (i = 0, j = 0; u[i] != '\0'; i++) {
+        if (!SAFE(u[i]))
+            j += 2;
+    }
+
+    x = apr_palloc(p, i + j + 1);
+    for (i = 0, j = 0; u[i] != '\0'; i++) {
+        if (SAFE(u[i])) {
+            x[j++] = u[i];
+        }
+        else {
+            x[j++] = '%';
+            x[j++] = c2x[u[i] >> 4];
+            x[j++] = c2x[u[i] & 0xf];
+        }
+    }
+#undef SAFE
+
+    x[j] = '\0';
+    return x;
+}
+
+char *mbox_escape_msgid(apr_pool_t *p, const char *s)
+{
+    return escape_uri(p, s, 0);
+}
+
+char *mbox_escape_query(apr_pool_t *p, const char *s)
+{
+    return escape_uri(p, s, 1);
+}
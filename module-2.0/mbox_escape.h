@@ -0,0 +1,69 @@
+/* Licensed to the Apache Software Foundation (ASF) under one or more
+ * contributor license agreements.  See the NOTICE file distributed with
+ * this work for additional information regarding copyright ownership.
+ * The ASF licenses this file to You under the Apache License, Version 2.0
+ * (the "License"); you may not use this file except in compliance with
+ * the License.  You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef MBOX_ESCAPE_H
+#define MBOX_ESCAPE_H
+
+/*
+ * HTML and URI escaping shared by the module and mod-mbox-util, so that
+ * strings escaped once at index time are byte for byte what the module
+ * would have produced.
+ */
+
+#include "apr.h"
+#include "apr_pools.h"
+
+/* Character classes for mbox_escape_mem(). */
+#define MBOX_ESCAPE_MARKUP 0x01 /* < > & */
+#define MBOX_ESCAPE_QUOTES 0x02 /* " ' */
+#define MBOX_ESCAPE_CNTRL  0x04 /* C0 controls and DEL, as &#NNN; */
+#define MBOX_ESCAPE_ALL    (MBOX_ESCAPE_MARKUP | MBOX_ESCAPE_QUOTES | \
+                            MBOX_ESCAPE_CNTRL)
+
+/* Returns the length of the leading run of s that needs no escaping
+ * for the given classes.
+ */
+apr_size_t mbox_escape_clean_span(const char *s, apr_size_t len, int flags);
+
+/* Escapes len bytes of s (which may contain NULs) for the given
+ * classes in a single pass.  Always returns a NUL-terminated copy;
+ * its length is stored in *outlen if outlen is not NULL.
+ */
+char *mbox_escape_mem(apr_pool_t *p, const char *s, apr_size_t len,
+                      int flags, apr_size_t *outlen);
+
+/* Escapes HTML special characters (< > & " ') and control characters
+ * (as &#NNN;).  Always returns a copy.
+ */
+char *mbox_escape_html(apr_pool_t *p, const char *s);
+
+/* Wipes out (at most three of) the characters preceding the '@' of an
+ * e-mail address, in place.  Apply it before escaping.
+ */
+char *mbox_email_antispam(char *email);
+
+/* Escapes a Message-ID for use in a URI path: what ap_escape_uri()
+ * does, plus '&'.  Always returns a copy.
+ */
+char *mbox_escape_msgid(apr_pool_t *p, const char *s);
+
+/* Escapes a value for use in a query string, as a form would: all but
+ * the unreserved characters, '+' and '=' included.  Always returns a
+ * copy.
+ */
+char *mbox_escape_query(apr_pool_t *p, const char *s);
+
+#endif
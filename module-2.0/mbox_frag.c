@@ -0,0 +1,487 @@
+/* Licensed to the Apache Software Foundation (ASF) under one or more
+ * contributor license agreements.  See the NOTICE file distributed with
+ * this work for additional information regarding copyright ownership.
+ * The ASF licenses this file to You under the Apache License, Version 2.0
+ * (the "License"); you may not use this file except in compliance with
+ * the License.  You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+/* Prerendered message views.
+ *
+ * The file starts with a header (frag_header, then the base URI), and
+ * the views follow, in the order they were written.  The DBM record of
+ * a view is a frag_record followed by the subject of the message.  Both
+ * carry the time the views were written at, so that a DBM and a file
+ * that were not written together are never used together.
+ */
+
+#include "mbox_frag.h"
+#include "mbox_dbm.h"
+
+#include "apr_dbm.h"
+#include "apr_strings.h"
+
+#include <string.h>
+#include <zlib.h>
+
+#define FRAG_MAGIC "MBOXFRAG"
+#define FRAG_VERSION 1
+
+#define FRAG_BUFSIZE (16 * 1024)
+
+#define FRAG_PERMS (APR_FPROT_UREAD | APR_FPROT_UWRITE | \
+                    APR_FPROT_GREAD | APR_FPROT_WREAD)
+
+typedef struct frag_header
+{
+    char magic[8];
+    apr_uint32_t version;
+    apr_uint32_t flags;
+    apr_int32_t antispam;
+    apr_uint32_t base_uri_len;
+    apr_int64_t stamp;
+    apr_int64_t index_mtime;
+    apr_int64_t index_size;
+} frag_header;
+
+typedef struct frag_record
+{
+    apr_int64_t stamp;
+    apr_uint64_t offset;
+    apr_uint64_t stored_len;
+    apr_uint64_t len;
+    apr_int64_t date;
+} frag_record;
+
+struct mbox_frag_writer
+{
+    apr_pool_t *pool;
+    const char *path;
+    int flags;
+    apr_int64_t stamp;
+
+    apr_file_t *f;
+    char *tmp;
+    apr_dbm_t *db;
+    const char *dbtmp;
+
+    apr_off_t offset;           /* End of the file */
+    apr_off_t start;            /* Of the view being written */
+    apr_uint64_t len;           /* Of the view being written */
+
+    z_stream z;
+    int zinit;
+    unsigned char *zbuf;
+
+    mbox_out_t out;
+};
+
+static const char *dbm_path(apr_pool_t *p, const char *path)
+{
+    return apr_pstrcat(p, path, MBOX_FRAG_DBM_SUFFIX, NULL);
+}
+
+apr_status_t mbox_frag_open(mbox_frag_t **frag, apr_pool_t *p,
+                            const char *path)
+{
+    mbox_frag_t *fr;
+    frag_header h;
+    apr_size_t n;
+    char *uri;
+    apr_status_t rv;
+
+    fr = apr_pcalloc(p, sizeof(mbox_frag_t));
+    fr->path = path;
+
+    rv = apr_file_open(&fr->file, apr_pstrcat(p, path, MBOX_FRAG_SUFFIX,
+                                              NULL),
+                       APR_READ | APR_SENDFILE_ENABLED, APR_OS_DEFAULT, p);
+    if (rv != APR_SUCCESS)
+        return rv;
+
+    rv = apr_file_read_full(fr->file, &h, sizeof(h), &n);
+    if (rv == APR_SUCCESS
+        && (memcmp(h.magic, FRAG_MAGIC, sizeof(h.magic)) != 0
+            || h.version != FRAG_VERSION || h.base_uri_len > 8192)) {
+        rv = APR_EGENERAL;
+    }
+    if (rv == APR_SUCCESS) {
+        uri = apr_palloc(p, h.base_uri_len + 1);
+        rv = apr_file_read_full(fr->file, uri, h.base_uri_len, &n);
+        uri[h.base_uri_len] = '\0';
+    }
+    if (rv != APR_SUCCESS) {
+        apr_file_close(fr->file);
+        return rv;
+    }
+
+    fr->info.flags = h.flags;
+    fr->info.antispam = h.antispam;
+    fr->info.index_mtime = h.index_mtime;
+    fr->info.index_size = h.index_size;
+    fr->info.base_uri = uri;
+    fr->stamp = h.stamp;
+
+    *frag = fr;
+    return APR_SUCCESS;
+}
+
+int mbox_frag_matches(const mbox_frag_t *frag, const mbox_frag_info_t *info)
+{
+    return frag->info.index_mtime == info->index_mtime
+        && frag->info.index_size == info->index_size
+        && !frag->info.antispam == !info->antispam
+        && strcmp(frag->info.base_uri, info->base_uri) == 0;
+}
+
+apr_status_t mbox_frag_fetch(mbox_frag_t *frag, apr_pool_t *p,
+                             const char *msgID, mbox_frag_rec_t *rec)
+{
+    apr_dbm_t *db;
+    apr_datum_t key, value;
+    frag_record fr;
+    apr_status_t rv;
+
+    rv = apr_dbm_open_ex(&db, APR_STRINGIFY(DBM_TYPE),
+                         dbm_path(p, frag->path), APR_DBM_READONLY,
+                         APR_OS_DEFAULT, p);
+    if (rv != APR_SUCCESS)
+        return APR_NOTFOUND;
+
+    key.dptr = (char *) msgID;
+    key.dsize = strlen(msgID) + 1;
+
+    rv = apr_dbm_fetch(db, key, &value);
+    if (rv != APR_SUCCESS || !value.dptr || value.dsize <= sizeof(fr)) {
+        apr_dbm_close(db);
+        return APR_NOTFOUND;
+    }
+
+    memcpy(&fr, value.dptr, sizeof(fr));
+    if (fr.stamp != frag->stamp) {
+        apr_dbm_close(db);
+        return APR_NOTFOUND;
+    }
+
+    rec->offset = (apr_off_t) fr.offset;
+    rec->stored_len = (apr_size_t) fr.stored_len;
+    rec->len = (apr_size_t) fr.len;
+    rec->date = (apr_time_t) fr.date;
+    rec->html_subject = apr_pstrmemdup(p, value.dptr + sizeof(fr),
+                                       value.dsize - sizeof(fr) - 1);
+
+    apr_dbm_close(db);
+    return APR_SUCCESS;
+}
+
+apr_status_t mbox_frag_read(mbox_frag_t *frag, const mbox_frag_rec_t *rec,
+                            mbox_render_write_fn *write, void *baton)
+{
+    unsigned char in[FRAG_BUFSIZE], out[FRAG_BUFSIZE];
+    apr_off_t offset = rec->offset;
+    apr_size_t left = rec->stored_len;
+    z_stream z;
+    apr_status_t rv;
+    int zrv = Z_OK, full = 0;
+
+    rv = apr_file_seek(frag->file, APR_SET, &offset);
+    if (rv != APR_SUCCESS)
+        return rv;
+
+    if (!(frag->info.flags & MBOX_FRAG_GZIP)) {
+        while (left) {
+            apr_size_t n = left > sizeof(in) ? sizeof(in) : left;
+
+            rv = apr_file_read_full(frag->file, in, n, &n);
+            if (rv == APR_SUCCESS)
+                rv = write(baton, (const char *) in, n);
+            if (rv != APR_SUCCESS)
+                return rv;
+            left -= n;
+        }
+        return APR_SUCCESS;
+    }
+
+    memset(&z, 0, sizeof(z));
+    if (inflateInit2(&z, 15 + 16) != Z_OK)
+        return APR_EGENERAL;
+
+    while (rv == APR_SUCCESS && zrv != Z_STREAM_END) {
+        /* More input is only needed once the output is all out. */
+        if (!z.avail_in && !full) {
+            apr_size_t n = left > sizeof(in) ? sizeof(in) : left;
+
+            if (!n) {
+                rv = APR_EOF;
+                break;
+            }
+            rv = apr_file_read_full(frag->file, in, n, &n);
+            if (rv != APR_SUCCESS)
+                break;
+            left -= n;
+            z.next_in = in;
+            z.avail_in = (uInt) n;
+        }
+
+        z.next_out = out;
+        z.avail_out = sizeof(out);
+        zrv = inflate(&z, Z_NO_FLUSH);
+        /* Z_BUF_ERROR only means that no progress could be made. */
+        if (zrv != Z_OK && zrv != Z_STREAM_END && zrv != Z_BUF_ERROR) {
+            rv = APR_EGENERAL;
+            break;
+        }
+        full = z.avail_out == 0;
+        if (z.avail_out < sizeof(out))
+            rv = write(baton, (const char *) out, sizeof(out) - z.avail_out);
+    }
+
+    inflateEnd(&z);
+    return rv;
+}
+
+static apr_status_t writer_cleanup(void *data)
+{
+    mbox_frag_writer_t *w = data;
+
+    if (w->zinit) {
+        deflateEnd(&w->z);
+        w->zinit = 0;
+    }
+    return APR_SUCCESS;
+}
+
+apr_status_t mbox_frag_create(mbox_frag_writer_t **wp, apr_pool_t *p,
+                              const char *path, const mbox_frag_info_t *info)
+{
+    mbox_frag_writer_t *w;
+    frag_header h;
+    apr_size_t n;
+    apr_status_t rv;
+
+    w = apr_pcalloc(p, sizeof(mbox_frag_writer_t));
+    w->pool = p;
+    w->path = path;
+    w->flags = info->flags;
+    w->stamp = apr_time_now();
+
+    if (w->flags & MBOX_FRAG_GZIP) {
+        if (deflateInit2(&w->z, Z_DEFAULT_COMPRESSION, Z_DEFLATED, 15 + 16,
+                         8, Z_DEFAULT_STRATEGY) != Z_OK)
+            return APR_EGENERAL;
+        w->zinit = 1;
+        w->zbuf = apr_palloc(p, FRAG_BUFSIZE);
+        apr_pool_cleanup_register(p, w, writer_cleanup,
+                                  apr_pool_cleanup_null);
+    }
+
+    w->tmp = apr_pstrcat(p, path, MBOX_FRAG_SUFFIX, ".XXXXXX", NULL);
+    rv = apr_file_mktemp(&w->f, w->tmp,
+                         APR_CREATE | APR_WRITE | APR_EXCL | APR_BUFFERED, p);
+    if (rv != APR_SUCCESS)
+        return rv;
+
+    w->dbtmp = apr_pstrcat(p, dbm_path(p, path), ".new", NULL);
+    rv = apr_dbm_open_ex(&w->db, APR_STRINGIFY(DBM_TYPE), w->dbtmp,
+                         APR_DBM_RWTRUNC, APR_OS_DEFAULT, p);
+    if (rv != APR_SUCCESS) {
+        w->db = NULL;
+        mbox_frag_abort(w);
+        return rv;
+    }
+
+    memset(&h, 0, sizeof(h));
+    memcpy(h.magic, FRAG_MAGIC, sizeof(h.magic));
+    h.version = FRAG_VERSION;
+    h.flags = info->flags;
+    h.antispam = info->antispam;
+    h.base_uri_len = strlen(info->base_uri);
+    h.stamp = w->stamp;
+    h.index_mtime = info->index_mtime;
+    h.index_size = info->index_size;
+
+    rv = apr_file_write_full(w->f, &h, sizeof(h), &n);
+    if (rv == APR_SUCCESS)
+        rv = apr_file_write_full(w->f, info->base_uri, h.base_uri_len, &n);
+    if (rv != APR_SUCCESS) {
+        mbox_frag_abort(w);
+        return rv;
+    }
+    w->offset = sizeof(h) + h.base_uri_len;
+
+    *wp = w;
+    return APR_SUCCESS;
+}
+
+/* Compresses what is pending, up to the end of the view if flush. */
+static apr_status_t deflate_out(mbox_frag_writer_t *w, int flush)
+{
+    apr_status_t rv = APR_SUCCESS;
+    apr_size_t n;
+    int zrv;
+
+    do {
+        w->z.next_out = w->zbuf;
+        w->z.avail_out = FRAG_BUFSIZE;
+        zrv = deflate(&w->z, flush);
+        if (zrv == Z_STREAM_ERROR)
+            return APR_EGENERAL;
+
+        n = FRAG_BUFSIZE - w->z.avail_out;
+        if (n) {
+            rv = apr_file_write_full(w->f, w->zbuf, n, &n);
+            w->offset += n;
+        }
+    } while (rv == APR_SUCCESS
+             && (flush == Z_FINISH ? zrv != Z_STREAM_END
+                                   : w->z.avail_out == 0));
+
+    return rv;
+}
+
+static apr_status_t frag_write(void *baton, const char *data, apr_size_t len)
+{
+    mbox_frag_writer_t *w = baton;
+    apr_status_t rv;
+
+    w->len += len;
+
+    if (!(w->flags & MBOX_FRAG_GZIP)) {
+        rv = apr_file_write_full(w->f, data, len, &len);
+        w->offset += len;
+        return rv;
+    }
+
+    while (len) {
+        uInt n = len > 0x40000000 ? 0x40000000 : (uInt) len;
+
+        w->z.next_in = (Bytef *) data;
+        w->z.avail_in = n;
+        rv = deflate_out(w, Z_NO_FLUSH);
+        if (rv != APR_SUCCESS)
+            return rv;
+        data += n;
+        len -= n;
+    }
+
+    return APR_SUCCESS;
+}
+
+mbox_out_t *mbox_frag_begin(mbox_frag_writer_t *w, apr_pool_t *p)
+{
+    w->start = w->offset;
+    w->len = 0;
+    mbox_out_init(&w->out, p, frag_write, w);
+
+    return &w->out;
+}
+
+apr_status_t mbox_frag_end(mbox_frag_writer_t *w, const char *msgID,
+                           apr_time_t date, const char *html_subject)
+{
+    apr_datum_t key, value;
+    frag_record fr;
+    apr_size_t slen = html_subject ? strlen(html_subject) : 0;
+    apr_status_t rv = w->out.status;
+
+    if (rv == APR_SUCCESS && (w->flags & MBOX_FRAG_GZIP)) {
+        w->z.avail_in = 0;
+        rv = deflate_out(w, Z_FINISH);
+        deflateReset(&w->z);
+    }
+    if (rv != APR_SUCCESS)
+        return rv;
+
+    fr.stamp = w->stamp;
+    fr.offset = w->start;
+    fr.stored_len = w->offset - w->start;
+    fr.len = w->len;
+    fr.date = date;
+
+    value.dsize = sizeof(fr) + slen + 1;
+    value.dptr = apr_palloc(w->out.pool, value.dsize);
+    memcpy(value.dptr, &fr, sizeof(fr));
+    memcpy(value.dptr + sizeof(fr), html_subject ? html_subject : "", slen + 1);
+
+    key.dptr = (char *) msgID;
+    key.dsize = strlen(msgID) + 1;
+
+    return apr_dbm_store(w->db, key, value);
+}
+
+/* Renames the DBM written at from (whatever files it is made of) to to. */
+static apr_status_t rename_dbm(apr_pool_t *p, const char *from,
+                               const char *to)
+{
+    const char *from1, *from2, *to1, *to2;
+    apr_status_t rv;
+
+    rv = apr_dbm_get_usednames_ex(p, APR_STRINGIFY(DBM_TYPE), from,
+                                  &from1, &from2);
+    if (rv == APR_SUCCESS)
+        rv = apr_dbm_get_usednames_ex(p, APR_STRINGIFY(DBM_TYPE), to,
+                                      &to1, &to2);
+    if (rv == APR_SUCCESS)
+        rv = apr_file_rename(from1, to1, p);
+    if (rv == APR_SUCCESS && from2 && to2)
+        rv = apr_file_rename(from2, to2, p);
+
+    return rv;
+}
+
+apr_status_t mbox_frag_commit(mbox_frag_writer_t *w)
+{
+    apr_status_t rv;
+
+    apr_dbm_close(w->db);
+    w->db = NULL;
+
+    rv = apr_file_close(w->f);
+    w->f = NULL;
+    if (rv == APR_SUCCESS) {
+        /* Temporary files are only readable by their owner. */
+        apr_file_perms_set(w->tmp, FRAG_PERMS);
+
+        /* Until both are renamed, the stamps tell them apart. */
+        rv = rename_dbm(w->pool, w->dbtmp, dbm_path(w->pool, w->path));
+    }
+    if (rv == APR_SUCCESS) {
+        rv = apr_file_rename(w->tmp, apr_pstrcat(w->pool, w->path,
+                                                 MBOX_FRAG_SUFFIX, NULL),
+                             w->pool);
+    }
+
+    if (rv != APR_SUCCESS)
+        mbox_frag_abort(w);
+    return rv;
+}
+
+void mbox_frag_abort(mbox_frag_writer_t *w)
+{
+    const char *used1, *used2;
+
+    if (w->f) {
+        apr_file_close(w->f);
+        w->f = NULL;
+    }
+    apr_file_remove(w->tmp, w->pool);
+
+    if (w->db) {
+        apr_dbm_close(w->db);
+        w->db = NULL;
+    }
+    if (apr_dbm_get_usednames_ex(w->pool, APR_STRINGIFY(DBM_TYPE), w->dbtmp,
+                                 &used1, &used2) == APR_SUCCESS) {
+        apr_file_remove(used1, w->pool);
+        if (used2)
+            apr_file_remove(used2, w->pool);
+    }
+}
@@ -0,0 +1,109 @@
+/* Licensed to the Apache Software Foundation (ASF) under one or more
+ * contributor license agreements.  See the NOTICE file distributed with
+ * this work for additional information regarding copyright ownership.
+ * The ASF licenses this file to You under the Apache License, Version 2.0
+ * (the "License"); you may not use this file except in compliance with
+ * the License.  You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef MBOX_FRAG_H
+#define MBOX_FRAG_H
+
+/*
+ * Prerendered message views.  The view of every message of a mailbox
+ * (see mbox_view_message()) is written, one after the other, to a
+ * single file next to the mailbox, and a DBM maps each Message-ID to the
+ * place of its view in the file, so that the module can send the view
+ * as it is.  Views may be compressed, each as a gzip member of its own.
+ *
+ * A view depends on the index it was rendered from, on the URI of the
+ * mailbox and on the antispam setting, which are all recorded in the
+ * file: the views are only of use while they match.
+ */
+
+#include "apr.h"
+#include "apr_file_io.h"
+#include "apr_pools.h"
+
+#include "mbox_view.h"
+
+#define MBOX_FRAG_SUFFIX ".frags"
+#define MBOX_FRAG_DBM_SUFFIX ".fragsum"
+
+/* Flags */
+#define MBOX_FRAG_GZIP 0x01     /* Each view is gzip compressed */
+
+typedef struct mbox_frag_info
+{
+    int flags;
+    int antispam;
+    apr_time_t index_mtime;     /* Version of the index (mbox_index_stat()) */
+    apr_off_t index_size;
+    const char *base_uri;
+} mbox_frag_info_t;
+
+/* Where the view of a message is */
+typedef struct mbox_frag_rec
+{
+    apr_off_t offset;
+    apr_size_t stored_len;      /* In the file */
+    apr_size_t len;             /* Once uncompressed */
+    apr_time_t date;            /* Of the message */
+    const char *html_subject;
+} mbox_frag_rec_t;
+
+typedef struct mbox_frag
+{
+    apr_file_t *file;
+    mbox_frag_info_t info;
+    const char *path;           /* Of the mailbox */
+    apr_int64_t stamp;
+} mbox_frag_t;
+
+typedef struct mbox_frag_writer mbox_frag_writer_t;
+
+/* Opens the views of the mailbox at path, for reading. */
+apr_status_t mbox_frag_open(mbox_frag_t **frag, apr_pool_t *p,
+                            const char *path);
+
+/* Returns 1 if the views were rendered with the given settings, from
+ * the given version of the index.  Flags do not matter.
+ */
+int mbox_frag_matches(const mbox_frag_t *frag, const mbox_frag_info_t *info);
+
+/* Looks up the view of msgID.  Returns APR_NOTFOUND if there is none. */
+apr_status_t mbox_frag_fetch(mbox_frag_t *frag, apr_pool_t *p,
+                             const char *msgID, mbox_frag_rec_t *rec);
+
+/* Writes a view out, uncompressed. */
+apr_status_t mbox_frag_read(mbox_frag_t *frag, const mbox_frag_rec_t *rec,
+                            mbox_render_write_fn *write, void *baton);
+
+/* Starts writing the views of the mailbox at path.  Nothing replaces
+ * the current views (if any) until mbox_frag_commit().
+ */
+apr_status_t mbox_frag_create(mbox_frag_writer_t **w, apr_pool_t *p,
+                              const char *path, const mbox_frag_info_t *info);
+
+/* Returns where to write the view of the next message, allocating from
+ * p; mbox_frag_end() records it under msgID.
+ */
+mbox_out_t *mbox_frag_begin(mbox_frag_writer_t *w, apr_pool_t *p);
+apr_status_t mbox_frag_end(mbox_frag_writer_t *w, const char *msgID,
+                           apr_time_t date, const char *html_subject);
+
+/* Replaces the current views with the ones written. */
+apr_status_t mbox_frag_commit(mbox_frag_writer_t *w);
+
+/* Throws the views written away. */
+void mbox_frag_abort(mbox_frag_writer_t *w);
+
+#endif
@@ -0,0 +1,1301 @@
+/* Licensed to the Apache Software Foundation (ASF) under one or more
+ * contributor license agreements.  See the NOTICE file distributed with
+ * this work for additional information regarding copyright ownership.
+ * The ASF licenses this file to You under the Apache License, Version 2.0
+ * (the "License"); you may not use this file except in compliance with
+ * the License.  You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+/* Full-text search index.
+ *
+ * The index of a mailbox is a single file: an fts_header, then the
+ * documents (an fts_doc per message, in the order they were indexed),
+ * the term dictionary (an fts_term per term, sorted by the bytes of the
+ * terms), the strings both point to, NUL terminated, and the postings.
+ * The postings of a term list the documents it is in, in order, each as
+ * the difference from the previous one, followed by the number of times
+ * the term is there and by the difference of each of its positions from
+ * the previous one, all as varints.  Positions count the terms from the
+ * start of the message; one is skipped after the subject and after the
+ * author, so that phrases do not span them.
+ *
+ * Sections are aligned on 8 bytes and in the byte order of the host: an
+ * index is read where it was written, like the DBM files.
+ */
+
+#include "mbox_fts.h"
+
+#include "apr_hash.h"
+#include "apr_lib.h"
+#include "apr_mmap.h"
+#include "apr_strings.h"
+
+#include <math.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define FTS_MAGIC "MBOXFTS1"
+#define FTS_VERSION 1
+
+#define FTS_PERMS (APR_FPROT_UREAD | APR_FPROT_UWRITE | \
+                   APR_FPROT_GREAD | APR_FPROT_WREAD)
+
+/* BM25 parameters, as usually chosen */
+#define FTS_K1 1.2
+#define FTS_B  0.75
+
+typedef struct fts_header
+{
+    char magic[8];
+    apr_uint32_t version;
+    apr_uint32_t ndocs;
+    apr_uint32_t nterms;
+    apr_uint32_t reserved;
+    apr_uint64_t total_len;     /* Of all the documents, in terms */
+    apr_int64_t index_mtime;
+    apr_int64_t index_size;
+    apr_int64_t min_date;
+    apr_int64_t max_date;
+    apr_uint64_t docs_off;
+    apr_uint64_t terms_off;
+    apr_uint64_t strings_off;
+    apr_uint64_t strings_len;
+    apr_uint64_t postings_off;
+    apr_uint64_t postings_len;
+} fts_header;
+
+typedef struct fts_doc
+{
+    apr_int64_t date;
+    apr_uint32_t len;           /* In terms */
+    apr_uint32_t uri_msgID;     /* Offsets in the strings */
+    apr_uint32_t html_subject;
+    apr_uint32_t html_name;
+    apr_uint32_t html_name_antispam;
+    apr_uint32_t str_date;
+} fts_doc;
+
+typedef struct fts_term
+{
+    apr_uint64_t postings;      /* Offset in the postings */
+    apr_uint32_t postings_len;
+    apr_uint32_t df;            /* Number of documents */
+    apr_uint32_t str;           /* Offset in the strings */
+    apr_uint32_t len;
+} fts_term;
+
+/* Splits text into terms, which it hands to emit.  Text may be given a
+ * piece at a time, cut anywhere.
+ */
+typedef void fts_emit_fn(void *baton, const char *term, apr_size_t len);
+
+typedef struct fts_tokenizer
+{
+    char term[MBOX_FTS_MAX_TERM];
+    apr_size_t len;
+    unsigned char seq[4];       /* UTF-8 sequence being read */
+    apr_size_t seq_len;
+    apr_size_t seq_need;
+    int entity;                 /* Within an HTML entity */
+    fts_emit_fn *emit;
+    void *baton;
+} fts_tokenizer;
+
+/* Index of the mailbox being written */
+typedef struct fts_wterm
+{
+    mbox_varbuf_t postings;
+    apr_uint32_t df;
+    apr_uint32_t last;          /* Document */
+} fts_wterm;
+
+struct mbox_fts_writer
+{
+    apr_pool_t *pool;
+    const char *path;
+    char *tmp;
+    apr_file_t *f;
+    fts_header h;
+
+    apr_array_header_t *docs;   /* Of fts_doc */
+    apr_hash_t *terms;          /* Of fts_wterm */
+    mbox_varbuf_t strings;
+
+    /* The document being written */
+    apr_pool_t *dpool;
+    apr_hash_t *doc_terms;      /* Positions, as arrays of apr_uint32_t */
+    apr_uint32_t pos;
+    apr_uint32_t doc_len;
+    fts_tokenizer tok;
+    mbox_out_t out;
+};
+
+struct mbox_fts
+{
+    const char *box;
+    const fts_header *h;
+    const fts_doc *docs;
+    const fts_term *terms;
+    const char *strings;
+    const unsigned char *postings;
+};
+
+typedef struct fts_phrase
+{
+    int id;                     /* Among the phrases of the query */
+    int count;
+    const char **terms;
+    apr_size_t *lens;
+} fts_phrase;
+
+typedef struct fts_clause
+{
+    int negate;
+    apr_array_header_t *phrases;        /* Alternatives, of fts_phrase * */
+} fts_clause;
+
+struct mbox_fts_query
+{
+    apr_array_header_t *clauses;        /* Of fts_clause */
+    int positive;               /* Clauses a message must match */
+    int nphrases;
+};
+
+/* Tokenizer */
+
+/* Returns 1 if the character c separates terms: it is ASCII and neither
+ * a letter nor a digit, or it is one of the usual punctuation marks and
+ * spaces of Latin-1, of the general punctuation, CJK punctuation and
+ * full width forms blocks.
+ */
+static int is_separator(apr_uint32_t c)
+{
+    if (c < 0x80)
+        return !apr_isalnum(c);
+
+    return (c >= 0xa0 && c <= 0xbf) || c == 0xd7 || c == 0xf7
+        || (c >= 0x2000 && c <= 0x206f)
+        || (c >= 0x3000 && c <= 0x303f)
+        || (c >= 0xff00 && c <= 0xff0f)
+        || (c >= 0xff1a && c <= 0xff20)
+        || (c >= 0xff3b && c <= 0xff40)
+        || (c >= 0xff5b && c <= 0xff65);
+}
+
+static void token_init(fts_tokenizer *t, fts_emit_fn *emit, void *baton)
+{
+    memset(t, 0, sizeof(fts_tokenizer));
+    t->emit = emit;
+    t->baton = baton;
+}
+
+static void token_flush(fts_tokenizer *t)
+{
+    if (t->len)
+        t->emit(t->baton, t->term, t->len);
+    t->len = 0;
+}
+
+/* Adds bytes to the current term.  Characters are never cut: a term is
+ * cut before the first one that does not fit.
+ */
+static void token_append(fts_tokenizer *t, const unsigned char *s,
+                         apr_size_t len)
+{
+    if (t->len + len <= MBOX_FTS_MAX_TERM) {
+        memcpy(t->term + t->len, s, len);
+        t->len += len;
+    }
+}
+
+/* Handles the pending UTF-8 sequence, complete or not. */
+static void token_sequence(fts_tokenizer *t)
+{
+    apr_uint32_t c;
+    apr_size_t i;
+
+    if (t->seq_len == t->seq_need) {
+        c = t->seq[0] & (0x7f >> t->seq_need);
+        for (i = 1; i < t->seq_len; i++)
+            c = (c << 6) | (t->seq[i] & 0x3f);
+        if (is_separator(c)) {
+            token_flush(t);
+            t->seq_need = t->seq_len = 0;
+            return;
+        }
+    }
+
+    token_append(t, t->seq, t->seq_len);
+    t->seq_need = t->seq_len = 0;
+}
+
+static void tokenize(fts_tokenizer *t, const char *data, apr_size_t len)
+{
+    const unsigned char *s = (const unsigned char *) data;
+    const unsigned char *end = s + len;
+
+    for (; s < end; s++) {
+        unsigned char c = *s;
+
+        if (t->seq_need) {
+            if ((c & 0xc0) == 0x80) {
+                t->seq[t->seq_len++] = c;
+                if (t->seq_len == t->seq_need)
+                    token_sequence(t);
+                continue;
+            }
+            token_sequence(t);
+        }
+
+        if (c < 0x80) {
+            /* The text is HTML: entities are all escaped characters. */
+            if (t->entity) {
+                if (c == ';' || apr_isspace(c))
+                    t->entity = 0;
+            }
+            else if (apr_isalnum(c)) {
+                c = apr_tolower(c);
+                token_append(t, &c, 1);
+            }
+            else {
+                token_flush(t);
+                t->entity = (c == '&');
+            }
+        }
+        else if (c >= 0xc2 && c <= 0xf4) {
+            t->seq[0] = c;
+            t->seq_len = 1;
+            t->seq_need = c >= 0xf0 ? 4 : c >= 0xe0 ? 3 : 2;
+        }
+        else {
+            /* Not UTF-8: taken as it is */
+            token_append(t, &c, 1);
+        }
+    }
+}
+
+/* Ends the text given so far. */
+static void token_finish(fts_tokenizer *t)
+{
+    if (t->seq_need)
+        token_sequence(t);
+    token_flush(t);
+    t->entity = 0;
+}
+
+/* Varints */
+
+static void put_varint(mbox_varbuf_t *vb, apr_uint32_t v)
+{
+    char buf[5];
+    apr_size_t n = 0;
+
+    while (v >= 0x80) {
+        buf[n++] = (char) (v | 0x80);
+        v >>= 7;
+    }
+    buf[n++] = (char) v;
+    mbox_varbuf_strmemcat(vb, buf, n);
+}
+
+static int get_varint(const unsigned char **p, const unsigned char *end,
+                      apr_uint32_t *v)
+{
+    apr_uint32_t r = 0;
+    int shift;
+
+    for (shift = 0; *p < end && shift < 32; shift += 7) {
+        unsigned char c = *(*p)++;
+
+        r |= (apr_uint32_t) (c & 0x7f) << shift;
+        if (!(c & 0x80)) {
+            *v = r;
+            return 1;
+        }
+    }
+    return 0;
+}
+
+/* Writer */
+
+static apr_uint32_t add_string(mbox_fts_writer_t *w, const char *s)
+{
+    apr_size_t off = w->strings.len;
+
+    if (!s)
+        s = "";
+    mbox_varbuf_strmemcat(&w->strings, s, strlen(s) + 1);
+    return (apr_uint32_t) off;
+}
+
+static void writer_term(void *baton, const char *term, apr_size_t len)
+{
+    mbox_fts_writer_t *w = baton;
+    apr_array_header_t *pos;
+
+    pos = apr_hash_get(w->doc_terms, term, len);
+    if (!pos) {
+        pos = apr_array_make(w->dpool, 4, sizeof(apr_uint32_t));
+        apr_hash_set(w->doc_terms, apr_pstrmemdup(w->dpool, term, len), len,
+                     pos);
+    }
+    *(apr_uint32_t *) apr_array_push(pos) = w->pos++;
+    w->doc_len++;
+}
+
+static void index_field(mbox_fts_writer_t *w, const char *s)
+{
+    if (s)
+        tokenize(&w->tok, s, strlen(s));
+    token_finish(&w->tok);
+    w->pos++;
+}
+
+static apr_status_t writer_body(void *baton, const char *data,
+                                apr_size_t len)
+{
+    mbox_fts_writer_t *w = baton;
+
+    tokenize(&w->tok, data, len);
+    return APR_SUCCESS;
+}
+
+apr_status_t mbox_fts_create(mbox_fts_writer_t **wp, apr_pool_t *p,
+                             const char *path, apr_time_t index_mtime,
+                             apr_off_t index_size)
+{
+    mbox_fts_writer_t *w;
+    apr_status_t rv;
+
+    w = apr_pcalloc(p, sizeof(mbox_fts_writer_t));
+    w->pool = p;
+    w->path = apr_pstrcat(p, path, MBOX_FTS_SUFFIX, NULL);
+    w->tmp = apr_pstrcat(p, w->path, ".XXXXXX", NULL);
+
+    rv = apr_file_mktemp(&w->f, w->tmp, APR_CREATE | APR_WRITE | APR_EXCL
+                         | APR_BUFFERED, p);
+    if (rv != APR_SUCCESS)
+        return rv;
+
+    memcpy(w->h.magic, FTS_MAGIC, sizeof(w->h.magic));
+    w->h.version = FTS_VERSION;
+    w->h.index_mtime = index_mtime;
+    w->h.index_size = index_size;
+
+    w->docs = apr_array_make(p, 1024, sizeof(fts_doc));
+    w->terms = apr_hash_make(p);
+    mbox_varbuf_init(p, &w->strings, 64 * 1024);
+    apr_pool_create(&w->dpool, p);
+    token_init(&w->tok, writer_term, w);
+    mbox_out_init(&w->out, p, writer_body, w);
+
+    *wp = w;
+    return APR_SUCCESS;
+}
+
+mbox_out_t *mbox_fts_begin(mbox_fts_writer_t *w, Message *m)
+{
+    fts_doc *doc;
+
+    apr_pool_clear(w->dpool);
+    w->doc_terms = apr_hash_make(w->dpool);
+    w->pos = 0;
+    w->doc_len = 0;
+
+    doc = apr_array_push(w->docs);
+    doc->date = m->date;
+    doc->uri_msgID = add_string(w, m->uri_msgID);
+    doc->html_subject = add_string(w, m->html_subject);
+    doc->html_name = add_string(w, m->html_name);
+    doc->html_name_antispam = add_string(w, m->html_name_antispam);
+    doc->str_date = add_string(w, m->str_date);
+
+    if (w->docs->nelts == 1 || m->date < w->h.min_date)
+        w->h.min_date = m->date;
+    if (w->docs->nelts == 1 || m->date > w->h.max_date)
+        w->h.max_date = m->date;
+
+    index_field(w, m->html_subject);
+    index_field(w, ESCAPE_AND_CONV_HDR(w->dpool, m->from));
+
+    w->out.pool = w->dpool;
+    return &w->out;
+}
+
+void mbox_fts_end(mbox_fts_writer_t *w)
+{
+    apr_uint32_t ndoc = w->docs->nelts - 1;
+    apr_hash_index_t *hi;
+
+    token_finish(&w->tok);
+    APR_ARRAY_IDX(w->docs, ndoc, fts_doc).len = w->doc_len;
+    w->h.total_len += w->doc_len;
+
+    for (hi = apr_hash_first(w->dpool, w->doc_terms); hi;
+         hi = apr_hash_next(hi)) {
+        const void *key;
+        apr_ssize_t klen;
+        void *val;
+        apr_array_header_t *pos;
+        fts_wterm *wt;
+        apr_uint32_t last = 0;
+        int i;
+
+        apr_hash_this(hi, &key, &klen, &val);
+        pos = val;
+
+        wt = apr_hash_get(w->terms, key, klen);
+        if (!wt) {
+            wt = apr_pcalloc(w->pool, sizeof(fts_wterm));
+            mbox_varbuf_init(w->pool, &wt->postings, 0);
+            apr_hash_set(w->terms, apr_pstrmemdup(w->pool, key, klen), klen,
+                         wt);
+        }
+
+        put_varint(&wt->postings, ndoc - wt->last);
+        wt->last = ndoc;
+        wt->df++;
+
+        put_varint(&wt->postings, pos->nelts);
+        for (i = 0; i < pos->nelts; i++) {
+            apr_uint32_t p = APR_ARRAY_IDX(pos, i, apr_uint32_t);
+
+            put_varint(&wt->postings, p - last);
+            last = p;
+        }
+    }
+}
+
+typedef struct fts_wentry
+{
+    const char *term;
+    apr_size_t len;
+    fts_wterm *wt;
+} fts_wentry;
+
+static int term_cmp(const char *a, apr_size_t alen,
+                    const char *b, apr_size_t blen)
+{
+    int cmp = memcmp(a, b, alen < blen ? alen : blen);
+
+    if (cmp)
+        return cmp;
+    return alen < blen ? -1 : alen > blen;
+}
+
+static int wentry_cmp(const void *a, const void *b)
+{
+    const fts_wentry *x = a, *y = b;
+
+    return term_cmp(x->term, x->len, y->term, y->len);
+}
+
+apr_status_t mbox_fts_commit(mbox_fts_writer_t *w)
+{
+    apr_array_header_t *entries;
+    fts_term *terms;
+    apr_hash_index_t *hi;
+    apr_uint64_t postings = 0;
+    apr_size_t n;
+    apr_status_t rv;
+    int i;
+
+    entries = apr_array_make(w->pool, apr_hash_count(w->terms),
+                             sizeof(fts_wentry));
+    for (hi = apr_hash_first(w->pool, w->terms); hi; hi = apr_hash_next(hi)) {
+        fts_wentry *e = apr_array_push(entries);
+        const void *key;
+        apr_ssize_t klen;
+        void *val;
+
+        apr_hash_this(hi, &key, &klen, &val);
+        e->term = key;
+        e->len = klen;
+        e->wt = val;
+    }
+    qsort(entries->elts, entries->nelts, sizeof(fts_wentry), wentry_cmp);
+
+    terms = apr_palloc(w->pool, entries->nelts * sizeof(fts_term) + 1);
+    for (i = 0; i < entries->nelts; i++) {
+        fts_wentry *e = &APR_ARRAY_IDX(entries, i, fts_wentry);
+
+        terms[i].postings = postings;
+        terms[i].postings_len = e->wt->postings.len;
+        terms[i].df = e->wt->df;
+        terms[i].str = add_string(w, apr_pstrmemdup(w->pool, e->term, e->len));
+        terms[i].len = e->len;
+        postings += e->wt->postings.len;
+    }
+    while (w->strings.len % 8)
+        mbox_varbuf_strmemcat(&w->strings, "", 1);
+
+    if (w->strings.len > APR_UINT32_MAX) {
+        mbox_fts_abort(w);
+        return APR_ENOSPC;
+    }
+
+    w->h.ndocs = w->docs->nelts;
+    w->h.nterms = entries->nelts;
+    w->h.docs_off = sizeof(fts_header);
+    w->h.terms_off = w->h.docs_off + w->h.ndocs * sizeof(fts_doc);
+    w->h.strings_off = w->h.terms_off + w->h.nterms * sizeof(fts_term);
+    w->h.strings_len = w->strings.len;
+    w->h.postings_off = w->h.strings_off + w->h.strings_len;
+    w->h.postings_len = postings;
+
+    rv = apr_file_write_full(w->f, &w->h, sizeof(fts_header), &n);
+    if (rv == APR_SUCCESS && w->h.ndocs)
+        rv = apr_file_write_full(w->f, w->docs->elts,
+                                 w->h.ndocs * sizeof(fts_doc), &n);
+    if (rv == APR_SUCCESS && w->h.nterms)
+        rv = apr_file_write_full(w->f, terms, w->h.nterms * sizeof(fts_term),
+                                 &n);
+    if (rv == APR_SUCCESS && w->strings.len)
+        rv = apr_file_write_full(w->f, w->strings.buf, w->strings.len, &n);
+    for (i = 0; i < entries->nelts && rv == APR_SUCCESS; i++) {
+        fts_wterm *wt = APR_ARRAY_IDX(entries, i, fts_wentry).wt;
+
+        rv = apr_file_write_full(w->f, wt->postings.buf, wt->postings.len,
+                                 &n);
+    }
+
+    if (rv == APR_SUCCESS)
+        rv = apr_file_close(w->f);
+    else
+        apr_file_close(w->f);
+    w->f = NULL;
+    if (rv == APR_SUCCESS) {
+        /* Temporary files are only readable by their owner. */
+        apr_file_perms_set(w->tmp, FTS_PERMS);
+        rv = apr_file_rename(w->tmp, w->path, w->pool);
+    }
+    if (rv != APR_SUCCESS) {
+        mbox_fts_abort(w);
+        return rv;
+    }
+
+    w->tmp = NULL;
+    return APR_SUCCESS;
+}
+
+void mbox_fts_abort(mbox_fts_writer_t *w)
+{
+    if (w->f) {
+        apr_file_close(w->f);
+        w->f = NULL;
+    }
+    if (w->tmp) {
+        apr_file_remove(w->tmp, w->pool);
+        w->tmp = NULL;
+    }
+}
+
+/* Reader */
+
+apr_status_t mbox_fts_open(mbox_fts_t **ftsp, apr_pool_t *p, const char *path)
+{
+    mbox_fts_t *fts;
+    apr_file_t *f;
+    apr_finfo_t finfo;
+    apr_mmap_t *mm;
+    const fts_header *h;
+    const char *base;
+    apr_uint64_t size;
+    apr_status_t rv;
+
+    rv = apr_file_open(&f, apr_pstrcat(p, path, MBOX_FTS_SUFFIX, NULL),
+                       APR_READ, APR_OS_DEFAULT, p);
+    if (rv != APR_SUCCESS)
+        return APR_STATUS_IS_ENOENT(rv) ? APR_NOTFOUND : rv;
+
+    rv = apr_file_info_get(&finfo, APR_FINFO_SIZE, f);
+    if (rv == APR_SUCCESS && finfo.size < (apr_off_t) sizeof(fts_header))
+        rv = APR_EGENERAL;
+    if (rv == APR_SUCCESS)
+        rv = apr_mmap_create(&mm, f, 0, finfo.size, APR_MMAP_READ, p);
+    apr_file_close(f);
+    if (rv != APR_SUCCESS)
+        return rv;
+
+    base = mm->mm;
+    size = finfo.size;
+    h = (const fts_header *) base;
+
+    /* Everything the index points to must be within it. */
+    if (memcmp(h->magic, FTS_MAGIC, sizeof(h->magic)) != 0
+        || h->version != FTS_VERSION
+        || h->docs_off != sizeof(fts_header)
+        || h->terms_off != h->docs_off + (apr_uint64_t) h->ndocs
+                                         * sizeof(fts_doc)
+        || h->strings_off != h->terms_off + (apr_uint64_t) h->nterms
+                                            * sizeof(fts_term)
+        || h->strings_off > size
+        || h->strings_off % 8 || h->strings_len % 8
+        || h->strings_len > size - h->strings_off
+        || h->postings_off != h->strings_off + h->strings_len
+        || h->postings_len > size - h->postings_off
+        || (h->strings_len && base[h->strings_off + h->strings_len - 1])
+        || (!h->strings_len && h->ndocs)) {
+        apr_mmap_delete(mm);
+        return APR_EGENERAL;
+    }
+
+    fts = apr_pcalloc(p, sizeof(mbox_fts_t));
+    fts->box = strrchr(path, '/') ? strrchr(path, '/') + 1 : path;
+    fts->h = h;
+    fts->docs = (const fts_doc *) (base + h->docs_off);
+    fts->terms = (const fts_term *) (base + h->terms_off);
+    fts->strings = base + h->strings_off;
+    fts->postings = (const unsigned char *) base + h->postings_off;
+
+    *ftsp = fts;
+    return APR_SUCCESS;
+}
+
+int mbox_fts_matches(const mbox_fts_t *fts, apr_time_t index_mtime,
+                     apr_off_t index_size)
+{
+    return fts->h->index_mtime == index_mtime
+        && fts->h->index_size == index_size;
+}
+
+static const char *fts_string(const mbox_fts_t *fts, apr_uint32_t off)
+{
+    return off < fts->h->strings_len ? fts->strings + off : "";
+}
+
+static const fts_term *fts_lookup(const mbox_fts_t *fts, const char *term,
+                                  apr_size_t len)
+{
+    apr_uint32_t lo = 0, hi = fts->h->nterms;
+
+    while (lo < hi) {
+        apr_uint32_t mid = lo + (hi - lo) / 2;
+        const fts_term *t = &fts->terms[mid];
+        int cmp;
+
+        if (t->str >= fts->h->strings_len
+            || t->len > fts->h->strings_len - t->str)
+            return NULL;
+
+        cmp = term_cmp(fts->strings + t->str, t->len, term, len);
+        if (cmp == 0)
+            return t;
+        if (cmp < 0)
+            lo = mid + 1;
+        else
+            hi = mid;
+    }
+    return NULL;
+}
+
+/* Reads the postings of a term */
+typedef struct fts_cursor
+{
+    const unsigned char *p;
+    const unsigned char *end;
+    apr_uint32_t left;          /* Documents not read yet */
+    apr_uint32_t ndocs;
+    int started;
+    apr_uint32_t doc;
+    apr_uint32_t tf;
+    const unsigned char *pos;   /* Positions in doc */
+} fts_cursor;
+
+static int cursor_init(fts_cursor *c, const mbox_fts_t *fts,
+                       const fts_term *t)
+{
+    if (t->postings > fts->h->postings_len
+        || t->postings_len > fts->h->postings_len - t->postings)
+        return 0;
+
+    c->p = fts->postings + t->postings;
+    c->end = c->p + t->postings_len;
+    c->left = t->df;
+    c->ndocs = fts->h->ndocs;
+    c->started = 0;
+    return 1;
+}
+
+static int cursor_next(fts_cursor *c)
+{
+    apr_uint32_t delta, v, i;
+
+    if (!c->left || !get_varint(&c->p, c->end, &delta)
+        || (c->started && !delta)
+        || !get_varint(&c->p, c->end, &c->tf)) {
+        c->left = 0;
+        return 0;
+    }
+
+    c->pos = c->p;
+    for (i = 0; i < c->tf; i++) {
+        if (!get_varint(&c->p, c->end, &v)) {
+            c->left = 0;
+            return 0;
+        }
+    }
+
+    c->doc = c->started ? c->doc + delta : delta;
+    c->started = 1;
+    c->left--;
+    if (c->doc >= c->ndocs) {
+        c->left = 0;
+        return 0;
+    }
+    return 1;
+}
+
+/* Moves to the first document from doc on. */
+static int cursor_seek(fts_cursor *c, apr_uint32_t doc)
+{
+    while (c->doc < doc) {
+        if (!cursor_next(c))
+            return 0;
+    }
+    return 1;
+}
+
+/* Returns the positions of the term in the current document, in buf,
+ * which cursor_next() made sure are there.
+ */
+static void cursor_positions(const fts_cursor *c, apr_uint32_t *buf)
+{
+    const unsigned char *p = c->pos;
+    apr_uint32_t i, d, pos = 0;
+
+    for (i = 0; i < c->tf; i++) {
+        get_varint(&p, c->end, &d);
+        pos += d;
+        buf[i] = pos;
+    }
+}
+
+typedef void fts_match_fn(void *baton, apr_uint32_t doc, apr_uint32_t tf);
+
+/* Returns the number of times a phrase of count terms is found in the
+ * current document of each cursor.
+ */
+static apr_uint32_t phrase_tf(apr_pool_t *p, fts_cursor *c, int count,
+                              apr_uint32_t **buf, apr_uint32_t *size)
+{
+    apr_uint32_t tf = 0, i;
+    apr_uint32_t *next;
+    int j;
+
+    next = apr_pcalloc(p, count * sizeof(apr_uint32_t));
+    for (j = 0; j < count; j++) {
+        if (c[j].tf > size[j]) {
+            size[j] = c[j].tf * 2;
+            buf[j] = apr_palloc(p, size[j] * sizeof(apr_uint32_t));
+        }
+        cursor_positions(&c[j], buf[j]);
+    }
+
+    for (i = 0; i < c[0].tf; i++) {
+        apr_uint32_t start = buf[0][i];
+
+        for (j = 1; j < count; j++) {
+            while (next[j] < c[j].tf && buf[j][next[j]] < start + j)
+                next[j]++;
+            if (next[j] == c[j].tf)
+                return tf;
+            if (buf[j][next[j]] != start + j)
+                break;
+        }
+        if (j == count)
+            tf++;
+    }
+    return tf;
+}
+
+/* Calls fn for each document of fts where the phrase is. */
+static void phrase_scan(apr_pool_t *p, const mbox_fts_t *fts,
+                        const fts_phrase *ph, fts_match_fn *fn, void *baton)
+{
+    fts_cursor *c;
+    apr_uint32_t **buf, *size;
+    int i;
+
+    c = apr_palloc(p, ph->count * sizeof(fts_cursor));
+    for (i = 0; i < ph->count; i++) {
+        const fts_term *t = fts_lookup(fts, ph->terms[i], ph->lens[i]);
+
+        if (!t || !cursor_init(&c[i], fts, t) || !cursor_next(&c[i]))
+            return;
+    }
+
+    if (ph->count == 1) {
+        do {
+            fn(baton, c[0].doc, c[0].tf);
+        } while (cursor_next(&c[0]));
+        return;
+    }
+
+    buf = apr_pcalloc(p, ph->count * sizeof(apr_uint32_t *));
+    size = apr_pcalloc(p, ph->count * sizeof(apr_uint32_t));
+
+    for (;;) {
+        apr_uint32_t doc = c[0].doc, tf;
+        int agree = 1;
+
+        for (i = 1; i < ph->count; i++) {
+            if (c[i].doc > doc)
+                doc = c[i].doc;
+        }
+        for (i = 0; i < ph->count; i++) {
+            if (!cursor_seek(&c[i], doc))
+                return;
+            if (c[i].doc != doc)
+                agree = 0;
+        }
+        if (!agree)
+            continue;
+
+        tf = phrase_tf(p, c, ph->count, buf, size);
+        if (tf)
+            fn(baton, doc, tf);
+        if (!cursor_next(&c[0]))
+            return;
+    }
+}
+
+/* Query */
+
+static void query_term(void *baton, const char *term, apr_size_t len)
+{
+    apr_array_header_t *terms = baton;
+
+    APR_ARRAY_PUSH(terms, const char *) = apr_pstrmemdup(terms->pool, term,
+                                                         len);
+}
+
+static fts_phrase *query_phrase(apr_pool_t *p, mbox_fts_query_t *q,
+                                const char *s)
+{
+    apr_array_header_t *terms = apr_array_make(p, 4, sizeof(const char *));
+    fts_tokenizer t;
+    fts_phrase *ph;
+    int i;
+
+    /* Tokenized as the index is: escaped */
+    s = mbox_escape_html(p, s);
+    token_init(&t, query_term, terms);
+    tokenize(&t, s, strlen(s));
+    token_finish(&t);
+
+    if (!terms->nelts)
+        return NULL;
+
+    ph = apr_palloc(p, sizeof(fts_phrase));
+    ph->id = q->nphrases++;
+    ph->count = terms->nelts;
+    ph->terms = (const char **) terms->elts;
+    ph->lens = apr_palloc(p, ph->count * sizeof(apr_size_t));
+    for (i = 0; i < ph->count; i++)
+        ph->lens[i] = strlen(ph->terms[i]);
+    return ph;
+}
+
+apr_status_t mbox_fts_query_parse(mbox_fts_query_t **qp, apr_pool_t *p,
+                                  const char *s)
+{
+    mbox_fts_query_t *q;
+    int join = 0;
+
+    q = apr_pcalloc(p, sizeof(mbox_fts_query_t));
+    q->clauses = apr_array_make(p, 4, sizeof(fts_clause));
+
+    while (*s) {
+        const char *start;
+        fts_phrase *ph;
+        fts_clause *c;
+        char *item;
+        int negate = 0, quoted = 0;
+
+        if (apr_isspace(*s)) {
+            s++;
+            continue;
+        }
+
+        if (*s == '-') {
+            negate = 1;
+            s++;
+        }
+        if (*s == '"') {
+            quoted = 1;
+            start = ++s;
+            while (*s && *s != '"')
+                s++;
+            item = apr_pstrndup(p, start, s - start);
+            if (*s)
+                s++;
+        }
+        else {
+            start = s;
+            while (*s && !apr_isspace(*s))
+                s++;
+            item = apr_pstrndup(p, start, s - start);
+        }
+
+        if (!negate && !quoted && strcmp(item, "OR") == 0) {
+            join = q->clauses->nelts > 0;
+            continue;
+        }
+
+        ph = query_phrase(p, q, item);
+        if (ph && join && !negate) {
+            c = &APR_ARRAY_IDX(q->clauses, q->clauses->nelts - 1,
+                               fts_clause);
+            APR_ARRAY_PUSH(c->phrases, fts_phrase *) = ph;
+        }
+        else if (ph) {
+            c = apr_array_push(q->clauses);
+            c->negate = negate;
+            c->phrases = apr_array_make(p, 1, sizeof(fts_phrase *));
+            APR_ARRAY_PUSH(c->phrases, fts_phrase *) = ph;
+            if (!negate)
+                q->positive++;
+        }
+        join = 0;
+    }
+
+    if (!q->positive)
+        return APR_EINVAL;
+
+    *qp = q;
+    return APR_SUCCESS;
+}
+
+/* Search */
+
+typedef struct fts_entry
+{
+    const mbox_fts_t *fts;
+    apr_uint32_t doc;
+    apr_time_t date;
+    double score;
+} fts_entry;
+
+/* The hits found so far, as a heap with the worst first */
+typedef struct fts_heap
+{
+    fts_entry *e;
+    int count;
+    int size;
+    int order;
+} fts_heap;
+
+/* Returns 1 if a is worse than b. */
+static int entry_worse(const fts_heap *heap, const fts_entry *a,
+                       const fts_entry *b)
+{
+    if (heap->order == MBOX_FTS_BY_RELEVANCE && a->score != b->score)
+        return a->score < b->score;
+    return a->date < b->date;
+}
+
+static void heap_add(fts_heap *heap, const fts_entry *e)
+{
+    int i, child;
+
+    if (heap->count < heap->size) {
+        /* Up from the bottom */
+        for (i = heap->count++; i > 0; i = (i - 1) / 2) {
+            if (!entry_worse(heap, e, &heap->e[(i - 1) / 2]))
+                break;
+            heap->e[i] = heap->e[(i - 1) / 2];
+        }
+        heap->e[i] = *e;
+        return;
+    }
+
+    if (!entry_worse(heap, &heap->e[0], e))
+        return;
+
+    /* Down from the top, in place of the worst */
+    for (i = 0; (child = 2 * i + 1) < heap->count; i = child) {
+        if (child + 1 < heap->count
+            && entry_worse(heap, &heap->e[child + 1], &heap->e[child]))
+            child++;
+        if (!entry_worse(heap, &heap->e[child], e))
+            break;
+        heap->e[i] = heap->e[child];
+    }
+    heap->e[i] = *e;
+}
+
+/* How a mailbox matches the query */
+typedef struct fts_eval
+{
+    const mbox_fts_t *fts;
+    apr_uint32_t *matched;      /* Positive clauses each document matches */
+    int *clause;                /* Last one, plus one */
+    char *excluded;
+    double *score;
+
+    int current;                /* Clause being matched */
+    int negate;
+    double idf;
+    double avgdl;
+} fts_eval;
+
+static void eval_match(void *baton, apr_uint32_t doc, apr_uint32_t tf)
+{
+    fts_eval *ev = baton;
+    double dl = ev->fts->docs[doc].len;
+
+    if (ev->negate) {
+        ev->excluded[doc] = 1;
+        return;
+    }
+
+    if (ev->clause[doc] != ev->current + 1) {
+        ev->clause[doc] = ev->current + 1;
+        ev->matched[doc]++;
+    }
+    ev->score[doc] += ev->idf * tf * (FTS_K1 + 1)
+        / (tf + FTS_K1 * (1 - FTS_B + FTS_B * dl / ev->avgdl));
+}
+
+static void search_box(apr_pool_t *p, const mbox_fts_t *fts,
+                       const mbox_fts_query_t *q, const double *idf,
+                       double avgdl, fts_heap *heap)
+{
+    apr_uint32_t ndocs = fts->h->ndocs, doc;
+    fts_eval ev;
+    int i, j;
+
+    ev.fts = fts;
+    ev.matched = apr_pcalloc(p, ndocs * sizeof(apr_uint32_t));
+    ev.clause = apr_pcalloc(p, ndocs * sizeof(int));
+    ev.excluded = apr_pcalloc(p, ndocs);
+    ev.score = apr_pcalloc(p, ndocs * sizeof(double));
+    ev.avgdl = avgdl;
+
+    for (i = 0; i < q->clauses->nelts; i++) {
+        fts_clause *c = &APR_ARRAY_IDX(q->clauses, i, fts_clause);
+
+        ev.current = i;
+        ev.negate = c->negate;
+        for (j = 0; j < c->phrases->nelts; j++) {
+            fts_phrase *ph = APR_ARRAY_IDX(c->phrases, j, fts_phrase *);
+
+            ev.idf = idf[ph->id];
+            phrase_scan(p, fts, ph, eval_match, &ev);
+        }
+    }
+
+    for (doc = 0; doc < ndocs; doc++) {
+        fts_entry e;
+
+        if (ev.matched[doc] != (apr_uint32_t) q->positive
+            || ev.excluded[doc])
+            continue;
+
+        e.fts = fts;
+        e.doc = doc;
+        e.date = fts->docs[doc].date;
+        e.score = ev.score[doc];
+        heap_add(heap, &e);
+    }
+}
+
+static int box_cmp(const void *a, const void *b)
+{
+    const mbox_fts_t *x = *(const mbox_fts_t **) a;
+    const mbox_fts_t *y = *(const mbox_fts_t **) b;
+
+    /* Latest first */
+    if (x->h->max_date != y->h->max_date)
+        return x->h->max_date < y->h->max_date ? 1 : -1;
+    return 0;
+}
+
+static int order_relevance(const void *a, const void *b)
+{
+    const fts_entry *x = a, *y = b;
+
+    if (x->score != y->score)
+        return x->score < y->score ? 1 : -1;
+    if (x->date != y->date)
+        return x->date < y->date ? 1 : -1;
+    return 0;
+}
+
+static int order_date(const void *a, const void *b)
+{
+    const fts_entry *x = a, *y = b;
+
+    if (x->date != y->date)
+        return x->date < y->date ? 1 : -1;
+    return 0;
+}
+
+apr_status_t mbox_fts_search(apr_array_header_t **hits, apr_pool_t *p,
+                             mbox_fts_t **fts, int count,
+                             const mbox_fts_query_t *q, int order, int k,
+                             volatile const int *cancel)
+{
+    mbox_fts_t **boxes;
+    fts_heap heap;
+    apr_uint64_t ndocs = 0, total_len = 0;
+    double *idf, avgdl;
+    apr_pool_t *sp;
+    int i, j, l, m;
+
+    *hits = apr_array_make(p, k > 0 ? k : 1, sizeof(mbox_fts_hit_t));
+    if (k <= 0 || count <= 0)
+        return APR_SUCCESS;
+
+    /* The collection is every mailbox searched. */
+    for (i = 0; i < count; i++) {
+        ndocs += fts[i]->h->ndocs;
+        total_len += fts[i]->h->total_len;
+    }
+    avgdl = ndocs && total_len ? (double) total_len / ndocs : 1;
+
+    /* The weight of a phrase is the sum of that of its terms. */
+    idf = apr_pcalloc(p, q->nphrases * sizeof(double));
+    for (i = 0; i < q->clauses->nelts; i++) {
+        fts_clause *c = &APR_ARRAY_IDX(q->clauses, i, fts_clause);
+
+        for (j = 0; j < c->phrases->nelts; j++) {
+            fts_phrase *ph = APR_ARRAY_IDX(c->phrases, j, fts_phrase *);
+
+            for (l = 0; l < ph->count; l++) {
+                apr_uint64_t df = 0;
+
+                for (m = 0; m < count; m++) {
+                    const fts_term *t = fts_lookup(fts[m], ph->terms[l],
+                                                   ph->lens[l]);
+                    if (t)
+                        df += t->df;
+                }
+                idf[ph->id] += log(1 + (ndocs - df + 0.5) / (df + 0.5));
+            }
+        }
+    }
+
+    boxes = apr_pmemdup(p, fts, count * sizeof(mbox_fts_t *));
+    qsort(boxes, count, sizeof(mbox_fts_t *), box_cmp);
+
+    heap.e = apr_palloc(p, k * sizeof(fts_entry));
+    heap.count = 0;
+    heap.size = k;
+    heap.order = order;
+
+    apr_pool_create(&sp, p);
+    for (i = 0; i < count; i++) {
+        /* By date, boxes are searched latest first, and are done with
+         * once the older hits are newer than their messages.
+         */
+        if (order == MBOX_FTS_BY_DATE && heap.count == k
+            && boxes[i]->h->max_date < heap.e[0].date)
+            break;
+
+        if (cancel && *cancel) {
+            apr_pool_destroy(sp);
+            *hits = NULL;
+            return APR_EINTR;
+        }
+
+        search_box(sp, boxes[i], q, idf, avgdl, &heap);
+        apr_pool_clear(sp);
+    }
+    apr_pool_destroy(sp);
+
+    qsort(heap.e, heap.count, sizeof(fts_entry),
+          order == MBOX_FTS_BY_DATE ? order_date : order_relevance);
+
+    for (i = 0; i < heap.count; i++) {
+        const fts_entry *e = &heap.e[i];
+        const fts_doc *doc = &e->fts->docs[e->doc];
+        mbox_fts_hit_t *hit = apr_array_push(*hits);
+
+        hit->box = e->fts->box;
+        hit->date = e->date;
+        hit->score = e->score;
+        hit->uri_msgID = fts_string(e->fts, doc->uri_msgID);
+        hit->html_subject = fts_string(e->fts, doc->html_subject);
+        hit->html_name = fts_string(e->fts, doc->html_name);
+        hit->html_name_antispam = fts_string(e->fts, doc->html_name_antispam);
+        hit->str_date = fts_string(e->fts, doc->str_date);
+    }
+    return APR_SUCCESS;
+}
+
+/* Returns 1 if hit a is better than hit b. */
+static int hit_better(int order, const mbox_fts_hit_t *a,
+                      const mbox_fts_hit_t *b)
+{
+    if (order == MBOX_FTS_BY_RELEVANCE && a->score != b->score)
+        return a->score > b->score;
+    return a->date > b->date;
+}
+
+/* The next hit of each list, as a heap with the best first */
+typedef struct fts_head
+{
+    apr_array_header_t *hits;
+    int next;
+} fts_head;
+
+static const mbox_fts_hit_t *head_hit(const fts_head *h)
+{
+    return &APR_ARRAY_IDX(h->hits, h->next, mbox_fts_hit_t);
+}
+
+static void head_down(fts_head *heap, int count, int i, int order)
+{
+    fts_head e = heap[i];
+    int child;
+
+    for (; (child = 2 * i + 1) < count; i = child) {
+        if (child + 1 < count
+            && hit_better(order, head_hit(&heap[child + 1]),
+                          head_hit(&heap[child])))
+            child++;
+        if (!hit_better(order, head_hit(&heap[child]), head_hit(&e)))
+            break;
+        heap[i] = heap[child];
+    }
+    heap[i] = e;
+}
+
+void mbox_fts_merge(apr_array_header_t **hits, apr_pool_t *p,
+                    apr_array_header_t **lists, int count, int order, int k)
+{
+    fts_head *heap;
+    int i, n = 0;
+
+    *hits = apr_array_make(p, k > 0 ? k : 1, sizeof(mbox_fts_hit_t));
+    if (k <= 0)
+        return;
+
+    heap = apr_palloc(p, (count + 1) * sizeof(fts_head));
+    for (i = 0; i < count; i++) {
+        if (lists[i] && lists[i]->nelts) {
+            heap[n].hits = lists[i];
+            heap[n].next = 0;
+            n++;
+        }
+    }
+    for (i = n / 2 - 1; i >= 0; i--)
+        head_down(heap, n, i, order);
+
+    while (n && (*hits)->nelts < k) {
+        *(mbox_fts_hit_t *) apr_array_push(*hits) = *head_hit(&heap[0]);
+        if (++heap[0].next == heap[0].hits->nelts)
+            heap[0] = heap[--n];
+        head_down(heap, n, 0, order);
+    }
+}
@@ -0,0 +1,125 @@
+/* Licensed to the Apache Software Foundation (ASF) under one or more
+ * contributor license agreements.  See the NOTICE file distributed with
+ * this work for additional information regarding copyright ownership.
+ * The ASF licenses this file to You under the Apache License, Version 2.0
+ * (the "License"); you may not use this file except in compliance with
+ * the License.  You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef MBOX_FTS_H
+#define MBOX_FTS_H
+
+/*
+ * Full-text search.  mod-mbox-util writes an inverted index of each
+ * mailbox next to it: a sorted term dictionary, and for each term the
+ * messages it is found in, with its positions, as delta coded varints.
+ * The index of a list is made of those of its months, so that only the
+ * months that changed are indexed again; the module maps them in memory
+ * and answers boolean and phrase queries with the best hits, by date or
+ * by relevance (BM25).
+ *
+ * Terms are runs of ASCII letters and digits, lower-cased, and of
+ * non-ASCII bytes (UTF-8 text, as it is), taken from the subject, the
+ * author and the text body of the messages.
+ */
+
+#include "apr.h"
+#include "apr_pools.h"
+#include "apr_tables.h"
+
+#include "mbox_parse.h"
+#include "mbox_view.h"
+
+#define MBOX_FTS_SUFFIX ".fts"
+
+/* Longer terms are cut. */
+#define MBOX_FTS_MAX_TERM 32
+
+/* Orders of the hits */
+#define MBOX_FTS_BY_RELEVANCE 0
+#define MBOX_FTS_BY_DATE      1
+
+/* The index of a mailbox */
+typedef struct mbox_fts mbox_fts_t;
+
+typedef struct mbox_fts_writer mbox_fts_writer_t;
+
+typedef struct mbox_fts_query mbox_fts_query_t;
+
+/* A message found, with the fields of Message the lists show */
+typedef struct mbox_fts_hit
+{
+    const char *box;            /* Name of the mailbox */
+    apr_time_t date;
+    double score;
+    const char *uri_msgID;
+    const char *html_subject;
+    const char *html_name;
+    const char *html_name_antispam;
+    const char *str_date;
+} mbox_fts_hit_t;
+
+/* Opens the index of the mailbox at path.  Returns APR_NOTFOUND if there
+ * is none.
+ */
+apr_status_t mbox_fts_open(mbox_fts_t **fts, apr_pool_t *p, const char *path);
+
+/* Returns 1 if the index was built from the given version of the message
+ * index (see mbox_index_stat()).
+ */
+int mbox_fts_matches(const mbox_fts_t *fts, apr_time_t index_mtime,
+                     apr_off_t index_size);
+
+/* Starts indexing the mailbox at path.  Nothing replaces the current
+ * index (if any) until mbox_fts_commit().
+ */
+apr_status_t mbox_fts_create(mbox_fts_writer_t **w, apr_pool_t *p,
+                             const char *path, apr_time_t index_mtime,
+                             apr_off_t index_size);
+
+/* Adds m, and returns where to write its body, as mbox_view_body() does;
+ * mbox_fts_end() is called once it is written.
+ */
+mbox_out_t *mbox_fts_begin(mbox_fts_writer_t *w, Message *m);
+void mbox_fts_end(mbox_fts_writer_t *w);
+
+/* Replaces the current index with the one written. */
+apr_status_t mbox_fts_commit(mbox_fts_writer_t *w);
+
+/* Throws the index written away. */
+void mbox_fts_abort(mbox_fts_writer_t *w);
+
+/* Parses a query: the messages with all the words given, and the
+ * "quoted phrases" (as are words that are made of several terms, like
+ * addresses), but none of those given with a leading '-'.  Words or
+ * phrases joined by OR are alternatives.  Returns APR_EINVAL if there is
+ * nothing to look for.
+ */
+apr_status_t mbox_fts_query_parse(mbox_fts_query_t **q, apr_pool_t *p,
+                                  const char *s);
+
+/* Returns in *hits (of mbox_fts_hit_t) the best k messages matching q in
+ * the given indexes, best first.  If cancel is not NULL, it is looked at
+ * between indexes, and once it is set the search stops with APR_EINTR
+ * and *hits is NULL.
+ */
+apr_status_t mbox_fts_search(apr_array_header_t **hits, apr_pool_t *p,
+                             mbox_fts_t **fts, int count,
+                             const mbox_fts_query_t *q, int order, int k,
+                             volatile const int *cancel);
+
+/* Merges the hits of several searches, each as mbox_fts_search() returns
+ * them with the same order, into the best k, best first.
+ */
+void mbox_fts_merge(apr_array_header_t **hits, apr_pool_t *p,
+                    apr_array_header_t **lists, int count, int order, int k);
+
+#endif
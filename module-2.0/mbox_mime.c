@@ -0,0 +1,579 @@
+/* Licensed to the Apache Software Foundation (ASF) under one or more
+ * contributor license agreements.  See the NOTICE file distributed with
+ * this work for additional information regarding copyright ownership.
+ * The ASF licenses this file to You under the Apache License, Version 2.0
+ * (the "License"); you may not use this file except in compliance with
+ * the License.  You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+/* MIME structure parsing, and the serialized form of MIME trees.
+ *
+ * This is used by mod-mbox-util to record the structure of each message
+ * at index time, and by the module to parse messages the index has no
+ * structure for.
+ */
+
+#include "mbox_mime.h"
+
+#include "apr_lib.h"
+#include "apr_strings.h"
+#include "apr_tables.h"
+
+/**
+ * find certain header line, return copy of first part (up to first ";")
+ * @param p pool to allocate from
+ * @param name name of the header
+ * @param string input: pointer to pointer string where to find the header;
+ *        output: pointer to the ";" or "\n" after the copied value
+ * @param end pointer where to stop searching
+ * @note string must be NUL-terminated (but the NUL may be after *end)
+ * @return copy of the header value or NULL if not found
+ */
+static char *mbox_mime_get_header(apr_pool_t *p, const char *name,
+                                  char **string, const char *end)
+{
+    char *ptr;
+    int namelen = strlen(name);
+    for (ptr = *string;
+         ptr && *ptr && ptr < end ;
+         ptr = ap_strchr(ptr + 1, '\n') + 1)
+    {
+        int l;
+        if (strncasecmp(ptr, name, namelen) != 0)
+            continue;
+        ptr += namelen;
+        if (*ptr != ':')
+            continue;
+        ptr++;
+        while (*ptr == ' ')
+            ptr++;
+        if (ptr >= end)
+            break;
+        l = strcspn(ptr, ";\n");
+        *string = ptr + l;
+        while (l > 0 && apr_isspace(ptr[l - 1]))
+            l--;
+        return apr_pstrndup(p, ptr, l);
+    }
+    return NULL;
+}
+
+/**
+ * find value for parameter with certain name
+ * @param p pool to allocate from
+ * @param name name of the attribute
+ * @param string string with name=value pairs separated by ";",
+ *        value may be a quoted string delimited by double quotes
+ * @param end pointer where to stop searching
+ * @note string must be NUL-terminated (but the NUL may be after *end)
+ * @return copy of the value, NULL if not found
+ */
+static char *mbox_mime_get_parameter(apr_pool_t *p, const char *name,
+                                     const char *string, const char *end)
+{
+    const char *ptr = string;
+    int namelen = strlen(name);
+    while (ptr && ptr < end && *ptr) {
+        int have_match = 0;
+        const char *val_end;
+        while (*ptr && (apr_isspace(*ptr) || *ptr == ';'))
+            ptr++;
+        if (strncasecmp(ptr, name, namelen) == 0) {
+            ptr += strlen(name);
+            while (*ptr && apr_isspace(*ptr) && ptr < end)
+                ptr++;
+            if (*ptr == '=') {
+                have_match = 1;
+                ptr++;
+                if (ptr >= end)
+                    break;
+                while (*ptr && apr_isspace(*ptr) && ptr < end)
+                    ptr++;
+            }
+        }
+        if (!have_match)
+            ptr += strcspn(ptr, ";= \t");
+        if (*ptr == '"')
+            val_end = ap_strchr_c(++ptr, '"');
+        else
+            val_end = ptr + strcspn(ptr, ";\n ");
+        if (!val_end || val_end > end)
+            val_end = end;
+        if (have_match)
+            return apr_pstrmemdup(p, ptr, val_end - ptr);
+        ptr = val_end + 1;
+    }
+    return NULL;
+}
+
+/*
+ * Boundary delimiter search.  The skip table for "--boundary" is built
+ * once per multipart part (Horspool), so scanning a part for all of its
+ * delimiters reads most bytes at most once and many not at all.
+ */
+typedef struct mime_matcher
+{
+    const char *pat;
+    apr_size_t len;
+    apr_size_t skip[256];
+} mime_matcher_t;
+
+static void mime_matcher_init(mime_matcher_t *m, const char *pat)
+{
+    apr_size_t i;
+
+    m->pat = pat;
+    m->len = strlen(pat);
+    for (i = 0; i < 256; i++)
+        m->skip[i] = m->len;
+    for (i = 0; i + 1 < m->len; i++)
+        m->skip[(unsigned char) pat[i]] = m->len - 1 - i;
+}
+
+/* Returns the first occurrence of the pattern in [s, end), or NULL. */
+static char *mime_matcher_find(const mime_matcher_t *m, char *s,
+                               const char *end)
+{
+    const char *pat = m->pat;
+    apr_size_t last = m->len - 1;
+    unsigned char lc = pat[last];
+
+    while ((apr_size_t) (end - s) >= m->len) {
+        unsigned char c = s[last];
+        if (c == lc && memcmp(s, pat, last) == 0)
+            return s;
+        s += m->skip[c];
+    }
+    return NULL;
+}
+
+/* Returns the first "\n\n" in [s, end), or NULL. */
+static char *find_blank_line(char *s, const char *end)
+{
+    while (s < end && (s = memchr(s, '\n', end - s)) != NULL) {
+        if (s + 1 < end && s[1] == '\n')
+            return s;
+        s++;
+    }
+    return NULL;
+}
+
+/* Parses the headers of the part in [body, end) into mail.  Returns 0
+ * if it is not a usable MIME part.  The spans of sub-parts are found in
+ * a single scan of the part for its boundary and allocated in one
+ * block; the sub-parts themselves are left for mbox_mime_get_part().
+ * Bodies are neither copied nor decoded here, and nothing is
+ * NUL-terminated, so the message text is left untouched.
+ */
+static int mime_decode_part(apr_pool_t *p,
+                            mbox_mime_message_t *mail, char *body,
+                            char *end, char *ct, char *charset,
+                            mbox_cte_e cte, char *boundary)
+{
+    char *tmp = NULL;
+    char *headers_bound = NULL;
+
+    /* Locate the end of part headers */
+    if (!ct) {
+        headers_bound = find_blank_line(body, end);
+        if (!headers_bound) {
+            return 0;
+        }
+    }
+    else {
+        headers_bound = body;
+    }
+
+    if (!ct) {
+        /* If no Content-Type is provided, it means that we are parsing a
+         * sub-part of the multipart message. The Content-Type header
+         * should then be the first line of the part. If not, use
+         * text/plain as default for the sub-part.
+         */
+        tmp = body;
+        ct = mbox_mime_get_header(p, "Content-Type", &tmp, headers_bound);
+        if (!ct) {
+            ct = "text/plain";
+        }
+        else {
+            if (!charset)
+                charset = mbox_mime_get_parameter(p, "charset", tmp, headers_bound);
+            mail->content_name = mbox_mime_get_parameter(p, "name", tmp, headers_bound);
+        }
+        mail->content_type = ct;
+    }
+    else {
+        mail->content_type = ct;
+        if (!charset)
+            charset = mbox_mime_get_parameter(p, "charset", ct, ct + strlen(ct));
+    }
+    mail->charset = charset;
+
+    /* Now we have a Content-Type. Look for other useful header information */
+
+    /* Check Content-Disposition if the match is within the headers */
+    tmp = body;
+    mail->content_disposition = mbox_mime_get_header(p, "Content-Disposition", &tmp, headers_bound);
+    if (!mail->content_disposition)
+        mail->content_disposition = "inline";
+
+    /* Check Content-Transfer-Encoding, if needed */
+    if (cte == CTE_NONE) {
+        tmp = body;
+        tmp = mbox_mime_get_header(p, "Content-Transfer-Encoding", &tmp, headers_bound);
+        if (tmp)
+            mail->cte = mbox_parse_cte_header(tmp);
+    }
+    else {
+        mail->cte = cte;
+    }
+
+    /* Now we have all the headers we need. Start processing the body */
+    if (headers_bound == body)
+        mail->body = body;
+    else
+        mail->body = headers_bound + 2; /* skip double new line */
+
+    /* If the mail is a multipart message, find all of its boundaries,
+       and process its sub parts by recursive calls. */
+    if (strncmp(mail->content_type, "multipart/", strlen("multipart/")) == 0) {
+        mime_matcher_t matcher;
+        apr_array_header_t *delims;
+        mbox_mime_message_t *parts;
+        char *bound, *end_bound = NULL;
+        apr_size_t blen;
+        int i;
+
+        /* If the boundary was not given, we must look for it in the headers */
+        if (!boundary) {
+            boundary = mbox_mime_get_parameter(p, "boundary", body, headers_bound);
+            if (!boundary) {
+                return 0;
+            }
+        }
+        mail->boundary = boundary;
+
+        /* Every "--boundary" up to the first "--boundary--" starts a
+           part; the latter ends the last one.  Without both a start
+           and an end boundary, this is not a valid multipart. */
+        mime_matcher_init(&matcher, apr_pstrcat(p, "--", mail->boundary, NULL));
+        blen = matcher.len;
+        delims = apr_array_make(p, 8, sizeof(char *));
+
+        bound = mime_matcher_find(&matcher, mail->body, end);
+        while (bound) {
+            if (bound + blen + 2 <= end
+                && bound[blen] == '-' && bound[blen + 1] == '-') {
+                end_bound = bound;
+                break;
+            }
+            *(char **) apr_array_push(delims) = bound;
+            bound = mime_matcher_find(&matcher, bound + blen, end);
+        }
+        if (!end_bound || delims->nelts == 0) {
+            return 0;
+        }
+
+        mail->sub_count = delims->nelts;
+        mail->sub = apr_palloc(p, delims->nelts * sizeof(mbox_mime_message_t *));
+        parts = apr_pcalloc(p, delims->nelts * sizeof(mbox_mime_message_t));
+
+        for (i = 0; i < delims->nelts; i++) {
+            /* A part starts on the line after its boundary, and ends
+               where the next boundary starts. */
+            char *pstart = APR_ARRAY_IDX(delims, i, char *) + blen + 1;
+            char *pend = (i + 1 < delims->nelts)
+                ? APR_ARRAY_IDX(delims, i + 1, char *) : end_bound;
+
+            if (pstart > pend)
+                pstart = pend;
+
+            parts[i].span = pstart;
+            parts[i].span_end = pend;
+            mail->sub[i] = &parts[i];
+        }
+    }
+
+    /* If the parsed body is not multipart, the body length is the
+       length of its span.  Multipart parts have no body of their
+       own. */
+    else {
+        mail->body_len = end - mail->body;
+    }
+
+    return 1;
+}
+
+mbox_mime_message_t *mbox_mime_decode_multipart(apr_pool_t *p, char *body,
+                                                char *ct, char *charset,
+                                                mbox_cte_e cte, char *boundary)
+{
+    mbox_mime_message_t *mail;
+
+    if (!body) {
+        return NULL;
+    }
+
+    mail = apr_pcalloc(p, sizeof(mbox_mime_message_t));
+    mail->span = body;
+    mail->span_end = body + strlen(body);
+    if (!mime_decode_part(p, mail, mail->span, mail->span_end,
+                          ct, charset, cte, boundary)) {
+        return NULL;
+    }
+    mail->state = MBOX_MIME_PARSED;
+
+    return mail;
+}
+
+mbox_mime_message_t *mbox_mime_get_part(apr_pool_t *p,
+                                        mbox_mime_message_t *m, int i)
+{
+    mbox_mime_message_t *part;
+
+    if (!m || !m->sub || i < 0 || i >= m->sub_count) {
+        return NULL;
+    }
+
+    part = m->sub[i];
+    if (part->state == MBOX_MIME_UNPARSED) {
+        if (mime_decode_part(p, part, part->span, part->span_end,
+                             NULL, NULL, CTE_NONE, NULL))
+            part->state = MBOX_MIME_PARSED;
+        else
+            part->state = MBOX_MIME_INVALID;
+    }
+
+    return part->state == MBOX_MIME_PARSED ? part : NULL;
+}
+
+char *mbox_mime_decode_body(apr_pool_t *p, mbox_cte_e cte, char *body,
+                            apr_size_t len, apr_size_t *ret_len)
+{
+    char *new_body;
+
+    /* Failsafe : in case of body == NULL or len == 0, apr_pstrndup
+       will not allocate anything, not even one byte for the '\0' */
+    if (!body || !len) {
+        return NULL;
+    }
+
+    new_body = apr_pstrndup(p, body, len);
+
+    if (cte == CTE_BASE64)
+        len = mbox_cte_decode_b64(new_body);
+    else if (cte == CTE_QP)
+        len = mbox_cte_decode_qp(new_body);
+
+    if (ret_len)
+        *ret_len = len;
+
+    new_body[len] = 0;
+    return new_body;
+}
+
+/*
+ * Serialized MIME trees.  Parts are stored depth first, each as a state
+ * byte followed, for valid parts, by the body offset and length, the
+ * decoded length, the number of sub-parts and the CTE, then the
+ * content type, charset, disposition, name, boundary and attachment
+ * store key as length-prefixed strings (a length of 0 stands for NULL), as in the
+ * .msgsum records.
+ */
+#define MIME_STRING_MAX 0xffff
+
+static apr_status_t put_uint32(mbox_varbuf_t *vb, apr_size_t n)
+{
+    apr_uint32_t v = (apr_uint32_t) n;
+
+    if (v != n)
+        return APR_EGENERAL;
+    mbox_varbuf_strmemcat(vb, (const char *) &v, sizeof(v));
+    return APR_SUCCESS;
+}
+
+static apr_status_t put_cstring(mbox_varbuf_t *vb, const char *s)
+{
+    apr_size_t len = s ? strlen(s) + 1 : 0;
+    apr_uint16_t xlen = (apr_uint16_t) len;
+
+    if (len > MIME_STRING_MAX)
+        return APR_EGENERAL;
+    mbox_varbuf_strmemcat(vb, (const char *) &xlen, sizeof(xlen));
+    if (s)
+        mbox_varbuf_strmemcat(vb, s, len);
+    return APR_SUCCESS;
+}
+
+static apr_size_t decoded_length(apr_pool_t *p, mbox_mime_message_t *m)
+{
+    apr_size_t len = m->body_len;
+
+    if (m->store_key)
+        return m->decoded_len;
+    if (m->cte == CTE_BASE64 || m->cte == CTE_QP)
+        mbox_mime_decode_body(p, m->cte, m->body, m->body_len, &len);
+    return len;
+}
+
+apr_status_t mbox_mime_serialize(apr_pool_t *p, mbox_mime_message_t *m,
+                                 const char *base, mbox_varbuf_t *vb)
+{
+    apr_status_t rv;
+    unsigned char state = m ? MBOX_MIME_PARSED : MBOX_MIME_INVALID;
+    unsigned char cte;
+    int i;
+
+    mbox_varbuf_strmemcat(vb, (const char *) &state, 1);
+    if (!m)
+        return APR_SUCCESS;
+
+    cte = (unsigned char) m->cte;
+    if ((rv = put_uint32(vb, m->body - base)) != APR_SUCCESS
+        || (rv = put_uint32(vb, m->body_len)) != APR_SUCCESS
+        || (rv = put_uint32(vb, decoded_length(p, m))) != APR_SUCCESS
+        || (rv = put_uint32(vb, m->sub_count)) != APR_SUCCESS)
+        return rv;
+    mbox_varbuf_strmemcat(vb, (const char *) &cte, 1);
+
+    if ((rv = put_cstring(vb, m->content_type)) != APR_SUCCESS
+        || (rv = put_cstring(vb, m->charset)) != APR_SUCCESS
+        || (rv = put_cstring(vb, m->content_disposition)) != APR_SUCCESS
+        || (rv = put_cstring(vb, m->content_name)) != APR_SUCCESS
+        || (rv = put_cstring(vb, m->boundary)) != APR_SUCCESS
+        || (rv = put_cstring(vb, m->store_key)) != APR_SUCCESS)
+        return rv;
+
+    for (i = 0; i < m->sub_count; i++) {
+        rv = mbox_mime_serialize(p, mbox_mime_get_part(p, m, i), base, vb);
+        if (rv != APR_SUCCESS)
+            return rv;
+    }
+
+    return APR_SUCCESS;
+}
+
+typedef struct mime_reader
+{
+    const char *data;
+    apr_size_t pos;
+    apr_size_t len;
+    apr_size_t base_len;        /* Of the body the parts are in */
+} mime_reader_t;
+
+static int get_bytes(mime_reader_t *rd, void *dst, apr_size_t n)
+{
+    if (rd->len - rd->pos < n)
+        return 0;
+    memcpy(dst, rd->data + rd->pos, n);
+    rd->pos += n;
+    return 1;
+}
+
+static int get_cstring(apr_pool_t *p, mime_reader_t *rd, char **dst)
+{
+    apr_uint16_t xlen;
+
+    if (!get_bytes(rd, &xlen, sizeof(xlen)))
+        return 0;
+    if (xlen == 0) {
+        *dst = NULL;
+        return 1;
+    }
+    if (rd->len - rd->pos < xlen || rd->data[rd->pos + xlen - 1] != '\0')
+        return 0;
+    *dst = apr_pmemdup(p, rd->data + rd->pos, xlen);
+    rd->pos += xlen;
+    return 1;
+}
+
+static int get_part(apr_pool_t *p, mime_reader_t *rd, char *base,
+                    mbox_mime_message_t **part)
+{
+    mbox_mime_message_t *m;
+    unsigned char state, cte;
+    apr_uint32_t off, body_len, decoded_len, sub_count;
+    apr_uint32_t i;
+
+    if (!get_bytes(rd, &state, 1))
+        return 0;
+    if (state == MBOX_MIME_INVALID) {
+        *part = NULL;
+        return 1;
+    }
+    if (state != MBOX_MIME_PARSED
+        || !get_bytes(rd, &off, sizeof(off))
+        || !get_bytes(rd, &body_len, sizeof(body_len))
+        || !get_bytes(rd, &decoded_len, sizeof(decoded_len))
+        || !get_bytes(rd, &sub_count, sizeof(sub_count))
+        || !get_bytes(rd, &cte, 1))
+        return 0;
+
+    /* Every sub-part takes at least its state byte, and a body is
+       within the one of the message. */
+    if (sub_count > rd->len - rd->pos
+        || off > rd->base_len || body_len > rd->base_len - off)
+        return 0;
+
+    m = apr_pcalloc(p, sizeof(mbox_mime_message_t));
+    m->state = MBOX_MIME_PARSED;
+    m->body_offset = off;
+    m->body = base ? base + off : NULL;
+    m->body_len = body_len;
+    m->decoded_len = decoded_len;
+    m->cte = (mbox_cte_e) cte;
+
+    if (!get_cstring(p, rd, &m->content_type)
+        || !get_cstring(p, rd, &m->charset)
+        || !get_cstring(p, rd, &m->content_disposition)
+        || !get_cstring(p, rd, &m->content_name)
+        || !get_cstring(p, rd, &m->boundary)
+        || !get_cstring(p, rd, &m->store_key)
+        || !m->content_type || !m->content_disposition)
+        return 0;
+
+    if (sub_count) {
+        m->sub_count = sub_count;
+        m->sub = apr_palloc(p, sub_count * sizeof(mbox_mime_message_t *));
+        for (i = 0; i < sub_count; i++) {
+            if (!get_part(p, rd, base, &m->sub[i]))
+                return 0;
+            /* Invalid parts are kept as such, so that parts keep their
+               numbers. */
+            if (!m->sub[i]) {
+                m->sub[i] = apr_pcalloc(p, sizeof(mbox_mime_message_t));
+                m->sub[i]->state = MBOX_MIME_INVALID;
+            }
+        }
+    }
+
+    *part = m;
+    return 1;
+}
+
+apr_status_t mbox_mime_unserialize(apr_pool_t *p, const char *data,
+                                   apr_size_t len, char *base,
+                                   apr_size_t base_len,
+                                   mbox_mime_message_t **mime)
+{
+    mime_reader_t rd;
+
+    rd.data = data;
+    rd.pos = 0;
+    rd.len = len;
+    rd.base_len = base_len;
+
+    if (!get_part(p, &rd, base, mime) || rd.pos != rd.len) {
+        *mime = NULL;
+        return APR_EGENERAL;
+    }
+    return APR_SUCCESS;
+}
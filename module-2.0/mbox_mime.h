@@ -0,0 +1,67 @@
+/* Licensed to the Apache Software Foundation (ASF) under one or more
+ * contributor license agreements.  See the NOTICE file distributed with
+ * this work for additional information regarding copyright ownership.
+ * The ASF licenses this file to You under the Apache License, Version 2.0
+ * (the "License"); you may not use this file except in compliance with
+ * the License.  You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef MBOX_MIME_H
+#define MBOX_MIME_H
+
+/*
+ * MIME structure parsing, shared by the module and mod-mbox-util, and
+ * the serialized form of a MIME tree kept in the .mimesum index.
+ */
+
+#include "mbox_parse.h"
+#include "mbox_cte.h"
+
+/* Parses the top of the MIME structure of a message body.  body must be
+ * NUL-terminated; it is not modified.  Returns NULL if the body is not
+ * a usable MIME part.
+ */
+mbox_mime_message_t *mbox_mime_decode_multipart(apr_pool_t *p, char *body,
+                                                char *ct, char *charset,
+                                                mbox_cte_e cte,
+                                                char *boundary);
+
+/* Returns the i-th (from 0) sub-part of m, parsing its headers on first
+ * access, or NULL if there is no such part or it is not valid.
+ */
+mbox_mime_message_t *mbox_mime_get_part(apr_pool_t *p,
+                                        mbox_mime_message_t *m, int i);
+
+/* Returns a NUL-terminated copy of a part body, decoded according to
+ * its CTE, or NULL if there is no body.
+ */
+char *mbox_mime_decode_body(apr_pool_t *p, mbox_cte_e cte, char *body,
+                            apr_size_t len, apr_size_t *ret_len);
+
+/* Appends the whole tree under m to vb, parsing every part on the way.
+ * Body offsets are stored relative to base, the start of the message
+ * body.  m may be NULL, for a body that is not a usable MIME part.
+ */
+apr_status_t mbox_mime_serialize(apr_pool_t *p, mbox_mime_message_t *m,
+                                 const char *base, mbox_varbuf_t *vb);
+
+/* Rebuilds a tree stored by mbox_mime_serialize().  Part bodies point
+ * into base, or are NULL if base is NULL; either way, body_offset and
+ * body_len locate them in the message body, of base_len bytes: a tree
+ * with a part outside of it is rejected.  On success, *mime may be NULL
+ * if the stored body was not a usable MIME part.
+ */
+apr_status_t mbox_mime_unserialize(apr_pool_t *p, const char *data,
+                                   apr_size_t len, char *base,
+                                   apr_size_t base_len,
+                                   mbox_mime_message_t **mime);
+
+#endif
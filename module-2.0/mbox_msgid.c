@@ -0,0 +1,477 @@
+/* Licensed to the Apache Software Foundation (ASF) under one or more
+ * contributor license agreements.  See the NOTICE file distributed with
+ * this work for additional information regarding copyright ownership.
+ * The ASF licenses this file to You under the Apache License, Version 2.0
+ * (the "License"); you may not use this file except in compliance with
+ * the License.  You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+/* Site-wide Message-ID index.
+ *
+ * The file starts with a msgid_header, followed by the segments (a
+ * msgid_seg per mailbox of each list, with the version of its message
+ * index), the strings they point to, and an open addressing hash table
+ * of msgid_slot, with linear probing.  A slot holds the SHA-1 of a
+ * Message-ID, whole so that a hit is the message looked for, and the
+ * segment the message is in; its first 64 bits are the hash.  The table
+ * is kept at most half full.
+ *
+ * The index is rewritten as a whole, to a temporary file that is renamed
+ * over it, when the entries of a list change; writers take turns through
+ * a lock on PATH.lock.
+ */
+
+#include "mbox_msgid.h"
+
+#include "apr_file_io.h"
+#include "apr_mmap.h"
+#include "apr_sha1.h"
+#include "apr_strings.h"
+#include "apr_tables.h"
+
+#include <string.h>
+
+#define MSGID_MAGIC "MBOXMID1"
+#define MSGID_VERSION 2
+
+#define MSGID_MIN_SLOTS 1024
+
+#define MSGID_PERMS (APR_FPROT_UREAD | APR_FPROT_UWRITE | \
+                     APR_FPROT_GREAD | APR_FPROT_WREAD)
+
+typedef struct msgid_header
+{
+    char magic[8];
+    apr_uint32_t version;
+    apr_uint32_t nsegs;
+    apr_uint64_t nslots;        /* A power of two */
+    apr_uint64_t nentries;
+    apr_uint64_t segs_off;
+    apr_uint64_t strings_off;
+    apr_uint64_t strings_len;
+    apr_uint64_t slots_off;
+} msgid_header;
+
+typedef struct msgid_seg
+{
+    apr_int64_t index_mtime;
+    apr_int64_t index_size;
+    apr_uint32_t list;          /* Offsets in the strings */
+    apr_uint32_t box;
+    apr_uint32_t count;         /* Of entries */
+    apr_uint32_t reserved;
+} msgid_seg;
+
+typedef struct msgid_slot
+{
+    apr_uint64_t digest;        /* Bytes 0-7 of the SHA-1, 0 if the slot
+                                   is free */
+    apr_uint32_t seg;
+    apr_uint32_t digest_mid;    /* Bytes 8-11 */
+    apr_uint64_t digest_end;    /* Bytes 12-19 */
+} msgid_slot;
+
+struct mbox_msgid_index
+{
+    const msgid_header *h;
+    const msgid_seg *segs;
+    const char *strings;
+    const msgid_slot *slots;
+};
+
+/* A segment of the index being written */
+typedef struct msgid_wseg
+{
+    const char *list;
+    const char *box;
+    apr_time_t index_mtime;
+    apr_off_t index_size;
+    apr_uint32_t count;
+    int old;                    /* In the current index, or -1 */
+} msgid_wseg;
+
+
+struct mbox_msgid_writer
+{
+    apr_pool_t *pool;
+    const char *path;
+    const char *list;
+    apr_file_t *lock;
+    mbox_msgid_index_t *old;
+    char *declared;             /* Old segments of the list declared */
+
+    apr_array_header_t *segs;   /* Of msgid_wseg */
+    apr_array_header_t *added;  /* Of msgid_slot */
+    int current;                /* Segment entries are added to */
+    int changed;
+};
+
+/* Sets the digest of msgID in s. */
+static void msgid_digest(const char *msgID, msgid_slot *s)
+{
+    unsigned char digest[APR_SHA1_DIGESTSIZE];
+    apr_sha1_ctx_t ctx;
+
+    apr_sha1_init(&ctx);
+    apr_sha1_update(&ctx, msgID, strlen(msgID));
+    apr_sha1_final(digest, &ctx);
+
+    memcpy(&s->digest, digest, 8);
+    memcpy(&s->digest_mid, digest + 8, 4);
+    memcpy(&s->digest_end, digest + 12, 8);
+    if (!s->digest)
+        s->digest = 1;
+}
+
+static const char *msgid_string(const mbox_msgid_index_t *idx,
+                                apr_uint32_t off)
+{
+    return off < idx->h->strings_len ? idx->strings + off : "";
+}
+
+apr_status_t mbox_msgid_index_open(mbox_msgid_index_t **idxp, apr_pool_t *p,
+                                   const char *path)
+{
+    mbox_msgid_index_t *idx;
+    apr_file_t *f;
+    apr_finfo_t finfo;
+    apr_mmap_t *mm;
+    const msgid_header *h;
+    const char *base;
+    apr_uint64_t size;
+    apr_status_t rv;
+
+    rv = apr_file_open(&f, path, APR_READ, APR_OS_DEFAULT, p);
+    if (rv != APR_SUCCESS)
+        return APR_STATUS_IS_ENOENT(rv) ? APR_NOTFOUND : rv;
+
+    rv = apr_file_info_get(&finfo, APR_FINFO_SIZE, f);
+    if (rv == APR_SUCCESS && finfo.size < (apr_off_t) sizeof(msgid_header))
+        rv = APR_EGENERAL;
+    if (rv == APR_SUCCESS)
+        rv = apr_mmap_create(&mm, f, 0, finfo.size, APR_MMAP_READ, p);
+    apr_file_close(f);
+    if (rv != APR_SUCCESS)
+        return rv;
+
+    base = mm->mm;
+    size = finfo.size;
+    h = (const msgid_header *) base;
+
+    /* Indexes of an older format are written again by mod-mbox-util. */
+    if (memcmp(h->magic, MSGID_MAGIC, sizeof(h->magic)) == 0
+        && h->version != MSGID_VERSION) {
+        apr_mmap_delete(mm);
+        return APR_NOTFOUND;
+    }
+
+    /* Everything the index points to must be within it. */
+    if (memcmp(h->magic, MSGID_MAGIC, sizeof(h->magic)) != 0
+        || !h->nslots || (h->nslots & (h->nslots - 1))
+        || h->nentries >= h->nslots
+        || h->segs_off != sizeof(msgid_header)
+        || h->strings_off != h->segs_off + (apr_uint64_t) h->nsegs
+                                           * sizeof(msgid_seg)
+        || h->strings_len % 8
+        || h->slots_off != h->strings_off + h->strings_len
+        || h->slots_off > size
+        || h->nslots > (size - h->slots_off) / sizeof(msgid_slot)
+        || (h->strings_len && base[h->strings_off + h->strings_len - 1])) {
+        apr_mmap_delete(mm);
+        return APR_EGENERAL;
+    }
+
+    idx = apr_palloc(p, sizeof(mbox_msgid_index_t));
+    idx->h = h;
+    idx->segs = (const msgid_seg *) (base + h->segs_off);
+    idx->strings = base + h->strings_off;
+    idx->slots = (const msgid_slot *) (base + h->slots_off);
+
+    *idxp = idx;
+    return APR_SUCCESS;
+}
+
+apr_status_t mbox_msgid_index_lookup(const mbox_msgid_index_t *idx,
+                                     const char *msgID,
+                                     mbox_msgid_loc_t *loc)
+{
+    apr_uint64_t mask = idx->h->nslots - 1;
+    apr_uint64_t i, n;
+    msgid_slot key;
+
+    msgid_digest(msgID, &key);
+
+    /* The table is never full: a free slot ends the search. */
+    for (i = key.digest & mask, n = 0; n <= mask; i = (i + 1) & mask, n++) {
+        const msgid_slot *s = &idx->slots[i];
+
+        if (!s->digest)
+            break;
+        if (s->digest == key.digest && s->digest_mid == key.digest_mid
+            && s->digest_end == key.digest_end && s->seg < idx->h->nsegs) {
+            const msgid_seg *seg = &idx->segs[s->seg];
+
+            loc->list = msgid_string(idx, seg->list);
+            loc->box = msgid_string(idx, seg->box);
+            return APR_SUCCESS;
+        }
+    }
+    return APR_NOTFOUND;
+}
+
+static msgid_wseg *writer_seg(mbox_msgid_writer_t *w, const char *list,
+                              const char *box, int old)
+{
+    msgid_wseg *seg = apr_array_push(w->segs);
+
+    seg->list = list;
+    seg->box = box;
+    seg->old = old;
+    seg->count = 0;
+    if (old >= 0) {
+        seg->index_mtime = w->old->segs[old].index_mtime;
+        seg->index_size = w->old->segs[old].index_size;
+        seg->count = w->old->segs[old].count;
+    }
+    return seg;
+}
+
+apr_status_t mbox_msgid_writer_create(mbox_msgid_writer_t **wp, apr_pool_t *p,
+                                      const char *path, const char *list)
+{
+    mbox_msgid_writer_t *w;
+    apr_status_t rv;
+    apr_uint32_t i;
+
+    w = apr_pcalloc(p, sizeof(mbox_msgid_writer_t));
+    w->pool = p;
+    w->path = path;
+    w->list = list;
+    w->segs = apr_array_make(p, 64, sizeof(msgid_wseg));
+    w->added = apr_array_make(p, 1024, sizeof(msgid_slot));
+    w->current = -1;
+
+    rv = apr_file_open(&w->lock, apr_pstrcat(p, path, ".lock", NULL),
+                       APR_CREATE | APR_WRITE, MSGID_PERMS, p);
+    if (rv == APR_SUCCESS) {
+        rv = apr_file_lock(w->lock, APR_FLOCK_EXCLUSIVE);
+        if (rv != APR_SUCCESS)
+            apr_file_close(w->lock);
+    }
+    if (rv != APR_SUCCESS)
+        return rv;
+
+    /* An index that cannot be read is written anew. */
+    rv = mbox_msgid_index_open(&w->old, p, path);
+    if (rv != APR_SUCCESS) {
+        w->old = NULL;
+        w->changed = 1;
+    }
+
+    /* The other lists keep their segments. */
+    if (w->old) {
+        w->declared = apr_pcalloc(p, w->old->h->nsegs + 1);
+        for (i = 0; i < w->old->h->nsegs; i++) {
+            const char *l = msgid_string(w->old, w->old->segs[i].list);
+
+            if (strcmp(l, list) != 0)
+                writer_seg(w, l, msgid_string(w->old, w->old->segs[i].box),
+                           i);
+        }
+    }
+
+    *wp = w;
+    return APR_SUCCESS;
+}
+
+int mbox_msgid_writer_box(mbox_msgid_writer_t *w, const char *box,
+                          apr_time_t index_mtime, apr_off_t index_size)
+{
+    msgid_wseg *seg;
+    apr_uint32_t i;
+
+    for (i = 0; w->old && i < w->old->h->nsegs; i++) {
+        const msgid_seg *s = &w->old->segs[i];
+
+        if (strcmp(msgid_string(w->old, s->list), w->list) == 0
+            && strcmp(msgid_string(w->old, s->box), box) == 0
+            && s->index_mtime == index_mtime
+            && s->index_size == index_size) {
+            w->declared[i] = 1;
+            writer_seg(w, w->list, msgid_string(w->old, s->box), i);
+            w->current = -1;
+            return 1;
+        }
+    }
+
+    seg = writer_seg(w, w->list, apr_pstrdup(w->pool, box), -1);
+    seg->index_mtime = index_mtime;
+    seg->index_size = index_size;
+    w->current = w->segs->nelts - 1;
+    w->changed = 1;
+    return 0;
+}
+
+void mbox_msgid_writer_add(mbox_msgid_writer_t *w, const char *msgID)
+{
+    msgid_slot *e;
+
+    if (w->current < 0)
+        return;
+
+    e = apr_array_push(w->added);
+    msgid_digest(msgID, e);
+    e->seg = w->current;
+    APR_ARRAY_IDX(w->segs, w->current, msgid_wseg).count++;
+}
+
+static void table_insert(msgid_slot *slots, apr_uint64_t mask,
+                         const msgid_slot *e, apr_uint32_t seg)
+{
+    apr_uint64_t i = e->digest & mask;
+
+    while (slots[i].digest)
+        i = (i + 1) & mask;
+    slots[i] = *e;
+    slots[i].seg = seg;
+}
+
+static apr_uint32_t add_string(apr_array_header_t *strings, const char *s)
+{
+    apr_uint32_t off = strings->nelts;
+
+    do {
+        *(char *) apr_array_push(strings) = *s;
+    } while (*s++);
+    return off;
+}
+
+apr_status_t mbox_msgid_writer_commit(mbox_msgid_writer_t *w)
+{
+    msgid_header h;
+    msgid_seg *segs;
+    msgid_slot *slots;
+    apr_array_header_t *strings;
+    apr_uint32_t *renum = NULL;
+    apr_uint64_t nentries = 0, nslots, mask, i;
+    apr_file_t *f;
+    apr_size_t n;
+    char *tmp;
+    apr_status_t rv;
+    int j;
+
+    /* Mailboxes of the list that are gone */
+    for (i = 0; w->old && i < w->old->h->nsegs; i++) {
+        if (!w->declared[i]
+            && strcmp(msgid_string(w->old, w->old->segs[i].list),
+                      w->list) == 0)
+            w->changed = 1;
+    }
+    if (!w->changed) {
+        mbox_msgid_writer_abort(w);
+        return APR_SUCCESS;
+    }
+
+    strings = apr_array_make(w->pool, 4096, 1);
+    segs = apr_pcalloc(w->pool, (w->segs->nelts + 1) * sizeof(msgid_seg));
+    if (w->old)
+        renum = apr_palloc(w->pool,
+                           (w->old->h->nsegs + 1) * sizeof(apr_uint32_t));
+    for (i = 0; w->old && i < w->old->h->nsegs; i++)
+        renum[i] = (apr_uint32_t) -1;
+
+    for (j = 0; j < w->segs->nelts; j++) {
+        msgid_wseg *ws = &APR_ARRAY_IDX(w->segs, j, msgid_wseg);
+
+        segs[j].index_mtime = ws->index_mtime;
+        segs[j].index_size = ws->index_size;
+        segs[j].list = add_string(strings, ws->list);
+        segs[j].box = add_string(strings, ws->box);
+        segs[j].count = ws->count;
+        if (ws->old >= 0)
+            renum[ws->old] = j;
+        nentries += ws->count;
+    }
+    while (strings->nelts % 8)
+        *(char *) apr_array_push(strings) = '\0';
+
+    for (nslots = MSGID_MIN_SLOTS; nslots < 2 * nentries; nslots *= 2);
+    mask = nslots - 1;
+    slots = apr_pcalloc(w->pool, nslots * sizeof(msgid_slot));
+
+    /* Kept entries, then new ones */
+    nentries = 0;
+    for (i = 0; w->old && i < w->old->h->nslots; i++) {
+        const msgid_slot *s = &w->old->slots[i];
+
+        if (s->digest && s->seg < w->old->h->nsegs
+            && renum[s->seg] != (apr_uint32_t) -1 && nentries < nslots / 2) {
+            table_insert(slots, mask, s, renum[s->seg]);
+            nentries++;
+        }
+    }
+    for (j = 0; j < w->added->nelts; j++) {
+        msgid_slot *e = &APR_ARRAY_IDX(w->added, j, msgid_slot);
+
+        table_insert(slots, mask, e, e->seg);
+        nentries++;
+    }
+
+    memset(&h, 0, sizeof(h));
+    memcpy(h.magic, MSGID_MAGIC, sizeof(h.magic));
+    h.version = MSGID_VERSION;
+    h.nsegs = w->segs->nelts;
+    h.nslots = nslots;
+    h.nentries = nentries;
+    h.segs_off = sizeof(msgid_header);
+    h.strings_off = h.segs_off + h.nsegs * sizeof(msgid_seg);
+    h.strings_len = strings->nelts;
+    h.slots_off = h.strings_off + h.strings_len;
+
+    tmp = apr_pstrcat(w->pool, w->path, ".XXXXXX", NULL);
+    rv = apr_file_mktemp(&f, tmp, APR_CREATE | APR_WRITE | APR_EXCL
+                         | APR_BUFFERED, w->pool);
+    if (rv == APR_SUCCESS) {
+        rv = apr_file_write_full(f, &h, sizeof(h), &n);
+        if (rv == APR_SUCCESS && h.nsegs)
+            rv = apr_file_write_full(f, segs, h.nsegs * sizeof(msgid_seg),
+                                     &n);
+        if (rv == APR_SUCCESS && strings->nelts)
+            rv = apr_file_write_full(f, strings->elts, strings->nelts, &n);
+        if (rv == APR_SUCCESS)
+            rv = apr_file_write_full(f, slots, nslots * sizeof(msgid_slot),
+                                     &n);
+        if (rv == APR_SUCCESS)
+            rv = apr_file_close(f);
+        else
+            apr_file_close(f);
+
+        if (rv == APR_SUCCESS) {
+            /* Temporary files are only readable by their owner. */
+            apr_file_perms_set(tmp, MSGID_PERMS);
+            rv = apr_file_rename(tmp, w->path, w->pool);
+        }
+        if (rv != APR_SUCCESS)
+            apr_file_remove(tmp, w->pool);
+    }
+
+    mbox_msgid_writer_abort(w);
+    return rv;
+}
+
+void mbox_msgid_writer_abort(mbox_msgid_writer_t *w)
+{
+    if (w->lock) {
+        apr_file_unlock(w->lock);
+        apr_file_close(w->lock);
+        w->lock = NULL;
+    }
+}
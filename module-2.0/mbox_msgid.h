@@ -0,0 +1,80 @@
+/* Licensed to the Apache Software Foundation (ASF) under one or more
+ * contributor license agreements.  See the NOTICE file distributed with
+ * this work for additional information regarding copyright ownership.
+ * The ASF licenses this file to You under the Apache License, Version 2.0
+ * (the "License"); you may not use this file except in compliance with
+ * the License.  You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef MBOX_MSGID_H
+#define MBOX_MSGID_H
+
+/*
+ * Site-wide Message-ID index.  A single file, shared by all the lists of
+ * a site, maps the digest of each Message-ID to the list and mailbox the
+ * message is in, so that the module finds a message by its Message-ID
+ * with a lookup in a hash table it maps in memory, however large the
+ * archives are.  mod-mbox-util updates the entries of a list whenever the
+ * index of one of its mailboxes changes.
+ */
+
+#include "apr.h"
+#include "apr_pools.h"
+
+typedef struct mbox_msgid_index mbox_msgid_index_t;
+
+typedef struct mbox_msgid_writer mbox_msgid_writer_t;
+
+/* Where a message is */
+typedef struct mbox_msgid_loc
+{
+    const char *list;           /* URL of the list */
+    const char *box;            /* Name of the mailbox */
+} mbox_msgid_loc_t;
+
+/* Opens the index at path.  Returns APR_NOTFOUND if there is none, or
+ * only of an older format.
+ */
+apr_status_t mbox_msgid_index_open(mbox_msgid_index_t **idx, apr_pool_t *p,
+                                   const char *path);
+
+/* Looks msgID (with its angle brackets, as in the message indexes) up.
+ * Returns APR_NOTFOUND if it is not there.  loc points into the index.
+ */
+apr_status_t mbox_msgid_index_lookup(const mbox_msgid_index_t *idx,
+                                     const char *msgID,
+                                     mbox_msgid_loc_t *loc);
+
+/* Starts updating the entries of the list at URL list, in the index at
+ * path (which is created if need be).  Other processes wait until the
+ * update is committed or aborted; readers see the previous index until
+ * then.
+ */
+apr_status_t mbox_msgid_writer_create(mbox_msgid_writer_t **w, apr_pool_t *p,
+                                      const char *path, const char *list);
+
+/* Declares a mailbox of the list, at the given version of its message
+ * index (see mbox_index_stat()).  Returns 1 if the index already has its
+ * entries for that version; otherwise, they are to be added with
+ * mbox_msgid_writer_add().  The entries of the mailboxes of the list that
+ * are not declared are removed.
+ */
+int mbox_msgid_writer_box(mbox_msgid_writer_t *w, const char *box,
+                          apr_time_t index_mtime, apr_off_t index_size);
+void mbox_msgid_writer_add(mbox_msgid_writer_t *w, const char *msgID);
+
+/* Replaces the index with the one updated, if anything changed. */
+apr_status_t mbox_msgid_writer_commit(mbox_msgid_writer_t *w);
+
+/* Leaves the index as it is. */
+void mbox_msgid_writer_abort(mbox_msgid_writer_t *w);
+
+#endif
@@ -0,0 +1,298 @@
+/* Licensed to the Apache Software Foundation (ASF) under one or more
+ * contributor license agreements.  See the NOTICE file distributed with
+ * this work for additional information regarding copyright ownership.
+ * The ASF licenses this file to You under the Apache License, Version 2.0
+ * (the "License"); you may not use this file except in compliance with
+ * the License.  You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+/* Ordinal indexes.
+ *
+ * The ordinal index of a mailbox is a single file: an ordinal_header,
+ * then one ordinal_record per message, in the order of their dates, and
+ * the strings (the Message-IDs, NUL terminated) the records point to.
+ * The record of a message is at its ordinal; the first message of a date
+ * is found with a binary search on the dates of the records.
+ *
+ * Sections are aligned on 8 bytes and in the byte order of the host.
+ */
+
+#include "mbox_ordinal.h"
+#include "mbox_cte.h"
+
+#include "apr_file_io.h"
+#include "apr_mmap.h"
+#include "apr_strings.h"
+
+#include <string.h>
+
+#define ORDINAL_MAGIC "MBOXORD1"
+#define ORDINAL_VERSION 1
+
+#define ORDINAL_PERMS (APR_FPROT_UREAD | APR_FPROT_UWRITE | \
+                       APR_FPROT_GREAD | APR_FPROT_WREAD)
+
+typedef struct ordinal_header
+{
+    char magic[8];
+    apr_uint32_t version;
+    apr_uint32_t nrecords;
+    apr_int64_t index_mtime;
+    apr_int64_t index_size;
+    apr_uint64_t strings_len;
+} ordinal_header;
+
+typedef struct ordinal_record
+{
+    apr_int64_t date;
+    apr_uint32_t msgid;         /* Offset in the strings */
+    apr_uint32_t reserved;
+} ordinal_record;
+
+struct mbox_ordinal
+{
+    const ordinal_header *h;
+    const ordinal_record *records;
+    const char *strings;
+};
+
+struct mbox_ordinal_writer
+{
+    apr_pool_t *pool;
+    const char *path;
+    char *tmp;
+    apr_file_t *f;
+    ordinal_header h;
+
+    apr_array_header_t *records;        /* Of ordinal_record */
+    mbox_varbuf_t strings;
+};
+
+/* Writer */
+
+apr_status_t mbox_ordinal_create(mbox_ordinal_writer_t **wp, apr_pool_t *p,
+                                 const char *path, apr_time_t index_mtime,
+                                 apr_off_t index_size)
+{
+    mbox_ordinal_writer_t *w;
+    apr_status_t rv;
+
+    w = apr_pcalloc(p, sizeof(mbox_ordinal_writer_t));
+    w->pool = p;
+    w->path = apr_pstrcat(p, path, MBOX_ORDINAL_SUFFIX, NULL);
+    w->tmp = apr_pstrcat(p, w->path, ".XXXXXX", NULL);
+
+    rv = apr_file_mktemp(&w->f, w->tmp, APR_CREATE | APR_WRITE | APR_EXCL
+                         | APR_BUFFERED, p);
+    if (rv != APR_SUCCESS)
+        return rv;
+
+    memcpy(w->h.magic, ORDINAL_MAGIC, sizeof(w->h.magic));
+    w->h.version = ORDINAL_VERSION;
+    w->h.index_mtime = index_mtime;
+    w->h.index_size = index_size;
+
+    w->records = apr_array_make(p, 1024, sizeof(ordinal_record));
+    mbox_varbuf_init(p, &w->strings, 64 * 1024);
+
+    *wp = w;
+    return APR_SUCCESS;
+}
+
+void mbox_ordinal_add(mbox_ordinal_writer_t *w, apr_time_t date,
+                      const char *msgID)
+{
+    ordinal_record *rec = apr_array_push(w->records);
+
+    if (!msgID)
+        msgID = "";
+    rec->date = date;
+    rec->msgid = (apr_uint32_t) w->strings.len;
+    rec->reserved = 0;
+    mbox_varbuf_strmemcat(&w->strings, msgID, strlen(msgID) + 1);
+}
+
+apr_status_t mbox_ordinal_commit(mbox_ordinal_writer_t *w)
+{
+    apr_size_t n;
+    apr_status_t rv;
+
+    while (w->strings.len % 8)
+        mbox_varbuf_strmemcat(&w->strings, "", 1);
+
+    if (w->strings.len > APR_UINT32_MAX) {
+        mbox_ordinal_abort(w);
+        return APR_ENOSPC;
+    }
+
+    w->h.nrecords = w->records->nelts;
+    w->h.strings_len = w->strings.len;
+
+    rv = apr_file_write_full(w->f, &w->h, sizeof(ordinal_header), &n);
+    if (rv == APR_SUCCESS && w->records->nelts)
+        rv = apr_file_write_full(w->f, w->records->elts,
+                                 w->records->nelts * sizeof(ordinal_record),
+                                 &n);
+    if (rv == APR_SUCCESS && w->strings.len)
+        rv = apr_file_write_full(w->f, w->strings.buf, w->strings.len, &n);
+
+    if (rv == APR_SUCCESS)
+        rv = apr_file_close(w->f);
+    else
+        apr_file_close(w->f);
+    w->f = NULL;
+    if (rv == APR_SUCCESS) {
+        /* Temporary files are only readable by their owner. */
+        apr_file_perms_set(w->tmp, ORDINAL_PERMS);
+        rv = apr_file_rename(w->tmp, w->path, w->pool);
+    }
+    if (rv != APR_SUCCESS) {
+        mbox_ordinal_abort(w);
+        return rv;
+    }
+
+    w->tmp = NULL;
+    return APR_SUCCESS;
+}
+
+void mbox_ordinal_abort(mbox_ordinal_writer_t *w)
+{
+    if (w->f) {
+        apr_file_close(w->f);
+        w->f = NULL;
+    }
+    if (w->tmp) {
+        apr_file_remove(w->tmp, w->pool);
+        w->tmp = NULL;
+    }
+}
+
+/* Reader */
+
+apr_status_t mbox_ordinal_open(mbox_ordinal_t **ordp, apr_pool_t *p,
+                               const char *path)
+{
+    mbox_ordinal_t *ord;
+    apr_file_t *f;
+    apr_finfo_t finfo;
+    apr_mmap_t *mm;
+    const ordinal_header *h;
+    const char *base;
+    apr_uint64_t size;
+    apr_status_t rv;
+
+    rv = apr_file_open(&f, apr_pstrcat(p, path, MBOX_ORDINAL_SUFFIX, NULL),
+                       APR_READ, APR_OS_DEFAULT, p);
+    if (rv != APR_SUCCESS)
+        return APR_STATUS_IS_ENOENT(rv) ? APR_NOTFOUND : rv;
+
+    rv = apr_file_info_get(&finfo, APR_FINFO_SIZE, f);
+    if (rv == APR_SUCCESS && finfo.size < (apr_off_t) sizeof(ordinal_header))
+        rv = APR_EGENERAL;
+    if (rv == APR_SUCCESS)
+        rv = apr_mmap_create(&mm, f, 0, finfo.size, APR_MMAP_READ, p);
+    apr_file_close(f);
+    if (rv != APR_SUCCESS)
+        return rv;
+
+    base = mm->mm;
+    size = finfo.size;
+    h = (const ordinal_header *) base;
+
+    /* Tables of an older format are written again by mod-mbox-util. */
+    if (memcmp(h->magic, ORDINAL_MAGIC, sizeof(h->magic)) == 0
+        && h->version != ORDINAL_VERSION) {
+        apr_mmap_delete(mm);
+        return APR_NOTFOUND;
+    }
+
+    /* The records and the strings are all there is after the header. */
+    if (memcmp(h->magic, ORDINAL_MAGIC, sizeof(h->magic)) != 0
+        || h->strings_len % 8
+        || size - sizeof(ordinal_header)
+           < (apr_uint64_t) h->nrecords * sizeof(ordinal_record)
+        || size - sizeof(ordinal_header)
+           - (apr_uint64_t) h->nrecords * sizeof(ordinal_record)
+           != h->strings_len
+        || (h->strings_len && base[size - 1])
+        || (!h->strings_len && h->nrecords)) {
+        apr_mmap_delete(mm);
+        return APR_EGENERAL;
+    }
+
+    ord = apr_pcalloc(p, sizeof(mbox_ordinal_t));
+    ord->h = h;
+    ord->records = (const ordinal_record *) (base + sizeof(ordinal_header));
+    ord->strings = base + size - h->strings_len;
+
+    *ordp = ord;
+    return APR_SUCCESS;
+}
+
+int mbox_ordinal_matches(const mbox_ordinal_t *ord, apr_time_t index_mtime,
+                         apr_off_t index_size)
+{
+    return ord->h->index_mtime == index_mtime
+        && ord->h->index_size == index_size;
+}
+
+apr_uint32_t mbox_ordinal_count(const mbox_ordinal_t *ord)
+{
+    return ord->h->nrecords;
+}
+
+apr_time_t mbox_ordinal_date(const mbox_ordinal_t *ord, apr_uint32_t ordinal)
+{
+    if (ordinal >= ord->h->nrecords)
+        return 0;
+    return ord->records[ordinal].date;
+}
+
+const char *mbox_ordinal_msgid(const mbox_ordinal_t *ord,
+                               apr_uint32_t ordinal)
+{
+    apr_uint32_t off;
+
+    if (ordinal >= ord->h->nrecords)
+        return "";
+    off = ord->records[ordinal].msgid;
+    return off < ord->h->strings_len ? ord->strings + off : "";
+}
+
+apr_uint32_t mbox_ordinal_find(const mbox_ordinal_t *ord, apr_time_t date)
+{
+    apr_uint32_t lo = 0, hi = ord->h->nrecords, mid;
+
+    while (lo < hi) {
+        mid = lo + (hi - lo) / 2;
+        if (ord->records[mid].date < date)
+            lo = mid + 1;
+        else
+            hi = mid;
+    }
+    return lo;
+}
+
+apr_uint32_t mbox_ordinal_after(const mbox_ordinal_t *ord, apr_time_t date,
+                                const char *msgID)
+{
+    apr_time_t sec = apr_time_sec(date);
+    apr_uint32_t i, end;
+
+    /* The messages of that second, then the one looked for among them. */
+    i = mbox_ordinal_find(ord, apr_time_from_sec(sec));
+    end = mbox_ordinal_find(ord, apr_time_from_sec(sec + 1));
+    for (; i < end; i++) {
+        if (strcmp(mbox_ordinal_msgid(ord, i), msgID) == 0)
+            return i + 1;
+    }
+    return end;
+}
@@ -0,0 +1,88 @@
+/* Licensed to the Apache Software Foundation (ASF) under one or more
+ * contributor license agreements.  See the NOTICE file distributed with
+ * this work for additional information regarding copyright ownership.
+ * The ASF licenses this file to You under the Apache License, Version 2.0
+ * (the "License"); you may not use this file except in compliance with
+ * the License.  You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef MBOX_ORDINAL_H
+#define MBOX_ORDINAL_H
+
+/*
+ * Ordinal indexes.  The message index of a mailbox is keyed by
+ * Message-ID, and can only be read in whole otherwise.  mod-mbox-util
+ * writes next to it a table of its messages in the order of their dates,
+ * one record per message, so that the module finds the message at a
+ * position (its ordinal, as in the Message-ID index and the columns)
+ * with a lookup, and the first message of a date with a binary search.
+ */
+
+#include "apr.h"
+#include "apr_pools.h"
+#include "apr_time.h"
+
+#define MBOX_ORDINAL_SUFFIX ".ord"
+
+typedef struct mbox_ordinal mbox_ordinal_t;
+
+typedef struct mbox_ordinal_writer mbox_ordinal_writer_t;
+
+/* Opens the ordinal index of the mailbox at path.  Returns APR_NOTFOUND
+ * if there is none, or only of an older format.
+ */
+apr_status_t mbox_ordinal_open(mbox_ordinal_t **ord, apr_pool_t *p,
+                               const char *path);
+
+/* Returns 1 if the table was written from the given version of the
+ * message index (see mbox_index_stat()).
+ */
+int mbox_ordinal_matches(const mbox_ordinal_t *ord, apr_time_t index_mtime,
+                         apr_off_t index_size);
+
+/* Returns the number of messages, and the date and Message-ID of one
+ * (0 and "" past the last).
+ */
+apr_uint32_t mbox_ordinal_count(const mbox_ordinal_t *ord);
+apr_time_t mbox_ordinal_date(const mbox_ordinal_t *ord, apr_uint32_t ordinal);
+const char *mbox_ordinal_msgid(const mbox_ordinal_t *ord,
+                               apr_uint32_t ordinal);
+
+/* Returns the ordinal of the first message sent at date or later, or the
+ * number of messages if there is none.
+ */
+apr_uint32_t mbox_ordinal_find(const mbox_ordinal_t *ord, apr_time_t date);
+
+/* Returns the ordinal of the message after the one of the given date (to
+ * the second) and Message-ID.  If there is none such, the messages of
+ * that second are taken as before it.
+ */
+apr_uint32_t mbox_ordinal_after(const mbox_ordinal_t *ord, apr_time_t date,
+                                const char *msgID);
+
+/* Starts writing the ordinal index of the mailbox at path.  Nothing
+ * replaces the current one (if any) until mbox_ordinal_commit().
+ */
+apr_status_t mbox_ordinal_create(mbox_ordinal_writer_t **w, apr_pool_t *p,
+                                 const char *path, apr_time_t index_mtime,
+                                 apr_off_t index_size);
+
+/* Adds a message, after those of earlier dates. */
+void mbox_ordinal_add(mbox_ordinal_writer_t *w, apr_time_t date,
+                      const char *msgID);
+
+/* Replaces the current index with the one written. */
+apr_status_t mbox_ordinal_commit(mbox_ordinal_writer_t *w);
+
+/* Throws the index written away. */
+void mbox_ordinal_abort(mbox_ordinal_writer_t *w);
+
+#endif
@@ -0,0 +1,1507 @@
+/* Licensed to the Apache Software Foundation (ASF) under one or more
+ * contributor license agreements.  See the NOTICE file distributed with
+ * this work for additional information regarding copyright ownership.
+ * The ASF licenses this file to You under the Apache License, Version 2.0
+ * (the "License"); you may not use this file except in compliance with
+ * the License.  You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+/* Request independent pages.
+ */
+
+#include "mbox_page.h"
+
+#include "apr_file_info.h"
+#include "apr_fnmatch.h"
+#include "apr_lib.h"
+#include "apr_strings.h"
+#include "apr_time.h"
+
+#include <stdlib.h>
+#include <string.h>
+
+static const char *mbox_months[12][2] = {
+    {"Jan", "January"},
+    {"Feb", "February"},
+    {"Mar", "March"},
+    {"Apr", "April"},
+    {"May", "May"},
+    {"Jun", "June"},
+    {"Jul", "July"},
+    {"Aug", "August"},
+    {"Sep", "September"},
+    {"Oct", "October"},
+    {"Nov", "November"},
+    {"Dec", "December"}
+};
+
+/* Compare two file entries (in reverse order).
+ *
+ * This function is only Used when sorting file list to :
+ *  200501
+ *  200412
+ *  200411
+ */
+static int filename_rsort(const void *fn1, const void *fn2)
+{
+    mbox_file_t *f1 = (mbox_file_t *) fn1;
+    mbox_file_t *f2 = (mbox_file_t *) fn2;
+
+    return strcmp(f2->filename, f1->filename);
+}
+
+apr_status_t mbox_boxes_list(apr_array_header_t **files, apr_pool_t *p,
+                             mbox_cache_info *mli, const char *path)
+{
+    apr_status_t rv = APR_SUCCESS;
+    apr_finfo_t finfo;
+    apr_dir_t *dir;
+    mbox_file_t *fi;
+    apr_array_header_t *list;
+
+    *files = NULL;
+
+    if (!mli) {
+        return APR_NOTFOUND;
+    }
+
+    rv = apr_dir_open(&dir, path, p);
+    if (rv != APR_SUCCESS) {
+        return rv;
+    }
+
+    /* 15 Years of Mail Archives */
+    list = apr_array_make(p, 15 * 12, sizeof(mbox_file_t));
+
+    /* Foreach file in the directory, add its name and the message
+       count to our array */
+    while (apr_dir_read(&finfo, APR_FINFO_NAME, dir) == APR_SUCCESS) {
+        if ((apr_fnmatch("*.mbox", finfo.name, 0) == APR_SUCCESS) &&
+            (strstr(finfo.name, "incomplete") == NULL)) {
+            fi = (mbox_file_t *) apr_array_push(list);
+            fi->filename = apr_pstrdup(p, finfo.name);
+            mbox_cache_get_count(mli, &(fi->count), (char *) finfo.name);
+        }
+    }
+
+    apr_dir_close(dir);
+
+    if (list->nelts == 0) {
+        return APR_NOTFOUND;
+    }
+
+    /* Sort by reverse filename order */
+    qsort((void *) list->elts, list->nelts, sizeof(mbox_file_t),
+          filename_rsort);
+
+    *files = list;
+    return APR_SUCCESS;
+}
+
+int mbox_is_past_month(const char *box)
+{
+    apr_time_exp_t now;
+    char month[7];
+    int i;
+
+    for (i = 0; i < 6; i++) {
+        if (!apr_isdigit(box[i])) {
+            return 0;
+        }
+    }
+    if (strcmp(box + 6, ".mbox") != 0) {
+        return 0;
+    }
+
+    apr_time_exp_gmt(&now, apr_time_now());
+    apr_snprintf(month, sizeof(month), "%04d%02d",
+                 now.tm_year + 1900, now.tm_mon + 1);
+
+    return strncmp(box, month, 6) < 0;
+}
+
+/* What an include file is, for the version of the settings */
+static const char *include_version(apr_pool_t *p, const char *path)
+{
+    apr_finfo_t finfo;
+
+    if (!path) {
+        return "";
+    }
+    if (apr_stat(&finfo, path, APR_FINFO_MTIME | APR_FINFO_SIZE, p)
+        != APR_SUCCESS) {
+        return path;
+    }
+    return apr_psprintf(p, "%s %" APR_TIME_T_FMT " %" APR_OFF_T_FMT, path,
+                        finfo.mtime, finfo.size);
+}
+
+const char *mbox_page_cfg_version(apr_pool_t *p, const mbox_page_cfg_t *cfg)
+{
+    return apr_psprintf(p, "%d %d %s %s %s %s %s",
+                        cfg->antispam, cfg->hide_empty,
+                        cfg->root_path ? cfg->root_path : "",
+                        cfg->style_path ? cfg->style_path : "",
+                        cfg->script_path ? cfg->script_path : "",
+                        include_version(p, cfg->header_include_file),
+                        include_version(p, cfg->footer_include_file));
+}
+
+const char *mbox_boxes_version(apr_pool_t *p, apr_array_header_t *files)
+{
+    const char *s = "";
+    int i;
+
+    for (i = 0; files && i < files->nelts; i++) {
+        mbox_file_t *fi = &APR_ARRAY_IDX(files, i, mbox_file_t);
+
+        /* Whether a month is empty decides if it is listed at all. */
+        if (mbox_is_past_month(fi->filename)) {
+            s = apr_psprintf(p, "%s%s %d\n", s, fi->filename, fi->count);
+        }
+        else {
+            s = apr_psprintf(p, "%s%s %s\n", s, fi->filename,
+                             fi->count ? "open" : "empty");
+        }
+    }
+    return s;
+}
+
+/* Writes a file out as it is */
+static apr_status_t page_include(mbox_out_t *out, const char *fname)
+{
+    apr_file_t *f;
+    apr_status_t rv;
+    apr_size_t len;
+    char buf[8192];
+
+    rv = apr_file_open(&f, fname, APR_READ, APR_OS_DEFAULT, out->pool);
+    if (rv != APR_SUCCESS) {
+        return rv;
+    }
+
+    do {
+        len = sizeof(buf);
+        rv = apr_file_read(f, buf, &len);
+        mbox_out_write(out, buf, len);
+    } while (rv == APR_SUCCESS && out->status == APR_SUCCESS);
+
+    apr_file_close(f);
+    return rv == APR_EOF ? APR_SUCCESS : rv;
+}
+
+static apr_status_t page_header_includes(mbox_out_t *out,
+                                         const mbox_page_cfg_t *cfg)
+{
+    apr_status_t rv;
+
+    if (cfg->header_include_file) {
+        rv = page_include(out, cfg->header_include_file);
+        if (rv != APR_SUCCESS) {
+            return rv;
+        }
+    }
+
+    if (cfg->style_path) {
+        mbox_out_printf(out,
+                        "  <link rel=\"stylesheet\" type=\"text/css\" href=\"%s\" />\n",
+                        cfg->style_path);
+    }
+    return APR_SUCCESS;
+}
+
+static apr_status_t page_footer_includes(mbox_out_t *out,
+                                         const mbox_page_cfg_t *cfg)
+{
+    apr_status_t rv;
+
+    if (cfg->footer_include_file) {
+        rv = page_include(out, cfg->footer_include_file);
+        if (rv != APR_SUCCESS) {
+            return rv;
+        }
+    }
+
+    if (cfg->script_path) {
+        mbox_out_printf(out,
+                        "  <script type=\"text/javascript\" src=\"%s\"></script>\n",
+                        cfg->script_path);
+    }
+    return APR_SUCCESS;
+}
+
+apr_status_t mbox_page_header(mbox_out_t *out, const mbox_page_cfg_t *cfg,
+                              const char *title, const char *h1)
+{
+    apr_status_t rv;
+
+    if (!h1)
+        h1 = title;
+    mbox_out_printf(out,
+                    "<!DOCTYPE html>\n"
+                    "<html>\n"
+                    " <head>\n"
+                    "  <meta http-equiv=\"Content-Type\" "
+                        "content=\"text/html; charset=utf-8\" />\n"
+                    "  <title>%s</title>\n",
+                    title);
+
+    rv = page_header_includes(out, cfg);
+    if (rv != APR_SUCCESS) {
+        return rv;
+    }
+
+    mbox_out_puts(out, " </head>\n"
+                  " <body id=\"archives\">\n");
+    mbox_out_puts(out, " <div id=\"cont\">\n");
+
+    mbox_out_printf(out, "  <h1>%s</h1>\n\n", h1);
+    return APR_SUCCESS;
+}
+
+apr_status_t mbox_page_message_header(mbox_out_t *out,
+                                      const mbox_page_cfg_t *cfg,
+                                      const char *subject,
+                                      const char *base_path,
+                                      const char *base_name)
+{
+    apr_status_t rv;
+
+    rv = mbox_page_header(out, cfg, subject,
+                          apr_psprintf(out->pool, "%s mailing list archives",
+                                       base_name));
+    if (rv != APR_SUCCESS) {
+        return rv;
+    }
+
+    mbox_out_puts(out, "  <h5>\n");
+
+    if (cfg->root_path) {
+        mbox_out_printf(out, "<a href=\"%s\" title=\"Back to the archives depot\">"
+                        "Site index</a> &middot; ", cfg->root_path);
+    }
+
+    mbox_out_printf(out, "<a href=\"%s\" title=\"Back to the list index\">"
+                    "List index</a></h5>", base_path);
+    return APR_SUCCESS;
+}
+
+void mbox_page_message_footer(mbox_out_t *out)
+{
+    mbox_out_puts(out, " </div><!-- /#cont -->\n");
+    mbox_out_puts(out, " </body>\n");
+    mbox_out_puts(out, "</html>\n");
+}
+
+/* Outputs a static XHTML list of available mailboxes */
+static void page_boxlist(mbox_out_t *out, const mbox_page_cfg_t *cfg,
+                         apr_array_header_t *files, const char *box,
+                         const char *base_path, const char *path_info)
+{
+    mbox_file_t *fi;
+    int i;
+
+    mbox_out_puts(out, "  <div id=\"boxlist-outer\">\n");
+
+    mbox_out_puts(out, "  <h5>\n");
+    if (cfg->root_path) {
+        mbox_out_printf(out, "<a href=\"%s\" title=\"Back to the archives depot\">"
+                        "Site index</a> &middot; ", cfg->root_path);
+    }
+    mbox_out_printf(out, "<a href=\"%s\" title=\"Back to the list index\">"
+                    "List index</a>", base_path);
+    mbox_out_puts(out, "</h5>\n\n");
+
+    mbox_out_puts(out, "  <div id=\"boxlist-inner\">\n");
+
+    mbox_out_puts(out, "  <table id=\"boxlist\">\n");
+    mbox_out_puts(out, "   <thead><tr><th class=\"box\">Month</th><th class=\"msgcount\">Count</th></tr></thead>\n");
+    mbox_out_puts(out, "   <tbody>\n");
+
+    fi = (mbox_file_t *) files->elts;
+
+    for (i = 0; i < files->nelts; i++) {
+        if (fi[i].count || !cfg->hide_empty) {
+            int month = atoi(apr_pstrndup(out->pool, fi[i].filename + 4, 2));
+
+            if (strcmp(box, fi[i].filename) == 0) {
+                mbox_out_puts(out, "   <tr class=\"active\">");
+            }
+            else {
+                mbox_out_puts(out, "   <tr>");
+            }
+
+            mbox_out_printf(out,
+                            "    <td class=\"box\"><a href=\"%s/%s%s\" title=\"Browse %s %.4s archives\">"
+                            "%s %.4s</a></td><td class=\"msgcount\">%s</td>\n",
+                            base_path, fi[i].filename, path_info,
+                            mbox_months[month - 1][1], fi[i].filename,
+                            mbox_months[month - 1][0], fi[i].filename,
+                            cfg->exported
+                            && !mbox_is_past_month(fi[i].filename) ? ""
+                            : apr_itoa(out->pool, fi[i].count));
+
+            mbox_out_puts(out, "   </tr>\n");
+        }
+    }
+
+    mbox_out_puts(out, "   </tbody>\n");
+    mbox_out_puts(out, "  </table>\n");
+    mbox_out_puts(out, "  </div><!-- /#boxlist-inner -->\n");
+    mbox_out_puts(out, "  </div><!-- /#boxlist-outer -->\n");
+}
+
+/* Outputs an XHTML list of available mailboxes */
+static void page_index_boxlist(mbox_out_t *out, const mbox_page_cfg_t *cfg,
+                               apr_array_header_t *files)
+{
+    mbox_file_t *fi;
+    int side = 0, year_hdr = 0, i;
+
+    mbox_out_puts(out, "  <table id=\"grid\">\n");
+
+    fi = (mbox_file_t *) files->elts;
+
+    for (i = 0; i < files->nelts; i++) {
+        /* Only display an entry if it has messages or if we don't
+           hide empty mailboxes */
+        if (fi[i].count || !cfg->hide_empty) {
+            if (!year_hdr) {
+                if (!side) {
+                    mbox_out_puts(out, "  <tr><td class=\"left\">\n");
+                    side = 1;
+                }
+                else {
+                    mbox_out_puts(out, "  <td class=\"right\">\n");
+                    side = 0;
+                }
+
+                mbox_out_puts(out, "   <div class=\"year-cont\">\n");
+                mbox_out_puts(out, "   <table class=\"year\">\n");
+                mbox_out_puts(out, "    <thead><tr>\n");
+                mbox_out_printf(out, "     <th colspan=\"3\">Year %.4s</th>\n",
+                                fi[i].filename);
+                mbox_out_puts(out, "    </tr></thead>\n");
+                mbox_out_puts(out, "    <tbody>\n");
+
+                year_hdr = 1;
+            }
+
+            mbox_out_puts(out, "    <tr>\n");
+            mbox_out_printf(out, "     <td class=\"date\">%s %.4s</td>\n",
+                            mbox_months[atoi(apr_pstrndup(out->pool,
+                                                          fi[i].filename + 4,
+                                                          2)) - 1][0],
+                            fi[i].filename);
+            mbox_out_printf(out,
+                            "     <td class=\"links\"><span class=\"links\" id=\"%.4s%.2s\">"
+                            "<a href=\"%.4s%.2s.mbox/thread\">Thread</a>"
+                            " &middot; <a href=\"%.4s%.2s.mbox/date\">Date</a>"
+                            " &middot; <a href=\"%.4s%.2s.mbox/author\">Author</a></span></td>\n",
+                            fi[i].filename, fi[i].filename + 4, fi[i].filename,
+                            fi[i].filename + 4, fi[i].filename,
+                            fi[i].filename + 4, fi[i].filename,
+                            fi[i].filename + 4);
+            mbox_out_printf(out, "     <td class=\"msgcount\">%d</td>\n",
+                            fi[i].count);
+            mbox_out_puts(out, "    </tr>\n");
+        }
+
+        /* Year separation */
+        if (i + 1 < files->nelts && year_hdr
+            && (fi[i].filename[3] != fi[i + 1].filename[3])) {
+            mbox_out_puts(out, "    </tbody>\n");
+            mbox_out_puts(out, "   </table>\n");
+            mbox_out_puts(out, "   </div><!-- /.year-cont -->\n");
+            if (side) {
+                mbox_out_puts(out, "  </td>\n");
+            }
+            else {
+                mbox_out_puts(out, "  </td></tr>\n\n");
+            }
+
+            year_hdr = 0;
+        }
+    }
+
+    mbox_out_puts(out, "    </tbody>\n");
+    mbox_out_puts(out, "   </table>\n\n");
+
+    if (side) {
+        mbox_out_puts(out, "  </td><td class=\"right\"></td></tr>\n");
+    }
+
+    mbox_out_puts(out, "  </table>\n\n");
+}
+
+/* Display an XHTML message list entry */
+static void static_msglist_entry(mbox_out_t *out, Message *m, int linked,
+                                 int depth, int antispam)
+{
+    const char *tmp;
+    int i;
+
+    /* Message author */
+    mbox_out_puts(out, "   <tr>\n");
+
+    tmp = antispam ? m->html_name_antispam : m->html_name;
+
+    if (linked) {
+        mbox_out_printf(out, "    <td class=\"author\">%s</td>\n", tmp);
+    }
+    else {
+        mbox_out_puts(out, "    <td class=\"author\"></td>\n");
+    }
+
+    /* Subject, linked or not */
+    mbox_out_puts(out, "     <td class=\"subject\">");
+    for (i = 0; i < depth; i++) {
+        mbox_out_puts(out, "&nbsp;&nbsp;");
+    }
+
+    if (linked) {
+        mbox_out_printf(out, "<a id=\"%s\" href=\"%s\">", m->uri_msgID,
+                        m->uri_msgID);
+    }
+
+    mbox_out_puts(out, m->html_subject);
+    if (linked) {
+        mbox_out_puts(out, "</a>");
+    }
+    mbox_out_puts(out, "     </td>\n");
+
+    /* Message date */
+    if (linked) {
+        mbox_out_printf(out, "    <td class=\"date\">%s</td>\n",
+                        ESCAPE_OR_BLANK(out->pool, m->str_date));
+    }
+    else {
+        mbox_out_puts(out, "    <td class=\"date\"></td>\n");
+    }
+
+    mbox_out_puts(out, "   </tr>\n");
+}
+
+/* Display an XML message list entry */
+static void xml_msglist_entry(mbox_out_t *out, Message *m, int linked,
+                              int depth, int antispam)
+{
+    const char *from;
+
+    from = antispam ? m->html_name_antispam : m->html_name;
+
+    mbox_out_printf(out, " <message linked=\"%d\" depth=\"%d\" id=\"%s\">\n",
+                    linked, depth, ESCAPE_OR_BLANK(out->pool, m->msgID));
+
+    mbox_out_printf(out, "  <from><![CDATA[%s]]></from>\n", from);
+    mbox_out_printf(out, "  <date><![CDATA[%s]]></date>\n",
+                    ESCAPE_OR_BLANK(out->pool, m->str_date));
+
+    mbox_out_printf(out, "  <subject><![CDATA[%s]]></subject>\n",
+                    m->html_subject);
+    mbox_out_printf(out, " </message>\n");
+}
+
+static void msglist_entry(mbox_out_t *out, Message *m, int linked,
+                          int depth, int mode, int antispam)
+{
+    if (mode == MBOX_OUTPUT_STATIC) {
+        static_msglist_entry(out, m, linked, depth, antispam);
+    }
+    else {
+        xml_msglist_entry(out, m, linked, depth, antispam);
+    }
+}
+
+/* Display a threaded message list for Container 'c' */
+static void msglist_thread(mbox_out_t *out, Container *c, int depth,
+                           int mode, int antispam)
+{
+    Message *m;
+    int linked = 1;
+
+    /* Under the rules of our threading tree, if we do not have a
+     * message, we MUST have at least one child.  Therefore, print
+     * that child's subject when we don't have a message.
+     */
+
+    if (c->message) {
+        m = c->message;
+    }
+    else {
+        m = c->child->message;
+        linked = 0;
+    }
+
+    msglist_entry(out, m, linked, depth, mode, antispam);
+
+    /* Display children :
+     * Subject
+     *  +-> Re: Subject */
+    if (c->child) {
+        msglist_thread(out, c->child, depth + 1, mode, antispam);
+    }
+
+    /* Display follow-ups :
+     * Subject
+     *  +-> ...
+     *  | +-> ...
+     *  +-> Re: Subject */
+    if (depth && c->next) {
+        msglist_thread(out, c->next, depth, mode, antispam);
+    }
+}
+
+void mbox_msglist_init(mbox_msglist_t *l, apr_pool_t *p, MBOX_LIST *head,
+                       int count, int sortFlags)
+{
+    Container *c;
+
+    l->sort = sortFlags;
+    l->head = NULL;
+    l->threads = NULL;
+    l->first = -1;
+    l->count = count;
+    l->prev = NULL;
+    l->next = NULL;
+
+    /* Compute the page count, depending on the sort flags */
+    if (sortFlags != MBOX_SORT_THREAD) {
+        l->head = mbox_sort_list(head, sortFlags);
+
+        l->pages = count / DEFAULT_MSGS_PER_PAGE;
+        if (count > l->pages * DEFAULT_MSGS_PER_PAGE) {
+            l->pages++;
+        }
+    }
+    else {
+        l->threads = calculate_threads(p, head);
+        c = l->threads;
+        count = 0;
+
+        while (c) {
+            c = c->next;
+            count++;
+        }
+
+        l->pages = count / DEFAULT_THREADS_PER_PAGE;
+        if (count > l->pages * DEFAULT_THREADS_PER_PAGE) {
+            l->pages++;
+        }
+    }
+}
+
+const char *mbox_msglist_cursor(apr_pool_t *p, apr_time_t date,
+                                const char *msgID)
+{
+    return apr_psprintf(p, "after=%" APR_TIME_T_FMT ",%s",
+                        apr_time_sec(date), mbox_escape_msgid(p, msgID));
+}
+
+void mbox_page_msglist_entries(mbox_out_t *out, const mbox_msglist_t *l,
+                               int current_page, int mode, int antispam)
+{
+    MBOX_LIST *head;
+    Container *c;
+    int i = 0;
+
+    /* For date or author sorts */
+    if (l->sort != MBOX_SORT_THREAD) {
+        head = l->head;
+
+        /* Pass useless messages */
+        while (head && (i < current_page * DEFAULT_MSGS_PER_PAGE)) {
+            head = head->next;
+            i++;
+        }
+
+        /* Display current_page's messages */
+        while (head && (i < (current_page + 1) * DEFAULT_MSGS_PER_PAGE)) {
+            msglist_entry(out, (Message *) head->value, 1, 0, mode,
+                          antispam);
+
+            head = head->next;
+            i++;
+        }
+    }
+
+    /* For threaded view */
+    else {
+        c = l->threads;
+
+        /* Pass useless threads */
+        while (c && (i < current_page * DEFAULT_THREADS_PER_PAGE)) {
+            c = c->next;
+            i++;
+        }
+
+        /* Display current_page's threads */
+        while (c && (i < (current_page + 1) * DEFAULT_THREADS_PER_PAGE)) {
+            msglist_thread(out, c, 0, mode, antispam);
+            c = c->next;
+            i++;
+        }
+    }
+}
+
+static void link_if_not_active(mbox_out_t *out, int is_active,
+                               const char *label,
+                               const char *prefix, const char *suffix,
+                               const char *part1, const char *part2,
+                               const char *part3, const char *part4)
+{
+    if (is_active) {
+        mbox_out_printf(out, "%s%s%s", prefix, label, suffix);
+    } else {
+        mbox_out_printf(out, "%s<a href=\"%s%s%s%s\">%s</a>%s",
+                        prefix, part1, part2, part3, part4, label, suffix);
+    }
+}
+
+/* The link to a page of a list, as the module serves it (VIEW?N), or as
+ * it is exported (VIEW_N, and VIEW for the first).
+ */
+static void link_page(mbox_out_t *out, int is_active, const char *label,
+                      const char *prefix, const char *suffix,
+                      const char *baseURI, const char *path_info, int page,
+                      int exported)
+{
+    if (exported && page == 0) {
+        link_if_not_active(out, is_active, label, prefix, suffix, baseURI,
+                           path_info, "", "");
+    }
+    else {
+        link_if_not_active(out, is_active, label, prefix, suffix, baseURI,
+                           path_info, exported ? "_" : "?",
+                           apr_itoa(out->pool, page));
+    }
+}
+
+/* Display the page selector.
+ *
+ * FIXME: improve the algorithm in order to handle long pages list.
+ */
+static void msglist_page_selector(mbox_out_t *out, const char *baseURI,
+                                  const char *path_info, int pages,
+                                  int current_page, int exported)
+{
+    /* If we don't have more than one page, the page selector is useless. */
+    if (pages == 1) {
+        mbox_out_printf(out, "<span class=\"num-pages\">Showing page %d of %d</span>\n",
+                        current_page + 1, pages);
+    } else {
+        mbox_out_puts(out, "<span class=\"pagination\">");
+        link_page(out, current_page == 0, "&laquo; Previous Page",
+                  "<span id=\"prev-page\">", "</span>",
+                  baseURI, path_info, current_page - 1, exported);
+
+        for (int i = 0; i < pages; i++) {
+            mbox_out_puts(out, " &middot; ");
+            link_page(out, current_page == i, apr_itoa(out->pool, i + 1),
+                      "", "", baseURI, path_info, i, exported);
+        }
+        mbox_out_puts(out, " &middot; ");
+        link_page(out, current_page + 1 >= pages, "Next Page &raquo;",
+                  "<span id=\"next-page\">", "</span>",
+                  baseURI, path_info, current_page + 1, exported);
+        mbox_out_puts(out, "</span>\n");
+    }
+}
+
+/* Display the selector of a page that starts at a cursor. */
+static void msglist_cursor_selector(mbox_out_t *out, const char *baseURI,
+                                    const char *path_info,
+                                    const mbox_msglist_t *l)
+{
+    MBOX_LIST *head;
+    int shown = 0;
+
+    for (head = l->head; head; head = head->next) {
+        shown++;
+    }
+
+    mbox_out_puts(out, "<span class=\"pagination\">");
+    link_if_not_active(out, !l->prev, "&laquo; Previous Page",
+                       "<span id=\"prev-page\">", "</span>",
+                       baseURI, path_info, "?", l->prev ? l->prev : "");
+    if (shown) {
+        mbox_out_printf(out, " &middot; Messages %d to %d of %d &middot; ",
+                        l->first + 1, l->first + shown, l->count);
+    }
+    else {
+        mbox_out_printf(out, " &middot; No more messages of %d &middot; ",
+                        l->count);
+    }
+    link_if_not_active(out, !l->next, "Next Page &raquo;",
+                       "<span id=\"next-page\">", "</span>",
+                       baseURI, path_info, "?", l->next ? l->next : "");
+    mbox_out_puts(out, "</span>\n");
+}
+
+static void msglist_nav(mbox_out_t *out, const char *baseURI, int sortFlags)
+{
+    mbox_out_puts(out, "   <tr>");
+    link_if_not_active(out, sortFlags == MBOX_SORT_AUTHOR, "Author",
+                       "<th class=\"author\">", "</th>", baseURI, "/",
+                       "author", "");
+    link_if_not_active(out, sortFlags == MBOX_SORT_THREAD, "Subject",
+                       "<th class=\"subject\">", "</th>", baseURI, "/",
+                       "thread", "");
+    link_if_not_active(out, sortFlags == MBOX_SORT_DATE, "Date",
+                       "<th class=\"date\">", "</th>", baseURI, "/",
+                       "date", "");
+    mbox_out_puts(out, "</tr>\n\n");
+}
+
+apr_status_t mbox_page_msglist(mbox_out_t *out, const mbox_page_cfg_t *cfg,
+                               const mbox_msglist_t *l,
+                               apr_array_header_t *files, const char *box,
+                               const char *base_uri, const char *base_path,
+                               const char *base_name, const char *path_info,
+                               int current_page)
+{
+    apr_status_t rv;
+    const char *month;
+    const char *year;
+
+    /* Determine the month and year of the list, if we can. */
+    if (apr_fnmatch("[0-9][0-9][0-9][0-9][0-9][0-9].mbox", box, 0)
+        == APR_SUCCESS) {
+        month = mbox_months[atoi(apr_pstrndup(out->pool, base_uri +
+                                              (strlen(base_uri) -
+                                               strlen(".mbox") - 2),
+                                              2)) - 1][1];
+        year = base_uri + (strlen(base_uri) - strlen(".mbox") - 6);
+    }
+    else {
+        month = "";
+        year = "";
+    }
+
+    rv = mbox_page_header(out, cfg,
+                          apr_psprintf(out->pool,
+                                       "%s mailing list archives: %s %.4s",
+                                       base_name, month, year),
+                          NULL);
+    if (rv != APR_SUCCESS) {
+        return rv;
+    }
+
+    /* Display box list */
+    if (files) {
+        page_boxlist(out, cfg, files, box, base_path, path_info);
+    }
+
+    mbox_out_puts(out, "  <div id=\"msglist-outer\">\n");
+    mbox_out_puts(out, "<h5>");
+    if (l->first >= 0) {
+        msglist_cursor_selector(out, base_uri, path_info, l);
+    }
+    else {
+        msglist_page_selector(out, base_uri, path_info, l->pages,
+                              current_page, cfg->exported);
+    }
+    mbox_out_puts(out, "</h5>");
+    if (l->sort == MBOX_SORT_DATE && !cfg->exported) {
+        mbox_out_printf(out, "  <form id=\"jump\" action=\"%s/date\" method=\"get\">\n",
+                        base_uri);
+        mbox_out_puts(out, "   <input type=\"text\" name=\"date\" size=\"10\" title=\"YYYY[-MM[-DD]]\" />\n");
+        mbox_out_puts(out, "   <input type=\"submit\" value=\"Jump to date\" />\n");
+        mbox_out_puts(out, "  </form>\n");
+    }
+    mbox_out_puts(out, "  <div id=\"msglist-inner\">\n");
+    mbox_out_puts(out, "  <table id=\"msglist\">\n");
+    mbox_out_puts(out, "  <thead>\n");
+    msglist_nav(out, base_uri, l->sort);
+    mbox_out_puts(out, "  </thead>\n");
+
+    mbox_out_puts(out, "   <tbody>\n");
+    mbox_page_msglist_entries(out, l, current_page, MBOX_OUTPUT_STATIC,
+                              cfg->antispam);
+    mbox_out_puts(out, "   </tbody>\n");
+    mbox_out_puts(out, "  <tfoot>\n");
+    msglist_nav(out, base_uri, l->sort);
+    mbox_out_puts(out, "  </tfoot>\n");
+    mbox_out_puts(out, "  </table>\n");
+    mbox_out_puts(out, "  </div><!-- /#msglist-inner -->\n");
+    mbox_out_puts(out, "  </div><!-- /#msglist-outer -->\n");
+
+    mbox_out_puts(out, " <div id=\"shim\"></div>\n");
+
+    rv = page_footer_includes(out, cfg);
+    if (rv != APR_SUCCESS) {
+        return rv;
+    }
+
+    mbox_out_puts(out, " </div><!-- /#cont -->\n");
+    mbox_out_puts(out, " </body>\n");
+    mbox_out_puts(out, "</html>");
+    return APR_SUCCESS;
+}
+
+apr_status_t mbox_page_index(mbox_out_t *out, const mbox_page_cfg_t *cfg,
+                             mbox_cache_info *mli, apr_array_header_t *files,
+                             const char *list_url)
+{
+    apr_status_t rv;
+    apr_pool_t *p = out->pool;
+    const char *list = ESCAPE_OR_BLANK(p, mli->list);
+    const char *domain = ESCAPE_OR_BLANK(p, mli->domain);
+    char dstr[APR_RFC822_DATE_LEN];
+
+    mbox_out_puts(out, "<!DOCTYPE html>\n");
+    mbox_out_puts(out, "<html>\n");
+    mbox_out_puts(out, " <head>\n");
+    mbox_out_puts(out,
+                  "  <meta http-equiv=\"Content-Type\" content=\"text/html; charset=utf-8\" />\n");
+    if (mli->list && mli->domain) {
+        mbox_out_printf(out, "  <title>%s@%s Archives</title>\n",
+                        list, domain);
+    }
+    else {
+        mbox_out_puts(out, "  <title>Mailing list archives</title>\n");
+    }
+
+    mbox_out_printf(out, "<link rel=\"alternate\" title=\"%s@%s Archives\" "
+                    "type=\"application/atom+xml\" href=\"%s%s\" />\n",
+                    list, domain, list_url,
+                    cfg->exported ? "index.atom" : "?format=atom");
+
+    rv = page_header_includes(out, cfg);
+    if (rv != APR_SUCCESS) {
+        return rv;
+    }
+
+    mbox_out_puts(out, " </head>\n\n");
+
+    mbox_out_puts(out, " <body id=\"archives\">\n");
+    mbox_out_printf(out, "  <h1>Mailing list archives: %s@%s</h1>\n",
+                    list, domain);
+
+    if (cfg->root_path) {
+        mbox_out_printf(out,
+                        "  <h5><a href=\"%s\" title=\"Back to the archives depot\">"
+                        "Site index</a></h5>\n\n", cfg->root_path);
+    }
+
+    /* Output header and list information */
+    mbox_out_puts(out, "  <table id=\"listinfo\">\n");
+    mbox_out_puts(out,
+                  "   <thead><tr><th colspan=\"2\">List information</th></tr></thead>\n");
+    mbox_out_puts(out, "   <tbody>\n");
+
+    mbox_out_printf(out, "    <tr><td class=\"left\">Writing to the list</td>"
+                    "<td class=\"right\">%s@%s</td></tr>\n", list, domain);
+
+    mbox_out_printf(out, "    <tr><td class=\"left\">Subscription address</td>"
+                    "<td class=\"right\">%s-subscribe@%s</td></tr>\n",
+                    list, domain);
+
+    mbox_out_printf(out,
+                    "    <tr><td class=\"left\">Digest subscription address</td>"
+                    "<td class=\"right\">%s-digest-subscribe@%s</td></tr>\n",
+                    list, domain);
+
+    mbox_out_printf(out, "    <tr><td class=\"left\">Unsubscription addresses</td>"
+                    "<td class=\"right\">%s-unsubscribe@%s</td></tr>\n",
+                    list, domain);
+
+    mbox_out_printf(out, "    <tr><td class=\"left\">Getting help with the list</td>"
+                    "<td class=\"right\">%s-help@%s</td></tr>\n",
+                    list, domain);
+
+    mbox_out_printf(out, "<tr><td class=\"left\">Feeds:</td>"
+                    "<td class=\"right\">"
+                    "<a href=\"%s\">Atom 1.0</a></td></tr>\n",
+                    cfg->exported ? "index.atom" : "?format=atom");
+
+    mbox_out_puts(out, "   </tbody>\n");
+    mbox_out_puts(out, "  </table>\n");
+
+    /* Display the box list */
+    page_index_boxlist(out, cfg, files);
+
+    apr_rfc822_date(dstr, mli->mtime);
+    mbox_out_printf(out, "<p id=\"lastupdated\">Last updated on: %s</p>\n",
+                    dstr);
+
+    rv = page_footer_includes(out, cfg);
+    if (rv != APR_SUCCESS) {
+        return rv;
+    }
+
+    mbox_out_puts(out, "  </body>\n");
+    mbox_out_puts(out, "</html>");
+    return APR_SUCCESS;
+}
+
+/* The search form.  lists is the pattern of the lists searched, or NULL
+ * for the search of a single list.
+ */
+static void search_form(mbox_out_t *out, const char *base_path,
+                        const char *query, const char *lists, int order)
+{
+    apr_pool_t *p = out->pool;
+
+    mbox_out_printf(out, "  <form id=\"search\" action=\"%ssearch\" method=\"get\">\n",
+                    base_path);
+    mbox_out_printf(out, "   <input type=\"text\" name=\"q\" size=\"50\" value=\"%s\" />\n",
+                    ESCAPE_OR_BLANK(p, query));
+    if (lists) {
+        mbox_out_printf(out, "   <input type=\"text\" name=\"lists\" size=\"20\" value=\"%s\" title=\"Lists searched, as a pattern\" />\n",
+                        ESCAPE_OR_BLANK(p, lists));
+    }
+    mbox_out_puts(out, "   <select name=\"sort\">\n");
+    mbox_out_printf(out, "    <option value=\"relevance\"%s>Most relevant first</option>\n",
+                    order == MBOX_FTS_BY_RELEVANCE ? " selected=\"selected\"" : "");
+    mbox_out_printf(out, "    <option value=\"date\"%s>Newest first</option>\n",
+                    order == MBOX_FTS_BY_DATE ? " selected=\"selected\"" : "");
+    mbox_out_puts(out, "   </select>\n");
+    mbox_out_puts(out, "   <input type=\"submit\" value=\"Search\" />\n");
+    mbox_out_puts(out, "  </form>\n\n");
+}
+
+/* The results, and the end of the page */
+static apr_status_t search_results(mbox_out_t *out,
+                                   const mbox_page_cfg_t *cfg,
+                                   const char *base_path,
+                                   const char *search_uri,
+                                   apr_array_header_t *hits, int page)
+{
+    apr_status_t rv;
+    apr_pool_t *p = out->pool;
+    const char *uri = mbox_escape_html(p, search_uri);
+    int first = page * MBOX_SEARCH_PER_PAGE;
+    int last = first + MBOX_SEARCH_PER_PAGE;
+    int i;
+
+    if (hits && hits->nelts <= first) {
+        mbox_out_puts(out, "  <p id=\"no-results\">No message matches your search.</p>\n");
+    }
+    else if (hits) {
+        mbox_fts_hit_t *hit = (mbox_fts_hit_t *) hits->elts;
+
+        mbox_out_puts(out, "  <div id=\"msglist-outer\">\n");
+        mbox_out_puts(out, "<h5><span class=\"pagination\">");
+        if (page > 0) {
+            mbox_out_printf(out, "<span id=\"prev-page\"><a href=\"%s&amp;page=%d\">"
+                            "&laquo; Previous Page</a></span> &middot; ",
+                            uri, page - 1);
+        }
+        mbox_out_printf(out, "Results %d to %d", first + 1,
+                        hits->nelts < last ? hits->nelts : last);
+        if (hits->nelts > last) {
+            mbox_out_printf(out, " &middot; <span id=\"next-page\"><a href=\"%s&amp;page=%d\">"
+                            "Next Page &raquo;</a></span>", uri, page + 1);
+        }
+        mbox_out_puts(out, "</span></h5>\n");
+
+        mbox_out_puts(out, "  <div id=\"msglist-inner\">\n");
+        mbox_out_puts(out, "  <table id=\"msglist\">\n");
+        mbox_out_puts(out, "  <thead>\n");
+        mbox_out_puts(out, "   <tr><th class=\"author\">Author</th>"
+                      "<th class=\"subject\">Subject</th>"
+                      "<th class=\"date\">Date</th></tr>\n");
+        mbox_out_puts(out, "  </thead>\n");
+        mbox_out_puts(out, "   <tbody>\n");
+        for (i = first; i < hits->nelts && i < last; i++) {
+            mbox_out_puts(out, "   <tr>\n");
+            mbox_out_printf(out, "    <td class=\"author\">%s</td>\n",
+                            cfg->antispam ? hit[i].html_name_antispam
+                                          : hit[i].html_name);
+            mbox_out_printf(out, "     <td class=\"subject\"><a href=\"%s%s/%s\">%s</a></td>\n",
+                            base_path, hit[i].box, hit[i].uri_msgID,
+                            hit[i].html_subject);
+            mbox_out_printf(out, "    <td class=\"date\">%s</td>\n",
+                            ESCAPE_OR_BLANK(p, hit[i].str_date));
+            mbox_out_puts(out, "   </tr>\n");
+        }
+        mbox_out_puts(out, "   </tbody>\n");
+        mbox_out_puts(out, "  </table>\n");
+        mbox_out_puts(out, "  </div><!-- /#msglist-inner -->\n");
+        mbox_out_puts(out, "  </div><!-- /#msglist-outer -->\n");
+    }
+
+    mbox_out_puts(out, " <div id=\"shim\"></div>\n");
+
+    rv = page_footer_includes(out, cfg);
+    if (rv != APR_SUCCESS) {
+        return rv;
+    }
+
+    mbox_out_puts(out, " </div><!-- /#cont -->\n");
+    mbox_out_puts(out, " </body>\n");
+    mbox_out_puts(out, "</html>");
+    return APR_SUCCESS;
+}
+
+apr_status_t mbox_page_search(mbox_out_t *out, const mbox_page_cfg_t *cfg,
+                              mbox_cache_info *mli, const char *base_path,
+                              const char *query, int order,
+                              const char *search_uri,
+                              apr_array_header_t *hits, int page)
+{
+    apr_status_t rv;
+    apr_pool_t *p = out->pool;
+    const char *name = "Mailing list";
+
+    if (mli->list && mli->domain) {
+        name = apr_psprintf(p, "%s@%s", ESCAPE_OR_BLANK(p, mli->list),
+                            ESCAPE_OR_BLANK(p, mli->domain));
+    }
+
+    rv = mbox_page_header(out, cfg,
+                          apr_psprintf(p, "%s archives: search", name),
+                          apr_psprintf(p, "Search: %s", name));
+    if (rv != APR_SUCCESS) {
+        return rv;
+    }
+
+    mbox_out_puts(out, "  <h5>");
+    if (cfg->root_path) {
+        mbox_out_printf(out, "<a href=\"%s\" title=\"Back to the archives depot\">"
+                        "Site index</a> &middot; ", cfg->root_path);
+    }
+    mbox_out_printf(out, "<a href=\"%s\" title=\"Back to the list index\">"
+                    "List index</a></h5>\n\n", base_path);
+
+    search_form(out, base_path, query, NULL, order);
+
+    return search_results(out, cfg, base_path, search_uri, hits, page);
+}
+
+/* Writes the messages of l, those of a page of count messages, with
+ * links to the pages around at page_uri (HTML-escaped) followed by their
+ * number.
+ */
+static void msglist_range(mbox_out_t *out, const mbox_page_cfg_t *cfg,
+                          const char *page_uri, const mbox_msglist_t *l,
+                          int count, int page)
+{
+    int first = page * DEFAULT_MSGS_PER_PAGE;
+    int last = first + DEFAULT_MSGS_PER_PAGE;
+
+    mbox_out_puts(out, "  <div id=\"msglist-outer\">\n");
+    mbox_out_puts(out, "<h5><span class=\"pagination\">");
+    if (page > 0) {
+        mbox_out_printf(out, "<span id=\"prev-page\"><a href=\"%s%d\">"
+                        "&laquo; Previous Page</a></span> &middot; ",
+                        page_uri, page - 1);
+    }
+    mbox_out_printf(out, "Messages %d to %d of %d", first + 1,
+                    count < last ? count : last, count);
+    if (count > last) {
+        mbox_out_printf(out, " &middot; <span id=\"next-page\"><a href=\"%s%d\">"
+                        "Next Page &raquo;</a></span>", page_uri, page + 1);
+    }
+    mbox_out_puts(out, "</span></h5>\n");
+
+    mbox_out_puts(out, "  <div id=\"msglist-inner\">\n");
+    mbox_out_puts(out, "  <table id=\"msglist\">\n");
+    mbox_out_puts(out, "  <thead>\n");
+    mbox_out_puts(out, "   <tr><th class=\"author\">Author</th>"
+                  "<th class=\"subject\">Subject</th>"
+                  "<th class=\"date\">Date</th></tr>\n");
+    mbox_out_puts(out, "  </thead>\n");
+    mbox_out_puts(out, "   <tbody>\n");
+    mbox_page_msglist_entries(out, l, 0, MBOX_OUTPUT_STATIC, cfg->antispam);
+    mbox_out_puts(out, "   </tbody>\n");
+    mbox_out_puts(out, "  </table>\n");
+    mbox_out_puts(out, "  </div><!-- /#msglist-inner -->\n");
+    mbox_out_puts(out, "  </div><!-- /#msglist-outer -->\n");
+}
+
+apr_status_t mbox_page_filter(mbox_out_t *out, const mbox_page_cfg_t *cfg,
+                              mbox_cache_info *mli, const char *base_path,
+                              apr_table_t *form, const char *filter_uri,
+                              const mbox_msglist_t *l, int count, int page)
+{
+    apr_status_t rv;
+    apr_pool_t *p = out->pool;
+    const char *name = "Mailing list";
+    const char *uri = mbox_escape_html(p, filter_uri);
+    int first = page * DEFAULT_MSGS_PER_PAGE;
+
+    if (mli->list && mli->domain) {
+        name = apr_psprintf(p, "%s@%s", ESCAPE_OR_BLANK(p, mli->list),
+                            ESCAPE_OR_BLANK(p, mli->domain));
+    }
+
+    rv = mbox_page_header(out, cfg,
+                          apr_psprintf(p, "%s archives: filter", name),
+                          apr_psprintf(p, "Filter: %s", name));
+    if (rv != APR_SUCCESS) {
+        return rv;
+    }
+
+    mbox_out_puts(out, "  <h5>");
+    if (cfg->root_path) {
+        mbox_out_printf(out, "<a href=\"%s\" title=\"Back to the archives depot\">"
+                        "Site index</a> &middot; ", cfg->root_path);
+    }
+    mbox_out_printf(out, "<a href=\"%s\" title=\"Back to the list index\">"
+                    "List index</a></h5>\n\n", base_path);
+
+    mbox_out_printf(out, "  <form id=\"filter\" action=\"%sfilter\" method=\"get\">\n",
+                    base_path);
+    mbox_out_printf(out, "   <input type=\"text\" name=\"from\" size=\"20\" value=\"%s\" title=\"Author, or the start of the name with a *\" />\n",
+                    ESCAPE_OR_BLANK(p, apr_table_get(form, "from")));
+    mbox_out_printf(out, "   <input type=\"text\" name=\"subject\" size=\"30\" value=\"%s\" title=\"Found in the subject\" />\n",
+                    ESCAPE_OR_BLANK(p, apr_table_get(form, "subject")));
+    mbox_out_printf(out, "   <input type=\"text\" name=\"after\" size=\"10\" value=\"%s\" title=\"From YYYY[-MM[-DD]]\" />\n",
+                    ESCAPE_OR_BLANK(p, apr_table_get(form, "after")));
+    mbox_out_printf(out, "   <input type=\"text\" name=\"before\" size=\"10\" value=\"%s\" title=\"Until YYYY[-MM[-DD]], excluded\" />\n",
+                    ESCAPE_OR_BLANK(p, apr_table_get(form, "before")));
+    mbox_out_printf(out, "   <label><input type=\"checkbox\" name=\"attachment\" value=\"1\"%s /> With attachments</label>\n",
+                    apr_table_get(form, "attachment") ? " checked=\"checked\"" : "");
+    mbox_out_puts(out, "   <input type=\"submit\" value=\"Filter\" />\n");
+    mbox_out_puts(out, "  </form>\n\n");
+
+    if (l && count <= first) {
+        mbox_out_puts(out, "  <p id=\"no-results\">No message matches this filter.</p>\n");
+    }
+    else if (l) {
+        msglist_range(out, cfg, apr_pstrcat(p, uri, "&amp;page=", NULL), l,
+                      count, page);
+    }
+
+    mbox_out_puts(out, " <div id=\"shim\"></div>\n");
+
+    rv = page_footer_includes(out, cfg);
+    if (rv != APR_SUCCESS) {
+        return rv;
+    }
+
+    mbox_out_puts(out, " </div><!-- /#cont -->\n");
+    mbox_out_puts(out, " </body>\n");
+    mbox_out_puts(out, "</html>");
+    return APR_SUCCESS;
+}
+
+apr_status_t mbox_page_author(mbox_out_t *out, const mbox_page_cfg_t *cfg,
+                              mbox_cache_info *mli, const char *base_path,
+                              const char *author, const char *author_uri,
+                              const mbox_msglist_t *l, int count, int page)
+{
+    apr_status_t rv;
+    apr_pool_t *p = out->pool;
+    const char *name = "Mailing list";
+    char *html_author;
+
+    if (mli->list && mli->domain) {
+        name = apr_psprintf(p, "%s@%s", ESCAPE_OR_BLANK(p, mli->list),
+                            ESCAPE_OR_BLANK(p, mli->domain));
+    }
+
+    /* Names are shown as they are in the message lists. */
+    html_author = apr_pstrdup(p, author ? author : "");
+    if (cfg->antispam && strchr(html_author, '@')) {
+        html_author = mbox_email_antispam(html_author);
+    }
+    html_author = mbox_escape_html(p, html_author);
+
+    rv = mbox_page_header(out, cfg,
+                          apr_psprintf(p, "%s archives: messages of %s",
+                                       name, html_author),
+                          apr_psprintf(p, "Messages of %s: %s", html_author,
+                                       name));
+    if (rv != APR_SUCCESS) {
+        return rv;
+    }
+
+    mbox_out_puts(out, "  <h5>");
+    if (cfg->root_path) {
+        mbox_out_printf(out, "<a href=\"%s\" title=\"Back to the archives depot\">"
+                        "Site index</a> &middot; ", cfg->root_path);
+    }
+    mbox_out_printf(out, "<a href=\"%s\" title=\"Back to the list index\">"
+                    "List index</a></h5>\n\n", base_path);
+
+    msglist_range(out, cfg,
+                  apr_pstrcat(p, mbox_escape_html(p, author_uri), "?page=",
+                              NULL),
+                  l, count, page);
+
+    mbox_out_puts(out, " <div id=\"shim\"></div>\n");
+
+    rv = page_footer_includes(out, cfg);
+    if (rv != APR_SUCCESS) {
+        return rv;
+    }
+
+    mbox_out_puts(out, " </div><!-- /#cont -->\n");
+    mbox_out_puts(out, " </body>\n");
+    mbox_out_puts(out, "</html>");
+    return APR_SUCCESS;
+}
+
+apr_status_t mbox_page_range(mbox_out_t *out, const mbox_page_cfg_t *cfg,
+                             mbox_cache_info *mli, const char *base_path,
+                             const char *from, const char *to,
+                             const char *range_uri, const mbox_msglist_t *l,
+                             int count, int page)
+{
+    apr_status_t rv;
+    apr_pool_t *p = out->pool;
+    const char *name = "Mailing list";
+
+    if (mli->list && mli->domain) {
+        name = apr_psprintf(p, "%s@%s", ESCAPE_OR_BLANK(p, mli->list),
+                            ESCAPE_OR_BLANK(p, mli->domain));
+    }
+
+    rv = mbox_page_header(out, cfg,
+                          apr_psprintf(p, "%s archives: %s to %s", name,
+                                       ESCAPE_OR_BLANK(p, from),
+                                       ESCAPE_OR_BLANK(p, to)),
+                          apr_psprintf(p, "Messages from %s to %s: %s",
+                                       ESCAPE_OR_BLANK(p, from),
+                                       ESCAPE_OR_BLANK(p, to), name));
+    if (rv != APR_SUCCESS) {
+        return rv;
+    }
+
+    mbox_out_puts(out, "  <h5>");
+    if (cfg->root_path) {
+        mbox_out_printf(out, "<a href=\"%s\" title=\"Back to the archives depot\">"
+                        "Site index</a> &middot; ", cfg->root_path);
+    }
+    mbox_out_printf(out, "<a href=\"%s\" title=\"Back to the list index\">"
+                    "List index</a></h5>\n\n", base_path);
+
+    if (!count) {
+        mbox_out_puts(out, "  <p id=\"no-results\">No message was sent then.</p>\n");
+    }
+    else {
+        msglist_range(out, cfg,
+                      apr_pstrcat(p, mbox_escape_html(p, range_uri),
+                                  strchr(range_uri, '?') ? "&amp;page="
+                                  : "?page=", NULL),
+                      l, count, page);
+    }
+
+    mbox_out_puts(out, " <div id=\"shim\"></div>\n");
+
+    rv = page_footer_includes(out, cfg);
+    if (rv != APR_SUCCESS) {
+        return rv;
+    }
+
+    mbox_out_puts(out, " </div><!-- /#cont -->\n");
+    mbox_out_puts(out, " </body>\n");
+    mbox_out_puts(out, "</html>");
+    return APR_SUCCESS;
+}
+
+apr_status_t mbox_page_site_search_header(mbox_out_t *out,
+                                          const mbox_page_cfg_t *cfg,
+                                          const char *base_path,
+                                          const char *query,
+                                          const char *lists, int order)
+{
+    apr_status_t rv;
+
+    rv = mbox_page_header(out, cfg, "Mailing list archives: search",
+                          "Search the mailing lists");
+    if (rv != APR_SUCCESS) {
+        return rv;
+    }
+
+    mbox_out_printf(out, "  <h5><a href=\"%s\" title=\"Back to the archives depot\">"
+                    "Site index</a></h5>\n\n",
+                    cfg->root_path ? cfg->root_path : base_path);
+
+    search_form(out, base_path, query, lists ? lists : "", order);
+    return APR_SUCCESS;
+}
+
+apr_status_t mbox_page_site_search_list(mbox_out_t *out,
+                                        const mbox_page_cfg_t *cfg,
+                                        const char *base_path,
+                                        const char *list,
+                                        apr_array_header_t *hits)
+{
+    apr_pool_t *p = out->pool;
+    mbox_fts_hit_t *hit = (mbox_fts_hit_t *) hits->elts;
+    int i;
+
+    if (!hits->nelts) {
+        return APR_SUCCESS;
+    }
+
+    mbox_out_puts(out, "  <div class=\"list-hits\">\n");
+    mbox_out_printf(out, "   <h6><a href=\"%s%s/\">%s</a></h6>\n",
+                    base_path, mbox_escape_html(p, list),
+                    mbox_escape_html(p, list));
+    mbox_out_puts(out, "   <ul>\n");
+    for (i = 0; i < hits->nelts && i < MBOX_SITE_SEARCH_PREVIEW; i++) {
+        mbox_out_printf(out, "    <li><a href=\"%s%s/%s\">%s</a> &middot; %s &middot; %s</li>\n",
+                        base_path, hit[i].box, hit[i].uri_msgID,
+                        hit[i].html_subject,
+                        cfg->antispam ? hit[i].html_name_antispam
+                                      : hit[i].html_name,
+                        ESCAPE_OR_BLANK(p, hit[i].str_date));
+    }
+    mbox_out_puts(out, "   </ul>\n");
+    mbox_out_puts(out, "  </div>\n");
+    return APR_SUCCESS;
+}
+
+apr_status_t mbox_page_site_search_footer(mbox_out_t *out,
+                                          const mbox_page_cfg_t *cfg,
+                                          const char *base_path,
+                                          const char *search_uri,
+                                          apr_array_header_t *hits, int page,
+                                          apr_array_header_t *missed)
+{
+    apr_pool_t *p = out->pool;
+    int i;
+
+    if (missed && missed->nelts) {
+        mbox_out_puts(out, "  <p id=\"missed\">These lists were not searched in time:");
+        for (i = 0; i < missed->nelts; i++) {
+            mbox_out_printf(out, "%s %s", i ? "," : "",
+                            ESCAPE_OR_BLANK(p, APR_ARRAY_IDX(missed, i,
+                                                             const char *)));
+        }
+        mbox_out_puts(out, ".</p>\n");
+    }
+
+    return search_results(out, cfg, base_path, search_uri, hits, page);
+}
+
+/* Display an ATOM feed entry from given message structure */
+static void atom_entry(mbox_out_t *out, request_rec *r, Message *m,
+                       const char *mboxfile, const char *list_url,
+                       apr_file_t *f)
+{
+    apr_pool_t *pool = out->pool;
+    char dstr[100];
+    apr_size_t dlen;
+    apr_time_exp_t extime;
+    char *uid;
+    char *c;
+
+    mbox_out_puts(out, "<entry>\n");
+    mbox_out_printf(out, "<title>%s</title>\n", m->html_subject);
+    mbox_out_printf(out, "<author><name>%s</name></author>\n",
+                    ESCAPE_AND_CONV_HDR(pool, m->from));
+
+    mbox_out_printf(out, "<link rel=\"alternate\" href=\"%s%s/%s\"/>\n",
+                    list_url, mboxfile, m->uri_msgID);
+
+    uid = apr_pstrdup(pool, m->uri_msgID);
+
+    c = uid;
+    while (*c != '\0') {
+        if (*c == '.') {
+            *c = '-';
+        }
+        c++;
+    }
+
+    mbox_out_printf(out, "<id>urn:uuid:%s</id>\n", uid);
+
+    apr_time_exp_gmt(&extime, m->date);
+
+    apr_strftime(dstr, &dlen, sizeof(dstr), "%G-%m-%dT%H:%M:%SZ", &extime);
+
+    mbox_out_printf(out, "<updated>%s</updated>\n", dstr);
+    mbox_out_puts(out, "<content type=\"xhtml\">\n"
+                  "<div xmlns=\"http://www.w3.org/1999/xhtml\">\n" "<pre>\n");
+
+    m->mime_msg = mbox_fetch_message_mime(r, pool, f, m);
+    mbox_view_body(out, f, m, MBOX_RENDER_CNTRL);
+
+    mbox_out_puts(out, "\n</pre>\n</div>\n</content>\n");
+    mbox_out_puts(out, "</entry>\n");
+}
+
+static int atom_mbox(mbox_out_t *out, request_rec *r, const char *dir,
+                     const char *mboxfile, const char *list_url, int max)
+{
+    apr_status_t rv;
+    char *origfilename;
+    apr_file_t *f;
+    MBOX_LIST *head;
+    mbox_out_t entry;
+    apr_pool_t *tpool;
+    int i;
+
+    origfilename = r->filename;
+    r->filename = apr_pstrcat(r->pool, dir, mboxfile, NULL);
+
+    rv = apr_file_open(&f, r->filename, APR_READ, APR_OS_DEFAULT, r->pool);
+    if (rv != APR_SUCCESS) {
+        r->filename = origfilename;
+        return 0;
+    }
+
+    head = mbox_load_index(r, f, NULL);
+
+    /* Sort the list */
+    head = mbox_sort_list(head, MBOX_SORT_REVERSE_DATE);
+
+    apr_pool_create(&tpool, r->pool);
+    entry = *out;
+    entry.pool = tpool;
+
+    for (i = 0; i < max && head != NULL; i++) {
+        atom_entry(&entry, r, (Message *) head->value, mboxfile, list_url, f);
+        head = head->next;
+        apr_pool_clear(tpool);
+    }
+    out->status = entry.status;
+
+    apr_file_close(f);
+    r->filename = origfilename;
+    apr_pool_destroy(tpool);
+    return i;
+}
+
+void mbox_page_atom(mbox_out_t *out, request_rec *r, mbox_cache_info *mli,
+                    apr_array_header_t *files, const char *dir,
+                    const char *list_url, const char *feed_url)
+{
+    mbox_file_t *fi;
+    char dstr[100];
+    apr_size_t dlen;
+    apr_time_exp_t extime;
+    int i, entries = 0;
+
+    mbox_out_puts(out, "<?xml version=\"1.0\" encoding=\"UTF-8\"?>\n");
+    mbox_out_puts(out, "<feed xmlns=\"http://www.w3.org/2005/Atom\">\n");
+    mbox_out_printf(out, "<title>%s@%s Archives</title>\n",
+                    ESCAPE_OR_BLANK(out->pool, mli->list),
+                    ESCAPE_OR_BLANK(out->pool, mli->domain));
+    mbox_out_printf(out, "<link rel=\"self\" href=\"%s\"/>\n",
+                    feed_url);
+    mbox_out_printf(out, "<link href=\"%s\"/>\n", list_url);
+    mbox_out_printf(out, "<id>%s</id>\n", list_url);
+
+    apr_time_exp_gmt(&extime, mli->mtime);
+
+    apr_strftime(dstr, &dlen, sizeof(dstr), "%G-%m-%dT%H:%M:%SZ", &extime);
+
+    mbox_out_printf(out, "<updated>%s</updated>\n", dstr);
+
+    fi = files ? (mbox_file_t *) files->elts : NULL;
+    for (i = 0; fi && i < files->nelts && entries < MBOX_ATOM_NUM_ENTRIES;
+         i++) {
+        if (!fi[i].count) {
+            continue;
+        }
+        entries += atom_mbox(out, r, dir, fi[i].filename, list_url,
+                             MBOX_ATOM_NUM_ENTRIES - entries);
+    }
+
+    mbox_out_puts(out, "</feed>\n");
+}
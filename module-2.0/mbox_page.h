@@ -0,0 +1,240 @@
+/* Licensed to the Apache Software Foundation (ASF) under one or more
+ * contributor license agreements.  See the NOTICE file distributed with
+ * this work for additional information regarding copyright ownership.
+ * The ASF licenses this file to You under the Apache License, Version 2.0
+ * (the "License"); you may not use this file except in compliance with
+ * the License.  You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef MBOX_PAGE_H
+#define MBOX_PAGE_H
+
+/*
+ * Whole pages around the message views of mbox_view.h: the page chrome,
+ * the message lists of a mailbox, the list index and its Atom feed, and
+ * search results.  As views, they are written to an mbox_out_t, and
+ * depend on the request
+ * only through the arguments they take, so that mod-mbox-util can export
+ * an archive as static files that the module would serve byte for byte.
+ */
+
+#include "apr.h"
+#include "apr_pools.h"
+#include "apr_tables.h"
+
+#include "mbox_cache.h"
+#include "mbox_fts.h"
+#include "mbox_thread.h"
+#include "mbox_view.h"
+
+#define DEFAULT_MSGS_PER_PAGE 100
+#define DEFAULT_THREADS_PER_PAGE 40
+#define MBOX_SEARCH_PER_PAGE 50
+#define MBOX_SITE_SEARCH_PREVIEW 3
+
+#define MBOX_OUTPUT_STATIC 0
+#define MBOX_OUTPUT_AJAX   1
+
+#define MBOX_ATOM_NUM_ENTRIES 40
+
+typedef struct mbox_file
+{
+    char *filename;
+    int count;
+} mbox_file_t;
+
+/* The settings pages depend on (see the Mbox* directives) */
+typedef struct mbox_page_cfg
+{
+    int antispam;
+    int hide_empty;
+    const char *root_path;
+    const char *style_path;
+    const char *script_path;
+    const char *header_include_file;    /* Absolute paths */
+    const char *footer_include_file;
+
+    /* Pages written as static files (mod-mbox-util -e) only link to the
+       others written: page N of a message list is VIEW_N, and there is
+       no jump to a date.  As a month is not written again for the mail
+       of another, the month list leaves out the counts of open months. */
+    int exported;
+} mbox_page_cfg_t;
+
+/* A message list, ready to be paged through */
+typedef struct mbox_msglist
+{
+    int sort;
+    int pages;
+    MBOX_LIST *head;            /* For date and author sorts */
+    Container *threads;         /* For the thread sort */
+
+    /* A page of the date view that starts at a cursor (after=) holds its
+       messages only.  first is -1 for the other lists. */
+    int first;                  /* Position of its first message */
+    int count;                  /* Messages of the mailbox */
+    const char *prev;           /* Arguments of the pages before and */
+    const char *next;           /* after, URI-escaped, or NULL */
+} mbox_msglist_t;
+
+/* Lists the mailboxes in path, newest first, with their message counts.
+ * Returns APR_NOTFOUND if there is none.
+ */
+apr_status_t mbox_boxes_list(apr_array_header_t **files, apr_pool_t *p,
+                             mbox_cache_info *mli, const char *path);
+
+/* Returns 1 if the mailbox named box is of a month that is over: nothing
+ * is added to it any more.
+ */
+int mbox_is_past_month(const char *box);
+
+/* Changes with the markup of the pages, to tell the pages rendered by
+ * other builds apart.
+ */
+#define MBOX_PAGE_FORMAT 2
+
+/* Return strings that change with the settings (and include files) and
+ * with the box list pages are rendered with, to tell versions of the
+ * rendered pages apart.  The message counts of the months still open are
+ * left out of the box list's, as they change with every message: a page
+ * kept for its version shows them as they were when it was rendered.
+ */
+const char *mbox_page_cfg_version(apr_pool_t *p, const mbox_page_cfg_t *cfg);
+const char *mbox_boxes_version(apr_pool_t *p, apr_array_header_t *files);
+
+/* Writes the page up to its title.  h1 defaults to the title.  Returns
+ * an error if a header include file cannot be read.
+ */
+apr_status_t mbox_page_header(mbox_out_t *out, const mbox_page_cfg_t *cfg,
+                              const char *title, const char *h1);
+
+/* The page around a message view */
+apr_status_t mbox_page_message_header(mbox_out_t *out,
+                                      const mbox_page_cfg_t *cfg,
+                                      const char *subject,
+                                      const char *base_path,
+                                      const char *base_name);
+void mbox_page_message_footer(mbox_out_t *out);
+
+/* Sorts the list of the messages of a mailbox, or threads it, and
+ * counts its pages.
+ */
+void mbox_msglist_init(mbox_msglist_t *l, apr_pool_t *p, MBOX_LIST *head,
+                       int count, int sortFlags);
+
+/* Returns the arguments of the page of the date view after the message
+ * of the given date and Message-ID: after=DATE,MSGID, with DATE in
+ * seconds.  A page may also be given as after=ORDINAL, the position of
+ * the message before it.  Unlike page numbers, they do not shift as
+ * mail comes in.
+ */
+const char *mbox_msglist_cursor(apr_pool_t *p, apr_time_t date,
+                                const char *msgID);
+
+/* Writes the entries of a page of the list, as XHTML (MBOX_OUTPUT_STATIC)
+ * or XML (MBOX_OUTPUT_AJAX).
+ */
+void mbox_page_msglist_entries(mbox_out_t *out, const mbox_msglist_t *l,
+                               int current_page, int mode, int antispam);
+
+/* Writes a page of the list of the messages of the mailbox named box,
+ * at base_uri.  path_info is the view (eg "/thread"), which the links
+ * to the other months and pages keep.  The box list is left out if
+ * files is NULL.
+ */
+apr_status_t mbox_page_msglist(mbox_out_t *out, const mbox_page_cfg_t *cfg,
+                               const mbox_msglist_t *l,
+                               apr_array_header_t *files, const char *box,
+                               const char *base_uri, const char *base_path,
+                               const char *base_name, const char *path_info,
+                               int current_page);
+
+/* Writes the list index.  list_url is its absolute URL. */
+apr_status_t mbox_page_index(mbox_out_t *out, const mbox_page_cfg_t *cfg,
+                             mbox_cache_info *mli, apr_array_header_t *files,
+                             const char *list_url);
+
+/* Writes the Atom feed of the list, whose mailboxes are in dir (with a
+ * trailing slash).  feed_url is the absolute URL of the feed itself.  r
+ * is only used to load their indexes.
+ */
+void mbox_page_atom(mbox_out_t *out, request_rec *r, mbox_cache_info *mli,
+                    apr_array_header_t *files, const char *dir,
+                    const char *list_url, const char *feed_url);
+
+/* Writes a page of search results, with the search form.  hits are the
+ * messages found up to the end of the page, and one more if there are
+ * more.  query is the query as typed (NULL if there is none yet), and
+ * search_uri the URI of the results, URI-escaped, without the page.
+ */
+apr_status_t mbox_page_search(mbox_out_t *out, const mbox_page_cfg_t *cfg,
+                              mbox_cache_info *mli, const char *base_path,
+                              const char *query, int order,
+                              const char *search_uri,
+                              apr_array_header_t *hits, int page);
+
+/* Writes a page of the messages of the list a filter matches, with the
+ * filter form, whose fields are in form.  l holds the messages of the
+ * page (NULL if there is no filter yet), with their uri_msgID relative
+ * to base_path, and count those of all the pages.  filter_uri is the URI
+ * of the messages, URI-escaped, without the page.
+ */
+apr_status_t mbox_page_filter(mbox_out_t *out, const mbox_page_cfg_t *cfg,
+                              mbox_cache_info *mli, const char *base_path,
+                              apr_table_t *form, const char *filter_uri,
+                              const mbox_msglist_t *l, int count, int page);
+
+/* Writes a page of the messages of an author of the list, whose name
+ * is author.  l holds the messages of the page, with their uri_msgID
+ * relative to base_path, and count those of all the pages.  author_uri
+ * is the URI of the messages, URI-escaped, without the page.
+ */
+apr_status_t mbox_page_author(mbox_out_t *out, const mbox_page_cfg_t *cfg,
+                              mbox_cache_info *mli, const char *base_path,
+                              const char *author, const char *author_uri,
+                              const mbox_msglist_t *l, int count, int page);
+
+/* Writes a page of the messages of the list from one date to another,
+ * across its mailboxes, newest first.  from and to are the dates, as
+ * shown.  l holds the messages of the page, with their uri_msgID
+ * relative to base_path, and count those of all the pages.  range_uri
+ * is the URI of the messages, URI-escaped, without the page.
+ */
+apr_status_t mbox_page_range(mbox_out_t *out, const mbox_page_cfg_t *cfg,
+                             mbox_cache_info *mli, const char *base_path,
+                             const char *from, const char *to,
+                             const char *range_uri, const mbox_msglist_t *l,
+                             int count, int page);
+
+/* A page of search results across lists, in parts so that the form is
+ * sent while they are searched, and the best hits of each list as soon as
+ * it is.  lists is the pattern of the lists searched, as typed.  The box
+ * of the hits is LIST/MAILBOX, relative to base_path, and missed names the
+ * lists that were not searched in time.
+ */
+apr_status_t mbox_page_site_search_header(mbox_out_t *out,
+                                          const mbox_page_cfg_t *cfg,
+                                          const char *base_path,
+                                          const char *query,
+                                          const char *lists, int order);
+apr_status_t mbox_page_site_search_list(mbox_out_t *out,
+                                        const mbox_page_cfg_t *cfg,
+                                        const char *base_path,
+                                        const char *list,
+                                        apr_array_header_t *hits);
+apr_status_t mbox_page_site_search_footer(mbox_out_t *out,
+                                          const mbox_page_cfg_t *cfg,
+                                          const char *base_path,
+                                          const char *search_uri,
+                                          apr_array_header_t *hits, int page,
+                                          apr_array_header_t *missed);
+
+#endif
@@ -34,6 +34,10 @@
 #include "mbox_parse.h"
 #include "mbox_sort.h"
 #include "mbox_dbm.h"
+#include "mbox_cte.h"
+#include "mbox_escape.h"
+#include "mbox_mime.h"
+#include "mbox_utf8.h"
 
 /* FIXME: Remove this when apr_date_parse_rfc() and ap_strcasestr() are fixed ! */
 #include "mbox_externals.h"
@@ -46,11 +50,30 @@
 /* for dirname() */
 #include <libgen.h>
 
+#include <stdlib.h>
+
 #define OPEN_DBM(r, db, flags, suffix, temp, status) \
     temp = apr_pstrcat(r->pool, r->filename, suffix, NULL); \
     status = apr_dbm_open_ex(&db, APR_STRINGIFY(DBM_TYPE), temp, flags, APR_OS_DEFAULT, r->pool);
 
 #define MSGID_DBM_SUFFIX ".msgsum"
+#define MIME_DBM_SUFFIX ".mimesum"
+
+#define NO_SUBJECT "[No Subject]"
+
+/* The decoded and pre-escaped forms of the fields shown in message
+ * lists, computed once by mod-mbox-util.  In the index, a field that is
+ * identical to the one it was derived from is stored as NULL.
+ */
+typedef struct mb_display
+{
+    const char *name;
+    const char *html_name;
+    const char *html_name_antispam;
+    const char *utf8_subject;
+    const char *html_subject;
+    const char *uri_msgID;
+} mb_display;
 
 typedef struct mb_dbm_data
 {
@@ -65,6 +88,9 @@ typedef struct mb_dbm_data
     const char *content_type;
     const char *charset;
     const char *boundary;
+    const char *author_key;
+    int has_display;
+    mb_display display;
 } mb_dbm_data;
 
 /* Fills the MBOX_BUFF structure with data from the backing file descriptor.
@@ -377,15 +403,7 @@ static int mbox_compare_list_author(void *p, void *q, void *pointer)
     Message *d = (Message *) b->value;
     int cmp;
 
-    if (!c->str_from) {
-        return -1;
-    }
-
-    if (!d->str_from) {
-        return 1;
-    }
-
-    cmp = strcmp(c->str_from, d->str_from);
+    cmp = strcmp(c->author_key, d->author_key);
 
     /* Match, sort by normal value */
     if (!cmp)
@@ -394,11 +412,132 @@ static int mbox_compare_list_author(void *p, void *q, void *pointer)
     return cmp;
 }
 
+/* Maps a date onto an unsigned key with the same ordering. */
+#define DATE_SORT_KEY(t) ((apr_uint64_t) (t) ^ ((apr_uint64_t) 1 << 63))
+
+/* The first eight bytes of an author key, big-endian, so that comparing
+ * two prefixes gives the same answer as strcmp() on those bytes.
+ */
+static apr_uint64_t author_key_prefix(const char *key)
+{
+    apr_uint64_t prefix = 0;
+    int i;
+
+    for (i = 0; i < 8; i++) {
+        prefix <<= 8;
+        if (*key)
+            prefix |= (unsigned char) *key++;
+    }
+
+    return prefix;
+}
+
+/* Fallback comparison for authors whose keys share the same prefix.
+ * The item key holds the position within the run, which keeps the
+ * (date ordered) input order for identical authors and dates.
+ */
+static int compare_author_items(const void *p, const void *q)
+{
+    const mbox_sort_item_t *a = p;
+    const mbox_sort_item_t *b = q;
+    Message *c = (Message *) ((MBOX_LIST *) a->value)->value;
+    Message *d = (Message *) ((MBOX_LIST *) b->value)->value;
+    int cmp;
+
+    cmp = strcmp(c->author_key, d->author_key);
+    if (cmp)
+        return cmp;
+    if (c->date != d->date)
+        return (c->date > d->date) ? 1 : -1;
+    return (a->key > b->key) ? 1 : -1;
+}
+
+/*
+ * Sorts the list with mbox_sort_radix(): by date, then, for authors,
+ * by the fixed-size prefix of the author key, falling back to a full
+ * comparison only within runs of identical prefixes.
+ *
+ * Returns NULL if the scratch arrays could not be allocated.
+ */
+static MBOX_LIST *radix_sort_list(MBOX_LIST *l, int flags)
+{
+    mbox_sort_item_t *items, *sorted;
+    MBOX_LIST *cur;
+    apr_size_t n, i, j, k;
+
+    for (n = 0, cur = l; cur; cur = cur->next)
+        n++;
+
+    items = malloc(2 * n * sizeof(*items));
+    if (!items)
+        return NULL;
+
+    for (i = 0, cur = l; cur; cur = cur->next, i++) {
+        items[i].key = DATE_SORT_KEY(cur->key);
+        if (flags == MBOX_SORT_REVERSE_DATE)
+            items[i].key = ~items[i].key;
+        items[i].value = cur;
+    }
+
+    sorted = mbox_sort_radix(items, items + n, n);
+
+    if (flags == MBOX_SORT_AUTHOR) {
+        for (i = 0; i < n; i++) {
+            Message *m = (Message *) ((MBOX_LIST *) sorted[i].value)->value;
+            sorted[i].key = author_key_prefix(m->author_key);
+        }
+
+        /* Stable, so equal prefixes stay in date order. */
+        sorted = mbox_sort_radix(sorted,
+                                 sorted == items ? items + n : items, n);
+
+        for (i = 0; i < n; i = j) {
+            for (j = i + 1; j < n && sorted[j].key == sorted[i].key; j++)
+                ;
+
+            /* A zero in the last prefix byte means every key in the run
+             * is shorter than the prefix, so they are all equal.
+             */
+            if (j - i > 1 && (sorted[i].key & 0xff)) {
+                for (k = i; k < j; k++)
+                    sorted[k].key = k;
+                qsort(sorted + i, j - i, sizeof(*sorted),
+                      compare_author_items);
+            }
+        }
+    }
+
+    for (i = 0; i < n; i++) {
+        cur = (MBOX_LIST *) sorted[i].value;
+        cur->next = (i + 1 < n) ? (MBOX_LIST *) sorted[i + 1].value : NULL;
+    }
+    l = n ? (MBOX_LIST *) sorted[0].value : NULL;
+
+    free(items);
+    return l;
+}
+
 /*
- * Uses the sort_linked_list function from mbox_sort (merge-sort).
+ * Dates and authors are radix sorted; if that is not possible, falls
+ * back to the sort_linked_list function from mbox_sort (merge-sort).
  */
 MBOX_LIST *mbox_sort_list(MBOX_LIST *l, int flags)
 {
+    MBOX_LIST *sorted;
+
+    if (!l || !l->next)
+        return l;
+
+    switch (flags) {
+    case MBOX_SORT_DATE:
+    case MBOX_SORT_REVERSE_DATE:
+    case MBOX_SORT_AUTHOR:
+        sorted = radix_sort_list(l, flags);
+        if (sorted)
+            return sorted;
+        break;
+    }
+
     switch (flags) {
     case MBOX_SORT_DATE:
         l = (MBOX_LIST *) mbox_sort_linked_list(l, 0, mbox_compare_list,
@@ -419,60 +558,152 @@ MBOX_LIST *mbox_sort_list(MBOX_LIST *l, int flags)
 }
 
 /*
- * Normalize the from header in the message to something we like.
+ * Extracts the display name from a From header.
  */
-static void parse_from(request_rec *r, Message *m)
+static char *from_display_name(apr_pool_t *p, const char *from)
 {
     char *startFrom, *endFrom;
-    if (m->from) {
-        /* Froms come in many shapes and forms.
-         * Notably, we want to try and handle:
-         * 1) "Bob Smith" <bsmith@example.com>
-         * 2) Bob Smith <bsmith@example.com>
-         * 3) <bsmith@example.com>
-         * 4) bsmith@example.com
-         * 5) bsmith@example.com (Bob Smith)
-         */
 
-        /* FIXME: Optimize string matching */
-        startFrom = apr_pstrdup(r->pool, m->from);
+    /* Froms come in many shapes and forms.
+     * Notably, we want to try and handle:
+     * 1) "Bob Smith" <bsmith@example.com>
+     * 2) Bob Smith <bsmith@example.com>
+     * 3) <bsmith@example.com>
+     * 4) bsmith@example.com
+     * 5) bsmith@example.com (Bob Smith)
+     */
+
+    /* FIXME: Optimize string matching */
+    startFrom = apr_pstrdup(p, from);
+    endFrom = strchr(startFrom, '"');
+    if (endFrom) {          /* Case 1 */
+        startFrom = ++endFrom;
         endFrom = strchr(startFrom, '"');
-        if (endFrom) {          /* Case 1 */
-            startFrom = ++endFrom;
-            endFrom = strchr(startFrom, '"');
-            if (endFrom)
+        if (endFrom)
+            *endFrom = '\0';
+    }
+    else {
+        endFrom = strchr(startFrom, '<');
+        if (endFrom) {
+            if (endFrom == startFrom) {     /* Case 3 */
+                endFrom = strchr(++startFrom, '>');
+                if (endFrom)
+                    *endFrom = '\0';
+            }
+            else {          /* Case 2 */
+
+                /* FIXME: What about Bob Smith<bsmith@example.com>? */
                 *endFrom = '\0';
+                endFrom = strrchr(startFrom, ' ');
+                if (endFrom)
+                    *endFrom = '\0';
+            }
         }
         else {
-            endFrom = strchr(startFrom, '<');
-            if (endFrom) {
-                if (endFrom == startFrom) {     /* Case 3 */
-                    endFrom = strchr(++startFrom, '>');
-                    if (endFrom)
-                        *endFrom = '\0';
-                }
-                else {          /* Case 2 */
-
-                    /* FIXME: What about Bob Smith<bsmith@example.com>? */
+            endFrom = strchr(startFrom, '(');
+            if (endFrom) {  /* Case 5 */
+                startFrom = ++endFrom;
+                endFrom = strchr(startFrom, ')');
+                if (endFrom)
                     *endFrom = '\0';
-                    endFrom = strrchr(startFrom, ' ');
-                    if (endFrom)
-                        *endFrom = '\0';
-                }
             }
-            else {
-                endFrom = strchr(startFrom, '(');
-                if (endFrom) {  /* Case 5 */
-                    startFrom = ++endFrom;
-                    endFrom = strchr(startFrom, ')');
-                    if (endFrom)
-                        *endFrom = '\0';
-                }
 
-            }
         }
-        m->str_from = startFrom;
     }
+    return startFrom;
+}
+
+/*
+ * Case-folds a decoded display name into an author key.
+ */
+static char *author_key_from_name(apr_pool_t *p, const char *name)
+{
+    unsigned char *s, *d;
+    char *key;
+
+    key = apr_palloc(p, strlen(name) + 1);
+
+    for (s = (unsigned char *) name, d = (unsigned char *) key; *s; s++) {
+        if (apr_isspace(*s) || *s == '"') {
+            if (d > (unsigned char *) key && d[-1] != ' ')
+                *d++ = ' ';
+        }
+        else if (*s == 0xC3 && s[1] >= 0x80 && s[1] <= 0x9E && s[1] != 0x97) {
+            /* U+00C0 - U+00DE, except U+00D7 (multiplication sign) */
+            *d++ = *s++;
+            *d++ = *s + 0x20;
+        }
+        else {
+            *d++ = apr_tolower(*s);
+        }
+    }
+
+    if (d > (unsigned char *) key && d[-1] == ' ')
+        d--;
+    *d = '\0';
+
+    return key;
+}
+
+/*
+ * Returns the key messages are sorted on when sorting by author: the
+ * RFC 2047 decoded display name, case-folded, with quotes dropped and
+ * runs of whitespace collapsed.  Only ASCII and the Latin-1 range of
+ * UTF-8 are folded.
+ *
+ * This is computed by mod-mbox-util and stored in the index.
+ */
+char *mbox_author_key(apr_pool_t *p, const char *from)
+{
+    if (!from)
+        return "";
+
+    return author_key_from_name(p,
+               mbox_cte_decode_header(p, from_display_name(p, from)));
+}
+
+char *mbox_author_fold(apr_pool_t *p, const char *name)
+{
+    return author_key_from_name(p, name ? name : "");
+}
+
+/*
+ * Computes the display fields for a message: the decoded display name
+ * and subject, their escaped forms, and the escaped Message-ID.
+ */
+static void make_display(apr_pool_t *p, mb_display *d, const char *from,
+                         const char *subject, const char *msgID)
+{
+    d->name = NULL;
+    if (from)
+        d->name = mbox_utf8_repair_str(p,
+                      mbox_cte_decode_header(p, from_display_name(p, from)));
+
+    d->html_name = mbox_escape_html(p, d->name ? d->name : "");
+    d->html_name_antispam = d->html_name;
+    if (d->name && strchr(d->name, '@')) {
+        char *tmp = apr_pstrdup(p, d->name);
+        d->html_name_antispam = mbox_escape_html(p, mbox_email_antispam(tmp));
+    }
+
+    if (!subject || !*subject)
+        subject = NO_SUBJECT;
+    d->utf8_subject = mbox_utf8_repair_str(p,
+                          mbox_cte_decode_header(p, (char *) subject));
+    d->html_subject = mbox_escape_html(p, d->utf8_subject);
+
+    d->uri_msgID = mbox_escape_msgid(p, msgID);
+}
+
+/* Copies display fields into a message. */
+static void set_display(apr_pool_t *p, Message *m, const mb_display *d)
+{
+    m->name = apr_pstrdup(p, d->name);
+    m->html_name = apr_pstrdup(p, d->html_name);
+    m->html_name_antispam = apr_pstrdup(p, d->html_name_antispam);
+    m->utf8_subject = apr_pstrdup(p, d->utf8_subject);
+    m->html_subject = apr_pstrdup(p, d->html_subject);
+    m->uri_msgID = apr_pstrdup(p, d->uri_msgID);
 }
 
 static void parse_references(request_rec *r, Message *m)
@@ -500,12 +731,20 @@ static void normalize_message(request_rec *r, Message *m)
     apr_time_exp_t time_exp;
     apr_size_t len = 0;
 
-    /* Clean up the from to hide email addresses if possible. */
-    parse_from(r, m);
+    /* Indexes written before the display fields and the author key
+     * were stored lack them.
+     */
+    if (!m->html_subject) {
+        mb_display d;
+        make_display(r->pool, &d, m->from, m->subject, m->msgID);
+        set_display(r->pool, m, &d);
+    }
+    if (!m->author_key)
+        m->author_key = mbox_author_key(r->pool, m->from);
 
     /* Some morons don't provide subjects. */
     if (!m->subject || !*m->subject)
-        m->subject = "[No Subject]";
+        m->subject = NO_SUBJECT;
 
     if (!m->content_type || !*m->content_type)
         m->content_type = "text/plain";
@@ -580,6 +819,37 @@ static apr_status_t fetch_msgc(apr_pool_t *pool, apr_dbm_t *database,
     fetch_cstring(pool, msgc->charset, msgValue.dptr, pos, tlen);
     fetch_cstring(pool, msgc->boundary, msgValue.dptr, pos, tlen);
 
+    /* Fields appended to the record later on: older indexes end here. */
+    if (pos < msgValue.dsize) {
+        fetch_cstring(pool, msgc->author_key, msgValue.dptr, pos, tlen);
+    }
+    else {
+        msgc->author_key = NULL;
+    }
+
+    msgc->has_display = (pos < msgValue.dsize);
+    if (msgc->has_display) {
+        mb_display *d = &msgc->display;
+
+        fetch_cstring(pool, d->name, msgValue.dptr, pos, tlen);
+        fetch_cstring(pool, d->html_name, msgValue.dptr, pos, tlen);
+        fetch_cstring(pool, d->html_name_antispam, msgValue.dptr, pos, tlen);
+        fetch_cstring(pool, d->utf8_subject, msgValue.dptr, pos, tlen);
+        fetch_cstring(pool, d->html_subject, msgValue.dptr, pos, tlen);
+        fetch_cstring(pool, d->uri_msgID, msgValue.dptr, pos, tlen);
+
+        if (!d->html_name)
+            d->html_name = d->name;
+        if (!d->html_name_antispam)
+            d->html_name_antispam = d->html_name;
+        if (!d->utf8_subject)
+            d->utf8_subject = msgc->subject;
+        if (!d->html_subject)
+            d->html_subject = d->utf8_subject;
+        if (!d->uri_msgID)
+            d->uri_msgID = key;
+    }
+
     return APR_SUCCESS;
 }
 
@@ -594,6 +864,14 @@ static apr_status_t fetch_msgc(apr_pool_t *pool, apr_dbm_t *database,
         } \
     } while (0);
 
+/* Returns NULL if derived is the same string as source. */
+static const char *unless_same(const char *derived, const char *source)
+{
+    if (derived && source && !strcmp(derived, source))
+        return NULL;
+    return derived;
+}
+
 static apr_status_t store_msgc(apr_pool_t *pool, apr_dbm_t *database,
                                const char *key, mb_dbm_data *msgc,
                                const char *list, const char *domain)
@@ -603,10 +881,21 @@ static apr_status_t store_msgc(apr_pool_t *pool, apr_dbm_t *database,
     int pos = 0;
     apr_uint16_t tlen = 0;
     char *value;
+    mb_display d;
 
     if (!database || !key || !msgc)
         return APR_EGENERAL;
 
+    /* Only store what cannot be inferred from another field. */
+    d.name = msgc->display.name;
+    d.html_name = unless_same(msgc->display.html_name, d.name);
+    d.html_name_antispam = unless_same(msgc->display.html_name_antispam,
+                                       msgc->display.html_name);
+    d.utf8_subject = unless_same(msgc->display.utf8_subject, msgc->subject);
+    d.html_subject = unless_same(msgc->display.html_subject,
+                                 msgc->display.utf8_subject);
+    d.uri_msgID = unless_same(msgc->display.uri_msgID, key);
+
     /**
     printf("Message Start: %"APR_OFF_T_FMT
            "\n\t Body Start: %"APR_OFF_T_FMT
@@ -635,7 +924,14 @@ static apr_status_t store_msgc(apr_pool_t *pool, apr_dbm_t *database,
         sstrlen(msgc->references) + sizeof(tlen) +
         sstrlen(msgc->content_type) + sizeof(tlen) +
         sstrlen(msgc->charset) + sizeof(tlen) +
-        sstrlen(msgc->boundary) + sizeof(tlen);
+        sstrlen(msgc->boundary) + sizeof(tlen) +
+        sstrlen(msgc->author_key) + sizeof(tlen) +
+        sstrlen(d.name) + sizeof(tlen) +
+        sstrlen(d.html_name) + sizeof(tlen) +
+        sstrlen(d.html_name_antispam) + sizeof(tlen) +
+        sstrlen(d.utf8_subject) + sizeof(tlen) +
+        sstrlen(d.html_subject) + sizeof(tlen) +
+        sstrlen(d.uri_msgID) + sizeof(tlen);
 
     value = apr_palloc(pool, vlen);
 
@@ -658,6 +954,13 @@ static apr_status_t store_msgc(apr_pool_t *pool, apr_dbm_t *database,
     store_cstring(msgc->content_type, value, pos, tlen);
     store_cstring(msgc->charset, value, pos, tlen);
     store_cstring(msgc->boundary, value, pos, tlen);
+    store_cstring(msgc->author_key, value, pos, tlen);
+    store_cstring(d.name, value, pos, tlen);
+    store_cstring(d.html_name, value, pos, tlen);
+    store_cstring(d.html_name_antispam, value, pos, tlen);
+    store_cstring(d.utf8_subject, value, pos, tlen);
+    store_cstring(d.html_subject, value, pos, tlen);
+    store_cstring(d.uri_msgID, value, pos, tlen);
 
     msgValue.dptr = (char *) value;
     msgValue.dsize = pos;
@@ -665,6 +968,89 @@ static apr_status_t store_msgc(apr_pool_t *pool, apr_dbm_t *database,
     return apr_dbm_store(database, msgKey, msgValue);
 }
 
+/* Records the MIME structure of the message body in [body, body + len)
+ * (see mbox_mime_serialize()), after its length, which tells a record
+ * from an older index apart.  The value of the Content-Type header and
+ * its parameters are those the module will parse the message with.
+ */
+/* Extracts the large leaf parts under m to the attachment store. */
+static void store_parts(apr_pool_t *pool, mbox_mime_message_t *m,
+                        const mbox_attach_store_t *store)
+{
+    char *data, *key;
+    apr_size_t len;
+    int i;
+
+    if (!m)
+        return;
+
+    if (m->sub) {
+        for (i = 0; i < m->sub_count; i++)
+            store_parts(pool, mbox_mime_get_part(pool, m, i), store);
+        return;
+    }
+
+    /* Decoding never makes a body larger. */
+    if (m->body_len < store->min_size)
+        return;
+
+    if (m->cte == CTE_BASE64 || m->cte == CTE_QP)
+        data = mbox_mime_decode_body(pool, m->cte, m->body, m->body_len, &len);
+    else {
+        data = m->body;
+        len = m->body_len;
+    }
+
+    if (data && len >= store->min_size
+        && mbox_attach_put(pool, store->dir, data, len, &key) == APR_SUCCESS) {
+        m->store_key = key;
+        m->decoded_len = len;
+    }
+}
+
+static apr_status_t store_mime(apr_pool_t *pool, apr_dbm_t *database,
+                               const char *key, mb_dbm_data *msgc,
+                               const char *body, apr_size_t len,
+                               const mbox_attach_store_t *store)
+{
+    apr_datum_t mimeKey, mimeValue;
+    mbox_mime_message_t *mime;
+    mbox_varbuf_t vb;
+    apr_uint64_t blen = len;
+    apr_status_t rv;
+    char *copy, *ct, *charset;
+
+    if (!database || !key || !body)
+        return APR_EGENERAL;
+
+    ct = apr_pstrdup(pool, msgc->content_type);
+    if (!ct || !*ct)
+        ct = "text/plain";
+    charset = apr_pstrdup(pool, msgc->charset);
+    if (charset && !*charset)
+        charset = NULL;
+
+    /* The parser needs a NUL-terminated body. */
+    copy = apr_pstrmemdup(pool, body, len);
+    mime = mbox_mime_decode_multipart(pool, copy, ct, charset, msgc->cte,
+                                      apr_pstrdup(pool, msgc->boundary));
+    if (store)
+        store_parts(pool, mime, store);
+
+    mbox_varbuf_init(pool, &vb, 256);
+    mbox_varbuf_strmemcat(&vb, (const char *) &blen, sizeof(blen));
+    rv = mbox_mime_serialize(pool, mime, copy, &vb);
+    if (rv != APR_SUCCESS)
+        return rv;
+
+    mimeKey.dptr = (char *) key;
+    mimeKey.dsize = strlen(key) + 1;
+    mimeValue.dptr = vb.buf;
+    mimeValue.dsize = vb.len;
+
+    return apr_dbm_store(database, mimeKey, mimeValue);
+}
+
 /* This function is stolen from server/util.c, since we need to be able to run
  * standalone, without the httpd core... sigh. */
 static void ex_ap_str_tolower(char *str)
@@ -680,11 +1066,12 @@ static void ex_ap_str_tolower(char *str)
  * This function will generate the appropriate DBM for a given mbox file.
  */
 apr_status_t mbox_generate_index(request_rec *r, apr_file_t *f,
-                                 const char *list, const char *domain)
+                                 const char *list, const char *domain,
+                                 const mbox_attach_store_t *store)
 {
     apr_status_t status;
     apr_table_t *table;
-    apr_dbm_t *msgDB;
+    apr_dbm_t *msgDB, *mimeDB;
     apr_pool_t *tpool;
 #ifdef APR_HAS_MMAP
     apr_finfo_t fi;
@@ -712,6 +1099,9 @@ apr_status_t mbox_generate_index(request_rec *r, apr_file_t *f,
     if (fi.size == 0) {
         OPEN_DBM(r, msgDB, APR_DBM_RWCREATE, MSGID_DBM_SUFFIX, temp, status);
         apr_dbm_close(msgDB);
+        OPEN_DBM(r, mimeDB, APR_DBM_RWCREATE, MIME_DBM_SUFFIX, temp, status);
+        if (status == APR_SUCCESS)
+            apr_dbm_close(mimeDB);
         return OK;
     }
 
@@ -736,6 +1126,17 @@ apr_status_t mbox_generate_index(request_rec *r, apr_file_t *f,
 
     OPEN_DBM(r, msgDB, APR_DBM_RWCREATE, MSGID_DBM_SUFFIX, temp, status);
 
+    /* The MIME structure can only be recorded when the whole file is
+     * mapped; without it, the module parses messages as it serves them.
+     */
+#ifdef APR_HAS_MMAP
+    OPEN_DBM(r, mimeDB, APR_DBM_RWCREATE, MIME_DBM_SUFFIX, temp, status);
+    if (status != APR_SUCCESS)
+        mimeDB = NULL;
+#else
+    mimeDB = NULL;
+#endif
+
     mbox_fillbuf(&b);
 
     msgID = NULL;
@@ -766,6 +1167,10 @@ apr_status_t mbox_generate_index(request_rec *r, apr_file_t *f,
 
             if (msgID) {
                 store_msgc(tpool, msgDB, msgID, &msgc, list, domain);
+                if (mimeDB)
+                    store_mime(tpool, mimeDB, msgID, &msgc,
+                               b.sb + msgc.body_start,
+                               msgc.body_end - msgc.body_start, store);
                 msgID = NULL;
             }
             apr_pool_clear(tpool);
@@ -793,6 +1198,10 @@ apr_status_t mbox_generate_index(request_rec *r, apr_file_t *f,
 
                 msgc.from = apr_table_get(table, "From");
                 msgc.subject = apr_table_get(table, "Subject");
+                make_display(tpool, &msgc.display, msgc.from,
+                             msgc.subject, msgID);
+                msgc.author_key = author_key_from_name(tpool,
+                    msgc.display.name ? msgc.display.name : "");
                 temp = apr_table_get(table, "Date");
                 if (temp) {
                     /* FIXME: Change this back to apr_date_parse_rfc()
@@ -882,10 +1291,16 @@ apr_status_t mbox_generate_index(request_rec *r, apr_file_t *f,
      */
     if (msgID) {
         store_msgc(tpool, msgDB, msgID, &msgc, list, domain);
+        if (mimeDB)
+            store_mime(tpool, mimeDB, msgID, &msgc,
+                       b.sb + msgc.body_start,
+                       msgc.body_end - msgc.body_start, store);
     }
 
     apr_pool_destroy(tpool);
     apr_dbm_close(msgDB);
+    if (mimeDB)
+        apr_dbm_close(mimeDB);
 #ifdef APR_HAS_MMAP
     apr_mmap_delete(b.mm);
 #else
@@ -941,6 +1356,9 @@ MBOX_LIST *mbox_load_index(request_rec *r, apr_file_t *f, int *count)
         curMsg->content_type = apr_pstrdup(r->pool, msgc.content_type);
         curMsg->charset = apr_pstrdup(r->pool, msgc.charset);
         curMsg->boundary = apr_pstrdup(r->pool, msgc.boundary);
+        curMsg->author_key = apr_pstrdup(r->pool, msgc.author_key);
+        if (msgc.has_display)
+            set_display(r->pool, curMsg, &msgc.display);
         curMsg->date = msgc.date;
         curMsg->raw_ref = apr_pstrdup(r->pool, msgc.references);
         curMsg->msg_start = msgc.msg_start;
@@ -968,16 +1386,24 @@ MBOX_LIST *mbox_load_index(request_rec *r, apr_file_t *f, int *count)
     return head;
 }
 
+apr_status_t mbox_open_index(request_rec *r, apr_dbm_t **db)
+{
+    apr_status_t status;
+    char *temp;
+
+    OPEN_DBM(r, *db, APR_DBM_READONLY, MSGID_DBM_SUFFIX, temp, status);
+    return status;
+}
+
 /* This function returns the information about one particular message
  * that may or may not be in the DBM.  If it is not in the DBM index,
  * NULL will be returned.
  */
-Message *mbox_fetch_index(request_rec *r, apr_file_t *f, const char *msgID)
+Message *mbox_fetch_index_db(request_rec *r, apr_dbm_t *msgDB,
+                             const char *msgID)
 {
     apr_status_t status;
-    apr_dbm_t *msgDB;
     apr_datum_t msgKey;
-    char *temp;
     Message *curMsg = NULL;
     mb_dbm_data msgc;
 
@@ -985,11 +1411,6 @@ Message *mbox_fetch_index(request_rec *r, apr_file_t *f, const char *msgID)
     if (!msgID || *msgID == '\0')
         return NULL;
 
-    OPEN_DBM(r, msgDB, APR_DBM_READONLY, MSGID_DBM_SUFFIX, temp, status);
-
-    if (status != APR_SUCCESS)
-        return NULL;
-
     msgKey.dptr = (char *) msgID;
     /* We add one to the strlen to encompass the term null */
     msgKey.dsize = strlen(msgID) + 1;
@@ -1009,6 +1430,9 @@ Message *mbox_fetch_index(request_rec *r, apr_file_t *f, const char *msgID)
     curMsg->content_type = apr_pstrdup(r->pool, msgc.content_type);
     curMsg->charset = apr_pstrdup(r->pool, msgc.charset);
     curMsg->boundary = apr_pstrdup(r->pool, msgc.boundary);
+    curMsg->author_key = apr_pstrdup(r->pool, msgc.author_key);
+    if (msgc.has_display)
+        set_display(r->pool, curMsg, &msgc.display);
     curMsg->date = msgc.date;
     curMsg->raw_ref = apr_pstrdup(r->pool, msgc.references);
     curMsg->msg_start = msgc.msg_start;
@@ -1019,11 +1443,173 @@ Message *mbox_fetch_index(request_rec *r, apr_file_t *f, const char *msgID)
     /* Normalize the message and perform tweaks on it */
     normalize_message(r, curMsg);
 
+    return curMsg;
+}
+
+Message *mbox_fetch_index(request_rec *r, apr_file_t *f, const char *msgID)
+{
+    apr_dbm_t *msgDB;
+    Message *curMsg;
+
+    /* If the message ID passed in is blank. */
+    if (!msgID || *msgID == '\0')
+        return NULL;
+
+    if (mbox_open_index(r, &msgDB) != APR_SUCCESS)
+        return NULL;
+
+    curMsg = mbox_fetch_index_db(r, msgDB, msgID);
     apr_dbm_close(msgDB);
 
     return curMsg;
 }
 
+apr_status_t mbox_fetch_mime_index(request_rec *r, Message *m,
+                                   mbox_mime_message_t **mime)
+{
+    apr_status_t status;
+    apr_dbm_t *mimeDB;
+    apr_datum_t mimeKey, mimeValue;
+    apr_uint64_t blen;
+    char *temp;
+
+    *mime = NULL;
+
+    OPEN_DBM(r, mimeDB, APR_DBM_READONLY, MIME_DBM_SUFFIX, temp, status);
+    if (status != APR_SUCCESS)
+        return APR_NOTFOUND;
+
+    mimeKey.dptr = m->msgID;
+    mimeKey.dsize = strlen(m->msgID) + 1;
+
+    status = apr_dbm_fetch(mimeDB, mimeKey, &mimeValue);
+    if (status != APR_SUCCESS || !mimeValue.dptr
+        || mimeValue.dsize < sizeof(blen)) {
+        apr_dbm_close(mimeDB);
+        return APR_NOTFOUND;
+    }
+
+    /* A record for another version of the message is of no use. */
+    memcpy(&blen, mimeValue.dptr, sizeof(blen));
+    if (blen != (apr_uint64_t) (m->body_end - m->body_start)) {
+        apr_dbm_close(mimeDB);
+        return APR_NOTFOUND;
+    }
+
+    status = mbox_mime_unserialize(r->pool, mimeValue.dptr + sizeof(blen),
+                                   mimeValue.dsize - sizeof(blen),
+                                   m->raw_body, (apr_size_t) blen, mime);
+    apr_dbm_close(mimeDB);
+
+    return status == APR_SUCCESS ? APR_SUCCESS : APR_NOTFOUND;
+}
+
+/* Returns the MIME structure of a message: from the index if it was
+ * recorded there.  Otherwise, a message that is not multipart is
+ * described from its index entry alone, and only the others are loaded
+ * (in p) and parsed.
+ */
+mbox_mime_message_t *mbox_fetch_message_mime(request_rec *r, apr_pool_t *p,
+                                             apr_file_t *f, Message *m)
+{
+    mbox_mime_message_t *mime;
+
+    if (mbox_fetch_mime_index(r, m, &mime) == APR_SUCCESS) {
+        return mime;
+    }
+
+    if (m->content_type
+        && strncmp(m->content_type, "multipart/", strlen("multipart/")) != 0) {
+        mime = apr_pcalloc(p, sizeof(mbox_mime_message_t));
+        mime->body = m->raw_body;
+        mime->body_len = m->body_end - m->body_start;
+        mime->content_type = m->content_type;
+        mime->charset = m->charset;
+        mime->content_disposition = "inline";
+        mime->cte = m->cte;
+        mime->state = MBOX_MIME_PARSED;
+        return mime;
+    }
+
+    if (!m->raw_body && m->body_end > m->msg_start) {
+        load_message(p, f, m);
+    }
+
+    return mbox_mime_decode_multipart(p, m->raw_body,
+                                      m->content_type,
+                                      m->charset,
+                                      m->cte, m->boundary);
+}
+
+apr_status_t mbox_index_stat_path(apr_pool_t *p, const char *path,
+                                  apr_finfo_t *finfo)
+{
+    const char *used1, *used2;
+    char *temp;
+    apr_status_t status;
+
+    temp = apr_pstrcat(p, path, MSGID_DBM_SUFFIX, NULL);
+    status = apr_dbm_get_usednames_ex(p, APR_STRINGIFY(DBM_TYPE), temp,
+                                      &used1, &used2);
+    if (status != APR_SUCCESS)
+        return status;
+
+    return apr_stat(finfo, used1, APR_FINFO_MTIME | APR_FINFO_SIZE, p);
+}
+
+apr_status_t mbox_index_stat(request_rec *r, apr_finfo_t *finfo)
+{
+    return mbox_index_stat_path(r->pool, r->filename, finfo);
+}
+
+apr_status_t mbox_index_ordinals(request_rec *r, mbox_ordinal_t **ord)
+{
+    apr_finfo_t finfo;
+    apr_status_t status;
+
+    status = mbox_index_stat(r, &finfo);
+    if (status != APR_SUCCESS)
+        return status;
+
+    status = mbox_ordinal_open(ord, r->pool, r->filename);
+    if (status != APR_SUCCESS)
+        return status;
+
+    /* A table of an older index would point to the wrong messages. */
+    if (!mbox_ordinal_matches(*ord, finfo.mtime, finfo.size))
+        return APR_NOTFOUND;
+
+    return APR_SUCCESS;
+}
+
+Message *mbox_fetch_ordinal(request_rec *r, apr_dbm_t *db,
+                            const mbox_ordinal_t *ord, apr_uint32_t ordinal)
+{
+    return mbox_fetch_index_db(r, db, mbox_ordinal_msgid(ord, ordinal));
+}
+
+/*
+ * Reads a message (from msg_start to body_end) into m->raw_msg
+ */
+void load_message(apr_pool_t *p, apr_file_t *f, Message *m)
+{
+    apr_size_t len;
+
+    /* Fetch message (from msg_start to body_end) */
+    if (apr_file_seek(f, APR_SET, &m->msg_start) != APR_SUCCESS) {
+        return;
+    }
+
+    len = m->body_end - m->msg_start;
+    m->raw_msg = apr_palloc(p, len + 1);
+
+    if (apr_file_read_full(f, m->raw_msg, len, &len) != APR_SUCCESS) {
+        return;
+    }
+
+    m->raw_msg[len] = '\0';
+    m->raw_body = m->raw_msg + (m->body_start - m->msg_start);
+}
 
 int mbox_msg_count(request_rec *r, char *path)
 {
@@ -1241,3 +1827,26 @@ mbox_cte_e mbox_parse_cte_header(char *src)
 
     return CTE_NONE;
 }
+
+/* Returns the name of a CTE, for display. */
+const char *mbox_cte_to_char(mbox_cte_e cte)
+{
+    switch (cte) {
+    case CTE_NONE:
+        return "None";
+    case CTE_7BIT:
+        return "7-Bit";
+    case CTE_8BIT:
+        return "8-Bit";
+    case CTE_UUENCODE:
+        return "uuencode";
+    case CTE_BINARY:
+        return "Binary";
+    case CTE_QP:
+        return "Quoted Printable";
+    case CTE_BASE64:
+        return "Base64";
+    default:
+        return "Unknown CTE";
+    }
+}
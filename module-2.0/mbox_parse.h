@@ -34,6 +34,10 @@
 #include "apr.h"
 #include "apr_strings.h"
 #include "apr_mmap.h"
+#include "apr_dbm.h"
+
+#include "mbox_attach.h"
+#include "mbox_ordinal.h"
 
 #include <stdio.h>
 
@@ -97,6 +101,8 @@ typedef enum
 } mbox_cte_e;
 
 mbox_cte_e mbox_parse_cte_header(char *src);
+/* Display name of a CTE */
+const char *mbox_cte_to_char(mbox_cte_e cte);
 
 /* The following is based on Jamie Zawinski's description of the Netscape 3.x
  * threading algorithm at <http://www.jwz.org/doc/threading.html>.
@@ -124,20 +130,49 @@ typedef struct mbox_mime_message
     char *content_name;
     mbox_cte_e cte;
 
+    /* Sub-parts are parsed on first access, through
+     * mbox_mime_get_part(); until then only their span is known.
+     */
     struct mbox_mime_message **sub;
     unsigned int sub_count;
+    char *span;
+    char *span_end;
+    int state;
+
+    /* Only known for trees loaded from the .mimesum index: the offset
+     * of the body in the message body, and its length once decoded.
+     */
+    apr_size_t body_offset;
+    apr_size_t decoded_len;
+
+    /* Key of the decoded body in the attachment store, if it is there. */
+    char *store_key;
 } mbox_mime_message_t;
 
+#define MBOX_MIME_UNPARSED 0
+#define MBOX_MIME_PARSED   1
+#define MBOX_MIME_INVALID  2
+
 /* The basic information about a message.  */
 struct Message_Struct
 {
     ID msgID;
 
     char *from;
-    char *str_from;
+    char *author_key;
 
     char *subject;
 
+    /* Decoded (UTF-8) display name and subject, their escaped HTML
+     * forms and the URI-escaped msgID, as stored in the index.
+     */
+    char *name;
+    char *html_name;
+    char *html_name_antispam;
+    char *utf8_subject;
+    char *html_subject;
+    char *uri_msgID;
+
     apr_time_t date;
     char *str_date;
     char *rfc822_date;
@@ -179,16 +214,28 @@ void mbox_fillbuf(MBOX_BUFF *fb);
  */
 int mbox_getline(char *s, int n, MBOX_BUFF *in, int fold);
 
+/*
+ * Returns the normalized key used to sort messages by author.
+ */
+char *mbox_author_key(apr_pool_t *p, const char *from);
+
+/*
+ * Returns a display name case-folded as in author keys, to look them up.
+ */
+char *mbox_author_fold(apr_pool_t *p, const char *name);
+
 /*
  * Sorts a list of MBOX_LIST items by the specified order.
  */
 MBOX_LIST *mbox_sort_list(MBOX_LIST *l, int sortFlags);
 
 /*
- * Generates the DBM file.
+ * Generates the DBM file.  If store is not NULL, large parts are also
+ * extracted to the attachment store.
  */
 apr_status_t mbox_generate_index(request_rec *r, apr_file_t *f,
-                                 const char *list, const char *domain);
+                                 const char *list, const char *domain,
+                                 const mbox_attach_store_t *store);
 
 /*
  * Returns a list of Messages
@@ -200,6 +247,68 @@ MBOX_LIST *mbox_load_index(request_rec *r, apr_file_t *f, int *count);
  */
 Message *mbox_fetch_index(request_rec *r, apr_file_t *f, const char *msgID);
 
+/*
+ * Opens the message index of r->filename, for the pages that fetch many
+ * messages from it with mbox_fetch_index_db().  The caller closes it.
+ */
+apr_status_t mbox_open_index(request_rec *r, apr_dbm_t **db);
+
+/*
+ * Returns a single message based on message ID, from an index opened
+ * with mbox_open_index()
+ */
+Message *mbox_fetch_index_db(request_rec *r, apr_dbm_t *db,
+                             const char *msgID);
+
+/*
+ * Opens the ordinal index of r->filename (see mbox_ordinal.h), which
+ * finds its messages by their position by date.  Returns APR_NOTFOUND if
+ * there is none for the current message index.
+ */
+apr_status_t mbox_index_ordinals(request_rec *r, mbox_ordinal_t **ord);
+
+/*
+ * Returns the message at an ordinal of the mailbox, through its ordinal
+ * index and the message index opened with mbox_open_index(), or NULL if
+ * there is none.
+ */
+Message *mbox_fetch_ordinal(request_rec *r, apr_dbm_t *db,
+                            const mbox_ordinal_t *ord, apr_uint32_t ordinal);
+
+/*
+ * Returns the MIME structure of a message, as recorded in the index, with
+ * bodies pointing into m->raw_body if it is loaded.  Returns APR_NOTFOUND
+ * if the index has no structure for the message; on success, *mime may
+ * still be NULL if the message body is not a usable MIME part.
+ */
+apr_status_t mbox_fetch_mime_index(request_rec *r, Message *m,
+                                   mbox_mime_message_t **mime);
+
+/*
+ * Returns the MIME structure of a message, from the index if it is
+ * there, otherwise parsed from the mailbox (in p).
+ */
+mbox_mime_message_t *mbox_fetch_message_mime(request_rec *r, apr_pool_t *p,
+                                             apr_file_t *f, Message *m);
+
+/*
+ * Reads a message from the mailbox into m->raw_msg and m->raw_body.
+ */
+void load_message(apr_pool_t *p, apr_file_t *f, Message *m);
+
+/*
+ * Stats the message index of r->filename.  Its modification time and
+ * size change whenever mod-mbox-util updates it, so together they serve
+ * as the version of the index.
+ */
+apr_status_t mbox_index_stat(request_rec *r, apr_finfo_t *finfo);
+
+/*
+ * Stats the message index of the mailbox at path, as mbox_index_stat().
+ */
+apr_status_t mbox_index_stat_path(apr_pool_t *p, const char *path,
+                                  apr_finfo_t *finfo);
+
 /*
  * Get the total message count for a file.
  */
@@ -0,0 +1,303 @@
+/* Licensed to the Apache Software Foundation (ASF) under one or more
+ * contributor license agreements.  See the NOTICE file distributed with
+ * this work for additional information regarding copyright ownership.
+ * The ASF licenses this file to You under the Apache License, Version 2.0
+ * (the "License"); you may not use this file except in compliance with
+ * the License.  You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+/* Streaming body renderer.
+ *
+ * The raw body is buffered a window at a time; each window goes through
+ * the same stages as a whole body used to (CTE decoding, conversion to
+ * UTF-8, repair, HTML escaping, wrapping) in a pool cleared afterwards.
+ * Whatever a stage cannot handle at the end of a window (a base64 group,
+ * a QP line, a multibyte character cut in two) is carried over to the
+ * next one.
+ */
+
+#include "mbox_render.h"
+#include "mbox_escape.h"
+#include "mbox_utf8.h"
+
+#include "apr_lib.h"
+#include "apr_strings.h"
+
+#include <string.h>
+
+#define RENDER_WINDOW (64 * 1024)
+
+struct mbox_render
+{
+    apr_pool_t *pool;           /* Cleared after each window */
+    mbox_cte_e cte;
+    int flags;
+    mbox_render_write_fn *write;
+    void *baton;
+
+    mbox_cte_xlate_stream_t *xs;
+    int done;                   /* The rest of the body is ignored */
+    int column;                 /* For wrapping */
+
+    char *in;                   /* Raw input, RENDER_WINDOW bytes */
+    apr_size_t in_len;
+
+    char xcarry[16];            /* Charset input cut by the window */
+    apr_size_t xcarry_len;
+    char ucarry[4];             /* UTF-8 sequence cut by the window */
+    apr_size_t ucarry_len;
+};
+
+apr_status_t mbox_render_create(mbox_render_t **rd, apr_pool_t *p,
+                                mbox_cte_e cte, const char *charset,
+                                int flags, mbox_render_write_fn *write,
+                                void *baton)
+{
+    mbox_render_t *r = apr_pcalloc(p, sizeof(mbox_render_t));
+
+    apr_pool_create(&r->pool, p);
+    r->cte = cte;
+    r->flags = flags;
+    r->write = write;
+    r->baton = baton;
+    r->in = apr_palloc(p, RENDER_WINDOW);
+
+    *rd = r;
+    return mbox_cte_xlate_stream_open(p, charset, &r->xs);
+}
+
+/* Returns the length of the sequence cut at the end of s, if any. */
+static apr_size_t utf8_cut(const char *s, apr_size_t len)
+{
+    apr_size_t k;
+
+    for (k = 1; k <= 3 && k <= len; k++) {
+        unsigned char c = s[len - k];
+        apr_size_t need;
+
+        if ((c & 0xC0) == 0x80)
+            continue;
+        if (c < 0xC0)
+            return 0;
+
+        need = c >= 0xF0 ? 4 : c >= 0xE0 ? 3 : 2;
+        return need > k ? k : 0;
+    }
+    return 0;
+}
+
+/* Decodes what can be of the buffered input, leaving the rest of it at
+ * the start of the buffer.
+ */
+static char *decode_window(mbox_render_t *rd, int final, apr_size_t *len)
+{
+    char *data = rd->in, *dec;
+    apr_size_t n = rd->in_len, cut = n, i, j;
+
+    switch (rd->cte) {
+    case CTE_BASE64:
+        /* Only decode whole groups of four; blanks may be anywhere. */
+        if (!final) {
+            apr_size_t chars = 0;
+
+            for (i = 0; i < n; i++) {
+                if (!apr_isspace(data[i]))
+                    chars++;
+            }
+            for (i = chars % 4; i > 0;) {
+                if (!apr_isspace(data[--cut]))
+                    i--;
+            }
+        }
+
+        dec = apr_pstrmemdup(rd->pool, data, cut);
+        /* Padding (or a NUL) ends the data, as for a whole body. */
+        if (memchr(data, '=', cut) || memchr(data, '\0', cut))
+            rd->done = 1;
+        *len = mbox_cte_decode_b64(dec);
+
+        for (i = cut, j = 0; i < n; i++) {
+            if (!apr_isspace(data[i]))
+                data[j++] = data[i];
+        }
+        rd->in_len = j;
+        return dec;
+
+    case CTE_QP:
+        /* Only decode whole lines, or at least whole escapes. */
+        if (!final) {
+            for (i = n; i > 0 && data[i - 1] != '\n'; i--)
+                ;
+            if (i > 0)
+                cut = i;
+            else if (n >= 1 && data[n - 1] == '=')
+                cut = n - 1;
+            else if (n >= 2 && data[n - 2] == '=')
+                cut = n - 2;
+        }
+
+        dec = apr_pstrmemdup(rd->pool, data, cut);
+        if (memchr(data, '\0', cut))
+            rd->done = 1;
+        *len = mbox_cte_decode_qp(dec);
+
+        memmove(data, data + cut, n - cut);
+        rd->in_len = n - cut;
+        return dec;
+
+    default:
+        *len = n;
+        rd->in_len = 0;
+        return data;
+    }
+}
+
+static apr_status_t render_window(mbox_render_t *rd, int final)
+{
+    mbox_varbuf_t vb;
+    char *s, *z;
+    apr_size_t len, used, i;
+    apr_status_t rv;
+
+    if (rd->done) {
+        rd->in_len = 0;
+        return APR_SUCCESS;
+    }
+
+    s = decode_window(rd, final, &len);
+
+    /* The body used to be printed as a C string. */
+    if ((z = memchr(s, '\0', len)) != NULL) {
+        len = z - s;
+        rd->done = 1;
+    }
+    final = final || rd->done;
+
+    /* Conversion to UTF-8 */
+    if (rd->xcarry_len) {
+        char *t = apr_palloc(rd->pool, rd->xcarry_len + len);
+
+        memcpy(t, rd->xcarry, rd->xcarry_len);
+        memcpy(t + rd->xcarry_len, s, len);
+        s = t;
+        len += rd->xcarry_len;
+        rd->xcarry_len = 0;
+    }
+
+    mbox_varbuf_init(rd->pool, &vb, len + len / 2 + 16);
+    mbox_cte_xlate_stream_write(rd->xs, s, len, final, &used, &vb);
+    if (len - used > sizeof(rd->xcarry)) {
+        /* Not a character cut in two, whatever the converter says. */
+        mbox_varbuf_strmemcat(&vb, s + used, len - used);
+    }
+    else {
+        rd->xcarry_len = len - used;
+        memcpy(rd->xcarry, s + used, rd->xcarry_len);
+    }
+
+    /* UTF-8 repair */
+    s = vb.buf;
+    len = vb.len;
+    if (rd->ucarry_len) {
+        char *t = apr_palloc(rd->pool, rd->ucarry_len + len);
+
+        memcpy(t, rd->ucarry, rd->ucarry_len);
+        memcpy(t + rd->ucarry_len, s, len);
+        s = t;
+        len += rd->ucarry_len;
+    }
+    rd->ucarry_len = final ? 0 : utf8_cut(s, len);
+    memcpy(rd->ucarry, s + len - rd->ucarry_len, rd->ucarry_len);
+    len -= rd->ucarry_len;
+
+    s = mbox_utf8_repair(rd->pool, s, len, &len);
+    s = mbox_escape_mem(rd->pool, s, len, MBOX_ESCAPE_MARKUP, &len);
+
+    /* Wrap at the first blank after MBOX_WRAP_TO. */
+    for (i = 0; i < len; i++, rd->column++) {
+        if (s[i] == '\n')
+            rd->column = 0;
+        if (rd->column >= MBOX_WRAP_TO && (s[i] == ' ' || s[i] == '\t')) {
+            s[i] = '\n';
+            rd->column = 0;
+        }
+    }
+
+    if (rd->flags & MBOX_RENDER_CNTRL)
+        s = mbox_escape_mem(rd->pool, s, len, MBOX_ESCAPE_CNTRL, &len);
+
+    rv = len ? rd->write(rd->baton, s, len) : APR_SUCCESS;
+    apr_pool_clear(rd->pool);
+    return rv;
+}
+
+apr_status_t mbox_render_write(mbox_render_t *rd, const char *data,
+                               apr_size_t len)
+{
+    apr_status_t rv;
+
+    while (len && !rd->done) {
+        apr_size_t n = RENDER_WINDOW - rd->in_len;
+
+        if (n > len)
+            n = len;
+        memcpy(rd->in + rd->in_len, data, n);
+        rd->in_len += n;
+        data += n;
+        len -= n;
+
+        if (rd->in_len == RENDER_WINDOW) {
+            rv = render_window(rd, 0);
+            if (rv != APR_SUCCESS)
+                return rv;
+        }
+    }
+
+    return APR_SUCCESS;
+}
+
+apr_status_t mbox_render_file(mbox_render_t *rd, apr_file_t *f,
+                              apr_off_t offset, apr_off_t len)
+{
+    apr_status_t rv;
+
+    rv = apr_file_seek(f, APR_SET, &offset);
+    if (rv != APR_SUCCESS)
+        return rv;
+
+    while (len > 0 && !rd->done) {
+        apr_size_t n = RENDER_WINDOW - rd->in_len;
+
+        if ((apr_off_t) n > len)
+            n = (apr_size_t) len;
+        rv = apr_file_read_full(f, rd->in + rd->in_len, n, &n);
+        rd->in_len += n;
+        len -= n;
+        if (rv != APR_SUCCESS)
+            return rv;
+
+        if (rd->in_len == RENDER_WINDOW) {
+            rv = render_window(rd, 0);
+            if (rv != APR_SUCCESS)
+                return rv;
+        }
+    }
+
+    return APR_SUCCESS;
+}
+
+apr_status_t mbox_render_close(mbox_render_t *rd)
+{
+    apr_status_t rv = render_window(rd, 1);
+
+    apr_pool_destroy(rd->pool);
+    return rv;
+}
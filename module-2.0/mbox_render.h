@@ -0,0 +1,66 @@
+/* Licensed to the Apache Software Foundation (ASF) under one or more
+ * contributor license agreements.  See the NOTICE file distributed with
+ * this work for additional information regarding copyright ownership.
+ * The ASF licenses this file to You under the Apache License, Version 2.0
+ * (the "License"); you may not use this file except in compliance with
+ * the License.  You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef MBOX_RENDER_H
+#define MBOX_RENDER_H
+
+/*
+ * Streaming rendering of message bodies: CTE decoding, conversion to
+ * UTF-8, HTML escaping and wrapping, a window at a time, so that the
+ * memory used does not depend on the size of the body.
+ */
+
+#include "apr.h"
+#include "apr_file_io.h"
+#include "apr_pools.h"
+
+#include "mbox_cte.h"
+#include "mbox_parse.h"
+
+/* Lines are wrapped at the first blank after this column. */
+#define MBOX_WRAP_TO 90
+
+/* Flags for mbox_render_create() */
+#define MBOX_RENDER_CNTRL 0x01  /* Escape control characters as well */
+
+/* Receives the rendered body, a piece at a time. */
+typedef apr_status_t mbox_render_write_fn(void *baton, const char *data,
+                                          apr_size_t len);
+
+typedef struct mbox_render mbox_render_t;
+
+/* Creates a renderer for a body with the given CTE and charset (which
+ * may be NULL).  If the charset cannot be converted from, the renderer
+ * is still created, and passes the body through unconverted; the error
+ * is returned so that it can be reported.
+ */
+apr_status_t mbox_render_create(mbox_render_t **rd, apr_pool_t *p,
+                                mbox_cte_e cte, const char *charset,
+                                int flags, mbox_render_write_fn *write,
+                                void *baton);
+
+/* Feeds len bytes of the raw body to the renderer. */
+apr_status_t mbox_render_write(mbox_render_t *rd, const char *data,
+                               apr_size_t len);
+
+/* Feeds len bytes of the raw body, read from f at offset. */
+apr_status_t mbox_render_file(mbox_render_t *rd, apr_file_t *f,
+                              apr_off_t offset, apr_off_t len);
+
+/* Renders whatever is left of the body. */
+apr_status_t mbox_render_close(mbox_render_t *rd);
+
+#endif
@@ -21,6 +21,7 @@
  */
 
 #include <stdio.h> /* defines NULL */
+#include <string.h>
 #include "mbox_sort.h"
 
 /*
@@ -122,3 +123,60 @@ void *mbox_sort_linked_list(void *p, unsigned index,
         *pcount = tape[base].count;
     return tape[base].first;
 }
+
+/*
+ * Stable LSD radix sort on the 64-bit keys of an array of items.
+ *
+ * One pass per key byte, using tmp (which must hold n items) as the
+ * scratch array.  Histograms for all eight bytes are built up front,
+ * and bytes that are identical across every key are skipped, so a
+ * month's worth of dates usually takes four or five passes.
+ *
+ * @param items Array of items to sort.
+ * @param tmp Scratch array of the same size.
+ * @param n Number of items.
+ * @return Whichever of items or tmp holds the sorted result.
+ */
+mbox_sort_item_t *mbox_sort_radix(mbox_sort_item_t *items,
+                                  mbox_sort_item_t *tmp, apr_size_t n)
+{
+    apr_size_t count[8][256];
+    apr_size_t i, sum, c;
+    mbox_sort_item_t *src = items, *dst = tmp, *swap;
+    unsigned int pass;
+
+    if (n < 2)
+        return items;
+
+    memset(count, 0, sizeof(count));
+    for (i = 0; i < n; i++) {
+        apr_uint64_t k = items[i].key;
+        for (pass = 0; pass < 8; pass++) {
+            count[pass][(k >> (pass * 8)) & 0xff]++;
+        }
+    }
+
+    for (pass = 0; pass < 8; pass++) {
+        unsigned int shift = pass * 8;
+
+        /* Every key has the same value in this byte: nothing to do. */
+        if (count[pass][(items[0].key >> shift) & 0xff] == n)
+            continue;
+
+        for (sum = 0, c = 0; c < 256; c++) {
+            apr_size_t t = count[pass][c];
+            count[pass][c] = sum;
+            sum += t;
+        }
+
+        for (i = 0; i < n; i++) {
+            dst[count[pass][(src[i].key >> shift) & 0xff]++] = src[i];
+        }
+
+        swap = src;
+        src = dst;
+        dst = swap;
+    }
+
+    return src;
+}
@@ -17,6 +17,21 @@
 #ifndef MBOX_SORT_H
 #define MBOX_SORT_H
 
+#include "apr.h"
+
+/*
+ * An element for mbox_sort_radix(): an unsigned 64-bit key and the
+ * value it was derived from.
+ */
+typedef struct mbox_sort_item
+{
+    apr_uint64_t key;
+    void *value;
+} mbox_sort_item_t;
+
+mbox_sort_item_t *mbox_sort_radix(mbox_sort_item_t *items,
+                                  mbox_sort_item_t *tmp, apr_size_t n);
+
 void *mbox_sort_linked_list(void *p, unsigned index,
                             int (*compare) (void *, void *, void *),
                             void *pointer, unsigned long *pcount);
@@ -0,0 +1,733 @@
+/* Licensed to the Apache Software Foundation (ASF) under one or more
+ * contributor license agreements.  See the NOTICE file distributed with
+ * this work for additional information regarding copyright ownership.
+ * The ASF licenses this file to You under the Apache License, Version 2.0
+ * (the "License"); you may not use this file except in compliance with
+ * the License.  You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+/* Subject index.
+ *
+ * The index of a list is a single file: a subject_header, then the
+ * segments (a subject_seg per mailbox, with the version of its message
+ * index), the threads (a subject_thread each, newest first), the
+ * trigrams (a subject_gram each, sorted), the strings the segments and
+ * threads point to, NUL terminated, and the postings.  The postings of
+ * a trigram list the threads whose subject has it, in order, each as the
+ * difference from the previous one, as varints.  Trigrams are of bytes:
+ * UTF-8 subjects are matched as they are.
+ *
+ * Sections are aligned on 8 bytes and in the byte order of the host.
+ * The index is written again as a whole when a mailbox changes; the
+ * threads of the other mailboxes are copied from the current one.
+ */
+
+#include "mbox_subject.h"
+#include "mbox_cte.h"
+#include "mbox_thread.h"
+
+#include "apr_file_io.h"
+#include "apr_lib.h"
+#include "apr_mmap.h"
+#include "apr_strings.h"
+
+#include <stdlib.h>
+#include <string.h>
+
+#define SUBJECT_MAGIC "MBOXSUB1"
+#define SUBJECT_VERSION 1
+
+#define SUBJECT_PERMS (APR_FPROT_UREAD | APR_FPROT_UWRITE | \
+                       APR_FPROT_GREAD | APR_FPROT_WREAD)
+
+/* Below this many candidates, subjects are checked rather than the
+   postings of more trigrams intersected. */
+#define SUBJECT_CHECK 32
+
+typedef struct subject_header
+{
+    char magic[8];
+    apr_uint32_t version;
+    apr_uint32_t nsegs;
+    apr_uint32_t nthreads;
+    apr_uint32_t ngrams;
+    apr_uint64_t segs_off;
+    apr_uint64_t threads_off;
+    apr_uint64_t grams_off;
+    apr_uint64_t strings_off;
+    apr_uint64_t strings_len;
+    apr_uint64_t postings_off;
+    apr_uint64_t postings_len;
+} subject_header;
+
+typedef struct subject_seg
+{
+    apr_int64_t index_mtime;
+    apr_int64_t index_size;
+    apr_uint32_t box;           /* Offset in the strings */
+    apr_uint32_t reserved;
+} subject_seg;
+
+typedef struct subject_thread
+{
+    apr_int64_t date;
+    apr_uint32_t seg;
+    apr_uint32_t count;
+    apr_uint32_t key;           /* Offsets in the strings */
+    apr_uint32_t html_subject;
+    apr_uint32_t uri_msgID;
+    apr_uint32_t str_date;
+} subject_thread;
+
+typedef struct subject_gram
+{
+    apr_uint32_t gram;          /* Its bytes, first one highest */
+    apr_uint32_t count;         /* Of threads */
+    apr_uint64_t postings;      /* Offset in the postings */
+} subject_gram;
+
+struct mbox_subject_index
+{
+    const subject_header *h;
+    const subject_seg *segs;
+    const subject_thread *threads;
+    const subject_gram *grams;
+    const char *strings;
+    const unsigned char *postings;
+};
+
+/* Index being written */
+typedef struct subject_wseg
+{
+    const char *box;
+    apr_time_t index_mtime;
+    apr_off_t index_size;
+    int old;                    /* Segment of the current index, or -1 */
+} subject_wseg;
+
+typedef struct subject_wthread
+{
+    apr_time_t date;
+    apr_uint32_t seg;
+    apr_uint32_t count;
+    const char *key;
+    const char *html_subject;
+    const char *uri_msgID;
+    const char *str_date;
+} subject_wthread;
+
+struct mbox_subject_writer
+{
+    apr_pool_t *pool;
+    const char *path;
+    mbox_subject_index_t *old;
+    char *declared;             /* Old segments declared */
+
+    apr_array_header_t *segs;   /* Of subject_wseg */
+    apr_array_header_t *threads;        /* Of subject_wthread */
+    int current;                /* Segment threads are added to */
+    int changed;
+};
+
+char *mbox_subject_normalize(apr_pool_t *p, const char *subject)
+{
+    char *s, *d, *key;
+
+    key = mbox_strip_subject(p, subject ? subject : "");
+    if (!key) {
+        return apr_pstrdup(p, "");
+    }
+
+    for (s = d = key; *s; s++) {
+        if (apr_isspace(*s)) {
+            if (d > key && d[-1] != ' ') {
+                *d++ = ' ';
+            }
+        }
+        else {
+            *d++ = apr_tolower(*s);
+        }
+    }
+    if (d > key && d[-1] == ' ') {
+        d--;
+    }
+    *d = '\0';
+    return key;
+}
+
+/* Varints */
+
+static void put_varint(mbox_varbuf_t *vb, apr_uint32_t v)
+{
+    char buf[5];
+    apr_size_t n = 0;
+
+    while (v >= 0x80) {
+        buf[n++] = (char) (v | 0x80);
+        v >>= 7;
+    }
+    buf[n++] = (char) v;
+    mbox_varbuf_strmemcat(vb, buf, n);
+}
+
+static int get_varint(const unsigned char **p, const unsigned char *end,
+                      apr_uint32_t *v)
+{
+    apr_uint32_t r = 0;
+    int shift;
+
+    for (shift = 0; *p < end && shift < 32; shift += 7) {
+        unsigned char c = *(*p)++;
+
+        r |= (apr_uint32_t) (c & 0x7f) << shift;
+        if (!(c & 0x80)) {
+            *v = r;
+            return 1;
+        }
+    }
+    return 0;
+}
+
+static apr_uint32_t gram_at(const char *s)
+{
+    return ((apr_uint32_t) (unsigned char) s[0] << 16)
+        | ((apr_uint32_t) (unsigned char) s[1] << 8)
+        | (apr_uint32_t) (unsigned char) s[2];
+}
+
+/* Reader */
+
+apr_status_t mbox_subject_open(mbox_subject_index_t **idxp, apr_pool_t *p,
+                               const char *dir)
+{
+    mbox_subject_index_t *idx;
+    apr_file_t *f;
+    apr_finfo_t finfo;
+    apr_mmap_t *mm;
+    const subject_header *h;
+    const char *base;
+    apr_uint64_t size;
+    apr_status_t rv;
+
+    rv = apr_file_open(&f, apr_pstrcat(p, dir, MBOX_SUBJECT_FILE, NULL),
+                       APR_READ, APR_OS_DEFAULT, p);
+    if (rv != APR_SUCCESS)
+        return APR_STATUS_IS_ENOENT(rv) ? APR_NOTFOUND : rv;
+
+    rv = apr_file_info_get(&finfo, APR_FINFO_SIZE, f);
+    if (rv == APR_SUCCESS && finfo.size < (apr_off_t) sizeof(subject_header))
+        rv = APR_EGENERAL;
+    if (rv == APR_SUCCESS)
+        rv = apr_mmap_create(&mm, f, 0, finfo.size, APR_MMAP_READ, p);
+    apr_file_close(f);
+    if (rv != APR_SUCCESS)
+        return rv;
+
+    base = mm->mm;
+    size = finfo.size;
+    h = (const subject_header *) base;
+
+    /* Everything the index points to must be within it. */
+    if (memcmp(h->magic, SUBJECT_MAGIC, sizeof(h->magic)) != 0
+        || h->version != SUBJECT_VERSION
+        || h->segs_off != sizeof(subject_header)
+        || h->threads_off != h->segs_off + (apr_uint64_t) h->nsegs
+                                           * sizeof(subject_seg)
+        || h->grams_off != h->threads_off + (apr_uint64_t) h->nthreads
+                                            * sizeof(subject_thread)
+        || h->strings_off != h->grams_off + (apr_uint64_t) h->ngrams
+                                          * sizeof(subject_gram)
+        || h->strings_off > size || h->strings_len % 8
+        || h->strings_len > size - h->strings_off
+        || h->postings_off != h->strings_off + h->strings_len
+        || h->postings_len > size - h->postings_off
+        || (h->strings_len && base[h->strings_off + h->strings_len - 1])
+        || (!h->strings_len && h->nsegs)) {
+        apr_mmap_delete(mm);
+        return APR_EGENERAL;
+    }
+
+    idx = apr_palloc(p, sizeof(mbox_subject_index_t));
+    idx->h = h;
+    idx->segs = (const subject_seg *) (base + h->segs_off);
+    idx->threads = (const subject_thread *) (base + h->threads_off);
+    idx->grams = (const subject_gram *) (base + h->grams_off);
+    idx->strings = base + h->strings_off;
+    idx->postings = (const unsigned char *) base + h->postings_off;
+
+    *idxp = idx;
+    return APR_SUCCESS;
+}
+
+static const char *subject_string(const mbox_subject_index_t *idx,
+                                  apr_uint32_t off)
+{
+    return off < idx->h->strings_len ? idx->strings + off : "";
+}
+
+static const subject_gram *subject_lookup(const mbox_subject_index_t *idx,
+                                          apr_uint32_t gram)
+{
+    apr_uint32_t lo = 0, hi = idx->h->ngrams;
+
+    while (lo < hi) {
+        apr_uint32_t mid = lo + (hi - lo) / 2;
+
+        if (idx->grams[mid].gram < gram)
+            lo = mid + 1;
+        else if (idx->grams[mid].gram > gram)
+            hi = mid;
+        else
+            return &idx->grams[mid];
+    }
+    return NULL;
+}
+
+static int gram_count_cmp(const void *a, const void *b)
+{
+    const subject_gram *x = *(const subject_gram * const *) a;
+    const subject_gram *y = *(const subject_gram * const *) b;
+
+    return (x->count > y->count) - (x->count < y->count);
+}
+
+/* Keeps in cand (of apr_uint32_t) the threads the postings of g also
+ * list, or fills it if it is empty.
+ */
+static void postings_and(const mbox_subject_index_t *idx,
+                         const subject_gram *g, apr_array_header_t *cand,
+                         int fill)
+{
+    const unsigned char *p, *end = idx->postings + idx->h->postings_len;
+    apr_uint32_t *c = (apr_uint32_t *) cand->elts;
+    apr_uint32_t i, id = 0, delta;
+    int n = 0, kept = 0;
+
+    if (g->postings >= idx->h->postings_len) {
+        cand->nelts = 0;
+        return;
+    }
+    p = idx->postings + g->postings;
+
+    for (i = 0; i < g->count && get_varint(&p, end, &delta); i++) {
+        id = i ? id + delta : delta;
+        if (id >= idx->h->nthreads) {
+            break;
+        }
+        if (fill) {
+            *(apr_uint32_t *) apr_array_push(cand) = id;
+            continue;
+        }
+        while (n < cand->nelts && c[n] < id) {
+            n++;
+        }
+        if (n == cand->nelts) {
+            break;
+        }
+        if (c[n] == id) {
+            c[kept++] = id;
+            n++;
+        }
+    }
+    if (!fill) {
+        cand->nelts = kept;
+    }
+}
+
+static void push_hit(apr_array_header_t *hits, apr_pool_t *p,
+                     const mbox_subject_index_t *idx, apr_uint32_t id)
+{
+    const subject_thread *t = &idx->threads[id];
+    mbox_subject_hit_t *hit = apr_array_push(hits);
+
+    hit->box = t->seg < idx->h->nsegs
+        ? subject_string(idx, idx->segs[t->seg].box) : "";
+    hit->date = t->date;
+    hit->count = t->count;
+    hit->uri_msgID = subject_string(idx, t->uri_msgID);
+    hit->html_subject = subject_string(idx, t->html_subject);
+    hit->str_date = subject_string(idx, t->str_date);
+}
+
+void mbox_subject_search(apr_array_header_t **hitsp, apr_pool_t *p,
+                         const mbox_subject_index_t *idx, const char *query,
+                         int k)
+{
+    apr_array_header_t *hits, *rest, *cand, *grams;
+    const subject_gram *g;
+    char *q;
+    apr_size_t len, j;
+    apr_uint32_t i, n;
+    int all, m;
+
+    hits = apr_array_make(p, k > 0 ? k : 1, sizeof(mbox_subject_hit_t));
+    rest = apr_array_make(p, k > 0 ? k : 1, sizeof(apr_uint32_t));
+    *hitsp = hits;
+
+    q = mbox_subject_normalize(p, query);
+    len = strlen(q);
+    if (!len || k <= 0) {
+        return;
+    }
+
+    /* Every thread is a candidate for shorter queries. */
+    cand = apr_array_make(p, 64, sizeof(apr_uint32_t));
+    all = len < MBOX_SUBJECT_GRAM;
+    if (all) {
+        n = idx->h->nthreads;
+    }
+    else {
+        grams = apr_array_make(p, len, sizeof(const subject_gram *));
+        for (j = 0; j + MBOX_SUBJECT_GRAM <= len; j++) {
+            g = subject_lookup(idx, gram_at(q + j));
+            if (!g) {
+                return;
+            }
+            APR_ARRAY_PUSH(grams, const subject_gram *) = g;
+        }
+
+        /* From the rarest trigram, as long as intersecting pays. */
+        qsort(grams->elts, grams->nelts, sizeof(const subject_gram *),
+              gram_count_cmp);
+        postings_and(idx, APR_ARRAY_IDX(grams, 0, const subject_gram *),
+                     cand, 1);
+        for (m = 1; m < grams->nelts && cand->nelts > SUBJECT_CHECK; m++) {
+            g = APR_ARRAY_IDX(grams, m, const subject_gram *);
+            if (g != APR_ARRAY_IDX(grams, m - 1, const subject_gram *)) {
+                postings_and(idx, g, cand, 0);
+            }
+        }
+        n = cand->nelts;
+    }
+
+    /* Threads are newest first: subjects that start with the query
+       come first, then the others. */
+    for (i = 0; i < n && hits->nelts < k; i++) {
+        apr_uint32_t id = all ? i : APR_ARRAY_IDX(cand, i, apr_uint32_t);
+        const char *key = subject_string(idx, idx->threads[id].key);
+
+        if (strncmp(key, q, len) == 0) {
+            push_hit(hits, p, idx, id);
+        }
+        else if (rest->nelts < k && strstr(key, q)) {
+            APR_ARRAY_PUSH(rest, apr_uint32_t) = id;
+        }
+    }
+    for (m = 0; m < rest->nelts && hits->nelts < k; m++) {
+        push_hit(hits, p, idx, APR_ARRAY_IDX(rest, m, apr_uint32_t));
+    }
+}
+
+/* Writer */
+
+static subject_wseg *writer_seg(mbox_subject_writer_t *w, const char *box,
+                                apr_time_t index_mtime, apr_off_t index_size,
+                                int old)
+{
+    subject_wseg *seg = apr_array_push(w->segs);
+
+    seg->box = box;
+    seg->index_mtime = index_mtime;
+    seg->index_size = index_size;
+    seg->old = old;
+    return seg;
+}
+
+apr_status_t mbox_subject_writer_create(mbox_subject_writer_t **wp,
+                                        apr_pool_t *p, const char *dir)
+{
+    mbox_subject_writer_t *w;
+
+    w = apr_pcalloc(p, sizeof(mbox_subject_writer_t));
+    w->pool = p;
+    w->path = apr_pstrcat(p, dir, MBOX_SUBJECT_FILE, NULL);
+    w->segs = apr_array_make(p, 64, sizeof(subject_wseg));
+    w->threads = apr_array_make(p, 256, sizeof(subject_wthread));
+    w->current = -1;
+
+    /* An index that cannot be read is written anew. */
+    if (mbox_subject_open(&w->old, p, dir) != APR_SUCCESS) {
+        w->old = NULL;
+        w->changed = 1;
+    }
+    else {
+        w->declared = apr_pcalloc(p, w->old->h->nsegs + 1);
+    }
+
+    *wp = w;
+    return APR_SUCCESS;
+}
+
+int mbox_subject_writer_box(mbox_subject_writer_t *w, const char *box,
+                            apr_time_t index_mtime, apr_off_t index_size)
+{
+    apr_uint32_t i;
+
+    for (i = 0; w->old && i < w->old->h->nsegs; i++) {
+        const subject_seg *s = &w->old->segs[i];
+
+        if (!w->declared[i]
+            && strcmp(subject_string(w->old, s->box), box) == 0
+            && s->index_mtime == index_mtime
+            && s->index_size == index_size) {
+            w->declared[i] = 1;
+            writer_seg(w, subject_string(w->old, s->box), index_mtime,
+                       index_size, i);
+            w->current = -1;
+            return 1;
+        }
+    }
+
+    writer_seg(w, apr_pstrdup(w->pool, box), index_mtime, index_size, -1);
+    w->current = w->segs->nelts - 1;
+    w->changed = 1;
+    return 0;
+}
+
+static apr_uint32_t thread_count(Container *c)
+{
+    apr_uint32_t n = c->message ? 1 : 0;
+
+    for (c = c->child; c; c = c->next) {
+        n += thread_count(c);
+    }
+    return n;
+}
+
+void mbox_subject_writer_add(mbox_subject_writer_t *w, Container *thread)
+{
+    subject_wthread *t;
+    Message *m;
+
+    if (w->current < 0) {
+        return;
+    }
+
+    /* Threads without a first message start with a reply. */
+    m = thread->message ? thread->message
+        : thread->child ? thread->child->message : NULL;
+    if (!m) {
+        return;
+    }
+
+    t = apr_array_push(w->threads);
+    t->date = m->date;
+    t->seg = w->current;
+    t->count = thread_count(thread);
+    t->key = mbox_subject_normalize(w->pool, m->utf8_subject
+                                    ? m->utf8_subject : m->subject);
+    t->html_subject = apr_pstrdup(w->pool, m->html_subject);
+    t->uri_msgID = apr_pstrdup(w->pool, m->uri_msgID);
+    t->str_date = apr_pstrdup(w->pool, m->str_date);
+}
+
+static int wthread_cmp(const void *a, const void *b)
+{
+    const subject_wthread *x = a, *y = b;
+
+    if (x->date != y->date)
+        return x->date < y->date ? 1 : -1;
+    if (x->seg != y->seg)
+        return x->seg < y->seg ? -1 : 1;
+    return strcmp(x->uri_msgID ? x->uri_msgID : "",
+                  y->uri_msgID ? y->uri_msgID : "");
+}
+
+static int u64_cmp(const void *a, const void *b)
+{
+    apr_uint64_t x = *(const apr_uint64_t *) a, y = *(const apr_uint64_t *) b;
+
+    return (x > y) - (x < y);
+}
+
+static apr_uint32_t add_string(mbox_varbuf_t *vb, const char *s)
+{
+    apr_size_t off = vb->len;
+
+    if (!s)
+        s = "";
+    mbox_varbuf_strmemcat(vb, s, strlen(s) + 1);
+    return (apr_uint32_t) off;
+}
+
+static void pad8(mbox_varbuf_t *vb)
+{
+    static const char zeros[8] = { 0 };
+
+    if (vb->len % 8) {
+        mbox_varbuf_strmemcat(vb, zeros, 8 - vb->len % 8);
+    }
+}
+
+apr_status_t mbox_subject_writer_commit(mbox_subject_writer_t *w)
+{
+    subject_header h;
+    subject_seg *segs;
+    subject_thread *threads;
+    subject_gram *grams;
+    subject_wthread *wt;
+    apr_array_header_t *pairs;
+    apr_uint32_t *renum = NULL;
+    mbox_varbuf_t strings, postings;
+    apr_uint64_t *pv;
+    apr_uint32_t i, ngrams = 0, last = 0;
+    apr_file_t *f;
+    apr_size_t n;
+    char *tmp;
+    apr_status_t rv;
+    int j;
+
+    /* Mailboxes that are gone */
+    for (i = 0; w->old && i < w->old->h->nsegs; i++) {
+        if (!w->declared[i]) {
+            w->changed = 1;
+        }
+    }
+    if (!w->changed) {
+        return APR_SUCCESS;
+    }
+
+    mbox_varbuf_init(w->pool, &strings, 4096);
+    mbox_varbuf_init(w->pool, &postings, 4096);
+
+    segs = apr_pcalloc(w->pool, (w->segs->nelts + 1) * sizeof(subject_seg));
+    if (w->old) {
+        renum = apr_palloc(w->pool,
+                           (w->old->h->nsegs + 1) * sizeof(apr_uint32_t));
+        for (i = 0; i < w->old->h->nsegs; i++) {
+            renum[i] = (apr_uint32_t) -1;
+        }
+    }
+    for (j = 0; j < w->segs->nelts; j++) {
+        subject_wseg *ws = &APR_ARRAY_IDX(w->segs, j, subject_wseg);
+
+        segs[j].index_mtime = ws->index_mtime;
+        segs[j].index_size = ws->index_size;
+        segs[j].box = add_string(&strings, ws->box);
+        if (ws->old >= 0) {
+            renum[ws->old] = j;
+        }
+    }
+
+    /* The threads of the mailboxes kept */
+    for (i = 0; w->old && i < w->old->h->nthreads; i++) {
+        const subject_thread *t = &w->old->threads[i];
+
+        if (t->seg < w->old->h->nsegs && renum[t->seg] != (apr_uint32_t) -1) {
+            wt = apr_array_push(w->threads);
+            wt->date = t->date;
+            wt->seg = renum[t->seg];
+            wt->count = t->count;
+            wt->key = subject_string(w->old, t->key);
+            wt->html_subject = subject_string(w->old, t->html_subject);
+            wt->uri_msgID = subject_string(w->old, t->uri_msgID);
+            wt->str_date = subject_string(w->old, t->str_date);
+        }
+    }
+    qsort(w->threads->elts, w->threads->nelts, sizeof(subject_wthread),
+          wthread_cmp);
+
+    /* The trigrams of each thread, as (trigram, thread) pairs */
+    threads = apr_pcalloc(w->pool,
+                          (w->threads->nelts + 1) * sizeof(subject_thread));
+    pairs = apr_array_make(w->pool, w->threads->nelts * 16 + 1,
+                           sizeof(apr_uint64_t));
+    for (j = 0; j < w->threads->nelts; j++) {
+        const char *key;
+
+        wt = &APR_ARRAY_IDX(w->threads, j, subject_wthread);
+        threads[j].date = wt->date;
+        threads[j].seg = wt->seg;
+        threads[j].count = wt->count;
+        threads[j].key = add_string(&strings, wt->key);
+        threads[j].html_subject = add_string(&strings, wt->html_subject);
+        threads[j].uri_msgID = add_string(&strings, wt->uri_msgID);
+        threads[j].str_date = add_string(&strings, wt->str_date);
+
+        for (key = wt->key; key[0] && key[1] && key[2]; key++) {
+            APR_ARRAY_PUSH(pairs, apr_uint64_t) =
+                ((apr_uint64_t) gram_at(key) << 32) | (apr_uint32_t) j;
+        }
+    }
+    pad8(&strings);
+    qsort(pairs->elts, pairs->nelts, sizeof(apr_uint64_t), u64_cmp);
+
+    grams = apr_pcalloc(w->pool, (pairs->nelts + 1) * sizeof(subject_gram));
+    pv = (apr_uint64_t *) pairs->elts;
+    for (j = 0; j < pairs->nelts; j++) {
+        apr_uint32_t gram = (apr_uint32_t) (pv[j] >> 32);
+        apr_uint32_t id = (apr_uint32_t) pv[j];
+
+        if (j && pv[j] == pv[j - 1]) {
+            continue;
+        }
+        if (!ngrams || grams[ngrams - 1].gram != gram) {
+            grams[ngrams].gram = gram;
+            grams[ngrams].postings = postings.len;
+            ngrams++;
+            put_varint(&postings, id);
+        }
+        else {
+            put_varint(&postings, id - last);
+        }
+        grams[ngrams - 1].count++;
+        last = id;
+    }
+
+    memset(&h, 0, sizeof(h));
+    memcpy(h.magic, SUBJECT_MAGIC, sizeof(h.magic));
+    h.version = SUBJECT_VERSION;
+    h.nsegs = w->segs->nelts;
+    h.nthreads = w->threads->nelts;
+    h.ngrams = ngrams;
+    h.segs_off = sizeof(subject_header);
+    h.threads_off = h.segs_off + (apr_uint64_t) h.nsegs * sizeof(subject_seg);
+    h.grams_off = h.threads_off
+        + (apr_uint64_t) h.nthreads * sizeof(subject_thread);
+    h.strings_off = h.grams_off + (apr_uint64_t) ngrams * sizeof(subject_gram);
+    h.strings_len = strings.len;
+    h.postings_off = h.strings_off + h.strings_len;
+    h.postings_len = postings.len;
+
+    tmp = apr_pstrcat(w->pool, w->path, ".XXXXXX", NULL);
+    rv = apr_file_mktemp(&f, tmp, APR_CREATE | APR_WRITE | APR_EXCL
+                         | APR_BUFFERED, w->pool);
+    if (rv != APR_SUCCESS) {
+        return rv;
+    }
+
+    rv = apr_file_write_full(f, &h, sizeof(h), &n);
+    if (rv == APR_SUCCESS && h.nsegs)
+        rv = apr_file_write_full(f, segs, h.nsegs * sizeof(subject_seg), &n);
+    if (rv == APR_SUCCESS && h.nthreads)
+        rv = apr_file_write_full(f, threads,
+                                 h.nthreads * sizeof(subject_thread), &n);
+    if (rv == APR_SUCCESS && ngrams)
+        rv = apr_file_write_full(f, grams, ngrams * sizeof(subject_gram), &n);
+    if (rv == APR_SUCCESS && strings.len)
+        rv = apr_file_write_full(f, strings.buf, strings.len, &n);
+    if (rv == APR_SUCCESS && postings.len)
+        rv = apr_file_write_full(f, postings.buf, postings.len, &n);
+    if (rv == APR_SUCCESS)
+        rv = apr_file_close(f);
+    else
+        apr_file_close(f);
+
+    if (rv == APR_SUCCESS) {
+        /* Temporary files are only readable by their owner. */
+        apr_file_perms_set(tmp, SUBJECT_PERMS);
+        rv = apr_file_rename(tmp, w->path, w->pool);
+    }
+    if (rv != APR_SUCCESS) {
+        apr_file_remove(tmp, w->pool);
+    }
+    return rv;
+}
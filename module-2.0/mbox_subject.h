@@ -0,0 +1,95 @@
+/* Licensed to the Apache Software Foundation (ASF) under one or more
+ * contributor license agreements.  See the NOTICE file distributed with
+ * this work for additional information regarding copyright ownership.
+ * The ASF licenses this file to You under the Apache License, Version 2.0
+ * (the "License"); you may not use this file except in compliance with
+ * the License.  You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef MBOX_SUBJECT_H
+#define MBOX_SUBJECT_H
+
+/*
+ * Subject index.  mod-mbox-util lists the threads of all the months of a
+ * list in one file, in the list directory, newest first, with the
+ * trigrams of their subjects (decoded, without the "Re:" prefixes,
+ * lower-cased) and the threads each is in.  The module maps it in memory
+ * to find the threads whose subject contains what is being typed in a
+ * search box, without loading a single month.
+ */
+
+#include "apr.h"
+#include "apr_pools.h"
+#include "apr_tables.h"
+
+#include "mbox_parse.h"
+
+#define MBOX_SUBJECT_FILE "subjects.idx"
+
+/* Shorter queries are looked for through all the subjects. */
+#define MBOX_SUBJECT_GRAM 3
+
+typedef struct mbox_subject_index mbox_subject_index_t;
+
+typedef struct mbox_subject_writer mbox_subject_writer_t;
+
+/* A thread found */
+typedef struct mbox_subject_hit
+{
+    const char *box;            /* Name of the mailbox */
+    apr_time_t date;            /* Of its first message */
+    apr_uint32_t count;         /* Of messages */
+    const char *uri_msgID;      /* Of its first message */
+    const char *html_subject;
+    const char *str_date;
+} mbox_subject_hit_t;
+
+/* Returns subject as indexed: without its "Re:" prefixes, lower-cased,
+ * with runs of spaces as one.
+ */
+char *mbox_subject_normalize(apr_pool_t *p, const char *subject);
+
+/* Opens the index of the list in dir (with a trailing slash).  Returns
+ * APR_NOTFOUND if there is none.
+ */
+apr_status_t mbox_subject_open(mbox_subject_index_t **idx, apr_pool_t *p,
+                               const char *dir);
+
+/* Returns in *hits (of mbox_subject_hit_t) at most k threads whose
+ * subject contains query, those that start with it first, and then the
+ * newest first.
+ */
+void mbox_subject_search(apr_array_header_t **hits, apr_pool_t *p,
+                         const mbox_subject_index_t *idx, const char *query,
+                         int k);
+
+/* Starts updating the index of the list in dir.  Nothing replaces the
+ * current index until mbox_subject_writer_commit().
+ */
+apr_status_t mbox_subject_writer_create(mbox_subject_writer_t **w,
+                                        apr_pool_t *p, const char *dir);
+
+/* Declares a mailbox of the list, at the given version of its message
+ * index (see mbox_index_stat()).  Returns 1 if the index already has its
+ * threads for that version; otherwise, they are to be added with
+ * mbox_subject_writer_add().  The threads of the mailboxes that are not
+ * declared are removed.
+ */
+int mbox_subject_writer_box(mbox_subject_writer_t *w, const char *box,
+                            apr_time_t index_mtime, apr_off_t index_size);
+
+/* Adds a thread (a root of calculate_threads()) of the mailbox. */
+void mbox_subject_writer_add(mbox_subject_writer_t *w, Container *thread);
+
+/* Replaces the index with the one updated, if anything changed. */
+apr_status_t mbox_subject_writer_commit(mbox_subject_writer_t *w);
+
+#endif
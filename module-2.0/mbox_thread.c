@@ -57,9 +57,9 @@ static int is_reply(Message *m)
 /*
  * Strips all of the RE: junk from the subject line.
  */
-static char *strip_subject(apr_pool_t *p, Message *m)
+char *mbox_strip_subject(apr_pool_t *p, const char *subject)
 {
-    char *newVal, *match = m->subject, *tmp = NULL;
+    const char *newVal, *match = subject, *tmp = NULL;
 
     /* Match the following cases: Re:, RE:, RE[1]:, Re: Re[2]: Re: */
     while (match && *match) {
@@ -87,6 +87,11 @@ static char *strip_subject(apr_pool_t *p, Message *m)
     return apr_pstrdup(p, tmp);
 }
 
+static char *strip_subject(apr_pool_t *p, Message *m)
+{
+    return mbox_strip_subject(p, m->subject);
+}
+
 /*
  * Detects if the needle can be reached from either the haystack's
  * next or children.
@@ -507,3 +512,110 @@ Container *calculate_threads(apr_pool_t *p, MBOX_LIST *l)
     return (Container *) mbox_sort_linked_list(tmp, 3, compare_siblings, NULL,
                                                NULL);
 }
+
+/*
+ * Finds the container of message msgID under c
+ */
+static Container *find_thread(const char *msgID, Container *c)
+{
+    Container *next = NULL;
+
+    if (c->message && strcmp(msgID, c->message->msgID) == 0)
+        return c;
+
+    if (c->child)
+        next = find_thread(msgID, c->child);
+
+    if (!next && c->next)
+        next = find_thread(msgID, c->next);
+
+    return next;
+}
+
+/*
+ * Returns the message before msgID in thread order
+ */
+Container *mbox_thread_prev(Container *c, const char *msgID)
+{
+    Container *next = NULL;
+
+    /* Don't go any further */
+    if (c->message && strcmp(msgID, c->message->msgID) == 0)
+        return NULL;
+
+    if (c->child) {
+        next = (!strcmp(msgID, c->child->message->msgID) ? c :
+                mbox_thread_prev(c->child, msgID));
+    }
+
+    if (!next && c->next) {
+        /* Root set potentially does not have message */
+        if (c->next->message && strcmp(msgID, c->next->message->msgID) == 0) {
+            if (c->message) {
+                next = c;
+            }
+            else {
+                next = c->child;
+            }
+        }
+        else {
+            /* Message did not match. */
+            if (!c->next->message && c->next->child &&
+                strcmp(msgID, c->next->child->message->msgID) == 0) {
+                if (c->message) {
+                    next = c;
+                }
+                else {
+                    next = c->child;
+                }
+            }
+            else {
+                next = mbox_thread_prev(c->next, msgID);
+            }
+        }
+    }
+
+    return next;
+}
+
+/*
+ * Returns the message after msgID in thread order
+ */
+Container *mbox_thread_next(Container *c, const char *msgID)
+{
+    c = find_thread(msgID, c);
+
+    if (!c)
+        return NULL;
+
+    if (c->child)
+        return c->child;
+
+    /* Root elements don't have parents */
+    if (c->next && c->parent)
+        return c->next;
+
+    /* We are at the end of this level, so let's go up levels until we
+       find a next message. */
+    while (c->parent) {
+        c = c->parent;
+
+        /* This node must have a parent as well, otherwise we need to
+         * enter the root node checks below.
+         */
+        if (c->next && c->parent)
+            return c->next;
+    }
+
+    /* Allow skipping to non-related root nodes.  This makes for a
+       better browsing experience.  However, if a root node doesn't
+       have a message, we need to return its first child. */
+    if (c->next) {
+        if (c->next->message)
+            return c->next;
+
+        return c->next->child;
+    }
+
+    return NULL;
+}
@@ -23,4 +23,13 @@
 
 Container *calculate_threads(apr_pool_t *p, MBOX_LIST *l);
 
+/* Returns subject without its "Re:" prefixes, as threads are matched. */
+char *mbox_strip_subject(apr_pool_t *p, const char *subject);
+
+/* Thread navigation: the containers of the messages before and after
+ * msgID, or NULL.
+ */
+Container *mbox_thread_prev(Container *threads, const char *msgID);
+Container *mbox_thread_next(Container *threads, const char *msgID);
+
 #endif
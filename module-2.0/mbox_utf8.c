@@ -0,0 +1,315 @@
+/* Licensed to the Apache Software Foundation (ASF) under one or more
+ * contributor license agreements.  See the NOTICE file distributed with
+ * this work for additional information regarding copyright ownership.
+ * The ASF licenses this file to You under the Apache License, Version 2.0
+ * (the "License"); you may not use this file except in compliance with
+ * the License.  You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+/* UTF-8 and ASCII scanning, validation and repair.
+ *
+ * Almost all mail text is ASCII, so the scalar validator spends nearly
+ * all of its time in mbox_utf8_ascii_span(), which checks 16 bytes at
+ * a time with SSE2 where available and 8 bytes at a time otherwise.
+ * With SSSE3, mbox_utf8_is_valid() checks whole blocks of multi-byte
+ * text too, so clean non-ASCII text is not walked byte by byte either.
+ */
+
+#include "mbox_utf8.h"
+
+#include "apr_strings.h"
+
+#include <string.h>
+
+#if defined(__SSSE3__)
+#include <tmmintrin.h>
+#elif defined(__SSE2__)
+#include <emmintrin.h>
+#endif
+
+#define HIGH_BITS ((apr_uint64_t)0x8080808080808080ULL)
+
+apr_size_t mbox_utf8_ascii_span(const char *s, apr_size_t len)
+{
+    apr_size_t i = 0;
+
+#ifdef __SSE2__
+    while (i + 16 <= len) {
+        __m128i v = _mm_loadu_si128((const __m128i *) (s + i));
+        if (_mm_movemask_epi8(v))
+            break;
+        i += 16;
+    }
+#endif
+
+    while (i + 8 <= len) {
+        apr_uint64_t w;
+        memcpy(&w, s + i, 8);
+        if (w & HIGH_BITS)
+            break;
+        i += 8;
+    }
+
+    while (i < len && !(s[i] & 0x80))
+        i++;
+
+    return i;
+}
+
+apr_size_t mbox_utf8_valid_span(const char *s, apr_size_t len)
+{
+    const unsigned char *u = (const unsigned char *) s;
+    apr_size_t i = 0;
+
+    while (i < len) {
+        unsigned char c;
+        apr_size_t need, k;
+        unsigned char lo = 0x80, hi = 0xBF;
+
+        i += mbox_utf8_ascii_span(s + i, len - i);
+        if (i == len)
+            break;
+
+        c = u[i];
+        if (c >= 0xC2 && c <= 0xDF) {
+            need = 1;
+        }
+        else if (c >= 0xE0 && c <= 0xEF) {
+            need = 2;
+            if (c == 0xE0)
+                lo = 0xA0;      /* overlong */
+            else if (c == 0xED)
+                hi = 0x9F;      /* surrogates */
+        }
+        else if (c >= 0xF0 && c <= 0xF4) {
+            need = 3;
+            if (c == 0xF0)
+                lo = 0x90;      /* overlong */
+            else if (c == 0xF4)
+                hi = 0x8F;      /* above U+10FFFF */
+        }
+        else {
+            return i;
+        }
+
+        if (len - i <= need)
+            return i;
+
+        /* Only the first continuation byte has a narrowed range. */
+        if (u[i + 1] < lo || u[i + 1] > hi)
+            return i;
+        for (k = 2; k <= need; k++) {
+            if ((u[i + k] & 0xC0) != 0x80)
+                return i;
+        }
+
+        i += need + 1;
+    }
+
+    return i;
+}
+
+#ifdef __SSSE3__
+/*
+ * Block validation, after Keiser and Lemire, "Validating UTF-8 In Less
+ * Than One Instruction Per Byte" (2021).  Three nibble lookups on each
+ * byte and the byte before it flag every error that can be seen in a
+ * pair of bytes; the remaining one (a missing third or fourth byte) is
+ * found by looking two and three bytes back.
+ */
+#define TOO_SHORT      (1 << 0)
+#define TOO_LONG       (1 << 1)
+#define OVERLONG_3     (1 << 2)
+#define TOO_LARGE      (1 << 3)
+#define SURROGATE      (1 << 4)
+#define OVERLONG_2     (1 << 5)
+#define TOO_LARGE_1000 (1 << 6)
+#define OVERLONG_4     (1 << 6)
+#define TWO_CONTS      (1 << 7)
+#define CARRY          (TOO_SHORT | TOO_LONG | TWO_CONTS)
+
+static __m128i utf8_block_errors(__m128i in, __m128i prev_in)
+{
+    const __m128i nib = _mm_set1_epi8(0x0f);
+    const __m128i byte_1_high_lut = _mm_setr_epi8(
+        TOO_LONG, TOO_LONG, TOO_LONG, TOO_LONG,
+        TOO_LONG, TOO_LONG, TOO_LONG, TOO_LONG,
+        TWO_CONTS, TWO_CONTS, TWO_CONTS, TWO_CONTS,
+        TOO_SHORT | OVERLONG_2,
+        TOO_SHORT,
+        TOO_SHORT | OVERLONG_3 | SURROGATE,
+        TOO_SHORT | TOO_LARGE | TOO_LARGE_1000 | OVERLONG_4);
+    const __m128i byte_1_low_lut = _mm_setr_epi8(
+        CARRY | OVERLONG_3 | OVERLONG_2 | OVERLONG_4,
+        CARRY | OVERLONG_2,
+        CARRY,
+        CARRY,
+        CARRY | TOO_LARGE,
+        CARRY | TOO_LARGE | TOO_LARGE_1000,
+        CARRY | TOO_LARGE | TOO_LARGE_1000,
+        CARRY | TOO_LARGE | TOO_LARGE_1000,
+        CARRY | TOO_LARGE | TOO_LARGE_1000,
+        CARRY | TOO_LARGE | TOO_LARGE_1000,
+        CARRY | TOO_LARGE | TOO_LARGE_1000,
+        CARRY | TOO_LARGE | TOO_LARGE_1000,
+        CARRY | TOO_LARGE | TOO_LARGE_1000,
+        CARRY | TOO_LARGE | TOO_LARGE_1000 | SURROGATE,
+        CARRY | TOO_LARGE | TOO_LARGE_1000,
+        CARRY | TOO_LARGE | TOO_LARGE_1000);
+    const __m128i byte_2_high_lut = _mm_setr_epi8(
+        TOO_SHORT, TOO_SHORT, TOO_SHORT, TOO_SHORT,
+        TOO_SHORT, TOO_SHORT, TOO_SHORT, TOO_SHORT,
+        TOO_LONG | OVERLONG_2 | TWO_CONTS | OVERLONG_3 | TOO_LARGE_1000 | OVERLONG_4,
+        TOO_LONG | OVERLONG_2 | TWO_CONTS | OVERLONG_3 | TOO_LARGE,
+        TOO_LONG | OVERLONG_2 | TWO_CONTS | SURROGATE | TOO_LARGE,
+        TOO_LONG | OVERLONG_2 | TWO_CONTS | SURROGATE | TOO_LARGE,
+        TOO_SHORT, TOO_SHORT, TOO_SHORT, TOO_SHORT);
+    __m128i prev1, prev2, prev3, sc, must23;
+
+    prev1 = _mm_alignr_epi8(in, prev_in, 15);
+    sc = _mm_and_si128(
+             _mm_and_si128(
+                 _mm_shuffle_epi8(byte_1_high_lut,
+                                  _mm_and_si128(_mm_srli_epi16(prev1, 4), nib)),
+                 _mm_shuffle_epi8(byte_1_low_lut, _mm_and_si128(prev1, nib))),
+             _mm_shuffle_epi8(byte_2_high_lut,
+                              _mm_and_si128(_mm_srli_epi16(in, 4), nib)));
+
+    /* Third and fourth bytes of a sequence must be continuations. */
+    prev2 = _mm_alignr_epi8(in, prev_in, 14);
+    prev3 = _mm_alignr_epi8(in, prev_in, 13);
+    must23 = _mm_or_si128(_mm_subs_epu8(prev2, _mm_set1_epi8((char) 0xdf)),
+                          _mm_subs_epu8(prev3, _mm_set1_epi8((char) 0xef)));
+    must23 = _mm_and_si128(_mm_cmpgt_epi8(must23, _mm_setzero_si128()),
+                           _mm_set1_epi8((char) 0x80));
+
+    return _mm_xor_si128(must23, sc);
+}
+
+int mbox_utf8_is_valid(const char *s, apr_size_t len)
+{
+    __m128i prev = _mm_setzero_si128(), in, err = _mm_setzero_si128();
+    char tail[16];
+    apr_size_t i = 0;
+
+    for (;;) {
+        if (i + 16 <= len) {
+            in = _mm_loadu_si128((const __m128i *) (s + i));
+        }
+        else {
+            /* The zero padding is ASCII, so a sequence cut short by
+               the end of the data shows up as an error here. */
+            memset(tail, 0, sizeof(tail));
+            memcpy(tail, s + i, len - i);
+            in = _mm_loadu_si128((const __m128i *) tail);
+        }
+
+        /* Nothing can go wrong in ASCII following ASCII. */
+        if (_mm_movemask_epi8(in) || _mm_movemask_epi8(prev))
+            err = _mm_or_si128(err, utf8_block_errors(in, prev));
+
+        if (i + 16 > len)
+            break;
+        prev = in;
+        i += 16;
+    }
+
+    return _mm_movemask_epi8(_mm_cmpeq_epi8(err, _mm_setzero_si128()))
+        == 0xffff;
+}
+#else
+int mbox_utf8_is_valid(const char *s, apr_size_t len)
+{
+    return mbox_utf8_valid_span(s, len) == len;
+}
+#endif
+
+/* Length of the maximal subpart of an ill-formed sequence at s (the
+ * longest prefix of a well-formed sequence), or 1 if there is none.
+ * Each such subpart becomes one U+FFFD, as the Unicode standard
+ * recommends.
+ */
+static apr_size_t invalid_length(const unsigned char *u, apr_size_t len)
+{
+    unsigned char c = u[0], lo = 0x80, hi = 0xBF;
+    apr_size_t need, k;
+
+    if (c >= 0xC2 && c <= 0xDF)
+        need = 1;
+    else if (c >= 0xE0 && c <= 0xEF) {
+        need = 2;
+        if (c == 0xE0)
+            lo = 0xA0;
+        else if (c == 0xED)
+            hi = 0x9F;
+    }
+    else if (c >= 0xF0 && c <= 0xF4) {
+        need = 3;
+        if (c == 0xF0)
+            lo = 0x90;
+        else if (c == 0xF4)
+            hi = 0x8F;
+    }
+    else
+        return 1;
+
+    if (len < 2 || u[1] < lo || u[1] > hi)
+        return 1;
+    for (k = 2; k <= need && k < len; k++) {
+        if ((u[k] & 0xC0) != 0x80)
+            break;
+    }
+    return k;
+}
+
+#define REPLACEMENT "\xEF\xBF\xBD"
+
+char *mbox_utf8_repair(apr_pool_t *p, const char *s, apr_size_t len,
+                       apr_size_t *outlen)
+{
+    const unsigned char *u = (const unsigned char *) s;
+    apr_size_t i, run, n;
+    char *x;
+
+    if (mbox_utf8_is_valid(s, len)) {
+        if (outlen)
+            *outlen = len;
+        return (char *) s;
+    }
+
+    /* Worst case: every byte becomes a three-byte U+FFFD. */
+    x = apr_palloc(p, len * 3 + 1);
+    i = n = 0;
+    while (i < len) {
+        run = mbox_utf8_valid_span(s + i, len - i);
+        memcpy(x + n, s + i, run);
+        n += run;
+        i += run;
+        if (i == len)
+            break;
+
+        memcpy(x + n, REPLACEMENT, 3);
+        n += 3;
+        i += invalid_length(u + i, len - i);
+    }
+
+    x[n] = '\0';
+    if (outlen)
+        *outlen = n;
+    return x;
+}
+
+char *mbox_utf8_repair_str(apr_pool_t *p, const char *s)
+{
+    if (!s)
+        return NULL;
+    return mbox_utf8_repair(p, s, strlen(s), NULL);
+}
@@ -0,0 +1,52 @@
+/* Licensed to the Apache Software Foundation (ASF) under one or more
+ * contributor license agreements.  See the NOTICE file distributed with
+ * this work for additional information regarding copyright ownership.
+ * The ASF licenses this file to You under the Apache License, Version 2.0
+ * (the "License"); you may not use this file except in compliance with
+ * the License.  You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef MBOX_UTF8_H
+#define MBOX_UTF8_H
+
+/*
+ * UTF-8 and ASCII scanning, validation and repair, shared by the module
+ * and mod-mbox-util.
+ */
+
+#include "apr.h"
+#include "apr_pools.h"
+
+/* Returns the length of the leading run of 7-bit ASCII bytes in s. */
+apr_size_t mbox_utf8_ascii_span(const char *s, apr_size_t len);
+
+/* Returns the length of the longest prefix of s that is well-formed
+ * UTF-8 (RFC 3629: no overlong forms, surrogates or code points above
+ * U+10FFFF).  The prefix never ends in the middle of a sequence.
+ */
+apr_size_t mbox_utf8_valid_span(const char *s, apr_size_t len);
+
+/* Returns non-zero if all of s is well-formed UTF-8. */
+int mbox_utf8_is_valid(const char *s, apr_size_t len);
+
+/* Replaces each ill-formed sequence in s with U+FFFD.  Returns s itself
+ * if it is already valid; otherwise a NUL-terminated copy.  The result
+ * length is stored in *outlen if outlen is not NULL.
+ */
+char *mbox_utf8_repair(apr_pool_t *p, const char *s, apr_size_t len,
+                       apr_size_t *outlen);
+
+/* mbox_utf8_repair() for NUL-terminated strings; NULL stays NULL. */
+char *mbox_utf8_repair_str(apr_pool_t *p, const char *s);
+
+#define mbox_utf8_is_ascii(s, len) (mbox_utf8_ascii_span((s), (len)) == (len))
+
+#endif
@@ -0,0 +1,363 @@
+/* Licensed to the Apache Software Foundation (ASF) under one or more
+ * contributor license agreements.  See the NOTICE file distributed with
+ * this work for additional information regarding copyright ownership.
+ * The ASF licenses this file to You under the Apache License, Version 2.0
+ * (the "License"); you may not use this file except in compliance with
+ * the License.  You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+/* Precompressed page variants.
+ *
+ * The variant of a page is kept in DIR/xx/yyyy...SUFFIX, where xxyyyy...
+ * is the SHA-1 of its location in hex.  The file starts with a header
+ * line holding the hash of the version of the page, and the compressed
+ * page follows.  Variants are written to temporary files first and
+ * renamed, so that a reader sees a complete one or none, even if other
+ * processes store the same page at the same time.
+ */
+
+#include "mbox_variant.h"
+
+#include "apr_sha1.h"
+#include "apr_strings.h"
+
+#include <string.h>
+#include <zlib.h>
+#ifdef HAVE_ZSTD
+#include <zstd.h>
+#endif
+
+#define HASH_LEN (APR_SHA1_DIGESTSIZE * 2)
+
+#define VARIANT_MAGIC "MBOXVAR1 "
+#define VARIANT_HEADER_LEN (sizeof(VARIANT_MAGIC) - 1 + HASH_LEN + 1)
+
+#define VARIANT_BUFSIZE (16 * 1024)
+
+/* Pages are compressed once per version: spend what it takes. */
+#define VARIANT_GZIP_LEVEL Z_BEST_COMPRESSION
+#define VARIANT_ZSTD_LEVEL 19
+
+#define VARIANT_PERMS (APR_FPROT_UREAD | APR_FPROT_UWRITE | \
+                       APR_FPROT_GREAD | APR_FPROT_WREAD)
+#define VARIANT_DIR_PERMS (VARIANT_PERMS | APR_FPROT_UEXECUTE | \
+                           APR_FPROT_GEXECUTE | APR_FPROT_WEXECUTE)
+
+const mbox_encoding_t mbox_variant_encodings[] = {
+#ifdef HAVE_ZSTD
+    {"zstd", ".zst"},
+#endif
+    {"gzip", ".gz"},
+    {NULL, NULL}
+};
+
+#define NUM_ENCODINGS \
+    (sizeof(mbox_variant_encodings) / sizeof(mbox_variant_encodings[0]) - 1)
+
+/* A variant being written */
+typedef struct variant_stream
+{
+    const mbox_encoding_t *enc;
+    const char *path;
+    char *tmp;
+    apr_file_t *f;
+
+    z_stream z;
+    int zinit;
+#ifdef HAVE_ZSTD
+    ZSTD_CCtx *zc;
+#endif
+} variant_stream_t;
+
+struct mbox_variant_writer
+{
+    apr_pool_t *pool;
+    variant_stream_t streams[NUM_ENCODINGS];
+    unsigned char *buf;
+    mbox_out_t out;
+};
+
+char *mbox_variant_hash(apr_pool_t *p, const char *version)
+{
+    static const char hex[] = "0123456789abcdef";
+    unsigned char digest[APR_SHA1_DIGESTSIZE];
+    apr_sha1_ctx_t ctx;
+    char *hash;
+    int i;
+
+    apr_sha1_init(&ctx);
+    apr_sha1_update(&ctx, version, strlen(version));
+    apr_sha1_final(digest, &ctx);
+
+    hash = apr_palloc(p, HASH_LEN + 1);
+    for (i = 0; i < APR_SHA1_DIGESTSIZE; i++) {
+        hash[2 * i] = hex[digest[i] >> 4];
+        hash[2 * i + 1] = hex[digest[i] & 0xf];
+    }
+    hash[HASH_LEN] = '\0';
+    return hash;
+}
+
+static const char *variant_path(apr_pool_t *p, const char *dir,
+                                const char *location,
+                                const mbox_encoding_t *enc)
+{
+    const char *key = mbox_variant_hash(p, location);
+
+    return apr_psprintf(p, "%s/%.2s/%s%s", dir, key, key + 2, enc->suffix);
+}
+
+static const char *variant_header(apr_pool_t *p, const char *version)
+{
+    return apr_pstrcat(p, VARIANT_MAGIC, mbox_variant_hash(p, version), "\n",
+                       NULL);
+}
+
+apr_status_t mbox_variant_open(mbox_variant_t *v, apr_pool_t *p,
+                               const char *dir, const char *location,
+                               const char *version,
+                               const mbox_encoding_t *enc)
+{
+    apr_finfo_t finfo;
+    apr_status_t rv;
+    char header[VARIANT_HEADER_LEN];
+    apr_size_t n = sizeof(header);
+
+    rv = apr_file_open(&v->file, variant_path(p, dir, location, enc),
+                       APR_READ, APR_OS_DEFAULT, p);
+    if (rv != APR_SUCCESS)
+        return APR_STATUS_IS_ENOENT(rv) ? APR_NOTFOUND : rv;
+
+    rv = apr_file_read_full(v->file, header, n, &n);
+    if (rv == APR_SUCCESS
+        && memcmp(header, variant_header(p, version), n) != 0)
+        rv = APR_NOTFOUND;
+    if (rv == APR_SUCCESS)
+        rv = apr_file_info_get(&finfo, APR_FINFO_SIZE, v->file);
+    if (rv != APR_SUCCESS) {
+        apr_file_close(v->file);
+        return APR_STATUS_IS_EOF(rv) ? APR_NOTFOUND : rv;
+    }
+
+    v->offset = VARIANT_HEADER_LEN;
+    v->len = finfo.size - VARIANT_HEADER_LEN;
+    return APR_SUCCESS;
+}
+
+static apr_status_t writer_cleanup(void *data)
+{
+    mbox_variant_writer_t *w = data;
+    apr_size_t i;
+
+    for (i = 0; i < NUM_ENCODINGS; i++) {
+        variant_stream_t *s = &w->streams[i];
+
+        if (s->zinit) {
+            deflateEnd(&s->z);
+            s->zinit = 0;
+        }
+#ifdef HAVE_ZSTD
+        if (s->zc) {
+            ZSTD_freeCCtx(s->zc);
+            s->zc = NULL;
+        }
+#endif
+    }
+    return APR_SUCCESS;
+}
+
+/* Compresses len bytes of data (none, to the end of the page if last)
+ * to the file of s.
+ */
+static apr_status_t stream_write(mbox_variant_writer_t *w,
+                                 variant_stream_t *s, const char *data,
+                                 apr_size_t len, int last)
+{
+    apr_status_t rv = APR_SUCCESS;
+    apr_size_t n;
+
+#ifdef HAVE_ZSTD
+    if (s->zc) {
+        ZSTD_inBuffer in = {data, len, 0};
+        size_t left;
+
+        do {
+            ZSTD_outBuffer out = {w->buf, VARIANT_BUFSIZE, 0};
+
+            left = ZSTD_compressStream2(s->zc, &out, &in,
+                                        last ? ZSTD_e_end : ZSTD_e_continue);
+            if (ZSTD_isError(left))
+                return APR_EGENERAL;
+            if (out.pos)
+                rv = apr_file_write_full(s->f, w->buf, out.pos, &n);
+        } while (rv == APR_SUCCESS
+                 && (last ? left != 0 : in.pos < in.size));
+
+        return rv;
+    }
+#endif
+
+    do {
+        uInt chunk = len > 0x40000000 ? 0x40000000 : (uInt) len;
+        int flush = last && chunk == len ? Z_FINISH : Z_NO_FLUSH;
+        int zrv;
+
+        s->z.next_in = (Bytef *) data;
+        s->z.avail_in = chunk;
+        do {
+            s->z.next_out = w->buf;
+            s->z.avail_out = VARIANT_BUFSIZE;
+            zrv = deflate(&s->z, flush);
+            if (zrv == Z_STREAM_ERROR)
+                return APR_EGENERAL;
+
+            n = VARIANT_BUFSIZE - s->z.avail_out;
+            if (n)
+                rv = apr_file_write_full(s->f, w->buf, n, &n);
+        } while (rv == APR_SUCCESS
+                 && (flush == Z_FINISH ? zrv != Z_STREAM_END
+                                       : s->z.avail_out == 0));
+        data += chunk;
+        len -= chunk;
+    } while (rv == APR_SUCCESS && len);
+
+    return rv;
+}
+
+static apr_status_t variant_write(void *baton, const char *data,
+                                  apr_size_t len)
+{
+    mbox_variant_writer_t *w = baton;
+    apr_status_t rv = APR_SUCCESS;
+    apr_size_t i;
+
+    for (i = 0; i < NUM_ENCODINGS && rv == APR_SUCCESS && len; i++) {
+        rv = stream_write(w, &w->streams[i], data, len, 0);
+    }
+    return rv;
+}
+
+apr_status_t mbox_variant_create(mbox_variant_writer_t **wp, apr_pool_t *p,
+                                 const char *dir, const char *location,
+                                 const char *version)
+{
+    mbox_variant_writer_t *w;
+    const char *header = variant_header(p, version);
+    apr_status_t rv = APR_SUCCESS;
+    apr_size_t i, n;
+
+    w = apr_pcalloc(p, sizeof(mbox_variant_writer_t));
+    w->pool = p;
+    w->buf = apr_palloc(p, VARIANT_BUFSIZE);
+    apr_pool_cleanup_register(p, w, writer_cleanup, apr_pool_cleanup_null);
+
+    for (i = 0; i < NUM_ENCODINGS && rv == APR_SUCCESS; i++) {
+        variant_stream_t *s = &w->streams[i];
+
+        s->enc = &mbox_variant_encodings[i];
+        s->path = variant_path(p, dir, location, s->enc);
+
+#ifdef HAVE_ZSTD
+        if (strcmp(s->enc->name, "zstd") == 0) {
+            s->zc = ZSTD_createCCtx();
+            if (!s->zc
+                || ZSTD_isError(ZSTD_CCtx_setParameter(s->zc,
+                                                       ZSTD_c_compressionLevel,
+                                                       VARIANT_ZSTD_LEVEL)))
+                rv = APR_EGENERAL;
+        }
+        else
+#endif
+        if (deflateInit2(&s->z, VARIANT_GZIP_LEVEL, Z_DEFLATED, 15 + 16, 8,
+                         Z_DEFAULT_STRATEGY) == Z_OK)
+            s->zinit = 1;
+        else
+            rv = APR_EGENERAL;
+
+        if (rv == APR_SUCCESS)
+            rv = apr_dir_make_recursive(apr_pstrndup(p, s->path,
+                                                     strrchr(s->path, '/')
+                                                     - s->path),
+                                        VARIANT_DIR_PERMS, p);
+        if (rv == APR_SUCCESS) {
+            s->tmp = apr_pstrcat(p, s->path, ".XXXXXX", NULL);
+            rv = apr_file_mktemp(&s->f, s->tmp, APR_CREATE | APR_WRITE
+                                 | APR_EXCL | APR_BUFFERED, p);
+            if (rv != APR_SUCCESS)
+                s->f = NULL;
+        }
+        if (rv == APR_SUCCESS)
+            rv = apr_file_write_full(s->f, header, VARIANT_HEADER_LEN, &n);
+    }
+    if (rv != APR_SUCCESS) {
+        mbox_variant_abort(w);
+        return rv;
+    }
+
+    mbox_out_init(&w->out, p, variant_write, w);
+    *wp = w;
+    return APR_SUCCESS;
+}
+
+mbox_out_t *mbox_variant_out(mbox_variant_writer_t *w)
+{
+    return &w->out;
+}
+
+apr_status_t mbox_variant_commit(mbox_variant_writer_t *w)
+{
+    apr_status_t rv = w->out.status;
+    apr_size_t i;
+
+    for (i = 0; i < NUM_ENCODINGS && rv == APR_SUCCESS; i++) {
+        variant_stream_t *s = &w->streams[i];
+
+        rv = stream_write(w, s, NULL, 0, 1);
+        if (rv == APR_SUCCESS)
+            rv = apr_file_close(s->f);
+        else
+            apr_file_close(s->f);
+        s->f = NULL;
+        if (rv == APR_SUCCESS) {
+            /* Temporary files are only readable by their owner. */
+            apr_file_perms_set(s->tmp, VARIANT_PERMS);
+            rv = apr_file_rename(s->tmp, s->path, w->pool);
+        }
+        if (rv == APR_SUCCESS)
+            s->tmp = NULL;
+    }
+    if (rv != APR_SUCCESS) {
+        mbox_variant_abort(w);
+        return rv;
+    }
+
+    writer_cleanup(w);
+    return APR_SUCCESS;
+}
+
+void mbox_variant_abort(mbox_variant_writer_t *w)
+{
+    apr_size_t i;
+
+    for (i = 0; i < NUM_ENCODINGS; i++) {
+        variant_stream_t *s = &w->streams[i];
+
+        if (s->f) {
+            apr_file_close(s->f);
+            s->f = NULL;
+        }
+        if (s->tmp) {
+            apr_file_remove(s->tmp, w->pool);
+            s->tmp = NULL;
+        }
+    }
+    writer_cleanup(w);
+}
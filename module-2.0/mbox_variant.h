@@ -0,0 +1,88 @@
+/* Licensed to the Apache Software Foundation (ASF) under one or more
+ * contributor license agreements.  See the NOTICE file distributed with
+ * this work for additional information regarding copyright ownership.
+ * The ASF licenses this file to You under the Apache License, Version 2.0
+ * (the "License"); you may not use this file except in compliance with
+ * the License.  You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef MBOX_VARIANT_H
+#define MBOX_VARIANT_H
+
+/*
+ * Precompressed variants of rendered pages.  A page that no longer
+ * changes much (a list of a month that is over) is compressed once per
+ * version, in every encoding known here, into a store directory, so that
+ * the module can send it as it is to the clients that accept one of
+ * them, instead of having it compressed again on every hit.
+ *
+ * A page is stored under its location (any string telling it apart from
+ * the other pages), along with the version it was rendered as (any
+ * string that changes with the page): a newer version replaces the older
+ * one, so the store does not grow with every change.
+ */
+
+#include "apr.h"
+#include "apr_file_io.h"
+#include "apr_pools.h"
+
+#include "mbox_view.h"
+
+typedef struct mbox_encoding
+{
+    const char *name;           /* As in Content-Encoding */
+    const char *suffix;         /* Of the files of the store */
+} mbox_encoding_t;
+
+/* The encodings variants are stored in, most compact first, up to one
+ * with a NULL name.  zstd is only there when built with HAVE_ZSTD.
+ */
+extern const mbox_encoding_t mbox_variant_encodings[];
+
+/* Where a variant is, in its file */
+typedef struct mbox_variant
+{
+    apr_file_t *file;
+    apr_off_t offset;
+    apr_off_t len;
+} mbox_variant_t;
+
+typedef struct mbox_variant_writer mbox_variant_writer_t;
+
+/* Returns the hash the store knows a version by, which makes an entity
+ * tag for the page.
+ */
+char *mbox_variant_hash(apr_pool_t *p, const char *version);
+
+/* Opens the variant of the page at location in the encoding enc, if it
+ * is of the given version.  Returns APR_NOTFOUND otherwise.
+ */
+apr_status_t mbox_variant_open(mbox_variant_t *v, apr_pool_t *p,
+                               const char *dir, const char *location,
+                               const char *version,
+                               const mbox_encoding_t *enc);
+
+/* Starts compressing a page in every encoding.  The page is written to
+ * mbox_variant_out(), and nothing replaces the current variants (if
+ * any) until mbox_variant_commit().
+ */
+apr_status_t mbox_variant_create(mbox_variant_writer_t **w, apr_pool_t *p,
+                                 const char *dir, const char *location,
+                                 const char *version);
+mbox_out_t *mbox_variant_out(mbox_variant_writer_t *w);
+
+/* Replaces the current variants with the ones written. */
+apr_status_t mbox_variant_commit(mbox_variant_writer_t *w);
+
+/* Throws the variants written away. */
+void mbox_variant_abort(mbox_variant_writer_t *w);
+
+#endif
@@ -0,0 +1,303 @@
+/* Licensed to the Apache Software Foundation (ASF) under one or more
+ * contributor license agreements.  See the NOTICE file distributed with
+ * this work for additional information regarding copyright ownership.
+ * The ASF licenses this file to You under the Apache License, Version 2.0
+ * (the "License"); you may not use this file except in compliance with
+ * the License.  You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+/* Request independent message views.
+ */
+
+#include "mbox_view.h"
+
+#include "apr_strings.h"
+
+#include <stdarg.h>
+#include <string.h>
+
+void mbox_out_init(mbox_out_t *out, apr_pool_t *p,
+                   mbox_render_write_fn *write, void *baton)
+{
+    out->pool = p;
+    out->write = write;
+    out->baton = baton;
+    out->status = APR_SUCCESS;
+}
+
+void mbox_out_write(mbox_out_t *out, const char *data, apr_size_t len)
+{
+    if (out->status == APR_SUCCESS && len) {
+        out->status = out->write(out->baton, data, len);
+    }
+}
+
+void mbox_out_puts(mbox_out_t *out, const char *s)
+{
+    mbox_out_write(out, s, strlen(s));
+}
+
+void mbox_out_printf(mbox_out_t *out, const char *fmt, ...)
+{
+    va_list ap;
+    char *s;
+
+    va_start(ap, fmt);
+    s = apr_pvsprintf(out->pool, fmt, ap);
+    va_end(ap);
+
+    mbox_out_puts(out, s);
+}
+
+/* For the moment, the part to display is just the first text/ part
+ * found following first sub-parts.
+ */
+mbox_mime_message_t *mbox_view_body_part(apr_pool_t *p,
+                                         mbox_mime_message_t *m)
+{
+    while (m && strncasecmp(m->content_type, "text/", strlen("text/")) != 0) {
+        if (!m->sub_count) {
+            return NULL;
+        }
+        m = mbox_mime_get_part(p, m, 0);
+    }
+
+    return m;
+}
+
+static apr_status_t write_rendered(void *baton, const char *data,
+                                   apr_size_t len)
+{
+    mbox_out_t *out = baton;
+
+    mbox_out_write(out, data, len);
+    return out->status;
+}
+
+apr_status_t mbox_view_body(mbox_out_t *out, apr_file_t *f, Message *m,
+                            int flags)
+{
+    mbox_mime_message_t *part = mbox_view_body_part(out->pool, m->mime_msg);
+    mbox_render_t *rd;
+    apr_pool_t *p;
+    apr_status_t rv, xrv;
+
+    if (!part || !part->body_len) {
+        mbox_out_puts(out, MBOX_FETCH_ERROR_STR);
+        return APR_SUCCESS;
+    }
+
+    apr_pool_create(&p, out->pool);
+
+    xrv = mbox_render_create(&rd, p, part->cte, part->charset, flags,
+                             write_rendered, out);
+    if (part->body) {
+        rv = mbox_render_write(rd, part->body, part->body_len);
+    }
+    else {
+        rv = mbox_render_file(rd, f, m->body_start + part->body_offset,
+                              part->body_len);
+    }
+    if (rv == APR_SUCCESS) {
+        rv = mbox_render_close(rd);
+    }
+    if (rv != APR_SUCCESS && out->status == APR_SUCCESS) {
+        out->status = rv;
+    }
+
+    apr_pool_destroy(p);
+    return xrv;
+}
+
+void mbox_view_mime_structure(mbox_out_t *out, mbox_mime_message_t *m,
+                              char *link)
+{
+    int i;
+
+    if (!m) {
+        return;
+    }
+
+    mbox_out_puts(out, "<li>");
+
+    if (m->body_len && link) {
+        mbox_out_printf(out, "<a rel=\"nofollow\" href=\"%s\">", link);
+    }
+
+    if (m->content_name) {
+        mbox_out_printf(out, "%s (%s)",
+                        ESCAPE_OR_BLANK(out->pool, m->content_name),
+                        ESCAPE_OR_BLANK(out->pool, m->content_type));
+    }
+    else {
+        mbox_out_printf(out, "Unnamed %s",
+                        ESCAPE_OR_BLANK(out->pool, m->content_type));
+    }
+
+    if (m->body_len && link) {
+        mbox_out_puts(out, "</a>");
+    }
+
+    mbox_out_printf(out, " (%s, %s, %" APR_SIZE_T_FMT " bytes)</li>\n",
+                    m->content_disposition, mbox_cte_to_char(m->cte),
+                    m->body_len);
+
+    if (!m->sub) {
+        return;
+    }
+
+    for (i = 0; i < m->sub_count; i++) {
+        mbox_out_puts(out, "<ul>\n");
+
+        if (link && link[strlen(link) - 1] == '/') {
+            link[strlen(link) - 1] = 0;
+        }
+
+        mbox_view_mime_structure(out, mbox_mime_get_part(out->pool, m, i),
+                                 link ? apr_psprintf(out->pool, "%s/%d",
+                                                     link, i + 1) : NULL);
+        mbox_out_puts(out, "</ul>\n");
+    }
+}
+
+static void view_nav(mbox_out_t *out, char **context, const char *base_uri)
+{
+    mbox_out_puts(out, "    <th class=\"nav\">");
+
+    /* Date navigation */
+    if (context[0]) {
+        mbox_out_printf(out, "<a href=\"%s/%s\" "
+                        "title=\"Previous by date\">&laquo;</a>",
+                        base_uri,
+                        MSG_ID_ESCAPE_OR_BLANK(out->pool, context[0]));
+    }
+    else {
+        mbox_out_puts(out, "&laquo;");
+    }
+
+    mbox_out_printf(out, " <a href=\"%s/date\" "
+                    "title=\"View messages sorted by date\">Date</a> ",
+                    base_uri);
+
+    if (context[1]) {
+        mbox_out_printf(out, "<a href=\"%s/%s\" "
+                        "title=\"Next by date\">&raquo;</a>",
+                        base_uri,
+                        MSG_ID_ESCAPE_OR_BLANK(out->pool, context[1]));
+    }
+    else {
+        mbox_out_puts(out, "&raquo;");
+    }
+
+    mbox_out_puts(out, " &middot; ");
+
+    /* Thread navigation */
+    if (context[2]) {
+        mbox_out_printf(out, "<a href=\"%s/%s\" "
+                        "title=\"Previous by thread\">&laquo;</a>",
+                        base_uri,
+                        MSG_ID_ESCAPE_OR_BLANK(out->pool, context[2]));
+    }
+    else {
+        mbox_out_puts(out, "&laquo;");
+    }
+
+    mbox_out_printf(out, " <a href=\"%s/thread\" "
+                    "title=\"View messages sorted by thread\">Thread</a> ",
+                    base_uri);
+
+    if (context[3]) {
+        mbox_out_printf(out, "<a href=\"%s/%s\" "
+                        "title=\"Next by thread\">&raquo;</a>",
+                        base_uri,
+                        MSG_ID_ESCAPE_OR_BLANK(out->pool, context[3]));
+    }
+    else {
+        mbox_out_puts(out, "&raquo;");
+    }
+
+    mbox_out_puts(out, "</th>\n");
+}
+
+apr_status_t mbox_view_message(mbox_out_t *out, apr_file_t *f, Message *m,
+                               char **context, const char *base_uri,
+                               int antispam, int raw)
+{
+    char *from;
+    apr_status_t rv;
+
+    from = mbox_cte_decode_header(out->pool, m->from);
+    if (antispam) {
+        from = mbox_email_antispam(from);
+    }
+    from = ESCAPE_OR_BLANK(out->pool, from);
+
+    mbox_out_puts(out, "  <div id=\"msgview-inner\">\n");
+    mbox_out_puts(out, "  <table id=\"msgview\">\n");
+
+    /* Top navigation */
+    mbox_out_puts(out, "   <thead>\n"
+                  "    <tr>\n" "    <th class=\"title\">Message view</th>\n");
+    view_nav(out, context, base_uri);
+    mbox_out_puts(out, "   </tr>\n" "   </thead>\n\n");
+
+    /* Bottom navigation */
+    mbox_out_puts(out, "   <tfoot>\n"
+                  "    <tr>\n"
+                  "    <th class=\"title\"><a href=\"#archives\">Top</a></th>\n");
+    view_nav(out, context, base_uri);
+    mbox_out_puts(out, "   </tr>\n" "   </tfoot>\n\n");
+
+    /* Headers */
+    mbox_out_puts(out, "   <tbody>\n");
+    mbox_out_printf(out, "   <tr class=\"from\">\n"
+                    "    <td class=\"left\"><strong>From</strong></td>\n"
+                    "    <td class=\"right\">%s</td>\n" "   </tr>\n", from);
+
+    mbox_out_printf(out, "   <tr class=\"subject\">\n"
+                    "    <td class=\"left\"><strong>Subject</strong></td>\n"
+                    "    <td class=\"right\">%s</td>\n"
+                    "   </tr>\n", m->html_subject);
+
+    mbox_out_printf(out, "   <tr class=\"date\">\n"
+                    "    <td class=\"left\"><strong>Date</strong></td>\n"
+                    "    <td class=\"right\">%s</td>\n"
+                    "   </tr>\n", ESCAPE_OR_BLANK(out->pool, m->rfc822_date));
+
+    /* Message body */
+    mbox_out_puts(out,
+                  "   <tr class=\"contents\"><td colspan=\"2\"><pre>\n");
+    rv = mbox_view_body(out, f, m, 0);
+    mbox_out_puts(out, "</pre></td></tr>\n");
+
+    /* MIME structure */
+    mbox_out_puts(out, "   <tr class=\"mime\">\n"
+                  "    <td class=\"left\">Mime</td>\n"
+                  "    <td class=\"right\">\n<ul>\n");
+    mbox_view_mime_structure(out, m->mime_msg,
+                             raw ? apr_psprintf(out->pool, "%s/raw/%s/",
+                                                base_uri, m->uri_msgID)
+                                 : NULL);
+    mbox_out_puts(out, "</ul>\n</td>\n</tr>\n");
+
+    if (raw) {
+        mbox_out_printf(out, "   <tr class=\"raw\">\n"
+                        "    <td class=\"left\"></td>\n"
+                        "    <td class=\"right\"><a href=\"%s/raw/%s\" rel=\"nofollow\">View raw message</a></td>\n"
+                        "   </tr>\n", base_uri, m->uri_msgID);
+    }
+
+    mbox_out_puts(out, "   </tbody>\n");
+    mbox_out_puts(out, "  </table>\n");
+    mbox_out_puts(out, "  </div><!-- /#msgview-inner -->\n");
+
+    return rv;
+}
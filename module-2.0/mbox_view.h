@@ -0,0 +1,101 @@
+/* Licensed to the Apache Software Foundation (ASF) under one or more
+ * contributor license agreements.  See the NOTICE file distributed with
+ * this work for additional information regarding copyright ownership.
+ * The ASF licenses this file to You under the Apache License, Version 2.0
+ * (the "License"); you may not use this file except in compliance with
+ * the License.  You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef MBOX_VIEW_H
+#define MBOX_VIEW_H
+
+/*
+ * Message views that do not depend on the request they are served for,
+ * so that mod-mbox-util can render them ahead of time, exactly as the
+ * module would.  Views are written to an mbox_out_t, which the module
+ * points at the client.
+ */
+
+#include "apr.h"
+#include "apr_file_io.h"
+#include "apr_pools.h"
+
+#include "mbox_cte.h"
+#include "mbox_escape.h"
+#include "mbox_mime.h"
+#include "mbox_parse.h"
+#include "mbox_render.h"
+#include "mbox_utf8.h"
+
+#define MBOX_FETCH_ERROR_STR "An error occured while fetching this message, sorry !"
+
+/* Invalid UTF-8 is replaced with U+FFFD, so XML consumers can parse
+   the result. */
+#define ESCAPE_OR_BLANK(pool, s) \
+(s ? mbox_escape_html(pool, mbox_utf8_repair_str(pool, s)) : "")
+
+#define ESCAPE_AND_CONV_HDR(pool, s) \
+(s ? mbox_escape_html(pool, mbox_utf8_repair_str(pool, mbox_cte_decode_header(pool, s))) : "")
+
+#define MSG_ID_ESCAPE_OR_BLANK(pool, s) \
+(s ? mbox_escape_msgid(pool, s) : "")
+
+/* Where a view goes.  The first write error is kept in status, and
+ * nothing is written after it.
+ */
+typedef struct mbox_out
+{
+    apr_pool_t *pool;
+    mbox_render_write_fn *write;
+    void *baton;
+    apr_status_t status;
+} mbox_out_t;
+
+void mbox_out_init(mbox_out_t *out, apr_pool_t *p,
+                   mbox_render_write_fn *write, void *baton);
+void mbox_out_write(mbox_out_t *out, const char *data, apr_size_t len);
+void mbox_out_puts(mbox_out_t *out, const char *s);
+void mbox_out_printf(mbox_out_t *out, const char *fmt, ...)
+    __attribute__((format(printf, 2, 3)));
+
+/* Returns the part of a message that is displayed as its body, or NULL
+ * if there is none.
+ */
+mbox_mime_message_t *mbox_view_body_part(apr_pool_t *p,
+                                         mbox_mime_message_t *m);
+
+/* Writes the body of a message (m->mime_msg must be set), decoded,
+ * converted to UTF-8, escaped and wrapped.  The body is read from the
+ * message as loaded if it is, otherwise from f.  Returns the error met
+ * converting from the charset of the body, if any: the body is written
+ * anyway.
+ */
+apr_status_t mbox_view_body(mbox_out_t *out, apr_file_t *f, Message *m,
+                            int flags);
+
+/* Writes the MIME structure of a message, as a list of links to its
+ * parts.  'link' must already be properly URI-escaped; if it is NULL, the
+ * parts are not linked to.
+ */
+void mbox_view_mime_structure(mbox_out_t *out, mbox_mime_message_t *m,
+                              char *link);
+
+/* Writes the message view (the msgview-inner block) for m, whose MIME
+ * structure must be set.  context holds the previous and next messages
+ * by date, then by thread (or NULL).  raw tells whether to link to the
+ * raw message and its parts, which static exports do not have.  Returns
+ * as mbox_view_body().
+ */
+apr_status_t mbox_view_message(mbox_out_t *out, apr_file_t *f, Message *m,
+                               char **context, const char *base_uri,
+                               int antispam, int raw);
+
+#endif
@@ -19,12 +19,26 @@
 #include "apr_pools.h"
 #include "apr_general.h"
 #include "apr_strings.h"
+#include "mbox_author.h"
 #include "mbox_cache.h"
+#include "mbox_column.h"
+#include "mbox_cte.h"
+#include "mbox_frag.h"
+#include "mbox_fts.h"
+#include "mbox_msgid.h"
+#include "mbox_page.h"
 #include "mbox_parse.h"
+#include "mbox_subject.h"
+#include "mbox_thread.h"
+#include "mbox_view.h"
 #include "apr_getopt.h"
 #include "apr_date.h"
 #include "apr_lib.h"
 #include "apr_fnmatch.h"
+#include "apr_sha1.h"
+#include "apr_thread_proc.h"
+#include "apr_thread_mutex.h"
+#include "apr_uri.h"
 
 #define NL APR_EOL_STR
 
@@ -35,13 +49,60 @@ static int verbose;
 static const char *upath;
 static const char *shortname;
 static apr_file_t *errfile;
+static mbox_attach_store_t attach_store;
+static const char *prerender_uri;
+static int prerender_flags;
+static int prerender_antispam;
+static int search_index;
+static const char *msgid_index;
+static mbox_msgid_writer_t *msgid_writer;
+static mbox_subject_writer_t *subject_writer;
+static mbox_author_writer_t *author_writer;
+static const char *export_dir;
+static const char *export_url;
+static int export_jobs;
+static mbox_page_cfg_t export_cfg;
+
+/* Long only options */
+enum {
+    OPT_ROOT_PATH = 256,
+    OPT_STYLE,
+    OPT_SCRIPT,
+    OPT_HEADER_INCLUDE,
+    OPT_FOOTER_INCLUDE,
+    OPT_HIDE_EMPTY
+};
+
+static const apr_getopt_option_t options[] = {
+    {"verbose", 'v', 0, "More verbose output"},
+    {"create", 'c', 1, "Create a new cache"},
+    {"update", 'u', 1, "Update a cache"},
+    {"msgids", 'm', 1, "Dump the Message-ID cache of a file"},
+    {"search", 's', 0, "Build the full-text search index"},
+    {"msgid-index", 'g', 1, "Site-wide Message-ID index"},
+    {"attachments", 'a', 1, "Attachment store"},
+    {"threshold", 't', 1, "Minimum size of stored attachments"},
+    {"prerender", 'p', 1, "Prerender the message views of past months"},
+    {"compress", 'z', 0, "Compress prerendered views"},
+    {"no-antispam", 'n', 0, "Render pages without email obfuscation"},
+    {"export", 'e', 1, "Export the archives as static files"},
+    {"url", 'b', 1, "Absolute URL of the list"},
+    {"jobs", 'j', 1, "Number of months exported at once"},
+    {"root-path", OPT_ROOT_PATH, 1, "As MboxRootPath"},
+    {"style", OPT_STYLE, 1, "As MboxStyle"},
+    {"script", OPT_SCRIPT, 1, "As MboxScript"},
+    {"header-include", OPT_HEADER_INCLUDE, 1, "As MboxHeaderIncludeFile"},
+    {"footer-include", OPT_FOOTER_INCLUDE, 1, "As MboxFooterIncludeFile"},
+    {"hide-empty", OPT_HIDE_EMPTY, 0, "As MboxHideEmpty On"},
+    {NULL, 0, 0, NULL}
+};
 
 static void usage(void)
 {
     apr_file_printf(errfile,
                     "%s -- Program to Create and Update mod_mbox cache files"
-                    NL "Usage: %s [-v] -u MBOX_PATH" NL
-                    "       %s [-v] -c MBOX_PATH" NL
+                    NL "Usage: %s [-v] [-a STORE_PATH [-t SIZE]] [-p URI [-z]] [-s] [-g FILE -b URL] [-e DIR -b URL [-j N]] [-n] -u MBOX_PATH" NL
+                    "       %s [-v] [-a STORE_PATH [-t SIZE]] [-p URI [-z]] [-s] [-g FILE -b URL] [-e DIR -b URL [-j N]] [-n] -c MBOX_PATH" NL
                     "       %s [-v] -m MBOX_FILE" NL NL "Options: " NL
                     " -v    More verbose output" NL NL
                     " -u    Updates an existing cache. If this cache does not exist it will"
@@ -51,8 +112,60 @@ static void usage(void)
                     " -c    Force creation of a new cache. If there is an existing cache, it"
                     NL "       will be ignored and overwritten " NL NL
                     " -m    Dumps the Message-ID cache to stdout for the specified file."
-                    NL NL " -s    Set the path to store a Full Text Index." NL
-                    NL, shortname, shortname, shortname, shortname);
+                    NL NL " -s, --search"
+                    NL "       Index the subjects, authors and bodies of the messages for"
+                    NL "       the search page of the module (LIST/search).  Each mailbox"
+                    NL "       gets its own index, next to it; in update mode, only the"
+                    NL "       mailboxes whose index changed are indexed again.  The"
+                    NL "       subjects of the threads of the list are indexed too, for"
+                    NL "       LIST/ajax/subjects, the messages of each author, for"
+                    NL "       LIST/author/NAME, and the dates, authors, subjects and"
+                    NL "       attachments of the messages, for LIST/filter and"
+                    NL "       LIST/stats." NL
+                    NL " -g, --msgid-index FILE"
+                    NL "       Record the Message-IDs of the list, at the URL given with"
+                    NL "       -b, in FILE.  All the lists of a site may share it; the"
+                    NL "       module redirects MSGID_URI/ID to the message from there"
+                    NL "       (see MboxMsgidIndex)." NL
+                    NL " -a    Extract large attachments, decoded, to the given directory."
+                    NL "       It may be shared by several lists; an attachment is only"
+                    NL "       stored once.  The module serves them from there when"
+                    NL "       MboxAttachmentStore points to the same directory." NL
+                    NL " -t    Minimum decoded size of the attachments extracted by -a,"
+                    NL "       in bytes (default: %d)." NL
+                    NL " -p, --prerender"
+                    NL "       Render the message views of past months ahead of time,"
+                    NL "       for the module to serve as they are.  URI is the URI of"
+                    NL "       the list (without the month), as the module serves it."
+                    NL "       In update mode, views are only rendered again when the"
+                    NL "       index changed." NL
+                    NL " -z, --compress"
+                    NL "       Compress the views rendered by -p." NL
+                    NL " -n, --no-antispam"
+                    NL "       Render the views (and exported pages) for MboxAntispam Off." NL
+                    NL " -e, --export DIR"
+                    NL "       Export the archives to DIR as static files, at the URLs"
+                    NL "       the module serves them, relative to the list.  The list"
+                    NL "       index is index.html and its Atom feed index.atom.  Page N"
+                    NL "       of a message list, served at thread?N, is thread_N, and"
+                    NL "       the pages link to it there.  The pages of the months have"
+                    NL "       no extension: serve them as text/html, eg with"
+                    NL "       <DirectoryMatch \"\\.mbox$\"> ForceType \"text/html;"
+                    NL "       charset=utf-8\"</DirectoryMatch>.  Raw messages and the"
+                    NL "       jump to a date are left out.  A month is only exported"
+                    NL "       again when its index changed, or when a month is added"
+                    NL "       or a past month indexed again, which the month list of"
+                    NL "       its message lists shows."
+                    NL "       The settings the module has from directives are given"
+                    NL "       with --root-path, --style, --script, --header-include,"
+                    NL "       --footer-include and --hide-empty; include files are"
+                    NL "       local paths." NL
+                    NL " -b, --url URL"
+                    NL "       The absolute URL of the list, as the module serves it." NL
+                    NL " -j, --jobs N"
+                    NL "       Export N months at once (default: 1)." NL
+                    NL, shortname, shortname, shortname, shortname,
+                    MBOX_ATTACH_MIN_SIZE);
 }
 
 static int file_alphasort(const void *fn1, const void *fn2)
@@ -61,6 +174,441 @@ static int file_alphasort(const void *fn1, const void *fn2)
     return strcmp(*(char **) fn2, *(char **) fn1);
 }
 
+/* Finds the messages before and after the one of l, which is in the
+ * list sorted by date, by date and by thread, as fetch_context_msgids()
+ * does.
+ */
+static void message_context(char **context, Container *threads,
+                            MBOX_LIST *prev, MBOX_LIST *l)
+{
+    Message *m = (Message *) l->value;
+    Container *c;
+
+    context[0] = prev ? ((Message *) prev->value)->msgID : NULL;
+    context[1] = l->next ? ((Message *) l->next->value)->msgID : NULL;
+    context[2] = context[3] = NULL;
+    if (threads) {
+        c = mbox_thread_prev(threads, m->msgID);
+        if (c && c->message) {
+            context[2] = c->message->msgID;
+        }
+        c = mbox_thread_next(threads, m->msgID);
+        if (c && c->message) {
+            context[3] = c->message->msgID;
+        }
+    }
+}
+
+/* A mailbox, for the indexes and views built from its message index.
+ * The index is only loaded if one of them is out of date, and then once
+ * for all of them.
+ */
+typedef struct month_t
+{
+    const char *path;           /* Relative to the list */
+    char *filename;
+    apr_finfo_t finfo;          /* Of the message index */
+    apr_file_t *f;
+    MBOX_LIST *list;            /* By date */
+    Container *threads;         /* As the module computes them */
+    int failed;
+} month_t;
+
+/* Opens the mailbox and loads its message index, unless that is already
+ * done.  Returns 0 if they cannot be.
+ */
+static int month_load(request_rec *r, month_t *mo)
+{
+    apr_status_t rv;
+    char *temp = r->filename;
+
+    if (mo->f || mo->failed) {
+        return !mo->failed;
+    }
+
+    rv = apr_file_open(&mo->f, mo->filename, APR_READ, APR_OS_DEFAULT,
+                       r->pool);
+    if (rv != APR_SUCCESS) {
+        apr_file_printf(errfile, "Error: Cannot open '%s': %s" NL,
+                        mo->filename, apr_strerror(rv, errbuf, sizeof(errbuf)));
+        mo->f = NULL;
+        mo->failed = 1;
+        return 0;
+    }
+
+    r->filename = mo->filename;
+    mo->list = mbox_load_index(r, mo->f, NULL);
+    r->filename = temp;
+
+    /* Compute threads before sorting the list */
+    mo->threads = calculate_threads(r->pool, mo->list);
+    mo->list = mbox_sort_list(mo->list, MBOX_SORT_DATE);
+    return 1;
+}
+
+/* Renders the views of all the messages of a mailbox, unless those
+ * already rendered are still current.  This is done the way the module
+ * does it for each message, but threads are only computed once.
+ */
+static void prerender_mbox(request_rec *r, month_t *mo)
+{
+    apr_status_t rv;
+    mbox_frag_info_t info;
+    mbox_frag_t *frag;
+    mbox_frag_writer_t *w;
+    MBOX_LIST *l, *prev;
+    apr_pool_t *mpool;
+    int count = 0;
+    char *temp = r->filename;
+
+    if (!prerender_uri || !mbox_is_past_month(mo->path)) {
+        return;
+    }
+
+    info.flags = prerender_flags;
+    info.antispam = prerender_antispam;
+    info.index_mtime = mo->finfo.mtime;
+    info.index_size = mo->finfo.size;
+    info.base_uri = apr_pstrcat(r->pool, prerender_uri, "/", mo->path, NULL);
+
+    if (mbox_frag_open(&frag, r->pool, mo->filename) == APR_SUCCESS) {
+        int current = mbox_frag_matches(frag, &info)
+            && frag->info.flags == info.flags;
+
+        apr_file_close(frag->file);
+        if (current) {
+            if (verbose) {
+                apr_file_printf(errfile, "	Views up to date." NL);
+            }
+            return;
+        }
+    }
+
+    if (!month_load(r, mo)) {
+        return;
+    }
+    rv = mbox_frag_create(&w, r->pool, mo->filename, &info);
+    if (rv != APR_SUCCESS) {
+        apr_file_printf(errfile, "Error: Cannot prerender '%s': %s" NL,
+                        mo->filename, apr_strerror(rv, errbuf, sizeof(errbuf)));
+        return;
+    }
+
+    r->filename = mo->filename;
+    apr_pool_create(&mpool, r->pool);
+    for (prev = NULL, l = mo->list; l; prev = l, l = l->next) {
+        Message *m = (Message *) l->value;
+        char *context[4];
+
+        message_context(context, mo->threads, prev, l);
+        m->mime_msg = mbox_fetch_message_mime(r, mpool, mo->f, m);
+        mbox_view_message(mbox_frag_begin(w, mpool), mo->f, m, context,
+                          info.base_uri, info.antispam, 1);
+        rv = mbox_frag_end(w, m->msgID, m->date, m->html_subject);
+        m->mime_msg = NULL;
+        apr_pool_clear(mpool);
+        if (rv != APR_SUCCESS) {
+            break;
+        }
+        count++;
+    }
+    apr_pool_destroy(mpool);
+    r->filename = temp;
+
+    if (rv == APR_SUCCESS) {
+        rv = mbox_frag_commit(w);
+    }
+    else {
+        mbox_frag_abort(w);
+    }
+
+    if (rv != APR_SUCCESS) {
+        apr_file_printf(errfile, "Error: Prerendering '%s' failed: %s" NL,
+                        mo->filename, apr_strerror(rv, errbuf, sizeof(errbuf)));
+    }
+    else if (verbose) {
+        apr_file_printf(errfile, "	prerendered %d messages" NL, count);
+    }
+}
+
+/* Builds the full-text search index of the mailbox, in p, unless the
+ * current one was built from the same message index.
+ */
+static void index_mbox(request_rec *r, month_t *mo, apr_pool_t *p)
+{
+    apr_status_t rv;
+    mbox_fts_t *fts;
+    mbox_fts_writer_t *w = NULL;
+    mbox_column_t *cols;
+    mbox_column_writer_t *cw = NULL;
+    MBOX_LIST *l;
+    apr_pool_t *mpool;
+    int count = 0;
+    char *temp = r->filename;
+
+    if (mbox_fts_open(&fts, p, mo->filename) == APR_SUCCESS
+        && mbox_fts_matches(fts, mo->finfo.mtime, mo->finfo.size)
+        && mbox_column_open(&cols, p, mo->filename) == APR_SUCCESS
+        && mbox_column_matches(cols, mo->finfo.mtime, mo->finfo.size)) {
+        if (verbose) {
+            apr_file_printf(errfile, "	Search index up to date." NL);
+        }
+        return;
+    }
+
+    if (!month_load(r, mo)) {
+        return;
+    }
+    rv = mbox_fts_create(&w, p, mo->filename, mo->finfo.mtime,
+                         mo->finfo.size);
+    if (rv == APR_SUCCESS) {
+        rv = mbox_column_create(&cw, p, mo->filename, mo->finfo.mtime,
+                                mo->finfo.size);
+        if (rv != APR_SUCCESS) {
+            mbox_fts_abort(w);
+        }
+    }
+    if (rv != APR_SUCCESS) {
+        apr_file_printf(errfile, "Error: Cannot index '%s': %s" NL,
+                        mo->filename, apr_strerror(rv, errbuf, sizeof(errbuf)));
+        return;
+    }
+
+    /* The thread starts are those of the list by date. */
+    mbox_column_threads(cw, calculate_threads(p, mo->list));
+
+    r->filename = mo->filename;
+    apr_pool_create(&mpool, p);
+    for (l = mo->list; l; l = l->next) {
+        Message *m = (Message *) l->value;
+        mbox_out_t *out;
+
+        m->mime_msg = mbox_fetch_message_mime(r, mpool, mo->f, m);
+        out = mbox_fts_begin(w, m);
+        if (m->mime_msg && mbox_view_body_part(mpool, m->mime_msg)) {
+            mbox_view_body(out, mo->f, m, 0);
+        }
+        mbox_fts_end(w);
+        mbox_column_add(cw, m);
+        m->mime_msg = NULL;
+        apr_pool_clear(mpool);
+        count++;
+    }
+    apr_pool_destroy(mpool);
+    r->filename = temp;
+
+    rv = mbox_fts_commit(w);
+    if (rv == APR_SUCCESS) {
+        rv = mbox_column_commit(cw);
+    }
+    else {
+        mbox_column_abort(cw);
+    }
+    if (rv != APR_SUCCESS) {
+        apr_file_printf(errfile, "Error: Indexing '%s' failed: %s" NL,
+                        mo->filename, apr_strerror(rv, errbuf, sizeof(errbuf)));
+    }
+    else if (verbose) {
+        apr_file_printf(errfile, "	indexed %d messages" NL, count);
+    }
+}
+
+static void build_search(request_rec *r, month_t *mo)
+{
+    apr_pool_t *p;
+
+    if (!search_index) {
+        return;
+    }
+
+    /* The postings of a month are only needed while it is indexed. */
+    apr_pool_create(&p, r->pool);
+    index_mbox(r, mo, p);
+    apr_pool_destroy(p);
+}
+
+/* Writes the ordinal index of the mailbox, unless it has one for the
+ * current message index.
+ */
+static void index_ordinals(request_rec *r, month_t *mo)
+{
+    apr_status_t rv;
+    mbox_ordinal_t *ord;
+    mbox_ordinal_writer_t *w;
+    MBOX_LIST *l;
+    int count = 0;
+
+    if (mbox_ordinal_open(&ord, r->pool, mo->filename) == APR_SUCCESS
+        && mbox_ordinal_matches(ord, mo->finfo.mtime, mo->finfo.size)) {
+        if (verbose) {
+            apr_file_printf(errfile, "\tOrdinals up to date." NL);
+        }
+        return;
+    }
+
+    if (!month_load(r, mo)) {
+        return;
+    }
+    rv = mbox_ordinal_create(&w, r->pool, mo->filename, mo->finfo.mtime,
+                             mo->finfo.size);
+    if (rv != APR_SUCCESS) {
+        apr_file_printf(errfile, "Error: Cannot index '%s': %s" NL,
+                        mo->filename, apr_strerror(rv, errbuf, sizeof(errbuf)));
+        return;
+    }
+
+    /* Ordinals are positions in the month, by date. */
+    for (l = mo->list; l; l = l->next) {
+        Message *m = (Message *) l->value;
+        mbox_ordinal_add(w, m->date, m->msgID);
+        count++;
+    }
+
+    rv = mbox_ordinal_commit(w);
+    if (rv != APR_SUCCESS) {
+        apr_file_printf(errfile, "Error: Indexing '%s' failed: %s" NL,
+                        mo->filename, apr_strerror(rv, errbuf, sizeof(errbuf)));
+    }
+    else if (verbose) {
+        apr_file_printf(errfile, "\tnumbered %d messages" NL, count);
+    }
+}
+
+/* Records the Message-IDs of the mailbox in the site-wide index, unless
+ * it has them for the current message index.
+ */
+static void index_msgids(request_rec *r, month_t *mo)
+{
+    MBOX_LIST *l;
+    apr_uint32_t count = 0;
+
+    if (!msgid_writer) {
+        return;
+    }
+
+    if (mbox_msgid_writer_box(msgid_writer, mo->path, mo->finfo.mtime,
+                              mo->finfo.size)) {
+        if (verbose) {
+            apr_file_printf(errfile, "\tMessage-IDs up to date." NL);
+        }
+        return;
+    }
+
+    if (!month_load(r, mo)) {
+        return;
+    }
+    for (l = mo->list; l; l = l->next) {
+        Message *m = (Message *) l->value;
+        mbox_msgid_writer_add(msgid_writer, m->msgID);
+        count++;
+    }
+
+    if (verbose) {
+        apr_file_printf(errfile, "\trecorded %u Message-IDs" NL, count);
+    }
+}
+
+/* Lists the threads of the mailbox in the subject index of the list,
+ * unless it has them for the current message index.
+ */
+static void index_subjects(request_rec *r, month_t *mo)
+{
+    Container *c;
+    int count = 0;
+
+    if (!subject_writer) {
+        return;
+    }
+
+    if (mbox_subject_writer_box(subject_writer, mo->path, mo->finfo.mtime,
+                                mo->finfo.size)) {
+        if (verbose) {
+            apr_file_printf(errfile, "\tSubjects up to date." NL);
+        }
+        return;
+    }
+
+    if (!month_load(r, mo)) {
+        return;
+    }
+    for (c = mo->threads; c; c = c->next) {
+        mbox_subject_writer_add(subject_writer, c);
+        count++;
+    }
+
+    if (verbose) {
+        apr_file_printf(errfile, "\tlisted %d threads" NL, count);
+    }
+}
+
+/* Lists the messages of the mailbox in the author index of the list,
+ * unless it has them for the current message index.
+ */
+static void index_authors(request_rec *r, month_t *mo)
+{
+    MBOX_LIST *l;
+    int count = 0;
+
+    if (!author_writer) {
+        return;
+    }
+
+    if (mbox_author_writer_box(author_writer, mo->path, mo->finfo.mtime,
+                               mo->finfo.size)) {
+        if (verbose) {
+            apr_file_printf(errfile, "\tAuthors up to date." NL);
+        }
+        return;
+    }
+
+    if (!month_load(r, mo)) {
+        return;
+    }
+    for (l = mo->list; l; l = l->next) {
+        mbox_author_writer_add(author_writer, (Message *) l->value);
+        count++;
+    }
+
+    if (verbose) {
+        apr_file_printf(errfile, "\tlisted %d messages by author" NL, count);
+    }
+}
+
+/* Brings the indexes and views built from the message index of the
+ * mailbox path up to date with it.
+ */
+static void index_month(request_rec *r, char *path)
+{
+    apr_status_t rv;
+    month_t mo;
+    char *temp = r->filename;
+
+    memset(&mo, 0, sizeof(mo));
+    mo.path = path;
+    mo.filename = apr_pstrcat(r->pool, temp, path, NULL);
+
+    r->filename = mo.filename;
+    rv = mbox_index_stat(r, &mo.finfo);
+    r->filename = temp;
+    if (rv != APR_SUCCESS) {
+        apr_file_printf(errfile, "Error: Cannot stat the index of '%s': %s"
+                        NL, mo.filename,
+                        apr_strerror(rv, errbuf, sizeof(errbuf)));
+        return;
+    }
+
+    index_ordinals(r, &mo);
+    build_search(r, &mo);
+    index_subjects(r, &mo);
+    index_authors(r, &mo);
+    index_msgids(r, &mo);
+    prerender_mbox(r, &mo);
+
+    if (mo.f) {
+        apr_file_close(mo.f);
+    }
+}
+
 static int process_mbox(request_rec *r, mbox_cache_info *mli, char *path,
                         const char *list, const char *domain)
 {
@@ -79,6 +627,7 @@ static int process_mbox(request_rec *r, mbox_cache_info *mli, char *path,
             if (verbose) {
                 apr_file_printf(errfile, "\tNot Modified, Skipping." NL);
             }
+            index_month(r, path);
             return 0;
         }
     }
@@ -93,7 +642,8 @@ static int process_mbox(request_rec *r, mbox_cache_info *mli, char *path,
 
     temp = r->filename;
     r->filename = absfile;
-    rv = mbox_generate_index(r, f, list, domain);
+    rv = mbox_generate_index(r, f, list, domain,
+                             attach_store.dir ? &attach_store : NULL);
     r->filename = temp;
 
     if (rv != APR_SUCCESS) {
@@ -108,6 +658,7 @@ static int process_mbox(request_rec *r, mbox_cache_info *mli, char *path,
         apr_file_printf(errfile, "\tscanned %d messages" NL, count);
     }
     mbox_cache_set_count(mli, count, path);
+    index_month(r, path);
     return 0;
 }
 
@@ -231,6 +782,27 @@ static int scan_dir(request_rec *r)
         apr_file_printf(errfile, "Current Time: %s" NL, date);
     }
 
+    if (msgid_index) {
+        /* The list is recorded by its URL, without the trailing slash. */
+        char *url = apr_pstrdup(mpool, export_url);
+        apr_size_t len = strlen(url);
+        while (len && url[len - 1] == '/') {
+            url[--len] = '\0';
+        }
+        rv = mbox_msgid_writer_create(&msgid_writer, mpool, msgid_index, url);
+        if (rv != APR_SUCCESS) {
+            apr_file_printf(errfile, "Error: Cannot open '%s': %s" NL,
+                            msgid_index,
+                            apr_strerror(rv, errbuf, sizeof(errbuf)));
+            return EXIT_FAILURE;
+        }
+    }
+
+    if (search_index) {
+        mbox_subject_writer_create(&subject_writer, mpool, r->filename);
+        mbox_author_writer_create(&author_writer, mpool, r->filename);
+    }
+
     /* Iterate the .mbox files */
     apr_pool_create(&rpool, mpool);
     r->pool = rpool;
@@ -246,6 +818,45 @@ static int scan_dir(request_rec *r)
         }
     }
 
+    /* A mailbox left out would lose its threads.  The list is served
+       without the index, if it cannot be written. */
+    if (subject_writer && !rv) {
+        apr_status_t srv = mbox_subject_writer_commit(subject_writer);
+        if (srv != APR_SUCCESS) {
+            apr_file_printf(errfile,
+                            "Error: Updating the subject index failed: %s" NL,
+                            apr_strerror(srv, errbuf, sizeof(errbuf)));
+        }
+    }
+    subject_writer = NULL;
+    if (author_writer && !rv) {
+        apr_status_t srv = mbox_author_writer_commit(author_writer);
+        if (srv != APR_SUCCESS) {
+            apr_file_printf(errfile,
+                            "Error: Updating the author index failed: %s" NL,
+                            apr_strerror(srv, errbuf, sizeof(errbuf)));
+        }
+    }
+    author_writer = NULL;
+
+    if (msgid_writer) {
+        /* The mailboxes left out would lose their entries. */
+        if (rv) {
+            mbox_msgid_writer_abort(msgid_writer);
+        }
+        else {
+            rv = mbox_msgid_writer_commit(msgid_writer);
+            if (rv != APR_SUCCESS) {
+                apr_file_printf(errfile,
+                                "Error: Updating '%s' failed: %s" NL,
+                                msgid_index,
+                                apr_strerror(rv, errbuf, sizeof(errbuf)));
+                return EXIT_FAILURE;
+            }
+        }
+        msgid_writer = NULL;
+    }
+
     mli->mtime = newtime;
     rv = mbox_cache_touch(mli);
 
@@ -261,6 +872,526 @@ static int scan_dir(request_rec *r)
     return rv;
 }
 
+/* Static export (-e).  The pages of the list are written where a server
+ * would find them for the URLs the module serves them at, as the module
+ * renders them.  Each month directory records the version of the index
+ * and the settings it was exported with.
+ */
+#define EXPORT_STAMP ".export"
+#define EXPORT_PERMS (APR_FPROT_UREAD | APR_FPROT_UWRITE | \
+                      APR_FPROT_GREAD | APR_FPROT_WREAD)
+#define EXPORT_DIR_PERMS (EXPORT_PERMS | APR_FPROT_UEXECUTE | \
+                          APR_FPROT_GEXECUTE | APR_FPROT_WEXECUTE)
+
+typedef struct export_ctx
+{
+    request_rec *r;
+    apr_array_header_t *files;
+    const char *base_path;
+    const char *base_name;
+    const char *settings;       /* Signatures of what all pages depend on */
+    const char *boxes;
+    int next;                   /* Next month to export */
+    int failed;
+#if APR_HAS_THREADS
+    apr_thread_mutex_t *lock;
+#endif
+} export_ctx_t;
+
+/* A page being written.  It only replaces the previous one once
+ * complete.
+ */
+typedef struct export_file
+{
+    apr_file_t *f;
+    char *tmp;
+    const char *path;
+    mbox_out_t out;
+} export_file_t;
+
+static apr_status_t write_export(void *baton, const char *data,
+                                 apr_size_t len)
+{
+    return apr_file_write_full((apr_file_t *) baton, data, len, NULL);
+}
+
+static apr_status_t export_open(export_file_t *ef, apr_pool_t *p,
+                                const char *path)
+{
+    apr_status_t rv;
+
+    ef->path = path;
+    ef->tmp = apr_pstrcat(p, path, ".XXXXXX", NULL);
+    rv = apr_file_mktemp(&ef->f, ef->tmp,
+                         APR_CREATE | APR_WRITE | APR_EXCL | APR_BUFFERED, p);
+    if (rv == APR_SUCCESS) {
+        mbox_out_init(&ef->out, p, write_export, ef->f);
+    }
+    return rv;
+}
+
+/* Closes the page, and puts it in place if rv and the writes are all
+ * right.
+ */
+static apr_status_t export_close(export_file_t *ef, apr_status_t rv)
+{
+    apr_status_t crv;
+
+    if (rv == APR_SUCCESS) {
+        rv = ef->out.status;
+    }
+    crv = apr_file_close(ef->f);
+    if (rv == APR_SUCCESS) {
+        rv = crv;
+    }
+
+    if (rv == APR_SUCCESS) {
+        apr_file_perms_set(ef->tmp, EXPORT_PERMS);
+        rv = apr_file_rename(ef->tmp, ef->path, ef->out.pool);
+    }
+    if (rv != APR_SUCCESS) {
+        apr_file_remove(ef->tmp, ef->out.pool);
+    }
+    return rv;
+}
+
+static const char *signature(apr_pool_t *p, const char *s)
+{
+    char *sig = apr_palloc(p, 64);
+
+    apr_sha1_base64(s, strlen(s), sig);
+    return sig;
+}
+
+static char *read_stamp(apr_pool_t *p, const char *path)
+{
+    apr_file_t *f;
+    apr_size_t len;
+    char buf[256];
+
+    if (apr_file_open(&f, path, APR_READ, APR_OS_DEFAULT, p)
+        != APR_SUCCESS) {
+        return NULL;
+    }
+    apr_file_read_full(f, buf, sizeof(buf) - 1, &len);
+    apr_file_close(f);
+
+    return apr_pstrmemdup(p, buf, len);
+}
+
+/* Writes all the pages of a message list: page N (N > 0) of "thread"
+ * goes to thread_N.
+ */
+static apr_status_t export_msglist(export_ctx_t *ex, apr_pool_t *p,
+                                   const char *dir, const char *box,
+                                   const char *base_uri,
+                                   const mbox_msglist_t *l,
+                                   const char *name)
+{
+    apr_status_t rv = APR_SUCCESS;
+    apr_pool_t *ppool;
+    export_file_t ef;
+    const char *path_info = apr_pstrcat(p, "/", name, NULL);
+    int page;
+
+    apr_pool_create(&ppool, p);
+    for (page = 0; rv == APR_SUCCESS && (page == 0 || page < l->pages);
+         page++) {
+        const char *path;
+
+        if (page) {
+            path = apr_psprintf(ppool, "%s/%s_%d", dir, name, page);
+        }
+        else {
+            path = apr_pstrcat(ppool, dir, "/", name, NULL);
+        }
+
+        rv = export_open(&ef, ppool, path);
+        if (rv == APR_SUCCESS) {
+            rv = mbox_page_msglist(&ef.out, &export_cfg, l, ex->files, box,
+                                   base_uri, ex->base_path, ex->base_name,
+                                   path_info, page);
+            rv = export_close(&ef, rv);
+        }
+        apr_pool_clear(ppool);
+    }
+    apr_pool_destroy(ppool);
+
+    return rv;
+}
+
+/* Writes the page of each message, sorted by date in l, to a file named
+ * after its Message-ID.  Message-IDs that cannot be file names are
+ * skipped: the module cannot be asked for them either.
+ */
+static apr_status_t export_messages(export_ctx_t *ex, request_rec *r,
+                                    apr_file_t *f, const char *dir,
+                                    const char *base_uri, MBOX_LIST *l,
+                                    Container *threads, int *count)
+{
+    apr_status_t rv = APR_SUCCESS;
+    apr_pool_t *mpool;
+    export_file_t ef;
+    MBOX_LIST *prev;
+
+    apr_pool_create(&mpool, r->pool);
+    for (prev = NULL; l && rv == APR_SUCCESS; prev = l, l = l->next) {
+        Message *m = (Message *) l->value;
+        char *context[4];
+
+        if (!*m->msgID || *m->msgID == '.' || strchr(m->msgID, '/')) {
+            continue;
+        }
+
+        message_context(context, threads, prev, l);
+
+        rv = export_open(&ef, mpool,
+                         apr_pstrcat(mpool, dir, "/", m->msgID, NULL));
+        if (rv == APR_SUCCESS) {
+            m->mime_msg = mbox_fetch_message_mime(r, mpool, f, m);
+            rv = mbox_page_message_header(&ef.out, &export_cfg,
+                                          m->html_subject, ex->base_path,
+                                          ex->base_name);
+            if (rv == APR_SUCCESS) {
+                mbox_view_message(&ef.out, f, m, context, base_uri,
+                                  export_cfg.antispam, 0);
+                mbox_page_message_footer(&ef.out);
+            }
+            rv = export_close(&ef, rv);
+        }
+        apr_pool_clear(mpool);
+        (*count)++;
+    }
+    apr_pool_destroy(mpool);
+
+    return rv;
+}
+
+/* Writes to errfile from a worker, a line at a time. */
+static void export_log(export_ctx_t *ex, apr_pool_t *p, const char *fmt, ...)
+{
+    va_list ap;
+    char *s;
+
+    va_start(ap, fmt);
+    s = apr_pvsprintf(p, fmt, ap);
+    va_end(ap);
+
+#if APR_HAS_THREADS
+    apr_thread_mutex_lock(ex->lock);
+#endif
+    apr_file_puts(s, errfile);
+#if APR_HAS_THREADS
+    apr_thread_mutex_unlock(ex->lock);
+#endif
+}
+
+/* Exports a month, unless it is up to date.  Message pages only depend
+ * on the index of the month, but the message lists show the other
+ * months too.  The counts of open months are left out of them, and
+ * mbox_boxes_version() leaves them out of the stamp: the new mail of the
+ * current month does not render the message lists of all months again,
+ * only a new month or a past month indexed again does.
+ */
+static apr_status_t export_month(export_ctx_t *ex, request_rec *r,
+                                 const char *box)
+{
+    apr_status_t rv;
+    apr_finfo_t finfo;
+    apr_file_t *f;
+    mbox_msglist_t lt, ld, la;
+    MBOX_LIST *l;
+    const char *dir, *base_uri, *version, *stamp;
+    char *old;
+    int views, count = 0, exported = 0;
+    export_file_t ef;
+
+    r->filename = apr_pstrcat(r->pool, ex->r->filename, box, NULL);
+
+    rv = mbox_index_stat(r, &finfo);
+    if (rv != APR_SUCCESS) {
+        return rv;
+    }
+
+    version = apr_psprintf(r->pool,
+                           "index %" APR_TIME_T_FMT " %" APR_OFF_T_FMT "\n"
+                           "settings %s\nformat %d\n", finfo.mtime,
+                           finfo.size, ex->settings, MBOX_PAGE_FORMAT);
+    stamp = apr_pstrcat(r->pool, version, "boxes ", ex->boxes, "\n", NULL);
+
+    dir = apr_pstrcat(r->pool, export_dir, "/", box, NULL);
+    old = read_stamp(r->pool, apr_pstrcat(r->pool, dir, "/", EXPORT_STAMP,
+                                          NULL));
+    if (old && strcmp(old, stamp) == 0) {
+        if (verbose) {
+            export_log(ex, r->pool, "\t%s up to date." NL, box);
+        }
+        return APR_SUCCESS;
+    }
+    views = !old || strncmp(old, version, strlen(version)) != 0;
+
+    rv = apr_dir_make_recursive(dir, EXPORT_DIR_PERMS, r->pool);
+    if (rv != APR_SUCCESS) {
+        return rv;
+    }
+
+    rv = apr_file_open(&f, r->filename, APR_READ, APR_OS_DEFAULT, r->pool);
+    if (rv != APR_SUCCESS) {
+        return rv;
+    }
+
+    base_uri = apr_pstrcat(r->pool, ex->base_path, "/", box, NULL);
+
+    /* The lists are sorted as the module does it, from the index as it
+       is loaded: sorting is stable. */
+    l = mbox_load_index(r, f, &count);
+    mbox_msglist_init(&lt, r->pool, l, count, MBOX_SORT_THREAD);
+    mbox_msglist_init(&ld, r->pool, l, count, MBOX_SORT_DATE);
+
+    if (views) {
+        rv = export_messages(ex, r, f, dir, base_uri, ld.head, lt.threads,
+                             &exported);
+    }
+    if (rv == APR_SUCCESS) {
+        rv = export_msglist(ex, r->pool, dir, box, base_uri, &lt, "thread");
+    }
+    if (rv == APR_SUCCESS) {
+        rv = export_msglist(ex, r->pool, dir, box, base_uri, &ld, "date");
+    }
+    if (rv == APR_SUCCESS) {
+        l = mbox_load_index(r, f, &count);
+        mbox_msglist_init(&la, r->pool, l, count, MBOX_SORT_AUTHOR);
+        rv = export_msglist(ex, r->pool, dir, box, base_uri, &la, "author");
+    }
+    apr_file_close(f);
+
+    if (rv == APR_SUCCESS) {
+        rv = export_open(&ef, r->pool,
+                         apr_pstrcat(r->pool, dir, "/", EXPORT_STAMP, NULL));
+        if (rv == APR_SUCCESS) {
+            mbox_out_puts(&ef.out, stamp);
+            rv = export_close(&ef, APR_SUCCESS);
+        }
+    }
+
+    if (rv == APR_SUCCESS && verbose) {
+        export_log(ex, r->pool, "\texported %s (%d messages)" NL, box,
+                   exported);
+    }
+    return rv;
+}
+
+static void export_failed(export_ctx_t *ex)
+{
+#if APR_HAS_THREADS
+    apr_thread_mutex_lock(ex->lock);
+#endif
+    ex->failed++;
+#if APR_HAS_THREADS
+    apr_thread_mutex_unlock(ex->lock);
+#endif
+}
+
+/* Exports months until there is none left.  Each worker has pools of
+ * its own, and buffers: errbuf is the main thread's.
+ */
+static void export_months(export_ctx_t *ex)
+{
+    apr_allocator_t *allocator;
+    apr_pool_t *pool;
+    apr_status_t rv;
+    request_rec r;
+    const char *box;
+    char buf[128];
+    int i;
+
+    if (apr_allocator_create(&allocator) != APR_SUCCESS) {
+        export_failed(ex);
+        return;
+    }
+    apr_pool_create_ex(&pool, NULL, NULL, allocator);
+    apr_allocator_owner_set(allocator, pool);
+
+    r = *ex->r;
+    r.pool = pool;
+
+    for (;;) {
+#if APR_HAS_THREADS
+        apr_thread_mutex_lock(ex->lock);
+#endif
+        i = ex->next++;
+#if APR_HAS_THREADS
+        apr_thread_mutex_unlock(ex->lock);
+#endif
+        if (i >= ex->files->nelts) {
+            break;
+        }
+
+        box = APR_ARRAY_IDX(ex->files, i, mbox_file_t).filename;
+        rv = export_month(ex, &r, box);
+        if (rv != APR_SUCCESS) {
+            export_log(ex, pool, "Error: Exporting '%s' failed: %s" NL, box,
+                       apr_strerror(rv, buf, sizeof(buf)));
+            export_failed(ex);
+        }
+        apr_pool_clear(pool);
+    }
+
+    apr_pool_destroy(pool);
+}
+
+#if APR_HAS_THREADS
+static void *APR_THREAD_FUNC export_worker(apr_thread_t *thd, void *data)
+{
+    export_months(data);
+    apr_thread_exit(thd, APR_SUCCESS);
+    return NULL;
+}
+#endif
+
+/* Writes a page of the list itself */
+static apr_status_t export_list_page(request_rec *r, mbox_cache_info *mli,
+                                     export_ctx_t *ex, const char *name)
+{
+    apr_status_t rv;
+    export_file_t ef;
+
+    rv = export_open(&ef, r->pool,
+                     apr_pstrcat(r->pool, export_dir, "/", name, NULL));
+    if (rv != APR_SUCCESS) {
+        return rv;
+    }
+
+    if (strcmp(name, "index.html") == 0) {
+        rv = mbox_page_index(&ef.out, &export_cfg, mli, ex->files,
+                             export_url);
+    }
+    else {
+        mbox_page_atom(&ef.out, r, mli, ex->files, r->filename, export_url,
+                       apr_pstrcat(r->pool, export_url, name, NULL));
+    }
+
+    return export_close(&ef, rv);
+}
+
+static int export_list(request_rec *r)
+{
+    apr_status_t rv;
+    apr_uri_t uri;
+    mbox_cache_info *mli;
+    export_ctx_t ex;
+    const char *s;
+    char *path;
+    apr_size_t len;
+    int i;
+
+    if (verbose) {
+        apr_file_printf(errfile, "Exporting to '%s'" NL, export_dir);
+    }
+
+    rv = apr_uri_parse(r->pool, export_url, &uri);
+    if (rv != APR_SUCCESS || !uri.hostname) {
+        apr_file_printf(errfile, "Error: '%s' is not an absolute URL" NL,
+                        export_url);
+        return EXIT_FAILURE;
+    }
+
+    /* The list index is served at URL/, and months at PATH/YYYYMM.mbox */
+    path = apr_pstrdup(r->pool, uri.path ? uri.path : "");
+    len = strlen(path);
+    while (len && path[len - 1] == '/') {
+        path[--len] = '\0';
+    }
+    ex.base_path = path;
+    ex.base_name = strrchr(path, '/') ? strrchr(path, '/') + 1 : path;
+
+    path = apr_pstrdup(r->pool, export_url);
+    len = strlen(path);
+    while (len && path[len - 1] == '/') {
+        path[--len] = '\0';
+    }
+    export_url = apr_pstrcat(r->pool, path, "/", NULL);
+
+    rv = mbox_cache_get(&mli, r->filename, r->pool);
+    if (rv != APR_SUCCESS) {
+        apr_file_printf(errfile, "Error: Cannot open the cache of '%s': %s"
+                        NL, r->filename,
+                        apr_strerror(rv, errbuf, sizeof(errbuf)));
+        return EXIT_FAILURE;
+    }
+
+    rv = mbox_boxes_list(&ex.files, r->pool, mli, r->filename);
+    if (rv != APR_SUCCESS) {
+        apr_file_printf(errfile, "Error: Listing '%s' failed: %s" NL,
+                        r->filename, apr_strerror(rv, errbuf, sizeof(errbuf)));
+        mbox_cache_close(mli);
+        return EXIT_FAILURE;
+    }
+
+    s = apr_pstrcat(r->pool, mbox_page_cfg_version(r->pool, &export_cfg), " ",
+                    export_url, NULL);
+    ex.settings = signature(r->pool, s);
+
+    s = mbox_boxes_version(r->pool, ex.files);
+    ex.boxes = signature(r->pool, s);
+
+    rv = apr_dir_make_recursive(export_dir, EXPORT_DIR_PERMS, r->pool);
+    if (rv == APR_SUCCESS) {
+        rv = export_list_page(r, mli, &ex, "index.html");
+    }
+    if (rv == APR_SUCCESS) {
+        rv = export_list_page(r, mli, &ex, "index.atom");
+    }
+    mbox_cache_close(mli);
+
+    if (rv != APR_SUCCESS) {
+        apr_file_printf(errfile, "Error: Exporting the list index failed: %s"
+                        NL, apr_strerror(rv, errbuf, sizeof(errbuf)));
+        return EXIT_FAILURE;
+    }
+
+    ex.r = r;
+    ex.next = 0;
+    ex.failed = 0;
+
+#if APR_HAS_THREADS
+    rv = apr_thread_mutex_create(&ex.lock, APR_THREAD_MUTEX_DEFAULT, r->pool);
+    if (rv == APR_SUCCESS && export_jobs > 1) {
+        apr_thread_t **workers = apr_pcalloc(r->pool,
+                                             export_jobs * sizeof(*workers));
+        apr_status_t trv;
+
+        for (i = 0; i < export_jobs; i++) {
+            rv = apr_thread_create(&workers[i], NULL, export_worker, &ex,
+                                   r->pool);
+            if (rv != APR_SUCCESS) {
+                break;
+            }
+        }
+        /* The months left, if a worker could not start */
+        if (rv != APR_SUCCESS) {
+            export_months(&ex);
+        }
+        while (i--) {
+            apr_thread_join(&trv, workers[i]);
+        }
+        rv = APR_SUCCESS;
+    }
+    else if (rv == APR_SUCCESS) {
+        export_months(&ex);
+    }
+    if (rv != APR_SUCCESS) {
+        apr_file_printf(errfile, "Error: Cannot create a mutex: %s" NL,
+                        apr_strerror(rv, errbuf, sizeof(errbuf)));
+        return EXIT_FAILURE;
+    }
+#else
+    export_months(&ex);
+#endif
+
+    return ex.failed ? EXIT_FAILURE : 0;
+}
+
 static int load_msgid(request_rec *r)
 {
     apr_status_t rv;
@@ -290,7 +1421,8 @@ int main(int argc, const char *const argv[])
     server_rec s;
     apr_getopt_t *opt;
     const char *optarg;
-    char ch;
+    char *path;
+    int ch;
 
     apr_initialize();
     atexit(apr_terminate);
@@ -298,12 +1430,24 @@ int main(int argc, const char *const argv[])
     update_mode = -1;
     verbose = 0;
     upath = NULL;
+    attach_store.dir = NULL;
+    attach_store.min_size = MBOX_ATTACH_MIN_SIZE;
+    prerender_uri = NULL;
+    prerender_flags = 0;
+    prerender_antispam = 1;
+    msgid_index = NULL;
+    export_dir = NULL;
+    export_url = NULL;
+    export_jobs = 1;
+    memset(&export_cfg, 0, sizeof(export_cfg));
+    export_cfg.exported = 1;
 
     r.server = &s;
     s.limit_req_fieldsize = DEFAULT_LIMIT_REQUEST_FIELDSIZE;
     s.limit_req_fields = DEFAULT_LIMIT_REQUEST_FIELDS;
 
     apr_pool_create(&r.pool, NULL);
+    mbox_cte_xlate_cache_init(r.pool);
 
     if (argc) {
         shortname = apr_filepath_name_get(argv[0]);
@@ -326,7 +1470,7 @@ int main(int argc, const char *const argv[])
     }
 
     while ((rv =
-            apr_getopt(opt, "vc::u::s::m::", &ch, &optarg)) == APR_SUCCESS) {
+            apr_getopt_long(opt, options, &ch, &optarg)) == APR_SUCCESS) {
         switch (ch) {
         case 'v':
             if (verbose) {
@@ -368,6 +1512,113 @@ int main(int argc, const char *const argv[])
             update_mode = 2;
             upath = apr_pstrdup(r.pool, optarg);
             break;
+        case 'a':
+            {
+                char *dir;
+                /* Resolved now, as we change directory later on. */
+                rv = apr_filepath_merge(&dir, NULL, optarg, 0, r.pool);
+                if (rv != APR_SUCCESS) {
+                    apr_file_printf(errfile,
+                                    "Error: Unable to resolve path: %s" NL,
+                                    apr_strerror(rv, errbuf, sizeof(errbuf)));
+                    return EXIT_FAILURE;
+                }
+                attach_store.dir = dir;
+            }
+            break;
+        case 't':
+            {
+                char *end;
+                apr_int64_t size = apr_strtoi64(optarg, &end, 10);
+                if (*end || size < 0) {
+                    apr_file_printf(errfile,
+                                    "Error: -t takes a size in bytes" NL NL);
+                    usage();
+                    return EXIT_FAILURE;
+                }
+                attach_store.min_size = (apr_size_t) size;
+            }
+            break;
+        case 'p':
+            {
+                /* The views link to URI/YYYYMM.mbox/... */
+                char *uri = apr_pstrdup(r.pool, optarg);
+                apr_size_t len = strlen(uri);
+                while (len && uri[len - 1] == '/') {
+                    uri[--len] = '\0';
+                }
+                prerender_uri = uri;
+            }
+            break;
+        case 'z':
+            prerender_flags |= MBOX_FRAG_GZIP;
+            break;
+        case 's':
+            search_index = 1;
+            break;
+        case 'g':
+            rv = apr_filepath_merge(&path, NULL, optarg, 0, r.pool);
+            if (rv != APR_SUCCESS) {
+                apr_file_printf(errfile,
+                                "Error: Unable to resolve path: %s" NL,
+                                apr_strerror(rv, errbuf, sizeof(errbuf)));
+                return EXIT_FAILURE;
+            }
+            msgid_index = path;
+            break;
+        case 'n':
+            prerender_antispam = 0;
+            break;
+        case 'e':
+            rv = apr_filepath_merge(&path, NULL, optarg, 0, r.pool);
+            if (rv != APR_SUCCESS) {
+                apr_file_printf(errfile,
+                                "Error: Unable to resolve path: %s" NL,
+                                apr_strerror(rv, errbuf, sizeof(errbuf)));
+                return EXIT_FAILURE;
+            }
+            export_dir = path;
+            break;
+        case 'b':
+            export_url = optarg;
+            break;
+        case 'j':
+            export_jobs = atoi(optarg);
+            if (export_jobs < 1) {
+                apr_file_printf(errfile,
+                                "Error: -j takes a number of months" NL NL);
+                usage();
+                return EXIT_FAILURE;
+            }
+            break;
+        case OPT_ROOT_PATH:
+            export_cfg.root_path = optarg;
+            break;
+        case OPT_STYLE:
+            export_cfg.style_path = optarg;
+            break;
+        case OPT_SCRIPT:
+            export_cfg.script_path = optarg;
+            break;
+        case OPT_HEADER_INCLUDE:
+        case OPT_FOOTER_INCLUDE:
+            rv = apr_filepath_merge(&path, NULL, optarg, 0, r.pool);
+            if (rv != APR_SUCCESS) {
+                apr_file_printf(errfile,
+                                "Error: Unable to resolve path: %s" NL,
+                                apr_strerror(rv, errbuf, sizeof(errbuf)));
+                return EXIT_FAILURE;
+            }
+            if (ch == OPT_HEADER_INCLUDE) {
+                export_cfg.header_include_file = path;
+            }
+            else {
+                export_cfg.footer_include_file = path;
+            }
+            break;
+        case OPT_HIDE_EMPTY:
+            export_cfg.hide_empty = 1;
+            break;
         }
     }
 
@@ -377,6 +1628,18 @@ int main(int argc, const char *const argv[])
         return EXIT_FAILURE;
     }
 
+    if (export_dir && (!export_url || update_mode == 2)) {
+        apr_file_printf(errfile, "Error: -e needs -b, and -u or -c" NL NL);
+        usage();
+        return EXIT_FAILURE;
+    }
+    if (msgid_index && (!export_url || update_mode == 2)) {
+        apr_file_printf(errfile, "Error: -g needs -b, and -u or -c" NL NL);
+        usage();
+        return EXIT_FAILURE;
+    }
+    export_cfg.antispam = prerender_antispam;
+
     if (update_mode == -1) {
         apr_file_printf(errfile, "Error: -u, -c, or -m must be passed" NL NL);
         usage();
@@ -415,6 +1678,9 @@ int main(int argc, const char *const argv[])
         }
 
         rv = scan_dir(&r);
+        if (rv == APR_SUCCESS && export_dir) {
+            rv = export_list(&r);
+        }
     }
     else {
         r.filename = (char *) upath;
@@ -51,12 +51,33 @@ typedef struct {
     const char *base_name;
 } mbox_req_cfg_t;
 
+/* Per-child initialisation.
+ */
+static void mbox_child_init(apr_pool_t *p, server_rec *s)
+{
+    apr_status_t rv = mbox_cte_xlate_cache_init(p);
+
+    if (rv != APR_SUCCESS) {
+        ap_log_error(APLOG_MARK, APLOG_WARNING, rv, s,
+                     "mod_mbox: could not set up the charset converter cache");
+    }
+
+    mbox_msgcache_child_init(p, s);
+    mbox_msgid_child_init(p, s);
+    mbox_search_child_init(p, s);
+    mbox_stats_child_init(p, s);
+}
+
 /* Register module hooks.
  */
 static void mbox_register_hooks(apr_pool_t *p)
 {
+    ap_hook_child_init(mbox_child_init, NULL, NULL, APR_HOOK_MIDDLE);
     ap_hook_handler(mbox_file_handler, NULL, NULL, APR_HOOK_MIDDLE);
     ap_hook_handler(mbox_index_handler, NULL, NULL, APR_HOOK_FIRST);
+    ap_hook_handler(mbox_msgid_handler, NULL, NULL, APR_HOOK_MIDDLE);
+    mbox_msgcache_register_hooks(p);
+    mbox_search_register_hooks(p);
 }
 
 /* Module configuration management.
@@ -75,6 +96,9 @@ static void *mbox_create_dir_config(apr_pool_t *p, char *x)
     conf->script_path = NULL;
     conf->header_include_file = NULL;
     conf->footer_include_file = NULL;
+    conf->attach_store = NULL;
+    conf->page_store = NULL;
+    conf->msgid_index = NULL;
 
     return conf;
 }
@@ -121,100 +145,13 @@ static void *mbox_merge_dir_config(apr_pool_t *p, void *basev, void *addv)
     MBOX_CONFIG_MERGE_STRING(merge, to, from, script_path);
     MBOX_CONFIG_MERGE_STRING(merge, to, from, header_include_file );
     MBOX_CONFIG_MERGE_STRING(merge, to, from, footer_include_file );
+    MBOX_CONFIG_MERGE_STRING(merge, to, from, attach_store);
+    MBOX_CONFIG_MERGE_STRING(merge, to, from, page_store);
+    MBOX_CONFIG_MERGE_STRING(merge, to, from, msgid_index);
 
     return to;
 }
 
-/* Wrap text to MBOX_WRAP_TO. Changes passed string. */
-char *mbox_wrap_text(char *str)
-{
-    int i, pos;
-    apr_size_t len;
-
-    if (!str)
-        return NULL;
-
-    len = strlen(str);
-
-    /* Don't wrap messages with a size larger than MBOX_MAX_WRAP or
-       smaller than a line length. */
-    if ((len < MBOX_WRAP_TO) || (len > MBOX_MAX_WRAP))
-        return str;
-
-    for (i = 0, pos = 0; i < len; i++, pos++) {
-        /* Reset the position counter if we pass a newline character */
-        if (str[i] == '\n') {
-            pos = 0;
-        }
-
-        /* If the position counter is after the wrap limit, wrap text at
-           first space available */
-        if ((pos >= MBOX_WRAP_TO) && ((str[i] == ' ') || (str[i] == '\t'))) {
-            str[i] = '\n';
-            pos = 0;
-        }
-    }
-
-    return str;
-}
-
-/* Escape control chars */
-char *mbox_cntrl_escape(apr_pool_t *p, char *s)
-{
-    int i, j;
-    char *x;
-
-    /* first, count the number of extra characters */
-    for (i = 0, j = 0; s[i] != '\0'; i++)
-        if (apr_iscntrl(s[i]))
-            j += 5;
-
-    if (j == 0)
-        return s;
-
-    x = apr_palloc(p, i + j + 1);
-    for (i = 0, j = 0; s[i] != '\0'; i++, j++) {
-        if (apr_iscntrl(s[i])) {
-            snprintf(&x[j], 7, "&#%3.3d;", (unsigned char)s[i]);
-            j += 5;
-        }
-        else
-            x[j] = s[i];
-    }
-
-    x[j] = '\0';
-    return x;
-}
-
-/* Escape chars in msg ids which are have special meaning in URIs */
-char *mbox_msg_id_escape(apr_pool_t *p, char *s)
-{
-    int i, j;
-    char *x;
-
-    /* first, count the number of extra characters */
-    for (i = 0, j = 0; s[i] != '\0'; i++)
-        if (s[i] == '&')
-            /* Length of "%26" minus 1 (original character "&") */
-            j += 2;
-
-    if (j == 0)
-        return s;
-
-    x = apr_palloc(p, i + j + 1);
-    for (i = 0, j = 0; s[i] != '\0'; i++, j++) {
-        if (s[i] == '&') {
-            strncpy(&x[j], "%26", 3);
-            j += 2;
-        }
-        else
-            x[j] = s[i];
-    }
-
-    x[j] = '\0';
-    return x;
-}
-
 static mbox_req_cfg_t *get_req_conf(request_rec *r)
 {
     mbox_req_cfg_t *conf = ap_get_module_config(r->request_config, &mbox_module);
@@ -269,58 +206,44 @@ char *resolve_rel_path(request_rec *r, const char *rel_path) {
                        NULL);
 }
 
-apr_status_t open_for_sendfile(request_rec *r, const char *fname,
-                               apr_file_t **file, apr_finfo_t *finfo) {
-    apr_finfo_t finfo_tmp;
-    RETURN_NOT_SUCCESS(apr_stat(&finfo_tmp, fname, APR_FINFO_SIZE, r->pool));
-    RETURN_NOT_SUCCESS(apr_file_open(file, fname,
-                                     APR_FOPEN_READ|APR_FOPEN_SENDFILE_ENABLED,
-                                     APR_OS_DEFAULT, r->pool));
-    *finfo = finfo_tmp;
-    return APR_SUCCESS;
-}
-
-// sendfile() the given filename to the remote.
-// TODO: Add support for caching the fd instead of opening it every time.
-apr_status_t mbox_send_include_file(request_rec *r, const char* include_fname) {
-    const char *include_fname_abs = resolve_rel_path(r, include_fname);
-    apr_file_t* file = NULL;
-    apr_finfo_t finfo;
-    LOG_RETURN_NOT_SUCCESS(open_for_sendfile(r, include_fname_abs,
-                                              &file, &finfo),
-                            APLOG_WARNING, r,
-                            "open_for_sendfile", include_fname_abs);
-    apr_size_t bytes_sent = 0;
-    LOG_RETURN_NOT_SUCCESS(ap_send_fd(file, r, 0, finfo.size, &bytes_sent),
-                            APLOG_WARNING, r,
-                            "ap_send_fd", finfo.name);
-    return apr_file_close(file);
-}
+/* Parses a date of the arguments of a request */
+apr_status_t mbox_arg_date(apr_time_t *t, const char *s)
+{
+    apr_time_exp_t tm;
+    int year, month = 1, day = 1, n;
 
-apr_status_t mbox_send_header_includes(request_rec *r, mbox_dir_cfg_t *conf) {
-    if (conf->header_include_file) {
-        RETURN_NOT_SUCCESS(mbox_send_include_file(r, conf->header_include_file));
+    if (strspn(s, "0123456789-") != strlen(s)) {
+        return APR_EINVAL;
     }
-
-    if (conf->style_path) {
-        ap_rprintf(r,
-                   "  <link rel=\"stylesheet\" type=\"text/css\" href=\"%s\" />\n",
-                   conf->style_path);
+    n = sscanf(s, "%d-%d-%d", &year, &month, &day);
+    if (n < 1 || year < 1970 || year > 9999 || month < 1 || month > 12
+        || day < 1 || day > 31) {
+        return APR_EINVAL;
     }
-    return APR_SUCCESS;
-}
 
-apr_status_t mbox_send_footer_includes(request_rec *r, mbox_dir_cfg_t *conf) {
-    if (conf->footer_include_file) {
-        RETURN_NOT_SUCCESS(mbox_send_include_file(r, conf->footer_include_file));
-    }
+    memset(&tm, 0, sizeof(tm));
+    tm.tm_year = year - 1900;
+    tm.tm_mon = month - 1;
+    tm.tm_mday = day;
+    return apr_time_exp_gmt_get(t, &tm);
+}
 
-    if (conf->script_path) {
-        ap_rprintf(r,
-                   "  <script type=\"text/javascript\" src=\"%s\"></script>\n",
-                   conf->script_path);
-    }
-    return APR_SUCCESS;
+/* The settings of the pages served for r */
+void mbox_page_cfg_init_request(mbox_page_cfg_t *cfg, request_rec *r)
+{
+    mbox_dir_cfg_t *conf = ap_get_module_config(r->per_dir_config,
+                                                &mbox_module);
+
+    cfg->antispam = conf->antispam;
+    cfg->hide_empty = conf->hide_empty;
+    cfg->root_path = conf->root_path;
+    cfg->style_path = conf->style_path;
+    cfg->script_path = conf->script_path;
+    cfg->header_include_file = conf->header_include_file ?
+        resolve_rel_path(r, conf->header_include_file) : NULL;
+    cfg->footer_include_file = conf->footer_include_file ?
+        resolve_rel_path(r, conf->footer_include_file) : NULL;
+    cfg->exported = 0;
 }
 
 static const command_rec mbox_cmds[] = {
@@ -356,6 +279,29 @@ static const command_rec mbox_cmds[] = {
                  OR_INDEXES,
                  "Path to a file that will be included verbatim at the end of "
                  "the <body> of every HTML document."),
+    AP_INIT_TAKE1("mboxattachmentstore", ap_set_string_slot,
+                 (void *) APR_OFFSETOF(mbox_dir_cfg_t, attach_store),
+                 OR_INDEXES,
+                 "Path to the attachment store written by mod-mbox-util -a, "
+                 "from which large attachments are served."),
+    AP_INIT_TAKE1("mboxpagestore", ap_set_string_slot,
+                 (void *) APR_OFFSETOF(mbox_dir_cfg_t, page_store),
+                 OR_INDEXES,
+                 "Path to a directory the server can write to, where the "
+                 "message lists of past months are kept compressed."),
+    AP_INIT_TAKE1("mboxmsgidindex", ap_set_string_slot,
+                 (void *) APR_OFFSETOF(mbox_dir_cfg_t, msgid_index),
+                 OR_INDEXES,
+                 "Path to the site-wide Message-ID index written by "
+                 "mod-mbox-util -g, for mbox-msgid-handler."),
+    AP_INIT_TAKE1("mboxmessagecache", mbox_msgcache_set_size, NULL,
+                  RSRC_CONF,
+                  "Size in bytes (or with a K, M or G suffix) of the cache "
+                  "of rendered messages kept by each process; 0 disables it."),
+    AP_INIT_TAKE1("mboxsearchthreads", mbox_search_set_threads, NULL,
+                  RSRC_CONF,
+                  "Number of threads of each process searching the lists of "
+                  "a directory at once; 0 searches them one after the other."),
     {NULL}
 };
 
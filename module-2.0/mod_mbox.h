@@ -24,7 +24,6 @@
 #include "http_protocol.h"
 #include "http_request.h"
 #include "util_script.h"
-#include "util_varbuf.h"
 
 #include "apr_date.h"
 #include "apr_lib.h"
@@ -37,9 +36,23 @@
 #include <stdio.h>
 #include <ctype.h>
 
+#include "mbox_author.h"
 #include "mbox_cache.h"
+#include "mbox_column.h"
+#include "mbox_cte.h"
+#include "mbox_escape.h"
+#include "mbox_frag.h"
+#include "mbox_fts.h"
+#include "mbox_mime.h"
+#include "mbox_msgid.h"
+#include "mbox_page.h"
 #include "mbox_parse.h"
+#include "mbox_render.h"
+#include "mbox_subject.h"
 #include "mbox_thread.h"
+#include "mbox_utf8.h"
+#include "mbox_variant.h"
+#include "mbox_view.h"
 
 #ifndef MOD_MBOX_H
 #define MOD_MBOX_H
@@ -51,25 +64,13 @@ extern "C"
 
 #define MBOX_HANDLER "mbox-handler"
 #define MBOX_MAGIC_TYPE "mbox-file"
-
-#define DEFAULT_MSGS_PER_PAGE 100
-#define DEFAULT_THREADS_PER_PAGE 40
+#define MBOX_MSGID_HANDLER "mbox-msgid-handler"
 
 #define MBOX_PREV 0
 #define MBOX_NEXT 1
 #define MBOX_PREV_THREAD 2
 #define MBOX_NEXT_THREAD 3
 
-#define MBOX_OUTPUT_STATIC 0
-#define MBOX_OUTPUT_AJAX   1
-
-#define MBOX_WRAP_TO 90
-#define MBOX_MAX_WRAP 50000
-
-#define MBOX_ATOM_NUM_ENTRIES 40
-
-#define MBOX_FETCH_ERROR_STR "An error occured while fetching this message, sorry !"
-
 typedef struct mbox_dir_cfg
 {
     int enabled;
@@ -80,14 +81,11 @@ typedef struct mbox_dir_cfg
     const char *script_path;
     const char *header_include_file;
     const char *footer_include_file;
+    const char *attach_store;
+    const char *page_store;
+    const char *msgid_index;
 } mbox_dir_cfg_t;
 
-typedef struct mbox_file
-{
-    char *filename;
-    int count;
-} mbox_file_t;
-
 /* Declare ourselves so the configuration routines can find and know us.
 * We'll fill it in at the end of the module.
 */
@@ -96,8 +94,16 @@ extern module mbox_module;
 /* Handlers */
 int mbox_atom_handler(request_rec *r, mbox_cache_info *mli);
 int mbox_sitemap_handler(request_rec *r, mbox_cache_info *mli);
+int mbox_search_handler(request_rec *r, mbox_cache_info *mli);
+int mbox_subjects_handler(request_rec *r, mbox_cache_info *mli);
+int mbox_filter_handler(request_rec *r, mbox_cache_info *mli);
+int mbox_author_handler(request_rec *r, mbox_cache_info *mli);
+int mbox_range_handler(request_rec *r, mbox_cache_info *mli);
+int mbox_stats_handler(request_rec *r, mbox_cache_info *mli);
+int mbox_site_search_handler(request_rec *r);
 int mbox_file_handler(request_rec *r);
 int mbox_index_handler(request_rec *r);
+int mbox_msgid_handler(request_rec *r);
 
 /* Output functions */
 apr_status_t mbox_xml_msglist(request_rec *r, apr_file_t *f,
@@ -105,12 +111,6 @@ apr_status_t mbox_xml_msglist(request_rec *r, apr_file_t *f,
 apr_status_t mbox_static_msglist(request_rec *r, apr_file_t *f,
                                  int sortFlags);
 apr_status_t mbox_xml_boxlist(request_rec *r);
-apr_status_t mbox_static_boxlist(request_rec *r);
-apr_status_t mbox_static_index_boxlist(request_rec *r,
-                                       mbox_dir_cfg_t *conf,
-                                       mbox_cache_info *mli);
-
-void mbox_atom_entries(request_rec *r, mbox_cache_info *mli);
 
 apr_status_t mbox_ajax_browser(request_rec *r);
 
@@ -118,36 +118,61 @@ int mbox_raw_message(request_rec *r, apr_file_t *f);
 int mbox_static_message(request_rec *r, apr_file_t *f);
 apr_status_t mbox_xml_message(request_rec *r, apr_file_t *f);
 
-/* CTE decoding functions */
-const char *mbox_cte_to_char(mbox_cte_e cte);
-apr_size_t mbox_cte_decode_qp(char *p);
-apr_size_t mbox_cte_decode_b64(char *src);
-apr_size_t mbox_cte_escape_html(apr_pool_t *p, const char *s,
-                                apr_size_t len, char **body);
-char *mbox_cte_decode_header(apr_pool_t *p, char *src);
-apr_status_t mbox_cte_convert_to_utf8(apr_pool_t *p, const char *charset,
-                                      const char *src, apr_size_t len,
-                                      struct ap_varbuf *vb);
-
-/* MIME decoding functions */
-mbox_mime_message_t *mbox_mime_decode_multipart(request_rec *r, apr_pool_t *p,
-                                                char *body, char *ct,
-                                                char *charset,
-                                                mbox_cte_e cte,
-                                                char *boundary);
-char *mbox_mime_decode_body(apr_pool_t *p, mbox_cte_e cte, char *body,
-                            apr_size_t len, apr_size_t *ret_len);
-char *mbox_mime_get_body(request_rec *r, apr_pool_t *p, mbox_mime_message_t *m);
-void mbox_mime_display_static_structure(request_rec *r,
-                                        mbox_mime_message_t *m,
-                                        char *link);
+/* MIME functions (the parser itself is in mbox_mime.h, the static
+ * views in mbox_view.h) */
+void mbox_out_init_request(mbox_out_t *out, request_rec *r);
+apr_status_t mbox_mime_send_body(request_rec *r, apr_file_t *f, Message *m,
+                                 int flags);
 void mbox_mime_display_xml_structure(request_rec *r,
                                      mbox_mime_message_t *m, char *link);
 
+/* Message view cache (mod_mbox_msgcache.c) */
+typedef struct mbox_rendered
+{
+    apr_time_t date;
+    const char *subject;
+    const char *data;
+    apr_size_t len;
+} mbox_rendered_t;
+
+typedef struct mbox_capture mbox_capture_t;
+
+/* Returns the cache key of a message view, or NULL if the cache is off
+ * or the index cannot be versioned.  kind tells views apart.
+ */
+const char *mbox_msgcache_key(request_rec *r, const char *kind,
+                              const char *msgID);
+/* Copies the cached view for key in *page, and returns 1, if there is
+ * one.
+ */
+int mbox_msgcache_get(request_rec *r, const char *key, mbox_rendered_t *page);
+void mbox_msgcache_put(request_rec *r, const char *key,
+                       const mbox_rendered_t *page);
+/* Captures what is sent to the client from now on, up to the size a
+ * cache entry can have; mbox_msgcache_captured() stops and returns it,
+ * or NULL if it got too big.
+ */
+mbox_capture_t *mbox_msgcache_capture(request_rec *r);
+const char *mbox_msgcache_captured(request_rec *r, mbox_capture_t *cap,
+                                   apr_size_t *len);
+const char *mbox_msgcache_set_size(cmd_parms *cmd, void *dummy,
+                                   const char *arg);
+void mbox_msgcache_child_init(apr_pool_t *p, server_rec *s);
+void mbox_msgcache_register_hooks(apr_pool_t *p);
+
+/* Site-wide Message-ID index (mod_mbox_msgid.c) */
+void mbox_msgid_child_init(apr_pool_t *p, server_rec *s);
+
+/* Statistics of the lists (mod_mbox_stats.c) */
+void mbox_stats_child_init(apr_pool_t *p, server_rec *s);
+
+/* Search across lists (mod_mbox_search.c) */
+const char *mbox_search_set_threads(cmd_parms *cmd, void *dummy,
+                                    const char *arg);
+void mbox_search_child_init(apr_pool_t *p, server_rec *s);
+void mbox_search_register_hooks(apr_pool_t *p);
+
 /* Utility functions */
-char *mbox_wrap_text(char *str);
-char *mbox_cntrl_escape(apr_pool_t *p, char *s);
-char *mbox_msg_id_escape(apr_pool_t *p, char *s);
 const char *get_base_path(request_rec *r);
 const char *get_base_uri(request_rec *r);
 const char *get_base_name(request_rec *r);
@@ -155,21 +180,11 @@ const char *get_base_name(request_rec *r);
 /* Returns an absolute file path, given one relative to the document root. */
 char *resolve_rel_path(request_rec *r, const char *rel_path);
 
-/* Open the file at the given path for purposes of sendfiling it later.
-   On success, file and finfo will be set. */
-apr_status_t open_for_sendfile(request_rec *r, const char *fname,
-                               apr_file_t **file, apr_finfo_t *finfo);
-
-/* XXX This should enforce that the result is valid UTF-8 */
-#define ESCAPE_OR_BLANK(pool, s) \
-(s ? mbox_cntrl_escape(pool, ap_escape_html(pool, s)) : "")
+/* Parses a date given as YYYY, YYYY-MM or YYYY-MM-DD, in GMT. */
+apr_status_t mbox_arg_date(apr_time_t *t, const char *s);
 
-/* XXX This should enforce that the result is valid UTF-8 */
-#define ESCAPE_AND_CONV_HDR(pool, s) \
-(s ? mbox_cntrl_escape(pool, ap_escape_html(pool, mbox_cte_decode_header(pool, s))) : "")
-
-#define MSG_ID_ESCAPE_OR_BLANK(pool, s) \
-(s ? mbox_msg_id_escape(pool, ap_escape_uri(pool, s)) : "")
+/* Page settings (see mbox_page.h) from the configuration of r */
+void mbox_page_cfg_init_request(mbox_page_cfg_t *cfg, request_rec *r);
 
 /* Returns the return code if it does not equal APR_SUCCESS. */
 #define RETURN_NOT_SUCCESS(rc) \
@@ -205,13 +220,12 @@ apr_status_t open_for_sendfile(request_rec *r, const char *fname,
 apr_array_header_t *mbox_fetch_boxes_list(request_rec *r,
                                           mbox_cache_info *mli,
                                           char *path);
+Message *fetch_message_info(request_rec *r, apr_file_t *f, char *msgID);
 Message *fetch_message(request_rec *r, apr_file_t *f, char *msgID);
 char **fetch_context_msgids(request_rec *r, apr_file_t *f, char *msgID);
 
-void load_message(apr_pool_t *p, apr_file_t *f, Message *m);
-
-apr_status_t mbox_send_header_includes(request_rec *r, mbox_dir_cfg_t *conf);
-apr_status_t mbox_send_footer_includes(request_rec *r, mbox_dir_cfg_t *conf);
+char *fetch_message_span(apr_pool_t *p, apr_file_t *f, apr_off_t offset,
+                         apr_size_t len);
 
 #ifdef __cplusplus
 }
@@ -20,10 +20,9 @@
 APLOG_USE_MODULE(mbox);
 #endif
 
-/* Fetch a message from mailbox */
-Message *fetch_message(request_rec *r, apr_file_t *f, char *msgID)
+/* Fetch a message from the index, without reading it from the mailbox */
+Message *fetch_message_info(request_rec *r, apr_file_t *f, char *msgID)
 {
-    apr_size_t len = 0;
     Message *m;
 
     /* Fetch message from mbox backend */
@@ -35,6 +34,20 @@ Message *fetch_message(request_rec *r, apr_file_t *f, char *msgID)
     r->mtime = m->date;
     ap_set_last_modified(r);
 
+    return m;
+}
+
+/* Fetch a message from mailbox */
+Message *fetch_message(request_rec *r, apr_file_t *f, char *msgID)
+{
+    apr_size_t len = 0;
+    Message *m;
+
+    m = fetch_message_info(r, f, msgID);
+    if (!m) {
+        return NULL;
+    }
+
     /* Fetch message (from msg_start to body_end) */
     if (apr_file_seek(f, APR_SET, &m->msg_start) != APR_SUCCESS) {
         return NULL;
@@ -63,126 +76,23 @@ Message *fetch_message(request_rec *r, apr_file_t *f, char *msgID)
     return m;
 }
 
-/* Fetch a message from mailbox */
-void load_message(apr_pool_t *p, apr_file_t *f, Message *m)
+/* Read len bytes at offset from mailbox, NUL-terminated */
+char *fetch_message_span(apr_pool_t *p, apr_file_t *f, apr_off_t offset,
+                         apr_size_t len)
 {
-    apr_size_t len;
-
-    /* Fetch message (from msg_start to body_end) */
-    if (apr_file_seek(f, APR_SET, &m->msg_start) != APR_SUCCESS) {
-        return;
-    }
+    char *buf;
 
-    len = m->body_end - m->msg_start;
-    m->raw_msg = apr_palloc(p, len + 1);
-
-    if (apr_file_read_full(f, m->raw_msg, len, &len) != APR_SUCCESS) {
-        return;
-    }
-
-    m->raw_msg[len] = '\0';
-    m->raw_body = m->raw_msg + (m->body_start - m->msg_start);
-}
-
-/* Find thread starting with message 'msgID' in container 'c' */
-static Container *find_thread(request_rec *r, char *msgID, Container *c)
-{
-    Container *next = NULL;
-
-    if (c->message && strcmp(msgID, c->message->msgID) == 0)
-        return c;
-
-    if (c->child)
-        next = find_thread(r, msgID, c->child);
-
-    if (!next && c->next)
-        next = find_thread(r, msgID, c->next);
-
-    return next;
-}
-
-static Container *find_prev_thread(request_rec *r, char *msgID,
-                                   Container *c)
-{
-    Container *next = NULL;
-
-    /* Don't go any further */
-    if (c->message && strcmp(msgID, c->message->msgID) == 0)
+    if (apr_file_seek(f, APR_SET, &offset) != APR_SUCCESS) {
         return NULL;
-
-    if (c->child) {
-        next = (!strcmp(msgID, c->child->message->msgID) ? c :
-                find_prev_thread(r, msgID, c->child));
     }
 
-    if (!next && c->next) {
-        /* Root set potentially does not have message */
-        if (c->next->message && strcmp(msgID, c->next->message->msgID) == 0) {
-            if (c->message) {
-                next = c;
-            }
-            else {
-                next = c->child;
-            }
-        }
-        else {
-            /* Message did not match. */
-            if (!c->next->message && c->next->child &&
-                strcmp(msgID, c->next->child->message->msgID) == 0) {
-                if (c->message) {
-                    next = c;
-                }
-                else {
-                    next = c->child;
-                }
-            }
-            else {
-                next = find_prev_thread(r, msgID, c->next);
-            }
-        }
-    }
-
-    return next;
-}
-
-static Container *find_next_thread(request_rec *r, char *msgID,
-                                   Container *c)
-{
-    c = find_thread(r, msgID, c);
-
-    if (!c)
+    buf = apr_palloc(p, len + 1);
+    if (apr_file_read_full(f, buf, len, &len) != APR_SUCCESS) {
         return NULL;
-
-    if (c->child)
-        return c->child;
-
-    /* Root elements don't have parents */
-    if (c->next && c->parent)
-        return c->next;
-
-    /* We are at the end of this level, so let's go up levels until we
-       find a next message. */
-    while (c->parent) {
-        c = c->parent;
-
-        /* This node must have a parent as well, otherwise we need to
-         * enter the root node checks below.
-         */
-        if (c->next && c->parent)
-            return c->next;
-    }
-
-    /* Allow skipping to non-related root nodes.  This makes for a
-       better browsing experience.  However, if a root node doesn't
-       have a message, we need to return its first child. */
-    if (c->next) {
-        if (c->next->message)
-            return c->next;
-
-        return c->next->child;
     }
 
-    return NULL;
+    buf[len] = '\0';
+    return buf;
 }
 
 /* Return an array of 4 strings : the prev, next, prev by thread an
@@ -219,13 +129,13 @@ char **fetch_context_msgids(request_rec *r, apr_file_t *f, char *msgID)
 
     /* And the MBOX_PREV_THREAD and MBOX_NEXT_THREAD ones */
     if (threads) {
-        c = find_prev_thread(r, msgID, threads);
+        c = mbox_thread_prev(threads, msgID);
 
         if (c && c->message) {
             context[2] = c->message->msgID;
         }
 
-        c = find_next_thread(r, msgID, threads);
+        c = mbox_thread_next(threads, msgID);
         if (c && c->message) {
             context[3] = c->message->msgID;
         }
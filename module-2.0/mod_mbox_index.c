@@ -26,21 +26,6 @@ APLOG_USE_MODULE(mbox);
 #endif
 
 
-/* Compare two file entries (in reverse order).
- *
- * This function is only Used when sorting file list to :
- *  200501
- *  200412
- *  200411
- */
-static int filename_rsort(const void *fn1, const void *fn2)
-{
-    mbox_file_t *f1 = (mbox_file_t *) fn1;
-    mbox_file_t *f2 = (mbox_file_t *) fn2;
-
-    return strcmp(f2->filename, f1->filename);
-}
-
 /* Fetches the .mbox files from the directory and return a chained
  * list of mbox_files_t containing all the information we need to
  * output a complete box listing.
@@ -48,51 +33,19 @@ static int filename_rsort(const void *fn1, const void *fn2)
 apr_array_header_t *mbox_fetch_boxes_list(request_rec *r,
                                           mbox_cache_info *mli, char *path)
 {
-    apr_status_t rv = APR_SUCCESS;
-    apr_finfo_t finfo;
-    apr_dir_t *dir;
-    mbox_file_t *fi;
     apr_array_header_t *files;
+    apr_status_t rv;
 
-    rv = apr_dir_open(&dir, path, r->pool);
+    rv = mbox_boxes_list(&files, r->pool, mli, path);
 
     /* If we couldn't open the directory, something like file
        permissions are stopping us. */
-    if (rv != APR_SUCCESS) {
+    if (rv != APR_SUCCESS && rv != APR_NOTFOUND) {
         ap_log_rerror(APLOG_MARK, APLOG_ERR, rv, r,
                       "mod_mbox(fetch_boxes_list): Failed to open directory '%s' for index",
                       path);
-        return NULL;
-    }
-
-    if (!mli) {
-        return NULL;
     }
 
-    /* 15 Years of Mail Archives */
-    files = apr_array_make(r->pool, 15 * 12, sizeof(mbox_file_t));
-
-    /* Foreach file in the directory, add its name and the message
-       count to our array */
-    while (apr_dir_read(&finfo, APR_FINFO_NAME, dir) == APR_SUCCESS) {
-        if ((apr_fnmatch("*.mbox", finfo.name, 0) == APR_SUCCESS) &&
-            (ap_strstr_c(finfo.name, "incomplete") == NULL)) {
-            fi = (mbox_file_t *) apr_array_push(files);
-            fi->filename = apr_pstrdup(r->pool, finfo.name);
-            mbox_cache_get_count(mli, &(fi->count), (char *) finfo.name);
-        }
-    }
-
-    apr_dir_close(dir);
-
-    if (files->nelts == 0) {
-        return NULL;
-    }
-
-    /* Sort by reverse filename order */
-    qsort((void *) files->elts, files->nelts, sizeof(mbox_file_t),
-          filename_rsort);
-
     return files;
 }
 
@@ -100,10 +53,8 @@ apr_array_header_t *mbox_fetch_boxes_list(request_rec *r,
 int mbox_atom_handler(request_rec  *r, mbox_cache_info *mli)
 {
     int errstatus;
-    char dstr[100];
-    apr_size_t dlen;
-    char *etag;
-    apr_time_exp_t extime;
+    char *etag, *list_url;
+    mbox_out_t out;
 
     /* Only allow GETs */
     r->allowed |= (AP_METHOD_BIT << M_GET);
@@ -128,24 +79,11 @@ int mbox_atom_handler(request_rec  *r, mbox_cache_info *mli)
         return r->status;
     }
 
-    ap_rputs("<?xml version=\"1.0\" encoding=\"UTF-8\"?>\n", r);
-    ap_rputs("<feed xmlns=\"http://www.w3.org/2005/Atom\">\n", r);
-    ap_rprintf(r, "<title>%s@%s Archives</title>\n",
-               ESCAPE_OR_BLANK(r->pool, mli->list),
-               ESCAPE_OR_BLANK(r->pool, mli->domain));
-    ap_rprintf(r, "<link rel=\"self\" href=\"%s?format=atom\"/>\n",
-               ap_construct_url(r->pool, r->uri, r));
-    ap_rprintf(r, "<link href=\"%s\"/>\n",
-               ap_construct_url(r->pool, r->uri, r));
-    ap_rprintf(r, "<id>%s</id>\n", ap_construct_url(r->pool, r->uri, r));
-
-    apr_time_exp_gmt(&extime, mli->mtime);
-
-    apr_strftime(dstr, &dlen, sizeof(dstr), "%G-%m-%dT%H:%M:%SZ", &extime);
-
-    ap_rprintf(r, "<updated>%s</updated>\n", dstr);
-    mbox_atom_entries(r, mli);
-    ap_rputs("</feed>\n", r);
+    mbox_out_init_request(&out, r);
+    list_url = ap_construct_url(r->pool, r->uri, r);
+    mbox_page_atom(&out, r, mli, mbox_fetch_boxes_list(r, mli, r->filename),
+                   r->filename, list_url,
+                   apr_pstrcat(r->pool, list_url, "?format=atom", NULL));
     return OK;
 }
 
@@ -156,9 +94,11 @@ int mbox_index_handler(request_rec *r)
     apr_status_t rv = APR_SUCCESS;
 
     mbox_dir_cfg_t *conf;
+    mbox_page_cfg_t cfg;
     mbox_cache_info *mli;
+    apr_array_header_t *files;
+    mbox_out_t out;
 
-    char dstr[APR_RFC822_DATE_LEN];
     char *etag;
 
     conf = ap_get_module_config(r->per_dir_config, &mbox_module);
@@ -172,12 +112,42 @@ int mbox_index_handler(request_rec *r)
     /* Open mbox cache */
     rv = mbox_cache_get(&mli, r->filename, r->pool);
     if (rv != APR_SUCCESS) {
+        /* Not a list: the directory of lists has a search of them all. */
+        if (r->path_info && (strcmp(r->path_info, "/search") == 0
+                             || strcmp(r->path_info, "/search/") == 0)) {
+            return mbox_site_search_handler(r);
+        }
         ap_log_rerror(APLOG_MARK, APLOG_DEBUG, rv, r,
                       "mod_mbox: Can't open directory cache '%s' for index",
                       r->filename);
         return DECLINED;
     }
 
+    if (r->path_info && (strcmp(r->path_info, "/search") == 0
+                         || strcmp(r->path_info, "/search/") == 0)) {
+        return mbox_search_handler(r, mli);
+    }
+
+    if (r->path_info && strcmp(r->path_info, "/ajax/subjects") == 0) {
+        return mbox_subjects_handler(r, mli);
+    }
+
+    if (r->path_info && strcmp(r->path_info, "/filter") == 0) {
+        return mbox_filter_handler(r, mli);
+    }
+
+    if (r->path_info && strncmp(r->path_info, "/author/", 8) == 0) {
+        return mbox_author_handler(r, mli);
+    }
+
+    if (r->path_info && strcmp(r->path_info, "/range") == 0) {
+        return mbox_range_handler(r, mli);
+    }
+
+    if (r->path_info && strcmp(r->path_info, "/stats") == 0) {
+        return mbox_stats_handler(r, mli);
+    }
+
     if (r->args && strstr(r->args, "format=atom") != NULL) {
         return mbox_atom_handler(r, mli);
     }
@@ -209,96 +179,22 @@ int mbox_index_handler(request_rec *r)
         return r->status;
     }
 
-    ap_rputs("<!DOCTYPE html>\n", r);
-    ap_rputs("<html>\n", r);
-    ap_rputs(" <head>\n", r);
-    ap_rputs
-        ("  <meta http-equiv=\"Content-Type\" content=\"text/html; charset=utf-8\" />\n",
-         r);
-    if (mli->list && mli->domain) {
-        ap_rprintf(r, "  <title>%s@%s Archives</title>\n",
-                   ESCAPE_OR_BLANK(r->pool, mli->list),
-                   ESCAPE_OR_BLANK(r->pool, mli->domain));
+    files = mbox_fetch_boxes_list(r, mli, r->filename);
+    if (!files) {
+        return HTTP_FORBIDDEN;
     }
-    else {
-        ap_rputs("  <title>Mailing list archives</title>\n", r);
-    }
-
-    ap_rprintf(r, "<link rel=\"alternate\" title=\"%s@%s Archives\" "
-               "type=\"application/atom+xml\" href=\"%s?format=atom\" />\n",
-               ESCAPE_OR_BLANK(r->pool, mli->list),
-               ESCAPE_OR_BLANK(r->pool, mli->domain),
-               ap_construct_url(r->pool, r->uri, r));
-
-    DECLINE_NOT_SUCCESS(mbox_send_header_includes(r, conf));
 
-    ap_rputs(" </head>\n\n", r);
-
-    ap_rputs(" <body id=\"archives\">\n", r);
-    ap_rprintf(r, "  <h1>Mailing list archives: %s@%s</h1>\n",
-               ESCAPE_OR_BLANK(r->pool, mli->list),
-               ESCAPE_OR_BLANK(r->pool, mli->domain));
-
-    if (conf->root_path) {
-        ap_rprintf(r,
-                   "  <h5><a href=\"%s\" title=\"Back to the archives depot\">"
-                   "Site index</a></h5>\n\n", conf->root_path);
-    }
+    mbox_page_cfg_init_request(&cfg, r);
+    mbox_out_init_request(&out, r);
 
-    /* Output header and list information */
-    ap_rputs("  <table id=\"listinfo\">\n", r);
-    ap_rputs
-        ("   <thead><tr><th colspan=\"2\">List information</th></tr></thead>\n",
-         r);
-    ap_rputs("   <tbody>\n", r);
-
-    ap_rprintf(r, "    <tr><td class=\"left\">Writing to the list</td>"
-               "<td class=\"right\">%s@%s</td></tr>\n",
-               ESCAPE_OR_BLANK(r->pool, mli->list),
-               ESCAPE_OR_BLANK(r->pool, mli->domain));
-
-    ap_rprintf(r, "    <tr><td class=\"left\">Subscription address</td>"
-               "<td class=\"right\">%s-subscribe@%s</td></tr>\n",
-               ESCAPE_OR_BLANK(r->pool, mli->list),
-               ESCAPE_OR_BLANK(r->pool, mli->domain));
-
-    ap_rprintf(r,
-               "    <tr><td class=\"left\">Digest subscription address</td>"
-               "<td class=\"right\">%s-digest-subscribe@%s</td></tr>\n",
-               ESCAPE_OR_BLANK(r->pool, mli->list), ESCAPE_OR_BLANK(r->pool,
-                                                                    mli->
-                                                                    domain));
-
-    ap_rprintf(r, "    <tr><td class=\"left\">Unsubscription addresses</td>"
-               "<td class=\"right\">%s-unsubscribe@%s</td></tr>\n",
-               ESCAPE_OR_BLANK(r->pool, mli->list),
-               ESCAPE_OR_BLANK(r->pool, mli->domain));
-
-    ap_rprintf(r, "    <tr><td class=\"left\">Getting help with the list</td>"
-               "<td class=\"right\">%s-help@%s</td></tr>\n",
-               ESCAPE_OR_BLANK(r->pool, mli->list),
-               ESCAPE_OR_BLANK(r->pool, mli->domain));
-
-    ap_rputs("<tr><td class=\"left\">Feeds:</td>"
-             "<td class=\"right\">"
-             "<a href=\"?format=atom\">Atom 1.0</a></td></tr>\n", r);
-
-    ap_rputs("   </tbody>\n", r);
-    ap_rputs("  </table>\n", r);
-
-    /* Display the box list */
-    rv = mbox_static_index_boxlist(r, conf, mli);
+    rv = mbox_page_index(&out, &cfg, mli, files,
+                         ap_construct_url(r->pool, r->uri, r));
     if (rv != APR_SUCCESS) {
-        return rv;
+        ap_log_rerror(APLOG_MARK, APLOG_WARNING, rv, r,
+                      "mod_mbox: Can't include a file in the index of '%s'",
+                      r->filename);
+        return DECLINED;
     }
 
-    apr_rfc822_date(dstr, mli->mtime);
-    ap_rprintf(r, "<p id=\"lastupdated\">Last updated on: %s</p>\n", dstr);
-
-    DECLINE_NOT_SUCCESS(mbox_send_footer_includes(r, conf));
-
-    ap_rputs("  </body>\n", r);
-    ap_rputs("</html>", r);
-
     return OK;
 }
@@ -0,0 +1,384 @@
+/* Licensed to the Apache Software Foundation (ASF) under one or more
+ * contributor license agreements.  See the NOTICE file distributed with
+ * this work for additional information regarding copyright ownership.
+ * The ASF licenses this file to You under the Apache License, Version 2.0
+ * (the "License"); you may not use this file except in compliance with
+ * the License.  You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+/**
+ * Per-process cache of rendered message views.
+ *
+ * A message view only depends on the message index (and on the way it
+ * is reached), so it is kept as rendered, keyed by the index version,
+ * and served again without touching the index or the mailbox.  The
+ * cache is bounded in bytes, and evicts the least recently used views
+ * first.  Views are captured by a filter on their way to the client.
+ */
+
+#include "mod_mbox.h"
+#include "mod_status.h"
+
+#include <stdlib.h>
+
+#ifdef APLOG_USE_MODULE
+APLOG_USE_MODULE(mbox);
+#endif
+
+/* Views bigger than this fraction of the cache are not worth keeping. */
+#define MSGCACHE_MAX_ENTRY(size) ((size) / 8)
+
+typedef struct msgcache_entry
+{
+    struct msgcache_entry *prev, *next;
+    const char *key;
+    apr_size_t klen;
+    apr_size_t size;
+    mbox_rendered_t page;
+} msgcache_entry_t;
+
+typedef struct msgcache
+{
+#if APR_HAS_THREADS
+    apr_thread_mutex_t *mutex;
+#endif
+    apr_hash_t *entries;
+    msgcache_entry_t *head, *tail;      /* Most recently used first */
+    apr_size_t used;
+
+    apr_uint64_t hits;
+    apr_uint64_t misses;
+    apr_uint64_t evictions;
+} msgcache_t;
+
+struct mbox_capture
+{
+    ap_filter_t *f;
+    mbox_varbuf_t vb;
+    int overflow;
+};
+
+static apr_size_t msgcache_size = 0;
+static msgcache_t *msgcache = NULL;
+static ap_filter_rec_t *capture_filter_handle;
+
+#if APR_HAS_THREADS
+#define MSGCACHE_LOCK() apr_thread_mutex_lock(msgcache->mutex)
+#define MSGCACHE_UNLOCK() apr_thread_mutex_unlock(msgcache->mutex)
+#else
+#define MSGCACHE_LOCK()
+#define MSGCACHE_UNLOCK()
+#endif
+
+static void entry_unlink(msgcache_entry_t *e)
+{
+    if (e->prev)
+        e->prev->next = e->next;
+    else
+        msgcache->head = e->next;
+    if (e->next)
+        e->next->prev = e->prev;
+    else
+        msgcache->tail = e->prev;
+    e->prev = e->next = NULL;
+}
+
+static void entry_push(msgcache_entry_t *e)
+{
+    e->prev = NULL;
+    e->next = msgcache->head;
+    if (msgcache->head)
+        msgcache->head->prev = e;
+    else
+        msgcache->tail = e;
+    msgcache->head = e;
+}
+
+static void entry_remove(msgcache_entry_t *e)
+{
+    entry_unlink(e);
+    apr_hash_set(msgcache->entries, e->key, e->klen, NULL);
+    msgcache->used -= e->size;
+    free(e);
+}
+
+const char *mbox_msgcache_key(request_rec *r, const char *kind,
+                              const char *msgID)
+{
+    mbox_dir_cfg_t *conf;
+    apr_finfo_t finfo;
+
+    if (!msgcache)
+        return NULL;
+
+    if (mbox_index_stat(r, &finfo) != APR_SUCCESS)
+        return NULL;
+
+    conf = ap_get_module_config(r->per_dir_config, &mbox_module);
+
+    return apr_psprintf(r->pool, "%s %" APR_TIME_T_FMT " %" APR_OFF_T_FMT
+                        " %d %s\n%s\n%s", kind, finfo.mtime, finfo.size,
+                        conf->antispam, get_base_uri(r), r->filename, msgID);
+}
+
+int mbox_msgcache_get(request_rec *r, const char *key, mbox_rendered_t *page)
+{
+    msgcache_entry_t *e;
+
+    MSGCACHE_LOCK();
+    e = apr_hash_get(msgcache->entries, key, APR_HASH_KEY_STRING);
+    if (!e) {
+        msgcache->misses++;
+        MSGCACHE_UNLOCK();
+        return 0;
+    }
+
+    msgcache->hits++;
+    entry_unlink(e);
+    entry_push(e);
+
+    /* The entry may be evicted as soon as the lock is released. */
+    page->date = e->page.date;
+    page->subject = e->page.subject ? apr_pstrdup(r->pool, e->page.subject)
+                                    : NULL;
+    page->data = apr_pmemdup(r->pool, e->page.data, e->page.len);
+    page->len = e->page.len;
+    MSGCACHE_UNLOCK();
+
+    return 1;
+}
+
+void mbox_msgcache_put(request_rec *r, const char *key,
+                       const mbox_rendered_t *page)
+{
+    msgcache_entry_t *e, *old;
+    apr_size_t klen = strlen(key);
+    apr_size_t slen = page->subject ? strlen(page->subject) + 1 : 0;
+    apr_size_t size = sizeof(*e) + klen + 1 + slen + page->len;
+    char *p;
+
+    if (size > MSGCACHE_MAX_ENTRY(msgcache_size))
+        return;
+
+    e = malloc(size);
+    if (!e) {
+        ap_log_rerror(APLOG_MARK, APLOG_WARNING, APR_ENOMEM, r,
+                      "mod_mbox: could not cache message view");
+        return;
+    }
+
+    p = (char *) (e + 1);
+    e->key = memcpy(p, key, klen + 1);
+    e->klen = klen;
+    e->size = size;
+    p += klen + 1;
+    e->page.date = page->date;
+    e->page.subject = slen ? memcpy(p, page->subject, slen) : NULL;
+    p += slen;
+    e->page.data = memcpy(p, page->data, page->len);
+    e->page.len = page->len;
+
+    MSGCACHE_LOCK();
+    old = apr_hash_get(msgcache->entries, e->key, klen);
+    if (old)
+        entry_remove(old);
+
+    while (msgcache->used + size > msgcache_size && msgcache->tail) {
+        entry_remove(msgcache->tail);
+        msgcache->evictions++;
+    }
+
+    apr_hash_set(msgcache->entries, e->key, klen, e);
+    entry_push(e);
+    msgcache->used += size;
+    MSGCACHE_UNLOCK();
+}
+
+static apr_status_t capture_filter(ap_filter_t *f, apr_bucket_brigade *bb)
+{
+    mbox_capture_t *cap = f->ctx;
+    apr_bucket *b;
+
+    for (b = APR_BRIGADE_FIRST(bb);
+         b != APR_BRIGADE_SENTINEL(bb) && !cap->overflow;
+         b = APR_BUCKET_NEXT(b)) {
+        const char *data;
+        apr_size_t len;
+
+        if (APR_BUCKET_IS_METADATA(b))
+            continue;
+
+        if (apr_bucket_read(b, &data, &len, APR_BLOCK_READ) != APR_SUCCESS
+            || cap->vb.len + len > MSGCACHE_MAX_ENTRY(msgcache_size)) {
+            cap->overflow = 1;
+            break;
+        }
+        mbox_varbuf_strmemcat(&cap->vb, data, len);
+    }
+
+    return ap_pass_brigade(f->next, bb);
+}
+
+/* Pushes whatever ap_rputs() and friends buffered down the filters. */
+static void push_buffered(request_rec *r)
+{
+    apr_bucket_brigade *bb;
+
+    bb = apr_brigade_create(r->pool, r->connection->bucket_alloc);
+    ap_pass_brigade(r->output_filters, bb);
+    apr_brigade_destroy(bb);
+}
+
+mbox_capture_t *mbox_msgcache_capture(request_rec *r)
+{
+    mbox_capture_t *cap = apr_pcalloc(r->pool, sizeof(*cap));
+
+    push_buffered(r);
+
+    mbox_varbuf_init(r->pool, &cap->vb, 8192);
+    cap->f = ap_add_output_filter_handle(capture_filter_handle, cap,
+                                         r, r->connection);
+    return cap;
+}
+
+const char *mbox_msgcache_captured(request_rec *r, mbox_capture_t *cap,
+                                   apr_size_t *len)
+{
+    push_buffered(r);
+    ap_remove_output_filter(cap->f);
+
+    if (cap->overflow)
+        return NULL;
+
+    *len = cap->vb.len;
+    return cap->vb.buf;
+}
+
+static int msgcache_status_hook(request_rec *r, int flags)
+{
+    apr_uint64_t hits, misses, evictions;
+    apr_size_t used;
+    unsigned int count;
+
+    if (!msgcache)
+        return OK;
+
+    MSGCACHE_LOCK();
+    hits = msgcache->hits;
+    misses = msgcache->misses;
+    evictions = msgcache->evictions;
+    used = msgcache->used;
+    count = apr_hash_count(msgcache->entries);
+    MSGCACHE_UNLOCK();
+
+    if (flags & AP_STATUS_SHORT) {
+        ap_rprintf(r, "MboxCacheHits: %" APR_UINT64_T_FMT "\n"
+                   "MboxCacheMisses: %" APR_UINT64_T_FMT "\n"
+                   "MboxCacheEvictions: %" APR_UINT64_T_FMT "\n"
+                   "MboxCacheEntries: %u\n"
+                   "MboxCacheBytes: %" APR_SIZE_T_FMT "\n",
+                   hits, misses, evictions, count, used);
+        return OK;
+    }
+
+    ap_rputs("<hr />\n<h2>mod_mbox message cache (this process)</h2>\n", r);
+    ap_rprintf(r, "<dl><dt>%u views, %" APR_SIZE_T_FMT " of %"
+               APR_SIZE_T_FMT " bytes</dt>\n"
+               "<dt>%" APR_UINT64_T_FMT " hits, %" APR_UINT64_T_FMT
+               " misses (%.1f%% hit ratio), %" APR_UINT64_T_FMT
+               " evictions</dt></dl>\n",
+               count, used, msgcache_size, hits, misses,
+               hits + misses ? 100.0 * hits / (hits + misses) : 0.0,
+               evictions);
+    return OK;
+}
+
+static apr_status_t msgcache_destroy(void *data)
+{
+    while (msgcache->tail) {
+        entry_remove(msgcache->tail);
+    }
+    msgcache = NULL;
+    return APR_SUCCESS;
+}
+
+void mbox_msgcache_child_init(apr_pool_t *p, server_rec *s)
+{
+    msgcache_t *cache;
+
+    if (!msgcache_size)
+        return;
+
+    cache = apr_pcalloc(p, sizeof(*cache));
+    cache->entries = apr_hash_make(p);
+#if APR_HAS_THREADS
+    if (apr_thread_mutex_create(&cache->mutex, APR_THREAD_MUTEX_DEFAULT, p)
+        != APR_SUCCESS) {
+        ap_log_error(APLOG_MARK, APLOG_WARNING, 0, s,
+                     "mod_mbox: could not create the message cache lock");
+        return;
+    }
+#endif
+
+    msgcache = cache;
+    apr_pool_cleanup_register(p, NULL, msgcache_destroy,
+                              apr_pool_cleanup_null);
+}
+
+static int msgcache_pre_config(apr_pool_t *p, apr_pool_t *plog,
+                               apr_pool_t *ptemp)
+{
+    /* The size is that of the configuration being read, not the last. */
+    msgcache_size = 0;
+    return OK;
+}
+
+const char *mbox_msgcache_set_size(cmd_parms *cmd, void *dummy,
+                                   const char *arg)
+{
+    const char *err = ap_check_cmd_context(cmd, GLOBAL_ONLY);
+    apr_off_t size;
+    char *end;
+
+    if (err)
+        return err;
+
+    if (apr_strtoff(&size, arg, &end, 10) != APR_SUCCESS || size < 0)
+        return "MboxMessageCache must be a size in bytes";
+
+    switch (apr_tolower(*end)) {
+    case 'g':
+        size *= 1024;
+        /* Fall through */
+    case 'm':
+        size *= 1024;
+        /* Fall through */
+    case 'k':
+        size *= 1024;
+        end++;
+        break;
+    }
+    if (*end)
+        return "MboxMessageCache must be a size in bytes";
+
+    msgcache_size = (apr_size_t) size;
+    return NULL;
+}
+
+void mbox_msgcache_register_hooks(apr_pool_t *p)
+{
+    ap_hook_pre_config(msgcache_pre_config, NULL, NULL, APR_HOOK_MIDDLE);
+    APR_OPTIONAL_HOOK(ap, status_hook, msgcache_status_hook, NULL, NULL,
+                      APR_HOOK_MIDDLE);
+    capture_filter_handle = ap_register_output_filter("MBOX_CAPTURE",
+                                                      capture_filter, NULL,
+                                                      AP_FTYPE_RESOURCE);
+}
@@ -0,0 +1,222 @@
+/* Licensed to the Apache Software Foundation (ASF) under one or more
+ * contributor license agreements.  See the NOTICE file distributed with
+ * this work for additional information regarding copyright ownership.
+ * The ASF licenses this file to You under the Apache License, Version 2.0
+ * (the "License"); you may not use this file except in compliance with
+ * the License.  You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+/**
+ * Redirects URI/MESSAGE-ID to the message, through the site-wide index
+ * mod-mbox-util -g maintains (see mbox_msgid.h), e.g.:
+ *
+ *   <Location /msgid>
+ *     SetHandler mbox-msgid-handler
+ *     MboxMsgidIndex /var/www/mail/msgid.idx
+ *   </Location>
+ *
+ * Each process keeps the indexes it uses mapped, until they are replaced.
+ */
+
+#include "mod_mbox.h"
+
+#ifdef APLOG_USE_MODULE
+APLOG_USE_MODULE(mbox);
+#endif
+
+typedef struct msgid_mapped
+{
+    apr_pool_t *pool;
+    mbox_msgid_index_t *idx;
+    apr_time_t mtime;
+    apr_off_t size;
+    apr_ino_t inode;
+} msgid_mapped_t;
+
+typedef struct msgid_state
+{
+#if APR_HAS_THREADS
+    apr_thread_mutex_t *mutex;
+#endif
+    apr_pool_t *pool;
+    apr_hash_t *indexes;        /* Of msgid_mapped_t, by path */
+} msgid_state_t;
+
+static msgid_state_t *msgid_state = NULL;
+
+#if APR_HAS_THREADS
+#define MSGID_LOCK() apr_thread_mutex_lock(msgid_state->mutex)
+#define MSGID_UNLOCK() apr_thread_mutex_unlock(msgid_state->mutex)
+#else
+#define MSGID_LOCK()
+#define MSGID_UNLOCK()
+#endif
+
+void mbox_msgid_child_init(apr_pool_t *p, server_rec *s)
+{
+    msgid_state_t *state;
+
+    state = apr_pcalloc(p, sizeof(*state));
+    state->pool = p;
+    state->indexes = apr_hash_make(p);
+#if APR_HAS_THREADS
+    if (apr_thread_mutex_create(&state->mutex, APR_THREAD_MUTEX_DEFAULT, p)
+        != APR_SUCCESS) {
+        ap_log_error(APLOG_MARK, APLOG_WARNING, 0, s,
+                     "mod_mbox: could not create the Message-ID index lock");
+        return;
+    }
+#endif
+
+    msgid_state = state;
+}
+
+/* Returns the index at path, mapped again if it was replaced.  Called
+ * with the lock held.
+ */
+static apr_status_t msgid_get(msgid_mapped_t **mp, request_rec *r,
+                              const char *path)
+{
+    msgid_mapped_t *m;
+    apr_finfo_t finfo;
+    apr_pool_t *pool;
+    mbox_msgid_index_t *idx;
+    apr_status_t rv;
+
+    rv = apr_stat(&finfo, path, APR_FINFO_MTIME | APR_FINFO_SIZE
+                  | APR_FINFO_INODE, r->pool);
+    if (rv != APR_SUCCESS) {
+        return APR_STATUS_IS_ENOENT(rv) ? APR_NOTFOUND : rv;
+    }
+
+    m = apr_hash_get(msgid_state->indexes, path, APR_HASH_KEY_STRING);
+    if (m && m->mtime == finfo.mtime && m->size == finfo.size
+        && m->inode == finfo.inode) {
+        *mp = m;
+        return APR_SUCCESS;
+    }
+
+    apr_pool_create(&pool, msgid_state->pool);
+    rv = mbox_msgid_index_open(&idx, pool, path);
+    if (rv != APR_SUCCESS) {
+        apr_pool_destroy(pool);
+        return rv;
+    }
+
+    if (m) {
+        apr_pool_destroy(m->pool);
+    }
+    else {
+        m = apr_palloc(msgid_state->pool, sizeof(*m));
+        apr_hash_set(msgid_state->indexes,
+                     apr_pstrdup(msgid_state->pool, path),
+                     APR_HASH_KEY_STRING, m);
+    }
+    m->pool = pool;
+    m->idx = idx;
+    m->mtime = finfo.mtime;
+    m->size = finfo.size;
+    m->inode = finfo.inode;
+
+    *mp = m;
+    return APR_SUCCESS;
+}
+
+/* Looks msgID up in the index at path, and copies where it is to r. */
+static apr_status_t msgid_lookup(request_rec *r, const char *path,
+                                 const char *msgID, mbox_msgid_loc_t *loc)
+{
+    msgid_mapped_t *m;
+    mbox_msgid_index_t *idx;
+    apr_status_t rv;
+
+    if (!msgid_state) {
+        rv = mbox_msgid_index_open(&idx, r->pool, path);
+        if (rv == APR_SUCCESS) {
+            rv = mbox_msgid_index_lookup(idx, msgID, loc);
+        }
+        return rv;
+    }
+
+    MSGID_LOCK();
+    rv = msgid_get(&m, r, path);
+    if (rv == APR_SUCCESS) {
+        rv = mbox_msgid_index_lookup(m->idx, msgID, loc);
+    }
+    if (rv == APR_SUCCESS) {
+        /* The mapping may go before the request does. */
+        loc->list = apr_pstrdup(r->pool, loc->list);
+        loc->box = apr_pstrdup(r->pool, loc->box);
+    }
+    MSGID_UNLOCK();
+
+    return rv;
+}
+
+int mbox_msgid_handler(request_rec *r)
+{
+    mbox_dir_cfg_t *conf;
+    mbox_msgid_loc_t loc;
+    const char *id, *msgID, *location;
+    apr_status_t rv;
+
+    if (!r->handler || strcmp(r->handler, MBOX_MSGID_HANDLER)) {
+        return DECLINED;
+    }
+
+    conf = ap_get_module_config(r->per_dir_config, &mbox_module);
+    if (!conf->msgid_index) {
+        ap_log_rerror(APLOG_MARK, APLOG_ERR, 0, r,
+                      "mod_mbox: MboxMsgidIndex is not set for '%s'",
+                      r->uri);
+        return HTTP_INTERNAL_SERVER_ERROR;
+    }
+
+    /* Only allow GETs */
+    r->allowed |= (AP_METHOD_BIT << M_GET);
+    if (r->method_number != M_GET) {
+        return HTTP_METHOD_NOT_ALLOWED;
+    }
+
+    /* Message-IDs may have slashes, which only the path info keeps. */
+    if (r->path_info && r->path_info[0] == '/' && r->path_info[1]) {
+        id = r->path_info + 1;
+    }
+    else {
+        id = strrchr(r->uri, '/');
+        id = id ? id + 1 : r->uri;
+    }
+    if (!*id) {
+        return HTTP_NOT_FOUND;
+    }
+
+    msgID = (id[0] == '<') ? id : apr_pstrcat(r->pool, "<", id, ">", NULL);
+
+    rv = msgid_lookup(r, conf->msgid_index, msgID, &loc);
+    if (rv == APR_NOTFOUND) {
+        return HTTP_NOT_FOUND;
+    }
+    if (rv != APR_SUCCESS) {
+        ap_log_rerror(APLOG_MARK, APLOG_ERR, rv, r,
+                      "mod_mbox: Can't read the Message-ID index '%s'",
+                      conf->msgid_index);
+        return HTTP_INTERNAL_SERVER_ERROR;
+    }
+
+    location = apr_pstrcat(r->pool, loc.list, "/", loc.box, "/",
+                           mbox_escape_msgid(r->pool, msgID), NULL);
+    if (location[0] == '/') {
+        location = ap_construct_url(r->pool, location, r);
+    }
+
+    apr_table_setn(r->headers_out, "Location", location);
+    return HTTP_MOVED_TEMPORARILY;
+}
@@ -23,142 +23,6 @@
 APLOG_USE_MODULE(mbox);
 #endif
 
-static const char *mbox_months[12][2] = {
-    {"Jan", "January"},
-    {"Feb", "February"},
-    {"Mar", "March"},
-    {"Apr", "April"},
-    {"May", "May"},
-    {"Jun", "June"},
-    {"Jul", "July"},
-    {"Aug", "August"},
-    {"Sep", "September"},
-    {"Oct", "October"},
-    {"Nov", "November"},
-    {"Dec", "December"}
-};
-
-/* Display an ATOM feed entry from given message structure */
-static void display_atom_entry(request_rec *r, Message *m, const char *mboxfile,
-                               apr_pool_t *pool, apr_file_t *f)
-{
-    char dstr[100];
-    apr_size_t dlen;
-    apr_time_exp_t extime;
-    char *uid;
-    char *c;
-
-    ap_rputs("<entry>\n", r);
-    ap_rprintf(r, "<title>%s</title>\n", ESCAPE_AND_CONV_HDR(pool, m->subject));
-    ap_rprintf(r, "<author><name>%s</name></author>\n",
-               ESCAPE_AND_CONV_HDR(pool, m->from));
-
-    ap_rprintf(r, "<link rel=\"alternate\" href=\"%s%s/%s\"/>\n",
-               ap_construct_url(r->pool, r->uri, r),
-               mboxfile, MSG_ID_ESCAPE_OR_BLANK(pool, m->msgID));
-
-    uid = MSG_ID_ESCAPE_OR_BLANK(pool, m->msgID);
-
-    c = uid;
-    while (*c != '\0') {
-        if (*c == '.') {
-            *c = '-';
-        }
-        c++;
-    }
-
-    ap_rprintf(r, "<id>urn:uuid:%s</id>\n", uid);
-
-    apr_time_exp_gmt(&extime, m->date);
-
-    apr_strftime(dstr, &dlen, sizeof(dstr), "%G-%m-%dT%H:%M:%SZ", &extime);
-
-    ap_rprintf(r, "<updated>%s</updated>\n", dstr);
-    ap_rputs("<content type=\"xhtml\">\n"
-             "<div xmlns=\"http://www.w3.org/1999/xhtml\">\n" "<pre>\n", r);
-
-    load_message(pool, f, m);
-    /* Parse multipart information */
-    m->mime_msg = mbox_mime_decode_multipart(r, pool, m->raw_body,
-                                             m->content_type,
-                                             m->charset,
-                                             m->cte, m->boundary);
-
-    ap_rprintf(r, "%s",
-               mbox_cntrl_escape(pool, mbox_wrap_text(mbox_mime_get_body(r, pool, m->mime_msg))));
-
-    ap_rputs("\n</pre>\n</div>\n</content>\n", r);
-    ap_rputs("</entry>\n", r);
-}
-
-static int mbox2atom(request_rec *r, const char *mboxfile,
-                     mbox_cache_info *mli, int max)
-{
-    apr_status_t rv;
-    char *filename;
-    char *origfilename;
-    apr_file_t *f;
-    MBOX_LIST *head;
-    Message *m;
-    int i;
-    apr_pool_t *tpool;
-
-    apr_pool_create(&tpool, r->pool);
-
-    filename = apr_pstrcat(r->pool, r->filename, mboxfile, NULL);
-
-    rv = apr_file_open(&f, filename, APR_READ, APR_OS_DEFAULT, r->pool);
-
-    if (rv != APR_SUCCESS) {
-        ap_log_rerror(APLOG_MARK, APLOG_ERR, rv, r,
-                      "mod_mbox(mbox2atom): Can't open mbox '%s' for atom feed",
-                      filename);
-        return 0;
-    }
-    origfilename = r->filename;
-
-    r->filename = filename;
-
-    head = mbox_load_index(r, f, NULL);
-
-    /* Sort the list */
-    head = mbox_sort_list(head, MBOX_SORT_REVERSE_DATE);
-
-    for (i = 0; i < max && head != NULL; i++) {
-        m = (Message *) head->value;
-        display_atom_entry(r, m, mboxfile, tpool, f);
-        head = head->next;
-        apr_pool_clear(tpool);
-    }
-
-    r->filename = origfilename;
-    apr_pool_destroy(tpool);
-    return i;
-}
-
-void mbox_atom_entries(request_rec *r, mbox_cache_info *mli)
-{
-    mbox_file_t *fi;
-    apr_array_header_t *files;
-    int i, entries = 0;
-
-    files = mbox_fetch_boxes_list(r, mli, r->filename);
-    if (!files) {
-        return;
-    }
-
-    fi = (mbox_file_t *) files->elts;
-    for (i = 0; i < files->nelts && entries < MBOX_ATOM_NUM_ENTRIES; i++) {
-        if (!fi[i].count) {
-            continue;
-        }
-        entries +=
-            mbox2atom(r, fi[i].filename, mli,
-                      MBOX_ATOM_NUM_ENTRIES - entries);
-    }
-}
-
-
 /* Outputs an XML list of available mailboxes */
 apr_status_t mbox_xml_boxlist(request_rec *r)
 {
@@ -214,27 +78,19 @@ apr_status_t mbox_xml_boxlist(request_rec *r)
     return APR_SUCCESS;
 }
 
-/* Outputs a statix XHTML list of available mailboxes */
-apr_status_t mbox_static_boxlist(request_rec *r)
+/* Returns the mailboxes of the list of the mailbox of r, for the box
+ * list of its pages.
+ */
+static apr_array_header_t *fetch_month_boxes(request_rec *r)
 {
-    apr_status_t rv = APR_SUCCESS;
-
-    mbox_dir_cfg_t *conf;
+    apr_status_t rv;
     mbox_cache_info *mli;
-    mbox_file_t *fi;
-    apr_array_header_t *files;
-
-    int i;
-    const char *base_path;
     char *path, *k;
 
-    conf = ap_get_module_config(r->per_dir_config, &mbox_module);
-    base_path = get_base_path(r);
-
     path = apr_pstrdup(r->pool, r->filename);
     k = strstr(path, ".mbox");
-    if (!k) {
-        return HTTP_NOT_FOUND;
+    if (!k || k - path < 7) {
+        return NULL;
     }
 
     /* Roll back before the '/YYYYMM' part of the filename */
@@ -247,363 +103,182 @@ apr_status_t mbox_static_boxlist(request_rec *r)
         ap_log_rerror(APLOG_MARK, APLOG_ERR, rv, r,
                       "mod_mbox(static_boxlist): Can't open directory cache '%s' for index",
                       path);
-        return HTTP_FORBIDDEN;
-    }
-
-    files = mbox_fetch_boxes_list(r, mli, path);
-    if (!files) {
-        return HTTP_FORBIDDEN;
+        return NULL;
     }
 
-    ap_rputs("  <div id=\"boxlist-outer\">\n", r);
+    return mbox_fetch_boxes_list(r, mli, path);
+}
 
-    ap_rputs("  <h5>\n", r);
-    if (conf->root_path) {
-        ap_rprintf(r, "<a href=\"%s\" title=\"Back to the archives depot\">"
-                   "Site index</a> &middot; ", conf->root_path);
+/* Loads into l the page of the date view of the mailbox in f that the
+ * arguments point to: after=CURSOR starts after a message (see
+ * mbox_msglist_cursor()), date=DATE (as YYYY[-MM[-DD]]) at the first
+ * message of that date or later.  The ordinal index of the mailbox
+ * finds the page with a binary search, and only its messages are
+ * loaded; without one, the whole index is, and searched.
+ */
+static int load_msglist_from(request_rec *r, apr_file_t *f,
+                             mbox_msglist_t *l, const char *args)
+{
+    mbox_ordinal_t *ord;
+    apr_dbm_t *db;
+    MBOX_LIST *head = NULL, **tail = &head, **page;
+    Message *m;
+    apr_time_t date = 0;
+    apr_int64_t ordinal = -1;
+    char *cursor, *msgID = NULL, *end;
+    int jump, first, count = 0, shown = 0, i;
+
+    /* after=ORDINAL, after=DATE,MSGID or date=DATE */
+    jump = (strncmp(args, "date=", 5) == 0);
+    cursor = apr_pstrdup(r->pool, args + (jump ? 5 : 6));
+    if (ap_unescape_url(cursor) != OK) {
+        return HTTP_BAD_REQUEST;
+    }
+    if (jump) {
+        if (mbox_arg_date(&date, cursor) != APR_SUCCESS) {
+            return HTTP_BAD_REQUEST;
+        }
     }
-    ap_rprintf(r, "<a href=\"%s\" title=\"Back to the list index\">"
-               "List index</a>", get_base_path(r));
-    ap_rputs("</h5>\n\n", r);
-
-    ap_rputs("  <div id=\"boxlist-inner\">\n", r);
-
-    ap_rputs("  <table id=\"boxlist\">\n", r);
-    ap_rputs("   <thead><tr><th class=\"box\">Month</th><th class=\"msgcount\">Count</th></tr></thead>\n",
-             r);
-    ap_rputs("   <tbody>\n", r);
-
-    fi = (mbox_file_t *) files->elts;
-
-    for (i = 0; i < files->nelts; i++) {
-        if (fi[i].count || !conf->hide_empty) {
-            if (strcmp(k + 1, fi[i].filename) == 0) {
-                ap_rputs("   <tr class=\"active\">", r);
+    else {
+        msgID = strchr(cursor, ',');
+        if (msgID) {
+            *msgID++ = '\0';
+        }
+        if (apr_isdigit(*cursor)) {
+            if (msgID) {
+                date = apr_time_from_sec(apr_strtoi64(cursor, &end, 10));
             }
             else {
-                ap_rputs("   <tr>", r);
+                ordinal = apr_strtoi64(cursor, &end, 10);
             }
-
-            ap_rprintf(r,
-                       "    <td class=\"box\"><a href=\"%s/%s%s\" title=\"Browse %s %.4s archives\">"
-                       "%s %.4s</a></td><td class=\"msgcount\">%d</td>\n",
-                       base_path, fi[i].filename, r->path_info,
-                       mbox_months[atoi
-                                   (apr_pstrndup
-                                    (r->pool, fi[i].filename + 4, 2)) - 1][1],
-                       fi[i].filename,
-                       mbox_months[atoi
-                                   (apr_pstrndup
-                                    (r->pool, fi[i].filename + 4, 2)) - 1][0],
-                       fi[i].filename, fi[i].count);
-
-            ap_rputs("   </tr>\n", r);
+        }
+        if (!apr_isdigit(*cursor) || *end || (msgID && !*msgID)) {
+            return HTTP_BAD_REQUEST;
         }
     }
 
-    ap_rputs("   </tbody>\n", r);
-    ap_rputs("  </table>\n", r);
-    ap_rputs("  </div><!-- /#boxlist-inner -->\n", r);
-    ap_rputs("  </div><!-- /#boxlist-outer -->\n", r);
-
-    return APR_SUCCESS;
-}
+    if (mbox_index_ordinals(r, &ord) == APR_SUCCESS
+        && mbox_open_index(r, &db) == APR_SUCCESS) {
+        count = (int) mbox_ordinal_count(ord);
+        if (jump) {
+            first = (int) mbox_ordinal_find(ord, date);
+        }
+        else if (msgID) {
+            first = (int) mbox_ordinal_after(ord, date, msgID);
+        }
+        else {
+            first = ordinal < count ? (int) ordinal + 1 : count;
+        }
 
-/* Outputs an XHTML list of available mailboxes */
-apr_status_t mbox_static_index_boxlist(request_rec *r, mbox_dir_cfg_t *conf,
-                                       mbox_cache_info *mli)
-{
-    mbox_file_t *fi;
-    apr_array_header_t *files;
-    int side = 0, year_hdr = 0, i;
+        for (i = first; i < count && i < first + DEFAULT_MSGS_PER_PAGE;
+             i++) {
+            m = mbox_fetch_ordinal(r, db, ord, i);
+            if (!m) {
+                continue;
+            }
+            *tail = apr_pcalloc(r->pool, sizeof(MBOX_LIST));
+            (*tail)->key = m->date;
+            (*tail)->value = m;
+            tail = &(*tail)->next;
+            shown++;
+        }
+        apr_dbm_close(db);
+        mbox_msglist_init(l, r->pool, head, shown, MBOX_SORT_DATE);
 
-    files = mbox_fetch_boxes_list(r, mli, r->filename);
-    if (!files) {
-        return HTTP_FORBIDDEN;
+        if (first > DEFAULT_MSGS_PER_PAGE) {
+            i = first - DEFAULT_MSGS_PER_PAGE - 1;
+            l->prev = mbox_msglist_cursor(r->pool, mbox_ordinal_date(ord, i),
+                                          mbox_ordinal_msgid(ord, i));
+        }
+        if (first + DEFAULT_MSGS_PER_PAGE < count) {
+            i = first + DEFAULT_MSGS_PER_PAGE - 1;
+            l->next = mbox_msglist_cursor(r->pool, mbox_ordinal_date(ord, i),
+                                          mbox_ordinal_msgid(ord, i));
+        }
     }
-
-    ap_rputs("  <table id=\"grid\">\n", r);
-
-    fi = (mbox_file_t *) files->elts;
-
-    for (i = 0; i < files->nelts; i++) {
-        /* Only display an entry if it has messages or if we don't
-           hide empty mailboxes */
-        if (fi[i].count || !conf->hide_empty) {
-            if (!year_hdr) {
-                if (!side) {
-                    ap_rputs("  <tr><td class=\"left\">\n", r);
-                    side = 1;
+    else {
+        head = mbox_sort_list(mbox_load_index(r, f, &count), MBOX_SORT_DATE);
+        page = apr_palloc(r->pool, (count + 1) * sizeof(MBOX_LIST *));
+        for (i = 0; head && i < count; head = head->next, i++) {
+            page[i] = head;
+        }
+        count = i;
+
+        first = ordinal < count ? (int) ordinal + 1 : count;
+        if (jump || msgID) {
+            for (first = 0; first < count; first++) {
+                m = (Message *) page[first]->value;
+                if (jump ? m->date >= date
+                    : apr_time_sec(m->date) > apr_time_sec(date)) {
+                    break;
                 }
-                else {
-                    ap_rputs("  <td class=\"right\">\n", r);
-                    side = 0;
+                if (!jump && apr_time_sec(m->date) == apr_time_sec(date)
+                    && strcmp(m->msgID, msgID) == 0) {
+                    first++;
+                    break;
                 }
-
-                ap_rputs("   <div class=\"year-cont\">\n", r);
-                ap_rputs("   <table class=\"year\">\n", r);
-                ap_rputs("    <thead><tr>\n", r);
-                ap_rprintf(r, "     <th colspan=\"3\">Year %.4s</th>\n",
-                           fi[i].filename);
-                ap_rputs("    </tr></thead>\n", r);
-                ap_rputs("    <tbody>\n", r);
-
-                year_hdr = 1;
             }
-
-            ap_rputs("    <tr>\n", r);
-            ap_rprintf(r, "     <td class=\"date\">%s %.4s</td>\n",
-                       mbox_months[atoi(apr_pstrndup(r->pool,
-                                                     fi[i].filename + 4,
-                                                     2)) - 1][0],
-                       fi[i].filename);
-            ap_rprintf(r,
-                       "     <td class=\"links\"><span class=\"links\" id=\"%.4s%.2s\">"
-                       "<a href=\"%.4s%.2s.mbox/thread\">Thread</a>"
-                       " &middot; <a href=\"%.4s%.2s.mbox/date\">Date</a>"
-                       " &middot; <a href=\"%.4s%.2s.mbox/author\">Author</a></span></td>\n",
-                       fi[i].filename, fi[i].filename + 4, fi[i].filename,
-                       fi[i].filename + 4, fi[i].filename, fi[i].filename + 4,
-                       fi[i].filename, fi[i].filename + 4);
-            ap_rprintf(r, "     <td class=\"msgcount\">%d</td>\n",
-                       fi[i].count);
-            ap_rputs("    </tr>\n", r);
         }
 
-        /* Year separation */
-        if (i + 1 < files->nelts && year_hdr
-            && (fi[i].filename[3] != fi[i + 1].filename[3])) {
-            ap_rputs("    </tbody>\n", r);
-            ap_rputs("   </table>\n", r);
-            ap_rputs("   </div><!-- /.year-cont -->\n", r);
-            if (side) {
-                ap_rputs("  </td>\n", r);
-            }
-            else {
-                ap_rputs("  </td></tr>\n\n", r);
-            }
-
-            year_hdr = 0;
+        shown = count - first;
+        if (shown > DEFAULT_MSGS_PER_PAGE) {
+            shown = DEFAULT_MSGS_PER_PAGE;
+            page[first + shown - 1]->next = NULL;
         }
-    }
-
-    ap_rputs("    </tbody>\n", r);
-    ap_rputs("   </table>\n\n", r);
-
-    if (side) {
-        ap_rputs("  </td><td class=\"right\"></td></tr>\n", r);
-    }
-
-    ap_rputs("  </table>\n\n", r);
-
-    return APR_SUCCESS;
-}
-
-/* Antispam protection,
- * proper order is:
- * apply mbox_cte_decode_header(), then email_antispam(), then
- * ESCAPE_OR_BLANK()
- */
-static char *email_antispam(char *email)
-{
-    char *tmp;
-    int i, atsign = 0, ltsign = 0;
-
-    tmp = strrchr(email, '@');
-
-    if (!tmp) {
-        return email;
-    }
-
-    /* Before the '@' sign */
-    atsign = tmp - email - 1;
-
-    tmp = strstr(email, "&lt;");
-    if (tmp) {
-        /* After the '&lt;' */
-        ltsign = tmp - email + strlen("&lt;") - 1;
-    }
+        mbox_msglist_init(l, r->pool, shown ? page[first] : NULL, shown,
+                          MBOX_SORT_DATE);
 
-    /* Wipe out at most three chars preceding the '@' sign */
-    for (i = 0; i < 3; i++) {
-        if ((atsign - i) > ltsign) {
-            email[atsign - i] = '.';
+        if (first > DEFAULT_MSGS_PER_PAGE) {
+            m = (Message *) page[first - DEFAULT_MSGS_PER_PAGE - 1]->value;
+            l->prev = mbox_msglist_cursor(r->pool, m->date, m->msgID);
+        }
+        if (first + DEFAULT_MSGS_PER_PAGE < count) {
+            m = (Message *) page[first + DEFAULT_MSGS_PER_PAGE - 1]->value;
+            l->next = mbox_msglist_cursor(r->pool, m->date, m->msgID);
         }
     }
 
-    return email;
-}
-
-/* Display an XHTML message list entry */
-static void display_static_msglist_entry(request_rec *r, Message *m,
-                                         int linked, int depth)
-{
-    mbox_dir_cfg_t *conf;
-
-    char *tmp;
-    int i;
-
-    conf = ap_get_module_config(r->per_dir_config, &mbox_module);
-
-    /* Message author */
-    ap_rputs("   <tr>\n", r);
-
-    tmp = mbox_cte_decode_header(r->pool, m->str_from);
-    if (conf->antispam) {
-        tmp = email_antispam(tmp);
-    }
-    tmp = ESCAPE_OR_BLANK(r->pool, tmp);
-
-    if (linked) {
-        ap_rprintf(r, "    <td class=\"author\">%s</td>\n", tmp);
-    }
-    else {
-        ap_rputs("    <td class=\"author\"></td>\n", r);
-    }
-
-    /* Subject, linked or not */
-    ap_rputs("     <td class=\"subject\">", r);
-    for (i = 0; i < depth; i++) {
-        ap_rputs("&nbsp;&nbsp;", r);
-    }
-
-    if (linked) {
-        const char *msgid = MSG_ID_ESCAPE_OR_BLANK(r->pool, m->msgID);
-        ap_rprintf(r, "<a id=\"%s\" href=\"%s\">", msgid, msgid);
-    }
-
-    ap_rprintf(r, "%s", ESCAPE_AND_CONV_HDR(r->pool, m->subject));
-    if (linked) {
-        ap_rputs("</a>", r);
-    }
-    ap_rputs("     </td>\n", r);
-
-    /* Message date */
-    if (linked) {
-        ap_rprintf(r, "    <td class=\"date\">%s</td>\n",
-                   ESCAPE_OR_BLANK(r->pool, m->str_date));
-    }
-    else {
-        ap_rputs("    <td class=\"date\"></td>\n", r);
-    }
-
-    ap_rputs("   </tr>\n", r);
-}
-
-/* Display an XML message list entry */
-static void display_xml_msglist_entry(request_rec *r, Message *m,
-                                      int linked, int depth)
-{
-    mbox_dir_cfg_t *conf;
-
-    char *from;
-
-    conf = ap_get_module_config(r->per_dir_config, &mbox_module);
-
-    from = mbox_cte_decode_header(r->pool, m->str_from);
-    if (conf->antispam) {
-        from = email_antispam(from);
-    }
-    from = ESCAPE_OR_BLANK(r->pool, from);
-
-    ap_rprintf(r, " <message linked=\"%d\" depth=\"%d\" id=\"%s\">\n",
-               linked, depth, ESCAPE_OR_BLANK(r->pool, m->msgID));
-
-    ap_rprintf(r, "  <from><![CDATA[%s]]></from>\n", from);
-    ap_rprintf(r, "  <date><![CDATA[%s]]></date>\n",
-               ESCAPE_OR_BLANK(r->pool, m->str_date));
-
-    ap_rprintf(r, "  <subject><![CDATA[%s]]></subject>\n",
-               ESCAPE_AND_CONV_HDR(r->pool, m->subject));
-    ap_rprintf(r, " </message>\n");
-}
-
-/* Display a threaded message list for Container 'c' */
-static void display_msglist_thread(request_rec *r, Container *c,
-                                   int depth, int mode)
-{
-    Message *m;
-    int linked = 1;
-
-    /* Under the rules of our threading tree, if we do not have a
-     * message, we MUST have at least one child.  Therefore, print
-     * that child's subject when we don't have a message.
-     */
-
-    if (c->message) {
-        m = c->message;
-    }
-    else {
-        m = c->child->message;
-        linked = 0;
-    }
-
-    if (mode == MBOX_OUTPUT_STATIC) {
-        display_static_msglist_entry(r, m, linked, depth);
-    }
-    else {
-        display_xml_msglist_entry(r, m, linked, depth);
-    }
-
-    /* Display children :
-     * Subject
-     *  +-> Re: Subject */
-    if (c->child) {
-        display_msglist_thread(r, c->child, depth + 1, mode);
-    }
-
-    /* Display follow-ups :
-     * Subject
-     *  +-> ...
-     *  | +-> ...
-     *  +-> Re: Subject */
-    if (depth && c->next) {
-        display_msglist_thread(r, c->next, depth, mode);
+    /* The first page is the first by number too. */
+    if (first && !l->prev) {
+        l->prev = "0";
     }
+    l->first = first;
+    l->count = count;
+    return OK;
 }
 
 /* Display the XML index of the specified mbox file. */
 apr_status_t mbox_xml_msglist(request_rec *r, apr_file_t *f, int sortFlags)
 {
     apr_finfo_t fi;
-
+    mbox_dir_cfg_t *conf;
+    mbox_msglist_t l;
+    mbox_out_t out;
     MBOX_LIST *head;
-    Message *m;
-    Container *threads = NULL, *c;
 
     int current_page = 0;       /* Current page number, starting at 0 */
-    int pages;                  /* Number of pages */
     int count = 0;              /* Message count */
-    int i = 0;
-
-    /* Fetch page number if present. Otherwise, assume page #1 */
-    if (r->args && strcmp(r->args, ""))
-        current_page = atoi(r->args);
+    int status;
 
-    /* Load the index of messages from the DB into the MBOX_LIST */
-    head = mbox_load_index(r, f, &count);
+    conf = ap_get_module_config(r->per_dir_config, &mbox_module);
 
-    /* Compute the page count, depending on the sort flags */
-    if (sortFlags != MBOX_SORT_THREAD) {
-        pages = count / DEFAULT_MSGS_PER_PAGE;
-        if (count > pages * DEFAULT_MSGS_PER_PAGE) {
-            pages++;
+    /* Pages of the date view may start at a cursor, or a date. */
+    if (sortFlags == MBOX_SORT_DATE && r->args
+        && (strncmp(r->args, "after=", 6) == 0
+            || strncmp(r->args, "date=", 5) == 0)) {
+        status = load_msglist_from(r, f, &l, r->args);
+        if (status != OK) {
+            return status;
         }
     }
     else {
-        threads = calculate_threads(r->pool, head);
-        c = threads;
-        count = 0;
+        /* Fetch page number if present. Otherwise, assume page #1 */
+        if (r->args && strcmp(r->args, ""))
+            current_page = atoi(r->args);
 
-        while (c) {
-            c = c->next;
-            count++;
-        }
-
-        pages = count / DEFAULT_THREADS_PER_PAGE;
-        if (count > pages * DEFAULT_THREADS_PER_PAGE) {
-            pages++;
-        }
+        /* Load the index of messages from the DB into the MBOX_LIST */
+        head = mbox_load_index(r, f, &count);
+        mbox_msglist_init(&l, r->pool, head, count, sortFlags);
     }
 
     /* This index only changes when the .mbox file changes. */
@@ -611,303 +286,260 @@ apr_status_t mbox_xml_msglist(request_rec *r, apr_file_t *f, int sortFlags)
     r->mtime = fi.mtime;
     ap_set_last_modified(r);
 
-    /* Send page header */
-    ap_rputs("<?xml version=\"1.0\" encoding=\"UTF-8\"?>\n", r);
-    ap_rprintf(r, "<index page=\"%d\" pages=\"%d\">\n", current_page, pages);
+    mbox_out_init_request(&out, r);
 
-    /* For date and author sorts */
-    if (sortFlags != MBOX_SORT_THREAD) {
-        /* Sort the list */
-        head = mbox_sort_list(head, sortFlags);
-
-        /* Pass useless messages */
-        while (head && (i < current_page * DEFAULT_MSGS_PER_PAGE)) {
-            head = head->next;
-            i++;
+    /* Send page header */
+    mbox_out_puts(&out, "<?xml version=\"1.0\" encoding=\"UTF-8\"?>\n");
+    if (l.first >= 0) {
+        mbox_out_printf(&out, "<index first=\"%d\" count=\"%d\"", l.first,
+                        l.count);
+        if (l.prev) {
+            mbox_out_printf(&out, " prev=\"%s\"",
+                            mbox_escape_html(r->pool, l.prev));
         }
-
-        /* Display current_page's messages */
-        while (head && (i < (current_page + 1) * DEFAULT_MSGS_PER_PAGE)) {
-            m = (Message *) head->value;
-            display_xml_msglist_entry(r, m, 1, 0);
-
-            head = head->next;
-            i++;
+        if (l.next) {
+            mbox_out_printf(&out, " next=\"%s\"",
+                            mbox_escape_html(r->pool, l.next));
         }
+        mbox_out_puts(&out, ">\n");
     }
-
-    /* For threaded view */
     else {
-        c = threads;
+        mbox_out_printf(&out, "<index page=\"%d\" pages=\"%d\"",
+                        current_page, l.pages);
 
-        /* Pass useless threads */
-        while (c && (i < current_page * DEFAULT_THREADS_PER_PAGE)) {
-            c = c->next;
-            i++;
-        }
+        /* From a page by number, the next one may be had by cursor. */
+        if (sortFlags == MBOX_SORT_DATE && current_page + 1 < l.pages) {
+            int i;
 
-        /* Display current_page's threads */
-        while (c && (i < (current_page + 1) * DEFAULT_THREADS_PER_PAGE)) {
-            display_msglist_thread(r, c, 0, MBOX_OUTPUT_AJAX);
-            c = c->next;
-            i++;
+            head = l.head;
+            for (i = 1; head && i < (current_page + 1) * DEFAULT_MSGS_PER_PAGE;
+                 i++) {
+                head = head->next;
+            }
+            if (head) {
+                Message *m = (Message *) head->value;
+                mbox_out_printf(&out, " next=\"%s\"",
+                                mbox_escape_html(r->pool,
+                                                 mbox_msglist_cursor(r->pool,
+                                                                     m->date,
+                                                                     m->msgID)));
+            }
         }
+        mbox_out_puts(&out, ">\n");
     }
 
-    ap_rputs("</index>", r);
+    mbox_page_msglist_entries(&out, &l, current_page, MBOX_OUTPUT_AJAX,
+                              conf->antispam);
+
+    mbox_out_puts(&out, "</index>");
 
     return OK;
 }
 
-static void send_link_if_not_active(request_rec *r,
-                                    int is_active,
-                                    const char* label,
-                                    const char *prefix, const char *suffix,
-                                    const char *part1, const char *part2,
-                                    const char *part3, const char *part4)
+/* Loads into l the index of the specified mbox file, sorted for its
+ * pages.
+ */
+static void load_msglist(request_rec *r, apr_file_t *f, mbox_msglist_t *l,
+                         int sortFlags)
 {
-    if (is_active) {
-        ap_rprintf(r, "%s%s%s", prefix, label, suffix);
-    } else {
-        ap_rprintf(r, "%s<a href=\"%s%s%s%s\">%s</a>%s",
-                      prefix, part1, part2, part3, part4, label, suffix);
-    }
+    MBOX_LIST *head;
+    int count = 0;              /* Message count */
+
+    /* Load the index of messages from the DB into the MBOX_LIST */
+    head = mbox_load_index(r, f, &count);
+    mbox_msglist_init(l, r->pool, head, count, sortFlags);
 }
 
-/* Display the page selector.
- *
- * FIXME: improve the algorithm in order to handle long pages list.
+/* Writes a page of the XHTML index of the specified mbox file. */
+static apr_status_t render_msglist(mbox_out_t *out, request_rec *r,
+                                   const mbox_page_cfg_t *cfg,
+                                   const mbox_msglist_t *l,
+                                   apr_array_header_t *files,
+                                   const char *box, int current_page)
+{
+    return mbox_page_msglist(out, cfg, l, files, box, get_base_uri(r),
+                             get_base_path(r), get_base_name(r),
+                             r->path_info, current_page);
+}
+
+/* Sends a page of the XHTML index of a past month from the page store,
+ * in the encoding the client prefers, compressing it into the store
+ * first if it is not there yet.  Returns DECLINED if the page must be
+ * rendered for this client.
  */
-static void mbox_static_msglist_page_selector(request_rec *r, const char *baseURI,
-                                              int pages, int current_page)
+static int send_stored_msglist(request_rec *r, const char *store,
+                               apr_file_t *f, const mbox_page_cfg_t *cfg,
+                               apr_array_header_t *files, const char *box,
+                               int sortFlags, int current_page)
 {
-    /* If we don't have more than one page, the page selector is useless. */
-    if (pages == 1) {
-        ap_rprintf(r, "<span class=\"num-pages\">Showing page %d of %d</span>\n",
-                      current_page + 1, pages);
-    } else {
-        // TODO: Get rid of the calls to apr_psprintf().
-        ap_rputs("<span class=\"pagination\">", r);
-        send_link_if_not_active(r, current_page == 0, "&laquo; Previous Page",
-                                "<span id=\"prev-page\">", "</span>",
-                                baseURI, r->path_info, "?",
-                                apr_psprintf(r->pool, "%d", current_page - 1));
-
-        for (int i = 0; i < pages; i++) {
-            ap_rputs(" &middot; ", r);
-            send_link_if_not_active(r, current_page == i,
-                                    apr_psprintf(r->pool, "%d", i + 1),
-                                    "", "", baseURI, r->path_info, "?",
-                                    apr_psprintf(r->pool, "%d", i));
+    const mbox_encoding_t *enc;
+    const char *accepts, *location, *version, *tag;
+    mbox_variant_writer_t *w;
+    mbox_variant_t v;
+    mbox_msglist_t l;
+    apr_bucket_brigade *bb;
+    apr_finfo_t finfo;
+    apr_status_t rv;
+    int errstatus;
+
+    /* The page only changes with the index, the settings and the box
+       list, or with the markup of the module. */
+    if (mbox_index_stat(r, &finfo) != APR_SUCCESS) {
+        return DECLINED;
+    }
+    version = apr_psprintf(r->pool, "%" APR_TIME_T_FMT " %" APR_OFF_T_FMT
+                           "\n%s\n%sformat %d", finfo.mtime, finfo.size,
+                           mbox_page_cfg_version(r->pool, cfg),
+                           mbox_boxes_version(r->pool, files),
+                           MBOX_PAGE_FORMAT);
+    location = apr_psprintf(r->pool, "%s\n%s\n%s %d %d", get_base_uri(r),
+                            r->filename, r->path_info, sortFlags,
+                            current_page);
+
+    apr_table_mergen(r->headers_out, "Vary", "Accept-Encoding");
+
+    accepts = apr_table_get(r->headers_in, "Accept-Encoding");
+    for (enc = mbox_variant_encodings; accepts && enc->name; enc++) {
+        if (ap_find_token(r->pool, accepts, enc->name)) {
+            break;
         }
-        ap_rputs(" &middot; ", r);
-        send_link_if_not_active(r, current_page + 1 >= pages, "Next Page &raquo;",
-                                "<span id=\"next-page\">", "</span>",
-                                baseURI, r->path_info, "?",
-                                apr_psprintf(r->pool, "%d", current_page + 1));
-        ap_rputs("</span>\n", r);
     }
-}
+    if (!accepts || !enc->name) {
+        enc = NULL;
+    }
 
-static void mbox_static_msglist_nav(request_rec *r, const char *baseURI,
-                                    int pages, int current_page,
-                                    int sortFlags)
-{
-    ap_rputs("   <tr>", r);
-    send_link_if_not_active(r, sortFlags == MBOX_SORT_AUTHOR, "Author",
-                            "<th class=\"author\">", "</th>", baseURI, "/",
-                            "author", "");
-    send_link_if_not_active(r, sortFlags == MBOX_SORT_THREAD, "Subject",
-                            "<th class=\"subject\">", "</th>", baseURI, "/",
-                            "thread", "");
-    send_link_if_not_active(r, sortFlags == MBOX_SORT_DATE, "Date",
-                            "<th class=\"date\">", "</th>", baseURI, "/",
-                            "date", "");
-    ap_rputs("</tr>\n\n", r);
-}
+    /* Variants are told apart, as mod_deflate does. */
+    tag = mbox_variant_hash(r->pool, version);
+    apr_table_setn(r->headers_out, "ETag",
+                   enc ? apr_psprintf(r->pool, "\"%s-%s\"", tag, enc->name)
+                       : apr_psprintf(r->pool, "\"%s\"", tag));
 
-/* Send page header */
-static apr_status_t send_page_header(request_rec *r, const char *title,
-                                     const char *h1)
-{
-    mbox_dir_cfg_t *conf = ap_get_module_config(r->per_dir_config,
-                                                &mbox_module);
-    ap_set_content_type(r, "text/html; charset=utf-8");
-    if (!h1)
-        h1 = title;
-    ap_rprintf(r,
-               "<!DOCTYPE html>\n"
-               "<html>\n"
-               " <head>\n"
-               "  <meta http-equiv=\"Content-Type\" "
-                   "content=\"text/html; charset=utf-8\" />\n"
-               "  <title>%s</title>\n",
-               title);
-
-    DECLINE_NOT_SUCCESS(mbox_send_header_includes(r, conf));
-
-    ap_rputs(" </head>\n"
-             " <body id=\"archives\">\n", r);
-    ap_rputs(" <div id=\"cont\">\n", r);
-
-    ap_rprintf(r, "  <h1>%s</h1>\n\n", h1);
-    return APR_SUCCESS;
-}
+    if ((errstatus = ap_meets_conditions(r)) != OK) {
+        return errstatus;
+    }
+    if (!enc) {
+        return DECLINED;
+    }
+
+    rv = mbox_variant_open(&v, r->pool, store, location, version, enc);
+    if (rv == APR_NOTFOUND) {
+        /* Only the pages the month has are stored: the others are
+           rendered as they are, with the tag of the identity. */
+        load_msglist(r, f, &l, sortFlags);
+        if (current_page < 0
+            || (current_page > 0 && current_page >= l.pages)) {
+            apr_table_setn(r->headers_out, "ETag",
+                           apr_psprintf(r->pool, "\"%s\"", tag));
+            return DECLINED;
+        }
+        rv = mbox_variant_create(&w, r->pool, store, location, version);
+        if (rv == APR_SUCCESS) {
+            rv = render_msglist(mbox_variant_out(w), r, cfg, &l, files, box,
+                                current_page);
+            if (rv == APR_SUCCESS) {
+                rv = mbox_variant_commit(w);
+            }
+            else {
+                mbox_variant_abort(w);
+            }
+        }
+        if (rv == APR_SUCCESS) {
+            rv = mbox_variant_open(&v, r->pool, store, location, version,
+                                   enc);
+        }
+    }
+    if (rv != APR_SUCCESS) {
+        ap_log_rerror(APLOG_MARK, APLOG_WARNING, rv, r,
+                      "mod_mbox: Can't store the index of '%s' in '%s'",
+                      r->filename, store);
+        /* The page is rendered as is: its tag is that of the identity. */
+        apr_table_setn(r->headers_out, "ETag",
+                       apr_psprintf(r->pool, "\"%s\"", tag));
+        return DECLINED;
+    }
+
+    apr_table_setn(r->headers_out, "Content-Encoding", enc->name);
+    ap_set_content_length(r, v.len);
 
+    bb = apr_brigade_create(r->pool, r->connection->bucket_alloc);
+    apr_brigade_insert_file(bb, v.file, v.offset, v.len, r->pool);
+    rv = ap_pass_brigade(r->output_filters, bb);
+    if (rv != APR_SUCCESS) {
+        ap_log_rerror(APLOG_MARK, APLOG_DEBUG, rv, r,
+                      "mod_mbox: sending the stored index of '%s' failed",
+                      r->filename);
+    }
+    return OK;
+}
 
 /* Display the XHTML index of the specified mbox file. */
 apr_status_t mbox_static_msglist(request_rec *r, apr_file_t *f,
                                  int sortFlags)
 {
     apr_finfo_t fi;
-
+    apr_status_t rv;
+    apr_array_header_t *files;
     mbox_dir_cfg_t *conf;
-    MBOX_LIST *head;
-    Message *m;
-    Container *threads = NULL, *c;
+    mbox_page_cfg_t cfg;
+    mbox_msglist_t l;
+    mbox_out_t out;
+    const char *box;
+    int cursor = 0;
 
     int current_page = 0;       /* Current page number, starting at 0 */
-    int pages;                  /* Total number of pages */
-    int count = 0;              /* Message count */
-    int i = 0;
-
-    const char *baseURI;
-    char *filename;
-    const char *month;
-    const char *year;
 
     conf = ap_get_module_config(r->per_dir_config, &mbox_module);
-    baseURI = get_base_uri(r);
-
-    /* Fetch page number if present. Otherwise, assume page #1 */
-    if (r->args && strcmp(r->args, ""))
-        current_page = atoi(r->args);
-
-    /* Load the index of messages from the DB into the MBOX_LIST */
-    head = mbox_load_index(r, f, &count);
 
-    /* Compute the page count, depending on the sort flags */
-    if (sortFlags != MBOX_SORT_THREAD) {
-        pages = count / DEFAULT_MSGS_PER_PAGE;
-        if (count > pages * DEFAULT_MSGS_PER_PAGE) {
-            pages++;
-        }
-    }
-    else {
-        threads = calculate_threads(r->pool, head);
-        c = threads;
-        count = 0;
-
-        while (c) {
-            c = c->next;
-            count++;
-        }
-
-        pages = count / DEFAULT_THREADS_PER_PAGE;
-        if (count > pages * DEFAULT_THREADS_PER_PAGE) {
-            pages++;
+    /* Pages of the date view may start at a cursor, or a date. */
+    if (sortFlags == MBOX_SORT_DATE && r->args
+        && (strncmp(r->args, "after=", 6) == 0
+            || strncmp(r->args, "date=", 5) == 0)) {
+        int status = load_msglist_from(r, f, &l, r->args);
+        if (status != OK) {
+            return status;
         }
+        cursor = 1;
     }
+    /* Fetch page number if present. Otherwise, assume page #1 */
+    else if (r->args && strcmp(r->args, ""))
+        current_page = atoi(r->args);
 
     /* This index only changes when the .mbox file changes. */
     apr_file_info_get(&fi, APR_FINFO_MTIME, f);
     r->mtime = fi.mtime;
     ap_set_last_modified(r);
 
-    /* Determine the month and year of the list, if we can. */
-    filename = strrchr(r->filename, '/');
-    if (filename &&
-        apr_fnmatch("[0-9][0-9][0-9][0-9][0-9][0-9].mbox", filename + 1, 0)
-        == APR_SUCCESS) {
-        month = mbox_months[atoi(apr_pstrndup(r->pool, baseURI +
-                                              (strlen(baseURI) -
-                                               strlen(".mbox") - 2),
-                                              2)) - 1][1];
-        year = baseURI + (strlen(baseURI) - strlen(".mbox") - 6);
-    }
-    else {
-        month = "";
-        year = "";
-    }
-
-    DECLINE_NOT_SUCCESS(send_page_header(r,
-                apr_psprintf(r->pool, "%s mailing list archives: %s %.4s",
-                             get_base_name(r), month, year),
-                NULL));
-
-    /* Display box list */
-    mbox_static_boxlist(r);
-
-    ap_rputs("  <div id=\"msglist-outer\">\n", r);
-    ap_rputs("<h5>", r);
-    mbox_static_msglist_page_selector(r, baseURI, pages, current_page);
-    ap_rputs("</h5>", r);
-    ap_rputs("  <div id=\"msglist-inner\">\n", r);
-    ap_rputs("  <table id=\"msglist\">\n", r);
-    ap_rputs("  <thead>\n", r);
-    mbox_static_msglist_nav(r, baseURI, pages, current_page, sortFlags);
-    ap_rputs("  </thead>\n", r);
-
-    ap_rputs("   <tbody>\n", r);
-
-    /* For date or author sorts */
-    if (sortFlags != MBOX_SORT_THREAD) {
-        /* Sort the list */
-        head = mbox_sort_list(head, sortFlags);
-
-        /* Pass useless messages */
-        while (head && (i < current_page * DEFAULT_MSGS_PER_PAGE)) {
-            head = head->next;
-            i++;
-        }
+    box = strrchr(r->filename, '/');
+    box = box ? box + 1 : r->filename;
 
-        /* Display current_page's messages */
-        while (head && (i < (current_page + 1) * DEFAULT_MSGS_PER_PAGE)) {
-            m = (Message *) head->value;
-            display_static_msglist_entry(r, m, 1, 0);
+    files = fetch_month_boxes(r);
+    mbox_page_cfg_init_request(&cfg, r);
+    ap_set_content_type(r, "text/html; charset=utf-8");
 
-            head = head->next;
-            i++;
+    /* Pages from a cursor are not stored: there are too many of them. */
+    if (conf->page_store && mbox_is_past_month(box) && !cursor) {
+        int status = send_stored_msglist(r, conf->page_store, f, &cfg, files,
+                                         box, sortFlags, current_page);
+        if (status != DECLINED) {
+            return status;
         }
     }
 
-    /* For threaded view */
-    else {
-        c = threads;
-
-        /* Pass useless threads */
-        while (c && (i < current_page * DEFAULT_THREADS_PER_PAGE)) {
-            c = c->next;
-            i++;
-        }
-
-        /* Display current_page's threads */
-        while (c && (i < (current_page + 1) * DEFAULT_THREADS_PER_PAGE)) {
-            display_msglist_thread(r, c, 0, MBOX_OUTPUT_STATIC);
-            c = c->next;
-            i++;
-        }
+    if (!cursor) {
+        load_msglist(r, f, &l, sortFlags);
     }
 
-    ap_rputs("   </tbody>\n", r);
-    ap_rputs("  <tfoot>\n", r);
-    mbox_static_msglist_nav(r, baseURI, pages, current_page, sortFlags);
-    ap_rputs("  </tfoot>\n", r);
-    ap_rputs("  </table>\n", r);
-    ap_rputs("  </div><!-- /#msglist-inner -->\n", r);
-    ap_rputs("  </div><!-- /#msglist-outer -->\n", r);
-
-    ap_rputs(" <div id=\"shim\"></div>\n", r);
-
-    DECLINE_NOT_SUCCESS(mbox_send_footer_includes(r, conf));
-
-    ap_rputs(" </div><!-- /#cont -->\n", r);
-    ap_rputs(" </body>\n", r);
-    ap_rputs("</html>", r);
+    mbox_out_init_request(&out, r);
+    rv = render_msglist(&out, r, &cfg, &l, files, box, current_page);
+    if (rv != APR_SUCCESS) {
+        ap_log_rerror(APLOG_MARK, APLOG_WARNING, rv, r,
+                      "mod_mbox: Can't include a file in the index of '%s'",
+                      r->filename);
+        return DECLINED;
+    }
     return OK;
 }
 
-/* Outputs the AJAX browser XHTML stub. */
 apr_status_t mbox_ajax_browser(request_rec *r)
 {
     const char* base_uri = get_base_uri(r);
@@ -916,10 +548,72 @@ apr_status_t mbox_ajax_browser(request_rec *r)
     return HTTP_MOVED_PERMANENTLY;
 }
 
+/* Sends a MIME part from the attachment store.  The file goes out as a
+ * file bucket, so that it can be sent with sendfile() and that Range
+ * requests are served by the byterange filter.  Returns DECLINED if the
+ * part is not in the store.
+ */
+static int mbox_send_stored_part(request_rec *r, const char *store,
+                                 mbox_mime_message_t *part)
+{
+    apr_bucket_brigade *bb;
+    apr_file_t *fd;
+    apr_finfo_t finfo;
+    apr_status_t rv;
+    char *path;
+    int errstatus;
+
+    path = mbox_attach_path(r->pool, store, part->store_key);
+    if (!path) {
+        return DECLINED;
+    }
+
+    rv = apr_file_open(&fd, path, APR_READ | APR_SENDFILE_ENABLED,
+                       APR_OS_DEFAULT, r->pool);
+    if (rv != APR_SUCCESS) {
+        ap_log_rerror(APLOG_MARK, APLOG_WARNING, rv, r,
+                      "attachment %s missing from the store", path);
+        return DECLINED;
+    }
+
+    if (apr_file_info_get(&finfo, APR_FINFO_SIZE, fd) != APR_SUCCESS
+        || finfo.size != (apr_off_t) part->decoded_len) {
+        apr_file_close(fd);
+        return DECLINED;
+    }
+
+    /* The key is a hash of the content: a strong validator. */
+    apr_table_setn(r->headers_out, "ETag",
+                   apr_pstrcat(r->pool, "\"", part->store_key, "\"", NULL));
+    apr_table_setn(r->headers_out, "Accept-Ranges", "bytes");
+
+    if ((errstatus = ap_meets_conditions(r)) != OK) {
+        apr_file_close(fd);
+        r->status = errstatus;
+        return r->status;
+    }
+
+    ap_set_content_length(r, finfo.size);
+
+    bb = apr_brigade_create(r->pool, r->connection->bucket_alloc);
+    apr_brigade_insert_file(bb, fd, 0, finfo.size, r->pool);
+    APR_BRIGADE_INSERT_TAIL(bb, apr_bucket_eos_create(bb->bucket_alloc));
+
+    rv = ap_pass_brigade(r->output_filters, bb);
+    if (rv != APR_SUCCESS) {
+        ap_log_rerror(APLOG_MARK, APLOG_DEBUG, rv, r,
+                      "sending %s failed", path);
+        return AP_FILTER_ERROR;
+    }
+
+    return OK;
+}
+
 /* Display a raw mail from cache. No processing is done here. */
 int mbox_raw_message(request_rec *r, apr_file_t *f)
 {
     int errstatus;
+    int indexed = 0;
     mbox_mime_message_t *mime_part;
     Message *m;
 
@@ -936,7 +630,7 @@ int mbox_raw_message(request_rec *r, apr_file_t *f)
     }
 
     /* Fetch message */
-    m = fetch_message(r, f, msgID);
+    m = fetch_message_info(r, f, msgID);
     if (!m) {
         return HTTP_NOT_FOUND;
     }
@@ -946,7 +640,17 @@ int mbox_raw_message(request_rec *r, apr_file_t *f)
         return r->status;
     }
 
-    if (!m->raw_msg) {
+    /* If the index knows the MIME structure of the message, a part is
+       read on its own, and nothing needs parsing. */
+    if (part && *part
+        && mbox_fetch_mime_index(r, m, &m->mime_msg) == APR_SUCCESS) {
+        indexed = 1;
+    }
+    else if (m->body_end > m->msg_start) {
+        load_message(r->pool, f, m);
+    }
+
+    if (!indexed && !m->raw_msg) {
         ap_set_content_type(r, "text/plain");
         ap_rprintf(r, "%s", MBOX_FETCH_ERROR_STR);
     }
@@ -969,16 +673,19 @@ int mbox_raw_message(request_rec *r, apr_file_t *f)
         return OK;
     }
 
-    /* First, parse the MIME structure, and look for the correct
-       subpart */
-    m->mime_msg = mbox_mime_decode_multipart(r, r->pool, m->raw_body,
-                                             m->content_type,
-                                             m->charset,
-                                             m->cte, m->boundary);
+    /* First, parse the top of the MIME structure, and walk down to the
+       correct subpart; parts off that path are never parsed. */
+    if (!indexed) {
+        m->mime_msg = mbox_mime_decode_multipart(r->pool, m->raw_body,
+                                                 m->content_type,
+                                                 m->charset,
+                                                 m->cte, m->boundary);
+    }
 
     mime_part = m->mime_msg;
 
     do {
+        mbox_mime_message_t *sub;
         int num;
 
         end = strchr(part, '/');
@@ -993,11 +700,9 @@ int mbox_raw_message(request_rec *r, apr_file_t *f)
             num = atoi(part);
         }
 
-        if (mime_part && num > 0 &&
-            (num <= mime_part->sub_count) &&
-            mime_part->sub[num - 1] &&
-            mime_part->sub[num - 1]->body != NULL) {
-            mime_part = mime_part->sub[num - 1];
+        sub = mbox_mime_get_part(r->pool, mime_part, num - 1);
+        if (sub) {
+            mime_part = sub;
         }
         else {
             return HTTP_NOT_FOUND;
@@ -1011,12 +716,38 @@ int mbox_raw_message(request_rec *r, apr_file_t *f)
         ap_set_content_type(r, mime_part->content_type);
     }
 
-    if (mime_part->body_len > 0) {
+    if (indexed && mime_part->store_key) {
+        mbox_dir_cfg_t *conf = ap_get_module_config(r->per_dir_config,
+                                                    &mbox_module);
+        if (conf->attach_store) {
+            int status = mbox_send_stored_part(r, conf->attach_store,
+                                               mime_part);
+            if (status != DECLINED) {
+                return status;
+            }
+        }
+    }
+
+    if (indexed && mime_part->body_len > 0) {
+        mime_part->body = fetch_message_span(r->pool, f,
+                                             m->body_start
+                                             + mime_part->body_offset,
+                                             mime_part->body_len);
+        if (!mime_part->body) {
+            return HTTP_INTERNAL_SERVER_ERROR;
+        }
+        ap_set_content_length(r, mime_part->decoded_len);
+    }
+
+    if (mime_part->body_len > 0
+        && mime_part->cte != CTE_BASE64 && mime_part->cte != CTE_QP) {
+        /* Nothing to decode: send the part as it is in the message. */
+        ap_rwrite(mime_part->body, mime_part->body_len, r);
+    }
+    else if (mime_part->body_len > 0) {
         const char *pdata;
         apr_size_t ret_len;
 
-        mime_part->body[mime_part->body_len] = 0;
-
         pdata = mbox_mime_decode_body(r->pool,
                                       mime_part->cte,
                                       mime_part->body,
@@ -1029,59 +760,139 @@ int mbox_raw_message(request_rec *r, apr_file_t *f)
     return OK;
 }
 
-static void mbox_static_message_nav(request_rec *r, char **context,
-                                    const char *baseURI, char *msgID)
+/* Display the body of the message view: the message itself, its
+ * context and its MIME structure.
+ */
+static void send_static_message(request_rec *r, apr_file_t *f,
+                                mbox_dir_cfg_t *conf, Message *m,
+                                const char *baseURI)
 {
-    ap_rputs("    <th class=\"nav\">", r);
+    mbox_out_t out;
+    apr_status_t rv;
 
-    /* Date navigation */
-    if (context[0]) {
-        ap_rprintf(r, "<a href=\"%s/%s\" "
-                   "title=\"Previous by date\">&laquo;</a>",
-                   baseURI, MSG_ID_ESCAPE_OR_BLANK(r->pool, context[0]));
+    mbox_out_init_request(&out, r);
+
+    rv = mbox_view_message(&out, f, m, fetch_context_msgids(r, f, m->msgID),
+                           baseURI, conf->antispam, 1);
+    if (rv != APR_SUCCESS) {
+        ap_log_rerror(APLOG_MARK, APLOG_ERR, rv, r,
+                      "conversion of the body of %s to utf-8 failed",
+                      m->msgID);
     }
-    else {
-        ap_rputs("&laquo;", r);
+}
+
+/* Send the page header of a message view */
+static void send_message_header(request_rec *r, const char *subject)
+{
+    mbox_page_cfg_t cfg;
+    mbox_out_t out;
+    apr_status_t rv;
+
+    mbox_page_cfg_init_request(&cfg, r);
+    mbox_out_init_request(&out, r);
+    ap_set_content_type(r, "text/html; charset=utf-8");
+
+    rv = mbox_page_message_header(&out, &cfg, subject, get_base_path(r),
+                                  get_base_name(r));
+    if (rv != APR_SUCCESS) {
+        ap_log_rerror(APLOG_MARK, APLOG_WARNING, rv, r,
+                      "mod_mbox: Can't include a file in the view of '%s'",
+                      r->filename);
     }
+}
+
+static void send_message_footer(request_rec *r)
+{
+    mbox_out_t out;
+
+    mbox_out_init_request(&out, r);
+    mbox_page_message_footer(&out);
+}
 
-    ap_rprintf(r, " <a href=\"%s/date\" "
-               "title=\"View messages sorted by date\">Date</a> ", baseURI);
+/* Sends the view of a message prerendered by mod-mbox-util, if there is
+ * one for the current index and settings.  Compressed views are sent
+ * as they are to the clients that accept them, if there is no chrome
+ * around them.  Returns DECLINED if the view must be rendered.
+ */
+static int send_prerendered(request_rec *r, mbox_dir_cfg_t *conf,
+                            const char *msgID, int display_chrome)
+{
+    mbox_frag_t *frag;
+    mbox_frag_info_t info;
+    mbox_frag_rec_t rec;
+    apr_finfo_t finfo;
+    apr_status_t rv;
+    const char *accepts;
+    int errstatus, inflate;
 
-    if (context[1]) {
-        ap_rprintf(r, "<a href=\"%s/%s\" "
-                   "title=\"Next by date\">&raquo;</a>",
-                   baseURI, MSG_ID_ESCAPE_OR_BLANK(r->pool, context[1]));
+    if (mbox_frag_open(&frag, r->pool, r->filename) != APR_SUCCESS) {
+        return DECLINED;
     }
-    else {
-        ap_rputs("&raquo;", r);
+
+    info.antispam = conf->antispam;
+    info.base_uri = get_base_uri(r);
+    if (mbox_index_stat(r, &finfo) != APR_SUCCESS) {
+        apr_file_close(frag->file);
+        return DECLINED;
     }
+    info.index_mtime = finfo.mtime;
+    info.index_size = finfo.size;
 
-    ap_rputs(" &middot; ", r);
+    if (!mbox_frag_matches(frag, &info)
+        || mbox_frag_fetch(frag, r->pool, msgID, &rec) != APR_SUCCESS) {
+        apr_file_close(frag->file);
+        return DECLINED;
+    }
+
+    r->mtime = rec.date;
+    ap_set_last_modified(r);
 
-    /* Thread navigation */
-    if (context[2]) {
-        ap_rprintf(r, "<a href=\"%s/%s\" "
-                   "title=\"Previous by thread\">&laquo;</a>",
-                   baseURI, MSG_ID_ESCAPE_OR_BLANK(r->pool, context[2]));
+    if ((errstatus = ap_meets_conditions(r)) != OK) {
+        r->status = errstatus;
+        return r->status;
     }
-    else {
-        ap_rputs("&laquo;", r);
+
+    inflate = frag->info.flags & MBOX_FRAG_GZIP;
+    if (inflate && !display_chrome) {
+        apr_table_mergen(r->headers_out, "Vary", "Accept-Encoding");
+
+        accepts = apr_table_get(r->headers_in, "Accept-Encoding");
+        if (accepts && (ap_find_token(r->pool, accepts, "gzip")
+                        || ap_find_token(r->pool, accepts, "x-gzip"))) {
+            apr_table_setn(r->headers_out, "Content-Encoding", "gzip");
+            inflate = 0;
+        }
+    }
+
+    if (display_chrome) {
+        send_message_header(r, rec.html_subject);
     }
 
-    ap_rprintf(r, " <a href=\"%s/thread\" "
-               "title=\"View messages sorted by thread\">Thread</a> ",
-               baseURI);
+    if (inflate) {
+        mbox_out_t out;
 
-    if (context[3]) {
-        ap_rprintf(r, "<a href=\"%s/%s\" "
-                   "title=\"Next by thread\">&raquo;</a>",
-                   baseURI, MSG_ID_ESCAPE_OR_BLANK(r->pool, context[3]));
+        mbox_out_init_request(&out, r);
+        rv = mbox_frag_read(frag, &rec, out.write, out.baton);
     }
     else {
-        ap_rputs("&raquo;", r);
+        apr_bucket_brigade *bb;
+
+        bb = apr_brigade_create(r->pool, r->connection->bucket_alloc);
+        apr_brigade_insert_file(bb, frag->file, rec.offset, rec.stored_len,
+                                r->pool);
+        rv = ap_pass_brigade(r->output_filters, bb);
+    }
+    if (rv != APR_SUCCESS) {
+        ap_log_rerror(APLOG_MARK, APLOG_DEBUG, rv, r,
+                      "mod_mbox: sending the prerendered view of %s failed",
+                      msgID);
+    }
+
+    if (display_chrome) {
+        send_message_footer(r);
     }
 
-    ap_rputs("</th>\n", r);
+    return OK;
 }
 
 /* Display a static XHTML mail */
@@ -1091,8 +902,10 @@ int mbox_static_message(request_rec *r, apr_file_t *f)
     mbox_dir_cfg_t *conf;
     Message *m;
 
-    const char *baseURI;
-    char *from, **context, *msgID, *escaped_msgID, *subject;
+    const char *baseURI, *key, *subject;
+    char *msgID;
+    mbox_rendered_t page;
+    mbox_capture_t *cap = NULL;
 
     conf = ap_get_module_config(r->per_dir_config, &mbox_module);
     baseURI = get_base_uri(r);
@@ -1114,9 +927,27 @@ int mbox_static_message(request_rec *r, apr_file_t *f)
     /* msgID should be the part of the URI that Apache could not resolve
      * on its own.  Grab it and skip over the expected /. */
     msgID = r->path_info + 1;
-    m = fetch_message(r, f, msgID);
-    if (!m) {
-        return HTTP_NOT_FOUND;
+
+    errstatus = send_prerendered(r, conf, msgID, display_chrome);
+    if (errstatus != DECLINED) {
+        return errstatus;
+    }
+
+    /* The page only changes with the index. */
+    key = mbox_msgcache_key(r, "static", msgID);
+    if (key && mbox_msgcache_get(r, key, &page)) {
+        m = NULL;
+        r->mtime = page.date;
+        ap_set_last_modified(r);
+        subject = page.subject;
+    }
+    else {
+        page.data = NULL;
+        m = fetch_message_info(r, f, msgID);
+        if (!m) {
+            return HTTP_NOT_FOUND;
+        }
+        subject = m->html_subject;
     }
 
     if ((errstatus = ap_meets_conditions(r)) != OK) {
@@ -1124,102 +955,30 @@ int mbox_static_message(request_rec *r, apr_file_t *f)
         return r->status;
     }
 
-    /* Parse multipart information */
-    m->mime_msg = mbox_mime_decode_multipart(r, r->pool, m->raw_body,
-                                             m->content_type,
-                                             m->charset,
-                                             m->cte, m->boundary);
-
-    subject = ESCAPE_AND_CONV_HDR(r->pool, m->subject);
-
-
     if (display_chrome) {
-        send_page_header(r, subject,
-                         apr_psprintf(r->pool, "%s mailing list archives",
-                                      get_base_name(r)));
-
-        ap_rputs("  <h5>\n", r);
-
-        if (conf->root_path) {
-            ap_rprintf(r, "<a href=\"%s\" title=\"Back to the archives depot\">"
-                    "Site index</a> &middot; ", conf->root_path);
-        }
-
-        ap_rprintf(r, "<a href=\"%s\" title=\"Back to the list index\">"
-                "List index</a></h5>", get_base_path(r));
+        send_message_header(r, subject);
     }
 
-    /* Display context message list */
-    from = mbox_cte_decode_header(r->pool, m->from);
-    if (conf->antispam) {
-        from = email_antispam(from);
+    if (page.data) {
+        ap_rwrite(page.data, page.len, r);
     }
-    from = ESCAPE_OR_BLANK(r->pool, from);
+    else {
+        /* Fetch (or parse) the MIME structure */
+        m->mime_msg = mbox_fetch_message_mime(r, r->pool, f, m);
 
-    ap_rputs("  <div id=\"msgview-inner\">\n", r);
-    ap_rputs("  <table id=\"msgview\">\n", r);
-
-    context = fetch_context_msgids(r, f, m->msgID);
-
-    /* Top navigation */
-    ap_rputs("   <thead>\n"
-                "    <tr>\n" "    <th class=\"title\">Message view</th>\n", r);
-    mbox_static_message_nav(r, context, baseURI, m->msgID);
-    ap_rputs("   </tr>\n" "   </thead>\n\n", r);
-
-    /* Bottom navigation */
-    ap_rputs("   <tfoot>\n"
-                "    <tr>\n"
-                "    <th class=\"title\"><a href=\"#archives\">Top</a></th>\n",
-                r);
-    mbox_static_message_nav(r, context, baseURI, m->msgID);
-    ap_rputs("   </tr>\n" "   </tfoot>\n\n", r);
-
-    /* Headers */
-    ap_rputs("   <tbody>\n", r);
-    ap_rprintf(r, "   <tr class=\"from\">\n"
-               "    <td class=\"left\"><strong>From</strong></td>\n"
-               "    <td class=\"right\">%s</td>\n" "   </tr>\n", from);
-
-    ap_rprintf(r, "   <tr class=\"subject\">\n"
-               "    <td class=\"left\"><strong>Subject</strong></td>\n"
-               "    <td class=\"right\">%s</td>\n"
-               "   </tr>\n", subject);
-
-    ap_rprintf(r, "   <tr class=\"date\">\n"
-               "    <td class=\"left\"><strong>Date</strong></td>\n"
-               "    <td class=\"right\">%s</td>\n"
-               "   </tr>\n", ESCAPE_OR_BLANK(r->pool, m->rfc822_date));
-
-    /* Message body */
-    ap_rputs("   <tr class=\"contents\"><td colspan=\"2\"><pre>\n", r);
-    ap_rprintf(r, "%s",
-               mbox_wrap_text(mbox_mime_get_body(r, r->pool, m->mime_msg)));
-    ap_rputs("</pre></td></tr>\n", r);
-
-    /* MIME structure */
-    ap_rputs("   <tr class=\"mime\">\n"
-             "    <td class=\"left\">Mime</td>\n"
-             "    <td class=\"right\">\n<ul>\n", r);
-    escaped_msgID = MSG_ID_ESCAPE_OR_BLANK(r->pool, m->msgID);
-    mbox_mime_display_static_structure(r, m->mime_msg,
-                                       apr_psprintf(r->pool, "%s/raw/%s/",
-                                                    baseURI, escaped_msgID));
-    ap_rputs("</ul>\n</td>\n</tr>\n", r);
-
-    ap_rprintf(r, "   <tr class=\"raw\">\n"
-               "    <td class=\"left\"></td>\n"
-               "    <td class=\"right\"><a href=\"%s/raw/%s\" rel=\"nofollow\">View raw message</a></td>\n"
-               "   </tr>\n", baseURI, escaped_msgID);
-
-    ap_rputs("   </tbody>\n", r);
-    ap_rputs("  </table>\n", r);
-    ap_rputs("  </div><!-- /#msgview-inner -->\n", r);
+        if (key) {
+            cap = mbox_msgcache_capture(r);
+        }
+        send_static_message(r, f, conf, m, baseURI);
+        if (cap && (page.data = mbox_msgcache_captured(r, cap, &page.len))) {
+            page.date = m->date;
+            page.subject = subject;
+            mbox_msgcache_put(r, key, &page);
+        }
+    }
 
     if (display_chrome) {
-        ap_rputs(" </div><!-- /#cont -->\n", r);
-        ap_rputs(" </body>\n", r);
-        ap_rputs("</html>\n", r);
+        send_message_footer(r);
     }
 
     return OK;
@@ -1231,43 +990,53 @@ apr_status_t mbox_xml_message(request_rec *r, apr_file_t *f)
     mbox_dir_cfg_t *conf;
     Message *m;
     char *from, *subj, *msgID;
+    const char *key;
+    mbox_rendered_t page;
+    mbox_capture_t *cap = NULL;
 
     conf = ap_get_module_config(r->per_dir_config, &mbox_module);
 
     /* Here, we skip 6 chars (/ajax/). */
     msgID = r->path_info + 6;
 
-    m = fetch_message(r, f, msgID);
+    key = mbox_msgcache_key(r, "xml", msgID);
+    if (key && mbox_msgcache_get(r, key, &page)) {
+        r->mtime = page.date;
+        ap_set_last_modified(r);
+        ap_rwrite(page.data, page.len, r);
+        return OK;
+    }
+
+    m = fetch_message_info(r, f, msgID);
     if (!m) {
         return HTTP_NOT_FOUND;
     }
 
-    /* Parse multipart information */
-    m->mime_msg = mbox_mime_decode_multipart(r, r->pool, m->raw_body,
-                                             m->content_type,
-                                             m->charset,
-                                             m->cte, m->boundary);
+    /* Fetch (or parse) the MIME structure */
+    m->mime_msg = mbox_fetch_message_mime(r, r->pool, f, m);
+
+    if (key) {
+        cap = mbox_msgcache_capture(r);
+    }
 
     ap_rputs("<?xml version=\"1.0\" encoding=\"UTF-8\"?>\n", r);
 
     from = mbox_cte_decode_header(r->pool, m->from);
     if (conf->antispam) {
-        from = email_antispam(from);
+        from = mbox_email_antispam(from);
     }
     from = ESCAPE_OR_BLANK(r->pool, from);
-    subj = ESCAPE_AND_CONV_HDR(r->pool, m->subject);
+    subj = m->html_subject;
 
     ap_rprintf(r, "<mail id=\"%s\">\n"
                " <from><![CDATA[%s]]></from>\n"
                " <subject><![CDATA[%s]]></subject>\n"
                " <date><![CDATA[%s]]></date>\n"
                " <contents><![CDATA[",
-               MSG_ID_ESCAPE_OR_BLANK(r->pool, m->msgID),
-               from, subj,
+               m->uri_msgID, from, subj,
                ESCAPE_OR_BLANK(r->pool, m->rfc822_date));
 
-    ap_rprintf(r, "%s",
-               mbox_cntrl_escape(r->pool, mbox_wrap_text(mbox_mime_get_body(r, r->pool, m->mime_msg))));
+    mbox_mime_send_body(r, f, m, MBOX_RENDER_CNTRL);
     ap_rputs("]]></contents>\n", r);
     ap_rputs(" <mime>\n", r);
     mbox_mime_display_xml_structure(r, m->mime_msg,
@@ -1275,5 +1044,11 @@ apr_status_t mbox_xml_message(request_rec *r, apr_file_t *f)
     ap_rputs(" </mime>\n", r);
     ap_rputs("</mail>\n", r);
 
+    if (cap && (page.data = mbox_msgcache_captured(r, cap, &page.len))) {
+        page.date = m->date;
+        page.subject = NULL;
+        mbox_msgcache_put(r, key, &page);
+    }
+
     return OK;
 }
@@ -0,0 +1,1375 @@
+/* Licensed to the Apache Software Foundation (ASF) under one or more
+ * contributor license agreements.  See the NOTICE file distributed with
+ * this work for additional information regarding copyright ownership.
+ * The ASF licenses this file to You under the Apache License, Version 2.0
+ * (the "License"); you may not use this file except in compliance with
+ * the License.  You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+/**
+ * Full-text search of a list, at LIST/search?q=QUERY, through the
+ * indexes of its mailboxes that mod-mbox-util -s builds (see
+ * mbox_fts.h).  Results are by relevance, or by date with sort=date,
+ * and paged with page=N.
+ *
+ * The threads whose subject contains what is typed in a search box are
+ * at LIST/ajax/subjects?q=TEXT (and n=COUNT), as XML, through the subject
+ * index it also builds (see mbox_subject.h).
+ *
+ * The messages of a list can be filtered, at LIST/filter, on their
+ * author (from=NAME, or from=START* for the names that start so), dates
+ * (after=DATE and before=DATE, as YYYY[-MM[-DD]]), subject (subject=TEXT)
+ * and attachments (attachment=1), through the columns mod-mbox-util -s
+ * writes next to each mailbox (see mbox_column.h).
+ *
+ * The messages of an author, in all the months of the list, are at
+ * LIST/author/NAME, newest first and paged with page=N, through the
+ * author index mod-mbox-util -s also builds (see mbox_author.h).
+ *
+ * The messages of several months, from one date to another, are at
+ * LIST/range (after=DATE and before=DATE, or days=N for the last N
+ * days), newest first and paged with page=N.  The columns of the months
+ * of a page are merged by date (see mbox_column_merge()); the months
+ * before it are skipped by their number of messages.
+ *
+ * The directory of the lists has a search across them, at
+ * DIR/search?q=QUERY, with lists=PATTERN to search some of them.  Each
+ * list is searched on its own, on the threads of a pool each process
+ * keeps (see MboxSearchThreads), and the best hits of each are merged.
+ * Lists that are not searched by the deadline are left out, and named.
+ */
+
+#include "mod_mbox.h"
+
+#if APR_HAS_THREADS
+#include "apr_thread_cond.h"
+#include "apr_thread_mutex.h"
+#include "apr_thread_pool.h"
+#endif
+
+#ifdef APLOG_USE_MODULE
+APLOG_USE_MODULE(mbox);
+#endif
+
+/* Deeper pages are not worth the hits kept to reach them. */
+#define MBOX_SEARCH_MAX_PAGE 100
+
+/* Searches across lists give up on the lists left after this long. */
+#define MBOX_SITE_SEARCH_DEADLINE apr_time_from_sec(3)
+
+/* Threads of each process searching lists, by default */
+#define MBOX_SEARCH_THREADS 4
+
+/* Threads suggested by default, and at most */
+#define MBOX_SUBJECTS_DEFAULT 10
+#define MBOX_SUBJECTS_MAX 50
+
+int mbox_search_handler(request_rec *r, mbox_cache_info *mli)
+{
+    apr_table_t *args;
+    apr_array_header_t *files, *boxes, *hits = NULL;
+    mbox_fts_query_t *q;
+    mbox_fts_t *fts;
+    mbox_file_t *fi;
+    mbox_page_cfg_t cfg;
+    mbox_out_t out;
+    const char *query, *arg, *base_path, *dir, *search_uri;
+    int order = MBOX_FTS_BY_RELEVANCE, page = 0, i;
+    apr_size_t len;
+    apr_status_t rv;
+
+    /* Only allow GETs */
+    r->allowed |= (AP_METHOD_BIT << M_GET);
+    if (r->method_number != M_GET) {
+        return HTTP_METHOD_NOT_ALLOWED;
+    }
+
+    ap_args_to_table(r, &args);
+    query = apr_table_get(args, "q");
+    arg = apr_table_get(args, "sort");
+    if (arg && strcmp(arg, "date") == 0) {
+        order = MBOX_FTS_BY_DATE;
+    }
+    arg = apr_table_get(args, "page");
+    if (arg) {
+        page = atoi(arg);
+        if (page < 0 || page > MBOX_SEARCH_MAX_PAGE) {
+            return HTTP_NOT_FOUND;
+        }
+    }
+
+    /* The list is what comes before /search. */
+    len = strlen(r->uri) - strlen(r->path_info);
+    base_path = apr_pstrcat(r->pool, apr_pstrndup(r->pool, r->uri, len),
+                            "/", NULL);
+    len = strlen(r->filename);
+    dir = (len && r->filename[len - 1] == '/') ? r->filename
+        : apr_pstrcat(r->pool, r->filename, "/", NULL);
+
+    ap_set_content_type(r, "text/html; charset=utf-8");
+
+    if (r->header_only) {
+        return OK;
+    }
+
+    if (query && *query) {
+        if (mbox_fts_query_parse(&q, r->pool, query) == APR_SUCCESS) {
+            files = mbox_fetch_boxes_list(r, mli, (char *) dir);
+            boxes = apr_array_make(r->pool, files ? files->nelts : 1,
+                                   sizeof(mbox_fts_t *));
+            fi = files ? (mbox_file_t *) files->elts : NULL;
+            for (i = 0; files && i < files->nelts; i++) {
+                rv = mbox_fts_open(&fts, r->pool,
+                                   apr_pstrcat(r->pool, dir, fi[i].filename,
+                                               NULL));
+                if (rv == APR_SUCCESS) {
+                    APR_ARRAY_PUSH(boxes, mbox_fts_t *) = fts;
+                }
+                else if (rv != APR_NOTFOUND) {
+                    ap_log_rerror(APLOG_MARK, APLOG_WARNING, rv, r,
+                                  "mod_mbox: Can't open the search index of '%s%s'",
+                                  dir, fi[i].filename);
+                }
+            }
+
+            /* One more than the page holds tells whether there is a
+               next page. */
+            mbox_fts_search(&hits, r->pool, (mbox_fts_t **) boxes->elts,
+                            boxes->nelts, q, order,
+                            (page + 1) * MBOX_SEARCH_PER_PAGE + 1, NULL);
+        }
+        else {
+            hits = apr_array_make(r->pool, 1, sizeof(mbox_fts_hit_t));
+        }
+    }
+    else {
+        query = NULL;
+    }
+
+    search_uri = apr_pstrcat(r->pool, base_path, "search?q=",
+                             mbox_escape_query(r->pool, query ? query : ""),
+                             order == MBOX_FTS_BY_DATE ? "&sort=date" : "",
+                             NULL);
+
+    mbox_page_cfg_init_request(&cfg, r);
+    mbox_out_init_request(&out, r);
+
+    rv = mbox_page_search(&out, &cfg, mli, base_path, query, order,
+                          search_uri, hits, page);
+    if (rv != APR_SUCCESS) {
+        ap_log_rerror(APLOG_MARK, APLOG_WARNING, rv, r,
+                      "mod_mbox: Can't include a file in the search page of '%s'",
+                      r->filename);
+        return DECLINED;
+    }
+
+    return OK;
+}
+
+int mbox_subjects_handler(request_rec *r, mbox_cache_info *mli)
+{
+    apr_table_t *args;
+    apr_array_header_t *hits;
+    mbox_subject_index_t *idx;
+    mbox_subject_hit_t *hit;
+    mbox_out_t out;
+    const char *query, *arg, *dir;
+    int count = MBOX_SUBJECTS_DEFAULT, i;
+    apr_size_t len;
+    apr_status_t rv;
+
+    /* Only allow GETs */
+    r->allowed |= (AP_METHOD_BIT << M_GET);
+    if (r->method_number != M_GET) {
+        return HTTP_METHOD_NOT_ALLOWED;
+    }
+
+    ap_args_to_table(r, &args);
+    query = apr_table_get(args, "q");
+    arg = apr_table_get(args, "n");
+    if (arg) {
+        count = atoi(arg);
+        if (count < 1 || count > MBOX_SUBJECTS_MAX) {
+            count = MBOX_SUBJECTS_MAX;
+        }
+    }
+
+    len = strlen(r->filename);
+    dir = (len && r->filename[len - 1] == '/') ? r->filename
+        : apr_pstrcat(r->pool, r->filename, "/", NULL);
+
+    rv = mbox_subject_open(&idx, r->pool, dir);
+    if (rv != APR_SUCCESS) {
+        if (rv != APR_NOTFOUND) {
+            ap_log_rerror(APLOG_MARK, APLOG_WARNING, rv, r,
+                          "mod_mbox: Can't open the subject index of '%s'",
+                          dir);
+        }
+        return HTTP_NOT_FOUND;
+    }
+
+    ap_set_content_type(r, "application/xml");
+
+    if (r->header_only) {
+        return OK;
+    }
+
+    mbox_subject_search(&hits, r->pool, idx, query ? query : "", count);
+
+    mbox_out_init_request(&out, r);
+    mbox_out_puts(&out, "<?xml version=\"1.0\" encoding=\"UTF-8\"?>\n");
+    mbox_out_puts(&out, "<subjects>\n");
+
+    hit = (mbox_subject_hit_t *) hits->elts;
+    for (i = 0; i < hits->nelts; i++) {
+        mbox_out_printf(&out, " <thread box=\"%s\" id=\"%s\" count=\"%u\">\n",
+                        ESCAPE_OR_BLANK(r->pool, hit[i].box),
+                        ESCAPE_OR_BLANK(r->pool, hit[i].uri_msgID),
+                        hit[i].count);
+        mbox_out_printf(&out, "  <date><![CDATA[%s]]></date>\n",
+                        hit[i].str_date);
+        mbox_out_printf(&out, "  <subject><![CDATA[%s]]></subject>\n",
+                        hit[i].html_subject);
+        mbox_out_puts(&out, " </thread>\n");
+    }
+
+    mbox_out_puts(&out, "</subjects>\n");
+
+    return OK;
+}
+
+/* The messages of a mailbox a filter matches */
+typedef struct filter_box
+{
+    const char *box;
+    mbox_column_t *cols;
+    apr_array_header_t *ordinals;
+} filter_box_t;
+
+int mbox_filter_handler(request_rec *r, mbox_cache_info *mli)
+{
+    static const char *const fields[] = {
+        "from", "subject", "after", "before", "attachment", NULL
+    };
+    apr_table_t *args;
+    apr_array_header_t *files, *boxes;
+    mbox_file_t *fi;
+    mbox_filter_t filter;
+    mbox_msglist_t l;
+    mbox_page_cfg_t cfg;
+    mbox_out_t out;
+    MBOX_LIST *head = NULL, **tail = &head;
+    const char *arg, *base_path, *dir, *filter_uri;
+    char *origfilename;
+    apr_dbm_t *db;
+    int page = 0, count = 0, shown = 0, i, j;
+    apr_int64_t skip;
+    apr_size_t len;
+    apr_status_t rv;
+
+    /* Only allow GETs */
+    r->allowed |= (AP_METHOD_BIT << M_GET);
+    if (r->method_number != M_GET) {
+        return HTTP_METHOD_NOT_ALLOWED;
+    }
+
+    memset(&filter, 0, sizeof(filter));
+    ap_args_to_table(r, &args);
+
+    /* Fields left empty in the form are not part of the filter. */
+    for (i = 0; fields[i]; i++) {
+        arg = apr_table_get(args, fields[i]);
+        if (arg && !*arg) {
+            apr_table_unset(args, fields[i]);
+        }
+    }
+
+    arg = apr_table_get(args, "from");
+    if (arg) {
+        len = strlen(arg);
+        filter.author_prefix = (arg[len - 1] == '*');
+        filter.author = mbox_author_fold(r->pool,
+                                         apr_pstrndup(r->pool, arg,
+                                                      len - filter.author_prefix));
+    }
+    arg = apr_table_get(args, "subject");
+    if (arg) {
+        filter.subject = mbox_subject_normalize(r->pool, arg);
+    }
+    arg = apr_table_get(args, "after");
+    if (arg && mbox_arg_date(&filter.after, arg) != APR_SUCCESS) {
+        return HTTP_BAD_REQUEST;
+    }
+    arg = apr_table_get(args, "before");
+    if (arg && mbox_arg_date(&filter.before, arg) != APR_SUCCESS) {
+        return HTTP_BAD_REQUEST;
+    }
+    if (apr_table_get(args, "attachment")) {
+        filter.flags |= MBOX_COLUMN_ATTACHMENT;
+    }
+    arg = apr_table_get(args, "page");
+    if (arg) {
+        page = atoi(arg);
+        if (page < 0) {
+            return HTTP_NOT_FOUND;
+        }
+    }
+
+    /* The list is what comes before /filter. */
+    len = strlen(r->uri) - strlen(r->path_info);
+    base_path = apr_pstrcat(r->pool, apr_pstrndup(r->pool, r->uri, len),
+                            "/", NULL);
+    len = strlen(r->filename);
+    dir = (len && r->filename[len - 1] == '/') ? r->filename
+        : apr_pstrcat(r->pool, r->filename, "/", NULL);
+
+    filter_uri = "";
+    for (i = 0; fields[i]; i++) {
+        arg = apr_table_get(args, fields[i]);
+        if (arg) {
+            filter_uri = apr_pstrcat(r->pool, filter_uri, "&", fields[i], "=",
+                                     mbox_escape_query(r->pool, arg), NULL);
+        }
+    }
+
+    ap_set_content_type(r, "text/html; charset=utf-8");
+
+    if (r->header_only) {
+        return OK;
+    }
+
+    mbox_page_cfg_init_request(&cfg, r);
+    mbox_out_init_request(&out, r);
+
+    if (!*filter_uri) {
+        rv = mbox_page_filter(&out, &cfg, mli, base_path, args, "", NULL, 0,
+                              0);
+    }
+    else {
+        filter_uri = apr_pstrcat(r->pool, base_path, "filter?",
+                                 filter_uri + 1, NULL);
+
+        /* Only the ordinals of the messages that match are gathered, from
+           the newest mailbox to the oldest. */
+        files = mbox_fetch_boxes_list(r, mli, (char *) dir);
+        boxes = apr_array_make(r->pool, files ? files->nelts : 1,
+                               sizeof(filter_box_t));
+        fi = files ? (mbox_file_t *) files->elts : NULL;
+        for (i = 0; files && i < files->nelts; i++) {
+            filter_box_t *b;
+            mbox_column_t *cols;
+
+            rv = mbox_column_open_current(&cols, r->pool,
+                                          apr_pstrcat(r->pool, dir,
+                                                      fi[i].filename, NULL));
+            if (rv != APR_SUCCESS) {
+                if (rv != APR_NOTFOUND) {
+                    ap_log_rerror(APLOG_MARK, APLOG_WARNING, rv, r,
+                                  "mod_mbox: Can't open the columns of '%s%s'",
+                                  dir, fi[i].filename);
+                }
+                continue;
+            }
+
+            b = apr_array_push(boxes);
+            b->box = fi[i].filename;
+            b->cols = cols;
+            mbox_column_filter(&b->ordinals, r->pool, cols, &filter);
+            count += b->ordinals->nelts;
+        }
+
+        /* Pages past the last are not found: skip stays within count. */
+        if (page > 0 && page > (count - 1) / DEFAULT_MSGS_PER_PAGE) {
+            return HTTP_NOT_FOUND;
+        }
+
+        /* Then the messages of the page, and only those, are loaded. */
+        origfilename = r->filename;
+        skip = (apr_int64_t) page * DEFAULT_MSGS_PER_PAGE;
+        for (i = 0; i < boxes->nelts && shown < DEFAULT_MSGS_PER_PAGE; i++) {
+            filter_box_t *b = &APR_ARRAY_IDX(boxes, i, filter_box_t);
+            apr_uint32_t *ordinal = (apr_uint32_t *) b->ordinals->elts;
+
+            if (skip >= b->ordinals->nelts) {
+                skip -= b->ordinals->nelts;
+                continue;
+            }
+
+            r->filename = apr_pstrcat(r->pool, dir, b->box, NULL);
+            if (mbox_open_index(r, &db) != APR_SUCCESS) {
+                skip = 0;
+                continue;
+            }
+            for (j = b->ordinals->nelts - 1 - skip;
+                 j >= 0 && shown < DEFAULT_MSGS_PER_PAGE; j--) {
+                Message *m = mbox_fetch_index_db(r, db,
+                                                 mbox_column_msgid(b->cols,
+                                                                   ordinal[j]));
+                if (!m) {
+                    continue;
+                }
+                m->uri_msgID = apr_pstrcat(r->pool, b->box, "/",
+                                           m->uri_msgID, NULL);
+
+                *tail = apr_pcalloc(r->pool, sizeof(MBOX_LIST));
+                (*tail)->key = m->date;
+                (*tail)->value = m;
+                tail = &(*tail)->next;
+                shown++;
+            }
+            apr_dbm_close(db);
+            skip = 0;
+        }
+        r->filename = origfilename;
+
+        mbox_msglist_init(&l, r->pool, head, shown, MBOX_SORT_REVERSE_DATE);
+        rv = mbox_page_filter(&out, &cfg, mli, base_path, args, filter_uri,
+                              &l, count, page);
+    }
+    if (rv != APR_SUCCESS) {
+        ap_log_rerror(APLOG_MARK, APLOG_WARNING, rv, r,
+                      "mod_mbox: Can't include a file in the filter page of '%s'",
+                      r->filename);
+        return DECLINED;
+    }
+
+    return OK;
+}
+
+int mbox_author_handler(request_rec *r, mbox_cache_info *mli)
+{
+    apr_array_header_t *postings;
+    mbox_author_index_t *idx;
+    mbox_msglist_t l;
+    mbox_page_cfg_t cfg;
+    mbox_out_t out;
+    MBOX_LIST *head = NULL, **tail = &head;
+    const char *key, *name, *arg, *base_path, *dir, *author_uri;
+    const char *box = NULL;
+    char *origfilename;
+    apr_dbm_t *db = NULL;
+    apr_table_t *args;
+    apr_uint32_t count;
+    int page = 0, shown = 0, i;
+    apr_size_t len;
+    apr_status_t rv;
+
+    /* Only allow GETs */
+    r->allowed |= (AP_METHOD_BIT << M_GET);
+    if (r->method_number != M_GET) {
+        return HTTP_METHOD_NOT_ALLOWED;
+    }
+
+    /* Names may be typed as they are shown: they are folded to keys. */
+    key = mbox_author_fold(r->pool, r->path_info + strlen("/author/"));
+    if (!*key) {
+        return HTTP_NOT_FOUND;
+    }
+
+    ap_args_to_table(r, &args);
+    arg = apr_table_get(args, "page");
+    if (arg) {
+        page = atoi(arg);
+        if (page < 0) {
+            return HTTP_NOT_FOUND;
+        }
+    }
+
+    /* The list is what comes before /author/. */
+    len = strlen(r->uri) - strlen(r->path_info);
+    base_path = apr_pstrcat(r->pool, apr_pstrndup(r->pool, r->uri, len),
+                            "/", NULL);
+    len = strlen(r->filename);
+    dir = (len && r->filename[len - 1] == '/') ? r->filename
+        : apr_pstrcat(r->pool, r->filename, "/", NULL);
+
+    rv = mbox_author_open(&idx, r->pool, dir);
+    if (rv != APR_SUCCESS) {
+        if (rv != APR_NOTFOUND) {
+            ap_log_rerror(APLOG_MARK, APLOG_WARNING, rv, r,
+                          "mod_mbox: Can't open the author index of '%s'",
+                          dir);
+        }
+        return HTTP_NOT_FOUND;
+    }
+
+    /* Pages past the last are not found: the first message of the page
+       stays within count. */
+    count = mbox_author_count(idx, key, &name);
+    if (!count
+        || (apr_uint32_t) page > (count - 1) / DEFAULT_MSGS_PER_PAGE) {
+        return HTTP_NOT_FOUND;
+    }
+
+    ap_set_content_type(r, "text/html; charset=utf-8");
+
+    if (r->header_only) {
+        return OK;
+    }
+
+    /* Only the messages of the page are loaded, from their mailboxes. */
+    mbox_author_postings(&postings, r->pool, idx, key,
+                         (apr_uint32_t) page * DEFAULT_MSGS_PER_PAGE,
+                         DEFAULT_MSGS_PER_PAGE);
+    origfilename = r->filename;
+    for (i = 0; i < postings->nelts; i++) {
+        mbox_author_posting_t *posting =
+            &APR_ARRAY_IDX(postings, i, mbox_author_posting_t);
+        Message *m;
+
+        /* Postings come by date, so mostly a mailbox at a time. */
+        if (!box || strcmp(box, posting->box) != 0) {
+            if (db) {
+                apr_dbm_close(db);
+                db = NULL;
+            }
+            box = posting->box;
+            r->filename = apr_pstrcat(r->pool, dir, box, NULL);
+            if (mbox_open_index(r, &db) != APR_SUCCESS) {
+                db = NULL;
+            }
+        }
+        m = db ? mbox_fetch_index_db(r, db, posting->msgID) : NULL;
+        if (!m) {
+            continue;
+        }
+        m->uri_msgID = apr_pstrcat(r->pool, posting->box, "/",
+                                   m->uri_msgID, NULL);
+
+        *tail = apr_pcalloc(r->pool, sizeof(MBOX_LIST));
+        (*tail)->key = m->date;
+        (*tail)->value = m;
+        tail = &(*tail)->next;
+        shown++;
+    }
+    if (db) {
+        apr_dbm_close(db);
+    }
+    r->filename = origfilename;
+
+    mbox_page_cfg_init_request(&cfg, r);
+    mbox_out_init_request(&out, r);
+
+    author_uri = apr_pstrcat(r->pool, base_path, "author/",
+                             mbox_escape_msgid(r->pool, key), NULL);
+    mbox_msglist_init(&l, r->pool, head, shown, MBOX_SORT_REVERSE_DATE);
+    rv = mbox_page_author(&out, &cfg, mli, base_path, name, author_uri, &l,
+                          (int) count, page);
+    if (rv != APR_SUCCESS) {
+        ap_log_rerror(APLOG_MARK, APLOG_WARNING, rv, r,
+                      "mod_mbox: Can't include a file in the author page of '%s'",
+                      r->filename);
+        return DECLINED;
+    }
+
+    return OK;
+}
+
+/* Ranges of dates */
+
+/* A mailbox with messages of a range */
+typedef struct range_box
+{
+    const char *box;
+    mbox_column_t *cols;        /* Opened if its messages are counted or
+                                   shown */
+    apr_uint32_t begin;         /* Its messages in the range */
+    apr_uint32_t end;
+    int count;
+} range_box_t;
+
+/* Sets *start and *end to the month a mailbox (YYYYMM.mbox) is of. */
+static apr_status_t range_month(apr_time_t *start, apr_time_t *end,
+                                apr_pool_t *p, const char *box)
+{
+    int year, month;
+
+    if (strspn(box, "0123456789") < 6
+        || sscanf(box, "%4d%2d", &year, &month) != 2
+        || mbox_arg_date(start, apr_psprintf(p, "%d-%d", year,
+                                             month)) != APR_SUCCESS) {
+        return APR_EINVAL;
+    }
+    if (month == 12) {
+        year++;
+        month = 0;
+    }
+    return mbox_arg_date(end, apr_psprintf(p, "%d-%d", year, month + 1));
+}
+
+/* Formats a date of a range, as in its arguments. */
+static const char *range_date(apr_pool_t *p, apr_time_t t)
+{
+    apr_time_exp_t tm;
+
+    apr_time_exp_gmt(&tm, t);
+    return apr_psprintf(p, "%04d-%02d-%02d", tm.tm_year + 1900,
+                        tm.tm_mon + 1, tm.tm_mday);
+}
+
+int mbox_range_handler(request_rec *r, mbox_cache_info *mli)
+{
+    static const char *const fields[] = { "after", "before", "days", NULL };
+    apr_table_t *args;
+    apr_array_header_t *files, *boxes, *picks;
+    mbox_column_run_t *runs;
+    mbox_file_t *fi;
+    range_box_t *b;
+    mbox_msglist_t l;
+    mbox_page_cfg_t cfg;
+    mbox_out_t out;
+    MBOX_LIST *head = NULL, **tail = &head;
+    const char *arg, *base_path, *dir, *range_uri, *from, *to;
+    char *origfilename;
+    apr_time_t after = 0, before = 0, start, end;
+    apr_time_t day = apr_time_from_sec(MBOX_COLUMN_DAY);
+    int page = 0, count = 0, shown = 0, first, nruns, taken, days, i;
+    apr_int64_t skip;
+    const char **run_box;
+    apr_dbm_t **run_db;
+    apr_size_t len;
+    apr_status_t rv;
+
+    /* Only allow GETs */
+    r->allowed |= (AP_METHOD_BIT << M_GET);
+    if (r->method_number != M_GET) {
+        return HTTP_METHOD_NOT_ALLOWED;
+    }
+
+    ap_args_to_table(r, &args);
+    arg = apr_table_get(args, "after");
+    if (arg && *arg && mbox_arg_date(&after, arg) != APR_SUCCESS) {
+        return HTTP_BAD_REQUEST;
+    }
+    arg = apr_table_get(args, "before");
+    if (arg && *arg && mbox_arg_date(&before, arg) != APR_SUCCESS) {
+        return HTTP_BAD_REQUEST;
+    }
+    /* days=N is the last N days, today included. */
+    arg = apr_table_get(args, "days");
+    if (arg && *arg) {
+        days = atoi(arg);
+        if (days < 1 || days > 100 * 366) {
+            return HTTP_BAD_REQUEST;
+        }
+        after = (r->request_time / day - (days - 1)) * day;
+        before = 0;
+    }
+    arg = apr_table_get(args, "page");
+    if (arg) {
+        page = atoi(arg);
+        if (page < 0) {
+            return HTTP_NOT_FOUND;
+        }
+    }
+
+    /* The list is what comes before /range. */
+    len = strlen(r->uri) - strlen(r->path_info);
+    base_path = apr_pstrcat(r->pool, apr_pstrndup(r->pool, r->uri, len),
+                            "/", NULL);
+    len = strlen(r->filename);
+    dir = (len && r->filename[len - 1] == '/') ? r->filename
+        : apr_pstrcat(r->pool, r->filename, "/", NULL);
+
+    files = mbox_fetch_boxes_list(r, mli, (char *) dir);
+    if (!files) {
+        return HTTP_FORBIDDEN;
+    }
+
+    /* Mailboxes are listed newest first.  Messages may be dated the day
+       before or after the month of their mailbox: those of the months
+       that are in the range by a day or more are all in it, and counted
+       from the list information; those of the months at its ends are
+       counted through their columns. */
+    boxes = apr_array_make(r->pool, files->nelts + 1, sizeof(range_box_t));
+    fi = (mbox_file_t *) files->elts;
+    for (i = 0; i < files->nelts; i++) {
+        int whole = 0;
+
+        if (range_month(&start, &end, r->pool, fi[i].filename)
+            == APR_SUCCESS) {
+            if ((after && end + day <= after)
+                || (before && start >= before + day)) {
+                continue;
+            }
+            whole = (!after || start >= after + day)
+                && (!before || end + day <= before);
+        }
+
+        b = apr_array_push(boxes);
+        memset(b, 0, sizeof(*b));
+        b->box = fi[i].filename;
+        if (whole) {
+            b->count = fi[i].count;
+        }
+        else {
+            rv = mbox_column_open_current(&b->cols, r->pool,
+                                          apr_pstrcat(r->pool, dir, b->box,
+                                                      NULL));
+            if (rv != APR_SUCCESS) {
+                if (rv != APR_NOTFOUND) {
+                    ap_log_rerror(APLOG_MARK, APLOG_WARNING, rv, r,
+                                  "mod_mbox: Can't open the columns of '%s%s'",
+                                  dir, b->box);
+                }
+                boxes->nelts--;
+                continue;
+            }
+            mbox_column_range(b->cols, after, before, &b->begin, &b->end);
+            b->count = (int) (b->end - b->begin);
+        }
+        count += b->count;
+    }
+
+    /* Pages past the last are not found: skip stays within count. */
+    if (page > 0 && page > (count - 1) / DEFAULT_MSGS_PER_PAGE) {
+        return HTTP_NOT_FOUND;
+    }
+    skip = (apr_int64_t) page * DEFAULT_MSGS_PER_PAGE;
+
+    ap_set_content_type(r, "text/html; charset=utf-8");
+
+    if (r->header_only) {
+        return OK;
+    }
+
+    /* The months before the page are skipped by their counts, without
+       being opened; those of the page are merged by date. */
+    b = (range_box_t *) boxes->elts;
+    for (first = 0; first < boxes->nelts && skip >= b[first].count;
+         first++) {
+        skip -= b[first].count;
+    }
+    runs = apr_palloc(r->pool, (boxes->nelts + 1) * sizeof(*runs));
+    run_box = apr_palloc(r->pool, (boxes->nelts + 1) * sizeof(*run_box));
+    nruns = 0;
+    for (i = first, taken = 0;
+         i < boxes->nelts && taken < skip + DEFAULT_MSGS_PER_PAGE; i++) {
+        taken += b[i].count;
+        if (!b[i].cols) {
+            rv = mbox_column_open_current(&b[i].cols, r->pool,
+                                          apr_pstrcat(r->pool, dir, b[i].box,
+                                                      NULL));
+            if (rv != APR_SUCCESS) {
+                if (rv != APR_NOTFOUND) {
+                    ap_log_rerror(APLOG_MARK, APLOG_WARNING, rv, r,
+                                  "mod_mbox: Can't open the columns of '%s%s'",
+                                  dir, b[i].box);
+                }
+            }
+            /* The month was counted from the list information: columns
+               of another count are of another version of the month. */
+            else if (mbox_column_count(b[i].cols)
+                     != (apr_uint32_t) b[i].count) {
+                rv = APR_NOTFOUND;
+            }
+            if (rv != APR_SUCCESS) {
+                /* Its messages are not part of the range after all. */
+                b[i].cols = NULL;
+                taken -= b[i].count;
+                count -= b[i].count;
+                continue;
+            }
+            b[i].end = mbox_column_count(b[i].cols);
+        }
+        runs[nruns].cols = b[i].cols;
+        runs[nruns].begin = b[i].begin;
+        runs[nruns].end = b[i].end;
+        run_box[nruns] = b[i].box;
+        nruns++;
+    }
+    if (page > 0 && (apr_int64_t) page * DEFAULT_MSGS_PER_PAGE >= count) {
+        return HTTP_NOT_FOUND;
+    }
+    mbox_column_merge(&picks, r->pool, runs, nruns, (apr_uint32_t) skip,
+                      DEFAULT_MSGS_PER_PAGE);
+
+    /* Then the messages of the page, and only those, are loaded, each
+       month's message index being opened once. */
+    origfilename = r->filename;
+    run_db = apr_pcalloc(r->pool, (nruns + 1) * sizeof(*run_db));
+    for (i = 0; i < picks->nelts; i++) {
+        mbox_column_pick_t *pick = &APR_ARRAY_IDX(picks, i,
+                                                  mbox_column_pick_t);
+        const char *box = run_box[pick->run];
+        Message *m;
+
+        if (!run_db[pick->run]) {
+            r->filename = apr_pstrcat(r->pool, dir, box, NULL);
+            if (mbox_open_index(r, &run_db[pick->run]) != APR_SUCCESS) {
+                run_db[pick->run] = NULL;
+                continue;
+            }
+        }
+        m = mbox_fetch_index_db(r, run_db[pick->run],
+                                mbox_column_msgid(runs[pick->run].cols,
+                                                  pick->ordinal));
+        if (!m) {
+            continue;
+        }
+        m->uri_msgID = apr_pstrcat(r->pool, box, "/", m->uri_msgID, NULL);
+
+        *tail = apr_pcalloc(r->pool, sizeof(MBOX_LIST));
+        (*tail)->key = m->date;
+        (*tail)->value = m;
+        tail = &(*tail)->next;
+        shown++;
+    }
+    for (i = 0; i < nruns; i++) {
+        if (run_db[i]) {
+            apr_dbm_close(run_db[i]);
+        }
+    }
+    r->filename = origfilename;
+
+    range_uri = "";
+    for (i = 0; fields[i]; i++) {
+        arg = apr_table_get(args, fields[i]);
+        if (arg && *arg) {
+            range_uri = apr_pstrcat(r->pool, range_uri, "&", fields[i], "=",
+                                    mbox_escape_query(r->pool, arg), NULL);
+        }
+    }
+    range_uri = apr_pstrcat(r->pool, base_path, "range",
+                            *range_uri ? "?" : "",
+                            *range_uri ? range_uri + 1 : "", NULL);
+    from = after ? range_date(r->pool, after) : "the start";
+    to = before ? range_date(r->pool, before - day) : "today";
+
+    mbox_page_cfg_init_request(&cfg, r);
+    mbox_out_init_request(&out, r);
+
+    mbox_msglist_init(&l, r->pool, head, shown, MBOX_SORT_REVERSE_DATE);
+    rv = mbox_page_range(&out, &cfg, mli, base_path, from, to, range_uri,
+                         &l, count, page);
+    if (rv != APR_SUCCESS) {
+        ap_log_rerror(APLOG_MARK, APLOG_WARNING, rv, r,
+                      "mod_mbox: Can't include a file in the range page of '%s'",
+                      r->filename);
+        return DECLINED;
+    }
+
+    return OK;
+}
+
+/* Search across lists */
+
+static int search_threads = MBOX_SEARCH_THREADS;
+#if APR_HAS_THREADS
+static apr_thread_pool_t *search_pool = NULL;
+#endif
+
+typedef struct site_search site_search_t;
+
+/* The search of a list */
+typedef struct site_shard
+{
+    site_search_t *search;
+    const char *name;
+    const char *dir;            /* With a trailing slash */
+    apr_pool_t *pool;
+    apr_array_header_t *hits;   /* Once searched, with the boxes as
+                                   LIST/MAILBOX */
+    int queued;                 /* To the search threads */
+    int started;
+} site_shard_t;
+
+/* A search across lists.  It lives in its own pool, which the request
+ * and the searches of the lists still to run share: the last one done
+ * with it destroys it, so that the request can give up on the lists
+ * that are late.
+ */
+struct site_search
+{
+    apr_pool_t *pool;
+#if APR_HAS_THREADS
+    apr_thread_mutex_t *mutex;
+    apr_thread_cond_t *cond;
+#endif
+    int refs;
+    volatile int cancelled;     /* Also read, without the lock, between
+                                   the mailboxes of a list */
+    int pending;
+    const mbox_fts_query_t *q;
+    int order;
+    int k;
+    apr_array_header_t *done;   /* Of site_shard_t *, as they complete */
+};
+
+#if APR_HAS_THREADS
+#define SITE_LOCK(s) if ((s)->mutex) apr_thread_mutex_lock((s)->mutex)
+#define SITE_UNLOCK(s) if ((s)->mutex) apr_thread_mutex_unlock((s)->mutex)
+#else
+#define SITE_LOCK(s)
+#define SITE_UNLOCK(s)
+#endif
+
+/* Drops a reference to the search, with its lock held. */
+static void site_release(site_search_t *search)
+{
+    int refs = --search->refs;
+    int i;
+
+    SITE_UNLOCK(search);
+    if (!refs) {
+        for (i = 0; i < search->done->nelts; i++) {
+            apr_pool_destroy(APR_ARRAY_IDX(search->done, i,
+                                           site_shard_t *)->pool);
+        }
+        apr_pool_destroy(search->pool);
+    }
+}
+
+static apr_status_t site_cleanup(void *data)
+{
+    site_search_t *search = data;
+
+    SITE_LOCK(search);
+    search->cancelled = 1;
+    site_release(search);
+    return APR_SUCCESS;
+}
+
+/* Searches the mailboxes of a list. */
+static void site_shard_search(site_shard_t *shard)
+{
+    site_search_t *search = shard->search;
+    apr_array_header_t *boxes;
+    apr_finfo_t finfo;
+    apr_dir_t *dir;
+    mbox_fts_t *fts;
+    mbox_fts_hit_t *hit;
+    int i;
+
+    /* The mailboxes of the list, as mbox_boxes_list() finds them */
+    boxes = apr_array_make(shard->pool, 12 * 15, sizeof(mbox_fts_t *));
+    if (apr_dir_open(&dir, shard->dir, shard->pool) == APR_SUCCESS) {
+        while (apr_dir_read(&finfo, APR_FINFO_NAME, dir) == APR_SUCCESS) {
+            if (apr_fnmatch("*.mbox", finfo.name, 0) == APR_SUCCESS
+                && strstr(finfo.name, "incomplete") == NULL
+                && mbox_fts_open(&fts, shard->pool,
+                                 apr_pstrcat(shard->pool, shard->dir,
+                                             finfo.name, NULL))
+                   == APR_SUCCESS) {
+                APR_ARRAY_PUSH(boxes, mbox_fts_t *) = fts;
+            }
+        }
+        apr_dir_close(dir);
+    }
+
+    /* A list given up on half way is not searched. */
+    if (mbox_fts_search(&shard->hits, shard->pool,
+                        (mbox_fts_t **) boxes->elts, boxes->nelts, search->q,
+                        search->order, search->k, &search->cancelled)
+        != APR_SUCCESS) {
+        return;
+    }
+
+    hit = (mbox_fts_hit_t *) shard->hits->elts;
+    for (i = 0; i < shard->hits->nelts; i++) {
+        hit[i].box = apr_pstrcat(shard->pool, shard->name, "/", hit[i].box,
+                                 NULL);
+    }
+}
+
+/* Searches a list, unless the search was given up on, and hands the hits
+ * to the request.
+ */
+static void site_shard_run(site_shard_t *shard)
+{
+    site_search_t *search = shard->search;
+    int cancelled;
+
+    SITE_LOCK(search);
+    cancelled = search->cancelled;
+    shard->started = 1;
+    SITE_UNLOCK(search);
+
+    /* Pools of their own, as pools are not shared across threads */
+    apr_pool_create(&shard->pool, NULL);
+    if (!cancelled) {
+        site_shard_search(shard);
+    }
+    else {
+        shard->hits = NULL;
+    }
+
+    SITE_LOCK(search);
+    APR_ARRAY_PUSH(search->done, site_shard_t *) = shard;
+    search->pending--;
+#if APR_HAS_THREADS
+    if (search->cond) {
+        apr_thread_cond_signal(search->cond);
+    }
+#endif
+    site_release(search);
+}
+
+#if APR_HAS_THREADS
+static void *APR_THREAD_FUNC site_shard_task(apr_thread_t *thd, void *data)
+{
+    site_shard_run(data);
+    return NULL;
+}
+#endif
+
+/* Returns the lists in dir whose name matches pattern. */
+static apr_array_header_t *site_lists(request_rec *r, const char *dir,
+                                      const char *pattern)
+{
+    apr_array_header_t *lists;
+    apr_finfo_t finfo;
+    apr_dir_t *d;
+
+    lists = apr_array_make(r->pool, 64, sizeof(const char *));
+    if (apr_dir_open(&d, dir, r->pool) != APR_SUCCESS) {
+        return lists;
+    }
+    while (apr_dir_read(&finfo, APR_FINFO_NAME | APR_FINFO_TYPE, d)
+           == APR_SUCCESS) {
+        if (finfo.filetype == APR_DIR && finfo.name[0] != '.'
+            && apr_fnmatch(pattern, finfo.name, 0) == APR_SUCCESS) {
+            APR_ARRAY_PUSH(lists, const char *) =
+                apr_pstrdup(r->pool, finfo.name);
+        }
+    }
+    apr_dir_close(d);
+    return lists;
+}
+
+/* Copies a hit out of the pool of its list. */
+static void hit_copy(apr_pool_t *p, mbox_fts_hit_t *hit)
+{
+    hit->box = apr_pstrdup(p, hit->box);
+    hit->uri_msgID = apr_pstrdup(p, hit->uri_msgID);
+    hit->html_subject = apr_pstrdup(p, hit->html_subject);
+    hit->html_name = apr_pstrdup(p, hit->html_name);
+    hit->html_name_antispam = apr_pstrdup(p, hit->html_name_antispam);
+    hit->str_date = apr_pstrdup(p, hit->str_date);
+}
+
+/* Sends the best hits of the lists searched since last time, with the
+ * lock of the search held.
+ */
+static void site_search_show(request_rec *r, mbox_out_t *out,
+                             const mbox_page_cfg_t *cfg,
+                             const char *base_path, site_search_t *search,
+                             int *shown)
+{
+    while (*shown < search->done->nelts) {
+        site_shard_t *shard = APR_ARRAY_IDX(search->done, (*shown)++,
+                                            site_shard_t *);
+
+        /* The list is the request's until the search is released. */
+        SITE_UNLOCK(search);
+        if (shard->hits && shard->hits->nelts) {
+            mbox_page_site_search_list(out, cfg, base_path, shard->name,
+                                       shard->hits);
+            ap_rflush(r);
+        }
+        SITE_LOCK(search);
+    }
+}
+
+/* Searches the lists for query, sending the best hits of each as it is
+ * done, and returns the best k hits of all, and the lists that were not
+ * searched by the deadline in missed.
+ */
+static apr_status_t site_search_run(request_rec *r, mbox_out_t *out,
+                                    const mbox_page_cfg_t *cfg,
+                                    const char *base_path, const char *dir,
+                                    apr_array_header_t *lists,
+                                    const char *query, int order, int k,
+                                    apr_array_header_t **hits,
+                                    apr_array_header_t **missed)
+{
+    site_search_t *search;
+    site_shard_t *shards;
+    mbox_fts_query_t *q;
+    apr_array_header_t **results;
+    apr_pool_t *pool;
+    apr_time_t deadline = apr_time_now() + MBOX_SITE_SEARCH_DEADLINE;
+    int threaded = 0, count = 0, shown = 0, i;
+    char *searched;
+    apr_status_t rv;
+
+    /* The searches of the lists may outlive the request. */
+    apr_pool_create(&pool, NULL);
+    rv = mbox_fts_query_parse(&q, pool, query);
+    if (rv != APR_SUCCESS) {
+        apr_pool_destroy(pool);
+        return rv;
+    }
+
+    search = apr_pcalloc(pool, sizeof(*search));
+    search->pool = pool;
+    search->q = q;
+    search->order = order;
+    search->k = k;
+    search->refs = 1;
+    search->done = apr_array_make(pool, lists->nelts + 1,
+                                  sizeof(site_shard_t *));
+    apr_pool_cleanup_register(r->pool, search, site_cleanup,
+                              apr_pool_cleanup_null);
+
+    shards = apr_pcalloc(pool, (lists->nelts + 1) * sizeof(site_shard_t));
+    for (i = 0; i < lists->nelts; i++) {
+        shards[i].search = search;
+        shards[i].name = apr_pstrdup(pool, APR_ARRAY_IDX(lists, i,
+                                                         const char *));
+        shards[i].dir = apr_pstrcat(pool, dir, shards[i].name, "/", NULL);
+    }
+
+#if APR_HAS_THREADS
+    if (search_pool
+        && apr_thread_mutex_create(&search->mutex, APR_THREAD_MUTEX_DEFAULT,
+                                   pool) == APR_SUCCESS
+        && apr_thread_cond_create(&search->cond, pool) == APR_SUCCESS) {
+        threaded = 1;
+    }
+    else {
+        search->mutex = NULL;
+        search->cond = NULL;
+    }
+#endif
+
+    for (i = 0; i < lists->nelts; i++) {
+        search->refs++;
+        search->pending++;
+#if APR_HAS_THREADS
+        if (threaded
+            && apr_thread_pool_push(search_pool, site_shard_task, &shards[i],
+                                    APR_THREAD_TASK_PRIORITY_NORMAL,
+                                    search) == APR_SUCCESS) {
+            shards[i].queued = 1;
+            continue;
+        }
+#endif
+        /* One after the other, as long as there is time */
+        if (apr_time_now() < deadline) {
+            site_shard_run(&shards[i]);
+            SITE_LOCK(search);
+            site_search_show(r, out, cfg, base_path, search, &shown);
+            SITE_UNLOCK(search);
+        }
+        else {
+            search->refs--;
+            search->pending--;
+        }
+    }
+
+    SITE_LOCK(search);
+    for (;;) {
+        site_search_show(r, out, cfg, base_path, search, &shown);
+#if APR_HAS_THREADS
+        if (threaded && search->pending) {
+            apr_time_t now = apr_time_now();
+
+            if (now < deadline) {
+                apr_thread_cond_timedwait(search->cond, search->mutex,
+                                          deadline - now);
+                continue;
+            }
+        }
+#endif
+        break;
+    }
+    /* The lists still searched are given up on. */
+    search->cancelled = 1;
+    SITE_UNLOCK(search);
+
+#if APR_HAS_THREADS
+    /* Those not started never will be, and those running stop before
+     * their next mailbox, so the threads are free for other requests.
+     */
+    if (threaded) {
+        apr_thread_pool_tasks_cancel(search_pool, search);
+    }
+#endif
+
+    SITE_LOCK(search);
+    for (i = 0; i < lists->nelts; i++) {
+        if (shards[i].queued && !shards[i].started) {
+            search->refs--;
+            search->pending--;
+        }
+    }
+
+    /* The hits of the lists done are kept until the request is. */
+    results = apr_palloc(r->pool, (search->done->nelts + 1)
+                                  * sizeof(apr_array_header_t *));
+    searched = apr_pcalloc(r->pool, lists->nelts + 1);
+    for (i = 0; i < search->done->nelts; i++) {
+        site_shard_t *shard = APR_ARRAY_IDX(search->done, i, site_shard_t *);
+
+        if (shard->hits) {
+            results[count++] = shard->hits;
+            searched[shard - shards] = 1;
+        }
+    }
+    mbox_fts_merge(hits, r->pool, results, count, order, k);
+    for (i = 0; i < (*hits)->nelts; i++) {
+        hit_copy(r->pool, &APR_ARRAY_IDX(*hits, i, mbox_fts_hit_t));
+    }
+    SITE_UNLOCK(search);
+
+    *missed = apr_array_make(r->pool, 1, sizeof(const char *));
+    for (i = 0; i < lists->nelts; i++) {
+        if (!searched[i]) {
+            APR_ARRAY_PUSH(*missed, const char *) =
+                APR_ARRAY_IDX(lists, i, const char *);
+        }
+    }
+
+    return APR_SUCCESS;
+}
+
+int mbox_site_search_handler(request_rec *r)
+{
+    apr_table_t *args;
+    apr_array_header_t *lists, *hits = NULL, *missed = NULL;
+    mbox_page_cfg_t cfg;
+    mbox_out_t out;
+    const char *query, *pattern, *arg, *base_path, *dir, *search_uri;
+    int order = MBOX_FTS_BY_RELEVANCE, page = 0;
+    apr_size_t len;
+    apr_status_t rv;
+
+    /* Only allow GETs */
+    r->allowed |= (AP_METHOD_BIT << M_GET);
+    if (r->method_number != M_GET) {
+        return HTTP_METHOD_NOT_ALLOWED;
+    }
+
+    ap_args_to_table(r, &args);
+    query = apr_table_get(args, "q");
+    pattern = apr_table_get(args, "lists");
+    arg = apr_table_get(args, "sort");
+    if (arg && strcmp(arg, "date") == 0) {
+        order = MBOX_FTS_BY_DATE;
+    }
+    arg = apr_table_get(args, "page");
+    if (arg) {
+        page = atoi(arg);
+        if (page < 0 || page > MBOX_SEARCH_MAX_PAGE) {
+            return HTTP_NOT_FOUND;
+        }
+    }
+
+    /* The directory is what comes before /search. */
+    len = strlen(r->uri) - strlen(r->path_info);
+    base_path = apr_pstrcat(r->pool, apr_pstrndup(r->pool, r->uri, len),
+                            "/", NULL);
+    len = strlen(r->filename);
+    dir = (len && r->filename[len - 1] == '/') ? r->filename
+        : apr_pstrcat(r->pool, r->filename, "/", NULL);
+
+    if (!query || !*query) {
+        query = NULL;
+    }
+    if (!pattern || !*pattern) {
+        pattern = NULL;
+    }
+
+    ap_set_content_type(r, "text/html; charset=utf-8");
+
+    if (r->header_only) {
+        return OK;
+    }
+
+    mbox_page_cfg_init_request(&cfg, r);
+    mbox_out_init_request(&out, r);
+
+    rv = mbox_page_site_search_header(&out, &cfg, base_path, query, pattern,
+                                      order);
+    if (rv == APR_SUCCESS) {
+        /* The form shows while the lists are searched. */
+        ap_rflush(r);
+
+        if (query) {
+            lists = site_lists(r, dir, pattern ? pattern : "*");
+            if (site_search_run(r, &out, &cfg, base_path, dir, lists,
+                                query, order,
+                                (page + 1) * MBOX_SEARCH_PER_PAGE + 1,
+                                &hits, &missed) != APR_SUCCESS) {
+                hits = apr_array_make(r->pool, 1, sizeof(mbox_fts_hit_t));
+            }
+        }
+
+        search_uri = apr_pstrcat(r->pool, base_path, "search?q=",
+                                 mbox_escape_query(r->pool,
+                                                   query ? query : ""),
+                                 pattern ? "&lists=" : "",
+                                 pattern ? mbox_escape_query(r->pool, pattern)
+                                         : "",
+                                 order == MBOX_FTS_BY_DATE ? "&sort=date" : "",
+                                 NULL);
+
+        rv = mbox_page_site_search_footer(&out, &cfg, base_path, search_uri,
+                                          hits, page, missed);
+    }
+    if (rv != APR_SUCCESS) {
+        ap_log_rerror(APLOG_MARK, APLOG_WARNING, rv, r,
+                      "mod_mbox: Can't include a file in the search page of '%s'",
+                      r->filename);
+        return DECLINED;
+    }
+
+    return OK;
+}
+
+static int search_pre_config(apr_pool_t *p, apr_pool_t *plog,
+                             apr_pool_t *ptemp)
+{
+    search_threads = MBOX_SEARCH_THREADS;
+    return OK;
+}
+
+const char *mbox_search_set_threads(cmd_parms *cmd, void *dummy,
+                                    const char *arg)
+{
+    const char *err = ap_check_cmd_context(cmd, GLOBAL_ONLY);
+    char *end;
+    long n;
+
+    if (err)
+        return err;
+
+    n = strtol(arg, &end, 10);
+    if (*end || n < 0 || n > 256)
+        return "MboxSearchThreads must be a number of threads";
+
+    search_threads = (int) n;
+    return NULL;
+}
+
+void mbox_search_child_init(apr_pool_t *p, server_rec *s)
+{
+#if APR_HAS_THREADS
+    apr_status_t rv;
+
+    search_pool = NULL;
+    if (!search_threads)
+        return;
+
+    rv = apr_thread_pool_create(&search_pool, 0, search_threads, p);
+    if (rv != APR_SUCCESS) {
+        ap_log_error(APLOG_MARK, APLOG_WARNING, rv, s,
+                     "mod_mbox: could not create the search threads");
+        search_pool = NULL;
+    }
+#endif
+}
+
+void mbox_search_register_hooks(apr_pool_t *p)
+{
+    ap_hook_pre_config(search_pre_config, NULL, NULL, APR_HOOK_MIDDLE);
+}
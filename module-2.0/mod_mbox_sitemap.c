@@ -80,7 +80,7 @@ static void mbox2sitemap(request_rec *r, const char *mboxfile,
 
         ap_rprintf(r, "<loc><![CDATA[%s%s/%s]]></loc>\n",
                    ap_construct_url(tpool, r->uri, r),
-                   mboxfile, MSG_ID_ESCAPE_OR_BLANK(tpool, m->msgID));
+                   mboxfile, m->uri_msgID);
 
         apr_time_exp_gmt(&extime, m->date);
         apr_strftime(dstr, &dlen, sizeof(dstr), "%G-%m-%d", &extime);
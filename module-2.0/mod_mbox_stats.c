@@ -0,0 +1,452 @@
+/* Licensed to the Apache Software Foundation (ASF) under one or more
+ * contributor license agreements.  See the NOTICE file distributed with
+ * this work for additional information regarding copyright ownership.
+ * The ASF licenses this file to You under the Apache License, Version 2.0
+ * (the "License"); you may not use this file except in compliance with
+ * the License.  You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+/**
+ * Activity of a list, at LIST/stats, as XML: the messages of each month
+ * and of each day, the threads started and the most active authors,
+ * from the columns mod-mbox-util -s writes next to each mailbox (see
+ * mbox_column.h).  from=YYYY[-MM] and to=YYYY[-MM] limit the months, and
+ * top=N the authors.
+ *
+ * Each process keeps the statistics of the months it counted, until
+ * their columns are written again for a new version of their index.
+ */
+
+#include "mod_mbox.h"
+
+#ifdef APLOG_USE_MODULE
+APLOG_USE_MODULE(mbox);
+#endif
+
+/* Authors listed by default, and at most */
+#define MBOX_STATS_TOP_DEFAULT 10
+#define MBOX_STATS_TOP_MAX 100
+
+typedef struct stats_month
+{
+    apr_pool_t *pool;
+    mbox_column_stats_t *stats;
+    apr_time_t mtime;           /* Of the columns */
+    apr_off_t size;
+    apr_ino_t inode;
+    apr_time_t index_mtime;     /* Of the message index they are of */
+    apr_off_t index_size;
+} stats_month_t;
+
+typedef struct stats_state
+{
+#if APR_HAS_THREADS
+    apr_thread_mutex_t *mutex;
+#endif
+    apr_pool_t *pool;
+    apr_hash_t *months;         /* Of stats_month_t, by path */
+} stats_state_t;
+
+static stats_state_t *stats_state = NULL;
+
+#if APR_HAS_THREADS
+#define STATS_LOCK() apr_thread_mutex_lock(stats_state->mutex)
+#define STATS_UNLOCK() apr_thread_mutex_unlock(stats_state->mutex)
+#else
+#define STATS_LOCK()
+#define STATS_UNLOCK()
+#endif
+
+/* A month of a request */
+typedef struct stats_row
+{
+    const char *box;
+    apr_uint32_t messages;
+    apr_uint32_t threads;
+    int authors;
+    int counted;                /* Unless it has no columns */
+} stats_row_t;
+
+/* What the months of a request add up to */
+typedef struct stats_total
+{
+    apr_uint32_t messages;
+    apr_uint32_t threads;
+    apr_array_header_t *days;   /* Of mbox_column_day_t */
+    apr_hash_t *posters;        /* Of apr_uint32_t counts, by author key */
+} stats_total_t;
+
+void mbox_stats_child_init(apr_pool_t *p, server_rec *s)
+{
+    stats_state_t *state;
+
+    state = apr_pcalloc(p, sizeof(*state));
+    state->pool = p;
+    state->months = apr_hash_make(p);
+#if APR_HAS_THREADS
+    if (apr_thread_mutex_create(&state->mutex, APR_THREAD_MUTEX_DEFAULT, p)
+        != APR_SUCCESS) {
+        ap_log_error(APLOG_MARK, APLOG_WARNING, 0, s,
+                     "mod_mbox: could not create the statistics lock");
+        return;
+    }
+#endif
+
+    stats_state = state;
+}
+
+/* Counts the activity of the mailbox at path, in p, from columns written
+ * from the version of its message index in index.  Returns APR_NOTFOUND
+ * if they were not.
+ */
+static apr_status_t stats_count(mbox_column_stats_t **stats, apr_pool_t *p,
+                                const char *path, const apr_finfo_t *index)
+{
+    mbox_column_t *cols;
+    apr_pool_t *tpool;
+    apr_status_t rv;
+
+    /* The columns are only mapped while they are counted. */
+    apr_pool_create(&tpool, p);
+    rv = mbox_column_open(&cols, tpool, path);
+    if (rv == APR_SUCCESS
+        && !mbox_column_matches(cols, index->mtime, index->size)) {
+        rv = APR_NOTFOUND;
+    }
+    if (rv == APR_SUCCESS) {
+        mbox_column_stats(stats, p, cols);
+    }
+    apr_pool_destroy(tpool);
+    return rv;
+}
+
+/* Returns the activity of the mailbox at path, counted again if its
+ * columns or its message index were replaced.  Called with the lock
+ * held.
+ */
+static apr_status_t stats_get(mbox_column_stats_t **stats, request_rec *r,
+                              const char *path)
+{
+    stats_month_t *m;
+    mbox_column_stats_t *counted;
+    apr_finfo_t finfo, index;
+    apr_pool_t *pool;
+    apr_status_t rv;
+
+    /* Columns left from an older index must not be counted, even if
+       they were counted before it was replaced. */
+    rv = mbox_index_stat_path(r->pool, path, &index);
+    if (rv == APR_SUCCESS) {
+        rv = apr_stat(&finfo, apr_pstrcat(r->pool, path, MBOX_COLUMN_SUFFIX,
+                                          NULL),
+                      APR_FINFO_MTIME | APR_FINFO_SIZE | APR_FINFO_INODE,
+                      r->pool);
+    }
+    if (rv != APR_SUCCESS) {
+        return APR_STATUS_IS_ENOENT(rv) ? APR_NOTFOUND : rv;
+    }
+
+    m = apr_hash_get(stats_state->months, path, APR_HASH_KEY_STRING);
+    if (m && m->mtime == finfo.mtime && m->size == finfo.size
+        && m->inode == finfo.inode && m->index_mtime == index.mtime
+        && m->index_size == index.size) {
+        *stats = m->stats;
+        return APR_SUCCESS;
+    }
+
+    apr_pool_create(&pool, stats_state->pool);
+    rv = stats_count(&counted, pool, path, &index);
+    if (rv != APR_SUCCESS) {
+        apr_pool_destroy(pool);
+        return rv;
+    }
+
+    if (m) {
+        apr_pool_destroy(m->pool);
+    }
+    else {
+        m = apr_palloc(stats_state->pool, sizeof(*m));
+        apr_hash_set(stats_state->months,
+                     apr_pstrdup(stats_state->pool, path),
+                     APR_HASH_KEY_STRING, m);
+    }
+    m->pool = pool;
+    m->stats = counted;
+    m->mtime = finfo.mtime;
+    m->size = finfo.size;
+    m->inode = finfo.inode;
+    m->index_mtime = index.mtime;
+    m->index_size = index.size;
+
+    *stats = m->stats;
+    return APR_SUCCESS;
+}
+
+/* Adds the activity of a month to its row and to the total. */
+static void stats_add(stats_total_t *total, stats_row_t *row, apr_pool_t *p,
+                      const mbox_column_stats_t *stats)
+{
+    mbox_column_poster_t *poster;
+    apr_uint32_t *count;
+    int i;
+
+    row->messages = stats->messages;
+    row->threads = stats->threads;
+    row->authors = stats->posters->nelts;
+    row->counted = 1;
+
+    total->messages += stats->messages;
+    total->threads += stats->threads;
+    apr_array_cat(total->days, stats->days);
+
+    poster = (mbox_column_poster_t *) stats->posters->elts;
+    for (i = 0; i < stats->posters->nelts; i++) {
+        count = apr_hash_get(total->posters, poster[i].author,
+                             APR_HASH_KEY_STRING);
+        if (!count) {
+            count = apr_pcalloc(p, sizeof(apr_uint32_t));
+            apr_hash_set(total->posters, apr_pstrdup(p, poster[i].author),
+                         APR_HASH_KEY_STRING, count);
+        }
+        *count += poster[i].count;
+    }
+}
+
+/* Adds the activity of the mailbox at path to its row and to the total. */
+static apr_status_t stats_month(request_rec *r, const char *path,
+                                stats_total_t *total, stats_row_t *row)
+{
+    mbox_column_stats_t *stats;
+    apr_finfo_t index;
+    apr_status_t rv;
+
+    if (!stats_state) {
+        rv = mbox_index_stat_path(r->pool, path, &index);
+        if (rv != APR_SUCCESS) {
+            return APR_STATUS_IS_ENOENT(rv) ? APR_NOTFOUND : rv;
+        }
+        rv = stats_count(&stats, r->pool, path, &index);
+        if (rv == APR_SUCCESS) {
+            stats_add(total, row, r->pool, stats);
+        }
+        return rv;
+    }
+
+    /* The counts may go before the request does: they are added up
+       while the lock is held. */
+    STATS_LOCK();
+    rv = stats_get(&stats, r, path);
+    if (rv == APR_SUCCESS) {
+        stats_add(total, row, r->pool, stats);
+    }
+    STATS_UNLOCK();
+
+    return rv;
+}
+
+/* Parses a month given as YYYY or YYYY-MM, as the name of its mailbox
+ * starts: YYYYMM.  A year alone is its first month, or its last if last
+ * is set.
+ */
+static apr_status_t stats_bound(const char **box, apr_pool_t *p,
+                                const char *s, int last)
+{
+    apr_size_t len = strlen(s);
+
+    if ((len != 4 && len != 7) || strspn(s, "0123456789") != 4
+        || (len == 7 && (s[4] != '-' || strspn(s + 5, "0123456789") != 2))) {
+        return APR_EINVAL;
+    }
+
+    *box = apr_pstrcat(p, apr_pstrndup(p, s, 4),
+                       len == 7 ? s + 5 : last ? "12" : "01", NULL);
+    return APR_SUCCESS;
+}
+
+static int day_cmp(const void *a, const void *b)
+{
+    const mbox_column_day_t *x = a, *y = b;
+
+    return (x->day > y->day) - (x->day < y->day);
+}
+
+static int poster_cmp(const void *a, const void *b)
+{
+    const mbox_column_poster_t *x = a, *y = b;
+
+    if (x->count != y->count)
+        return x->count < y->count ? 1 : -1;
+    return strcmp(x->author, y->author);
+}
+
+int mbox_stats_handler(request_rec *r, mbox_cache_info *mli)
+{
+    apr_table_t *args;
+    apr_array_header_t *files, *rows, *posters;
+    apr_hash_index_t *hi;
+    stats_total_t total;
+    stats_row_t *row;
+    mbox_column_day_t *day;
+    mbox_column_poster_t *poster;
+    mbox_dir_cfg_t *conf;
+    mbox_file_t *fi;
+    mbox_out_t out;
+    const char *arg, *dir, *from = NULL, *to = NULL;
+    char date[11];
+    int top = MBOX_STATS_TOP_DEFAULT, i, n;
+    apr_size_t len;
+    apr_status_t rv;
+
+    /* Only allow GETs */
+    r->allowed |= (AP_METHOD_BIT << M_GET);
+    if (r->method_number != M_GET) {
+        return HTTP_METHOD_NOT_ALLOWED;
+    }
+
+    conf = ap_get_module_config(r->per_dir_config, &mbox_module);
+
+    ap_args_to_table(r, &args);
+    arg = apr_table_get(args, "from");
+    if (arg && *arg && stats_bound(&from, r->pool, arg, 0) != APR_SUCCESS) {
+        return HTTP_BAD_REQUEST;
+    }
+    arg = apr_table_get(args, "to");
+    if (arg && *arg && stats_bound(&to, r->pool, arg, 1) != APR_SUCCESS) {
+        return HTTP_BAD_REQUEST;
+    }
+    arg = apr_table_get(args, "top");
+    if (arg) {
+        top = atoi(arg);
+        if (top < 0 || top > MBOX_STATS_TOP_MAX) {
+            top = MBOX_STATS_TOP_MAX;
+        }
+    }
+
+    len = strlen(r->filename);
+    dir = (len && r->filename[len - 1] == '/') ? r->filename
+        : apr_pstrcat(r->pool, r->filename, "/", NULL);
+
+    files = mbox_fetch_boxes_list(r, mli, (char *) dir);
+    if (!files) {
+        return HTTP_FORBIDDEN;
+    }
+
+    ap_set_content_type(r, "application/xml");
+
+    if (r->header_only) {
+        return OK;
+    }
+
+    memset(&total, 0, sizeof(total));
+    total.days = apr_array_make(r->pool, 64, sizeof(mbox_column_day_t));
+    total.posters = apr_hash_make(r->pool);
+
+    /* Mailboxes are listed newest first; months are counted in order. */
+    rows = apr_array_make(r->pool, files->nelts + 1, sizeof(stats_row_t));
+    fi = (mbox_file_t *) files->elts;
+    for (i = files->nelts - 1; i >= 0; i--) {
+        if ((from && strncmp(fi[i].filename, from, 6) < 0)
+            || (to && strncmp(fi[i].filename, to, 6) > 0)) {
+            continue;
+        }
+
+        row = apr_array_push(rows);
+        memset(row, 0, sizeof(*row));
+        row->box = fi[i].filename;
+        rv = stats_month(r, apr_pstrcat(r->pool, dir, fi[i].filename, NULL),
+                         &total, row);
+        if (rv != APR_SUCCESS && rv != APR_NOTFOUND) {
+            ap_log_rerror(APLOG_MARK, APLOG_WARNING, rv, r,
+                          "mod_mbox: Can't open the columns of '%s%s'",
+                          dir, fi[i].filename);
+        }
+    }
+
+    /* Messages of a month may be dated the day before or after it. */
+    qsort(total.days->elts, total.days->nelts, sizeof(mbox_column_day_t),
+          day_cmp);
+    day = (mbox_column_day_t *) total.days->elts;
+    for (i = 0, n = 0; i < total.days->nelts; i++) {
+        if (n && day[n - 1].day == day[i].day) {
+            day[n - 1].count += day[i].count;
+        }
+        else {
+            day[n++] = day[i];
+        }
+    }
+    total.days->nelts = n;
+
+    posters = apr_array_make(r->pool, apr_hash_count(total.posters) + 1,
+                             sizeof(mbox_column_poster_t));
+    for (hi = apr_hash_first(r->pool, total.posters); hi;
+         hi = apr_hash_next(hi)) {
+        const void *key;
+        void *val;
+
+        apr_hash_this(hi, &key, NULL, &val);
+        poster = apr_array_push(posters);
+        poster->author = key;
+        poster->count = *(apr_uint32_t *) val;
+    }
+    qsort(posters->elts, posters->nelts, sizeof(mbox_column_poster_t),
+          poster_cmp);
+
+    mbox_out_init_request(&out, r);
+    mbox_out_puts(&out, "<?xml version=\"1.0\" encoding=\"UTF-8\"?>\n");
+    mbox_out_printf(&out, "<stats messages=\"%u\" threads=\"%u\" authors=\"%d\">\n",
+                    total.messages, total.threads, posters->nelts);
+
+    /* Months without columns are listed, without counts. */
+    mbox_out_puts(&out, " <months>\n");
+    row = (stats_row_t *) rows->elts;
+    for (i = 0; i < rows->nelts; i++) {
+        if (row[i].counted) {
+            mbox_out_printf(&out, "  <month box=\"%s\" messages=\"%u\" threads=\"%u\" authors=\"%d\" />\n",
+                            ESCAPE_OR_BLANK(r->pool, row[i].box),
+                            row[i].messages, row[i].threads, row[i].authors);
+        }
+        else {
+            mbox_out_printf(&out, "  <month box=\"%s\" />\n",
+                            ESCAPE_OR_BLANK(r->pool, row[i].box));
+        }
+    }
+    mbox_out_puts(&out, " </months>\n");
+
+    mbox_out_puts(&out, " <days>\n");
+    for (i = 0; i < total.days->nelts; i++) {
+        apr_time_exp_t tm;
+        apr_size_t dlen;
+
+        apr_time_exp_gmt(&tm, day[i].day);
+        apr_strftime(date, &dlen, sizeof(date), "%Y-%m-%d", &tm);
+        mbox_out_printf(&out, "  <day date=\"%s\" messages=\"%u\" />\n",
+                        date, day[i].count);
+    }
+    mbox_out_puts(&out, " </days>\n");
+
+    /* Keys are names, or addresses for the messages without one. */
+    mbox_out_puts(&out, " <authors>\n");
+    poster = (mbox_column_poster_t *) posters->elts;
+    for (i = 0; i < posters->nelts && i < top; i++) {
+        char *name = apr_pstrdup(r->pool, poster[i].author);
+
+        if (conf->antispam && strchr(name, '@')) {
+            name = mbox_email_antispam(name);
+        }
+        mbox_out_printf(&out, "  <author name=\"%s\" messages=\"%u\" />\n",
+                        ESCAPE_OR_BLANK(r->pool, name), poster[i].count);
+    }
+    mbox_out_puts(&out, " </authors>\n");
+
+    mbox_out_puts(&out, "</stats>\n");
+
+    return OK;
+}